@@ -46,17 +46,52 @@ enum RegisterName{
     REG_ST4,
     REG_ST5,
     REG_ST6,
-    REG_ST7
+    REG_ST7,
+    REG_RAX,
+    REG_RBX,
+    REG_RCX,
+    REG_RDX,
+    REG_RDI,
+    REG_RSI,
+    REG_RBP,
+    REG_RSP,
+    REG_R8,
+    REG_R9,
+    REG_R11,
+    REG_R11D,
+    REG_R12,
+    REG_R13,
+    REG_R14,
+    REG_R15,
+    REG_R12D,
+    REG_R13D,
+    REG_R14D,
+    REG_R15D,
+    REG_XMM0,
+    REG_XMM1,
+    REG_XMM2,
+    REG_XMM3,
+    REG_XMM4,
+    REG_XMM5,
+    REG_XMM6,
+    REG_XMM7,
+    REG_NONE
 };
 
 extern const string REG_TO_STR[];
 
 enum AsmCmdName{
     ASM_ADD,
+    ASM_ADDSS,
     ASM_AND,
     ASM_CALL,
+    ASM_CLTD,
+    ASM_CLTQ,
     ASM_CMP,
+    ASM_CVTSI2SS,
+    ASM_CVTSS2SD,
     ASM_DIV,
+    ASM_DIVSS,
     ASM_FADDP,
     ASM_FCH,
     ASM_FCOMPP,
@@ -67,9 +102,16 @@ enum AsmCmdName{
     ASM_FNSTSW,
     ASM_FSTP,
     ASM_FSUBRP,
+    ASM_FUCOMIP,
     ASM_FXCH,
     ASM_IDIV,
     ASM_IMUL,
+    ASM_JA,
+    ASM_JAE,
+    ASM_JB,
+    ASM_JBE,
+    ASM_JG,
+    ASM_JL,
     ASM_JMP,
     ASM_JNE,
     ASM_JNG,
@@ -78,13 +120,18 @@ enum AsmCmdName{
     ASM_JZ,
     ASM_LEA,
     ASM_MOV,
+    ASM_MOVDQU,
+    ASM_MOVSD,
+    ASM_MOVSS,
     ASM_MOVZB,
     ASM_MUL,
+    ASM_MULSS,
     ASM_NEG ,
     ASM_NOT,
     ASM_OR,
     ASM_POP,
     ASM_PUSH,
+    ASM_REP_MOVS,
     ASM_RET,
     ASM_SAHF,
     ASM_SAR,
@@ -99,8 +146,11 @@ enum AsmCmdName{
     ASM_SETLE,
     ASM_SETE,
     ASM_SETNE, 
+    ASM_SHR,
     ASM_SUB,
+    ASM_SUBSS,
     ASM_TEST,
+    ASM_UCOMISS,
     ASM_XOR
 };
 
@@ -0,0 +1,98 @@
+#include "asm_writer.h"
+#include <iostream>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define write _write
+#else
+#include <unistd.h>
+#endif
+
+static const unsigned WRITER_BUFFER_SIZE = 1 << 20;
+
+AsmWriter::AsmWriter(ostream& output_):
+    output(output_),
+    fd(&output_ == &cout ? 1 : -1),
+    buffer(new char[WRITER_BUFFER_SIZE]),
+    used(0)
+{
+}
+
+AsmWriter::~AsmWriter()
+{
+    Flush();
+    delete[] buffer;
+}
+
+void AsmWriter::WriteOut(const char* data, unsigned len)
+{
+    if (fd < 0)
+    {
+        output.write(data, len);
+        return;
+    }
+    output.flush();
+    while (len > 0)
+    {
+        int written = write(fd, data, len);
+        if (written <= 0) return;
+        data += written;
+        len -= written;
+    }
+}
+
+void AsmWriter::Flush()
+{
+    WriteOut(buffer, used);
+    used = 0;
+}
+
+void AsmWriter::Write(const char* data, unsigned len)
+{
+    if (used + len > WRITER_BUFFER_SIZE)
+    {
+        Flush();
+        if (len > WRITER_BUFFER_SIZE)
+        {
+            WriteOut(data, len);
+            return;
+        }
+    }
+    memcpy(buffer + used, data, len);
+    used += len;
+}
+
+void AsmWriter::Write(const string& str)
+{
+    Write(str.data(), str.size());
+}
+
+void AsmWriter::Write(char c)
+{
+    if (used == WRITER_BUFFER_SIZE) Flush();
+    buffer[used++] = c;
+}
+
+void AsmWriter::WriteInt(int value)
+{
+    if (used + 16 > WRITER_BUFFER_SIZE) Flush();
+    used += FormatInt(value, buffer + used);
+}
+
+unsigned AsmWriter::FormatInt(int value, char* res)
+{
+    char digits[16];
+    unsigned len = 0;
+    unsigned abs_value = value < 0 ? 0u - (unsigned)value : value;
+    do
+    {
+        digits[len++] = '0' + abs_value % 10;
+        abs_value /= 10;
+    }
+    while (abs_value);
+    unsigned pos = 0;
+    if (value < 0) res[pos++] = '-';
+    while (len) res[pos++] = digits[--len];
+    return pos;
+}
@@ -0,0 +1,27 @@
+#ifndef ASM_WRITER
+#define ASM_WRITER
+
+#include <ostream>
+#include <string>
+
+using namespace std;
+
+class AsmWriter{
+private:
+    ostream& output;
+    int fd;
+    char* buffer;
+    unsigned used;
+    void WriteOut(const char* data, unsigned len);
+public:
+    AsmWriter(ostream& output_);
+    ~AsmWriter();
+    void Write(const char* data, unsigned len);
+    void Write(const string& str);
+    void Write(char c);
+    void WriteInt(int value);
+    void Flush();
+    static unsigned FormatInt(int value, char* res);
+};
+
+#endif
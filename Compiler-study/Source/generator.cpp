@@ -1,4 +1,7 @@
 #include "generator.h"
+#include "peephole.h"
+#include <stdlib.h>
+#include <algorithm>
 
 const string SIZE_TO_STR[] =
 {
@@ -42,16 +45,51 @@ const string REG_TO_STR[] =
     "%st(4)",
     "%st(5)",
     "%st(6)",
-    "%st(7)"
+    "%st(7)",
+    "%rax",
+    "%rbx",
+    "%rcx",
+    "%rdx",
+    "%rdi",
+    "%rsi",
+    "%rbp",
+    "%rsp",
+    "%r8",
+    "%r9",
+    "%r11",
+    "%r11d",
+    "%r12",
+    "%r13",
+    "%r14",
+    "%r15",
+    "%r12d",
+    "%r13d",
+    "%r14d",
+    "%r15d",
+    "%xmm0",
+    "%xmm1",
+    "%xmm2",
+    "%xmm3",
+    "%xmm4",
+    "%xmm5",
+    "%xmm6",
+    "%xmm7",
+    ""
 };
 
 const string ASM_CMD_TO_STR[] =
 {
     "add",
+    "addss",
     "and",
     "call",
+    "cltd",
+    "cltq",
     "cmp",
+    "cvtsi2ss",
+    "cvtss2sd",
     "div",
+    "divss",
     "faddp",
     "fch",
     "fcompp",
@@ -62,9 +100,16 @@ const string ASM_CMD_TO_STR[] =
     "fnstsw",
     "fstp",
     "fsubrp",
+    "fucomip",
     "fxch",
     "idiv",
     "imul",
+    "ja",
+    "jae",
+    "jb",
+    "jbe",
+    "jg",
+    "jl",
     "jmp",
     "jne",
     "jng",
@@ -73,13 +118,18 @@ const string ASM_CMD_TO_STR[] =
     "jz",
     "lea",
     "mov",
+    "movdqu",
+    "movsd",
+    "movss",
     "movzb",
     "mul",
+    "mulss",
     "neg",
     "not",
     "or",
     "pop",
     "push",
+    "rep movs",
     "ret",
     "sahf",
     "sar",
@@ -94,8 +144,11 @@ const string ASM_CMD_TO_STR[] =
     "setle",
     "sete",
     "setne",
+    "shr",
     "sub",
+    "subss",
     "test",
+    "ucomiss",
     "xor"
 };
 
@@ -107,59 +160,149 @@ const string ASM_DATA_TYPE_TO_STR[] =
     ".string"
 };
 
-//---AsmCmd---
-
-void AsmCmd::Print(ostream& o) const
+const RegisterName X64_INT_ARG_REGS[] =
 {
-}
+    REG_RDI,
+    REG_RSI,
+    REG_RDX,
+    REG_RCX,
+    REG_R8,
+    REG_R9
+};
 
-//---AsmLabel---
+const RegisterName X64_REAL_ARG_REGS[] =
+{
+    REG_XMM0,
+    REG_XMM1,
+    REG_XMM2,
+    REG_XMM3,
+    REG_XMM4,
+    REG_XMM5,
+    REG_XMM6,
+    REG_XMM7
+};
 
-AsmLabel::AsmLabel(AsmStrImmediate* label_):
-    label(label_)
+const RegisterName EXPR_REGS[] =
 {
-}
+    REG_EAX,
+    REG_EBX,
+    REG_ECX,
+    REG_EDX,
+    REG_ESI,
+    REG_EDI
+};
 
-AsmLabel::AsmLabel(AsmStrImmediate label_):
-    label(new AsmStrImmediate(label_))
+const RegisterName X86_VAR_REGS[] =
 {
-}
+    REG_ESI,
+    REG_EDI
+};
 
-AsmLabel::AsmLabel(string label):
-    label(new AsmStrImmediate(label))
+const RegisterName X64_VAR_REGS[] =
 {
-}
+    REG_R12D,
+    REG_R13D,
+    REG_R14D,
+    REG_R15D
+};
+
+static const unsigned ASM_CMD_COUNT = sizeof(ASM_CMD_TO_STR) / sizeof(ASM_CMD_TO_STR[0]);
+static const unsigned CMD_SIZE_COUNT = SIZE_QUARD + 1;
 
-void AsmLabel::Print(ostream& o) const
+static vector<string> BuildCmdText()
 {
-    o << "  ";
-    label->PrintBase(o);
-    o << ':';
+    vector<string> res;
+    for (unsigned cmd = 0; cmd < ASM_CMD_COUNT; ++cmd)
+        for (unsigned size = 0; size < CMD_SIZE_COUNT; ++size)
+            res.push_back("    " + ASM_CMD_TO_STR[cmd] + SIZE_TO_STR[size]);
+    return res;
 }
 
-//---AsmRawCmd---
+static const vector<string> CMD_TEXT = BuildCmdText();
 
-AsmRawCmd::AsmRawCmd(string cmd):
-    str(cmd)
+static const char LABEL_RELOCATION_MARK = '@';
+
+static string IntToStr(int value)
 {
+    char res[16];
+    return string(res, AsmWriter::FormatInt(value, res));
 }
 
-void AsmRawCmd::Print(ostream& o) const
+static string RelocateLabel(const string& label, unsigned base)
 {
-    o << str;
+    size_t pos = label.find(LABEL_RELOCATION_MARK);
+    if (pos == string::npos) return label;
+    size_t end = label.find_first_not_of("0123456789", pos + 1);
+    if (end == string::npos) end = label.size();
+    int number = base + atoi(label.substr(pos + 1, end - pos - 1).c_str());
+    return label.substr(0, pos) + IntToStr(number) + label.substr(end);
 }
 
-//---AsmCmd0---
+AsmCmdName InverseJump(AsmCmdName cmd)
+{
+    switch (cmd)
+    {
+        case ASM_JZ: return ASM_JNZ;
+        case ASM_JNZ: return ASM_JZ;
+        case ASM_JNE: return ASM_JZ;
+        case ASM_JL: return ASM_JNL;
+        case ASM_JNL: return ASM_JL;
+        case ASM_JG: return ASM_JNG;
+        case ASM_JNG: return ASM_JG;
+        case ASM_JA: return ASM_JBE;
+        case ASM_JBE: return ASM_JA;
+        case ASM_JB: return ASM_JAE;
+        case ASM_JAE: return ASM_JB;
+        default: return ASM_JMP;
+    }
+}
 
-AsmCmd0::AsmCmd0(AsmCmdName cmd, CmdSize cmd_size):
-    command(cmd),
-    size(cmd_size)
+static int HexDigit(char c)
 {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
 }
 
-void AsmCmd0::Print(ostream& o) const
+string UnescapeAsmString(const string& str)
 {
-    o << "    " << ASM_CMD_TO_STR[command] << SIZE_TO_STR[size];
+    string res;
+    for (size_t i = 0; i < str.size(); ++i)
+    {
+        if (str[i] != '\\' || i + 1 == str.size())
+        {
+            res.push_back(str[i]);
+            continue;
+        }
+        char c = str[++i];
+        switch (c)
+        {
+            case 'b': res.push_back('\b'); break;
+            case 'f': res.push_back('\f'); break;
+            case 'n': res.push_back('\n'); break;
+            case 'r': res.push_back('\r'); break;
+            case 't': res.push_back('\t'); break;
+            case 'x':
+            {
+                int value = 0;
+                while (i + 1 < str.size() && HexDigit(str[i + 1]) >= 0)
+                    value = value * 16 + HexDigit(str[++i]);
+                res.push_back((char)value);
+            }
+            break;
+            default:
+                if (c >= '0' && c <= '7')
+                {
+                    int value = c - '0';
+                    for (int n = 1; n < 3 && i + 1 < str.size() && str[i + 1] >= '0' && str[i + 1] <= '7'; ++n)
+                        value = value * 8 + str[++i] - '0';
+                    res.push_back((char)value);
+                }
+                else res.push_back(c);
+        }
+    }
+    return res;
 }
 
 //---AsmData---
@@ -171,396 +314,524 @@ AsmData::AsmData(string name_, string value_, AsmDataType type_):
 {
 }
 
-void AsmData::Print(ostream& o) const
+AsmData::~AsmData()
 {
-    o << "    " << name << ": " << ASM_DATA_TYPE_TO_STR[type] << ' ';
-    if (type == DATA_STR) o << '\"' << value << '\"';
-    else o << value;
 }
 
-//---AsmCmd1---
-
-AsmCmd1::AsmCmd1(AsmCmdName cmd, AsmOperand* oper_, CmdSize size):
-    AsmCmd0(cmd, size),
-    oper(oper_)
+string AsmData::GetName() const
 {
+    return name;
 }
 
-void AsmCmd1::Print(ostream& o) const
+string AsmData::GetValue() const
 {
-    o << "    " << ASM_CMD_TO_STR[command] << SIZE_TO_STR[size] << '\t';
-    if (size == SIZE_NONE)
-        oper->PrintBase(o);
-    else
-        oper->Print(o);
+    return value;
 }
 
-//---AsmCmd2---
+AsmDataType AsmData::GetType() const
+{
+    return type;
+}
 
-AsmCmd2::AsmCmd2(AsmCmdName cmd, AsmOperand* src_, AsmOperand* dest_, CmdSize size):
-    AsmCmd0(cmd, size),
-    src(src_),
-    dest(dest_)
+void AsmData::RelocateLabels(unsigned base)
 {
+    name = RelocateLabel(name, base);
 }
 
-void AsmCmd2::Print(ostream& o) const
+void AsmData::Print(AsmWriter& o) const
 {
-    o << "    " << ASM_CMD_TO_STR[command] << SIZE_TO_STR[size] << '\t';
-    src->Print(o);
-    o<< ", ";
-    dest->Print(o);
+    o.Write("    ", 4);
+    o.Write(name);
+    o.Write(": ", 2);
+    o.Write(ASM_DATA_TYPE_TO_STR[type]);
+    o.Write(' ');
+    if (type == DATA_STR)
+    {
+        o.Write('\"');
+        o.Write(value);
+        o.Write('\"');
+    }
+    else o.Write(value);
 }
 
-//---AsmOperand---
+//---AsmIntImmediate---
 
-void AsmOperand::Print(ostream& o) const
+AsmIntImmediate::AsmIntImmediate(int value_):
+    value(value_)
 {
 }
 
-void AsmOperand::PrintBase(ostream& o) const
+int AsmIntImmediate::GetIntValue() const
 {
-    Print(o);
+    return value;
 }
 
-//---AsmOperandBase---
+//--AsmStrImmediate--
 
-void AsmOperandBase::Print(ostream& o) const
+AsmStrImmediate::AsmStrImmediate()
 {
 }
 
-void AsmOperandBase::PrintBase(ostream& o) const
+AsmStrImmediate::AsmStrImmediate(const string& value_):
+    value(value_)
 {
 }
 
-//---AsmRegister---
-
-AsmRegister::AsmRegister(RegisterName reg_):
-    reg(reg_)
+const string& AsmStrImmediate::GetStrValue() const
 {
+    return value;
 }
 
-void AsmRegister::Print(ostream& o) const
+//---AsmMemory---
+
+AsmMemory::AsmMemory(AsmStrImmediate base_, int disp_, int index_, unsigned scale_):
+    base_type(OPER_LABEL),
+    base(0),
+    label(base_.GetStrValue()),
+    disp(disp_),
+    index(index_),
+    scale(scale_)
 {
-    o << REG_TO_STR[reg];
 }
 
-void AsmRegister::PrintBase(ostream& o) const
+AsmMemory::AsmMemory(AsmIntImmediate base_, int disp_, int index_, unsigned scale_):
+    base_type(OPER_INT),
+    base(base_.GetIntValue()),
+    disp(disp_),
+    index(index_),
+    scale(scale_)
 {
-    o << REG_TO_STR[reg];
 }
 
-//---AsmImmediate---
-
-void AsmImmediate::Print(ostream& o) const
+AsmMemory::AsmMemory(RegisterName reg, int disp_, int index_, unsigned scale_):
+    base_type(OPER_REGISTER),
+    base(reg),
+    disp(disp_),
+    index(index_),
+    scale(scale_)
 {
 }
 
-void AsmImmediate::PrintBase(ostream& o) const
+void AsmMemory::AddDisp(int delta)
 {
+    disp += delta;
 }
 
-string AsmImmediate::GetStrValue() const
+void AsmMemory::SetIndex(RegisterName reg, unsigned scale_)
 {
-    return "";
+    index = reg;
+    scale = scale_;
 }
 
-int AsmImmediate::GetIntValue() const
+bool AsmMemory::IsIndexed() const
 {
-    return 0;
+    return scale != 0;
 }
 
-//---AsmIntImmediate---
+//---AsmCode---
 
-AsmIntImmediate::AsmIntImmediate(int value_):
-    value(value_)
+AsmCode::AsmCode():
+    funct_write(AsmStrImmediate("printf")),
+    label_counter(0),
+    was_real(false),
+    was_int(false),
+    was_str(false),
+    was_new_line(false),
+    relocatable(false),
+    target(TARGET_X86),
+    sse(false),
+    reg_results(false),
+    optimize(false),
+    expr_regs_count(EXPR_REGS_COUNT)
 {
+    copy(EXPR_REGS, EXPR_REGS + EXPR_REGS_COUNT, expr_regs);
 }
 
-AsmIntImmediate::AsmIntImmediate(const AsmIntImmediate& src):
-    value(src.value)
+AsmCode::~AsmCode()
 {
+    for (list<AsmData*>::iterator it = data.begin(); it != data.end(); ++it)
+        delete *it;
 }
 
-int AsmIntImmediate::GetIntValue() const
+AsmCode* AsmCode::CreateFragment() const
 {
-    return value;
+    AsmCode* res = new AsmCode();
+    res->name_space = name_space;
+    res->relocatable = true;
+    res->SetTarget(target);
+    res->SetSse(sse);
+    res->SetRegResults(reg_results);
+    res->SetOptimize(optimize);
+    return res;
 }
 
-void AsmIntImmediate::Print(ostream& o) const
+void AsmCode::MergeFormatStr(bool& was, AsmStrImmediate& format_str, bool fragment_was,
+                             const AsmStrImmediate& fragment_format_str, set<string>& duplicates)
 {
-    o << '$' << value;
+    if (!fragment_was) return;
+    if (was) duplicates.insert(fragment_format_str.GetStrValue());
+    else format_str = fragment_format_str;
+    was = true;
 }
 
-void AsmIntImmediate::PrintBase(ostream& o) const
+void AsmCode::AppendFragment(AsmCode& fragment)
 {
-    o << value;
+    vector<int> relocated(fragment.code.names.size(), -1);
+    for (vector<AsmCmd>::iterator it = fragment.code.commands.begin(); it != fragment.code.commands.end(); ++it)
+    {
+        AsmCmd cmd = *it;
+        if (cmd.kind == CMD_RAW)
+        {
+            cmd.oper[0].value = code.names.size();
+            code.names.push_back(fragment.code.names[it->oper[0].value]);
+        }
+        else
+            for (int i = 0; i < 2; ++i)
+                if (cmd.oper[i].type == OPER_LABEL)
+                    cmd.oper[i].label = RelocateLabelId(fragment, relocated, cmd.oper[i].label);
+                else if (cmd.oper[i].type == OPER_MEMORY
+                         && (cmd.oper[i].mem.base_type == OPER_LABEL || cmd.oper[i].mem.base_type == OPER_RIP_LABEL))
+                    cmd.oper[i].mem.base = RelocateLabelId(fragment, relocated, cmd.oper[i].mem.base);
+        code.commands.push_back(cmd);
+    }
+    for (list<AsmData*>::iterator it = fragment.data.begin(); it != fragment.data.end(); ++it)
+        (*it)->RelocateLabels(label_counter);
+    label_counter += fragment.label_counter;
+    set<string> duplicates;
+    MergeFormatStr(was_real, format_str_real, fragment.was_real, fragment.format_str_real, duplicates);
+    MergeFormatStr(was_int, format_str_int, fragment.was_int, fragment.format_str_int, duplicates);
+    MergeFormatStr(was_str, format_str_str, fragment.was_str, fragment.format_str_str, duplicates);
+    MergeFormatStr(was_new_line, format_str_new_line, fragment.was_new_line, fragment.format_str_new_line, duplicates);
+    for (list<AsmData*>::iterator it = fragment.data.begin(); it != fragment.data.end(); ++it)
+        if (duplicates.find((*it)->GetName()) != duplicates.end()) delete *it;
+        else data.push_back(*it);
+    fragment.data.clear();
+    fragment.code.commands.clear();
 }
 
-//--AsmStrImmediate--
-
-AsmStrImmediate::AsmStrImmediate()
+unsigned AsmCode::RelocateLabelId(const AsmCode& fragment, vector<int>& relocated, unsigned id)
 {
+    if (relocated[id] < 0) relocated[id] = LabelId(RelocateLabel(fragment.code.names[id], label_counter));
+    return relocated[id];
 }
 
-AsmStrImmediate::AsmStrImmediate(const string& value_):
-    value(value_)
+string AsmCode::NextLabelNumber()
 {
+    string res = IntToStr(label_counter++);
+    return relocatable ? LABEL_RELOCATION_MARK + res : res;
 }
 
-AsmStrImmediate::AsmStrImmediate(const AsmStrImmediate& src)
+string AsmCode::GenStrLabel()
 {
-    value.assign(src.value);
+    return NextLabelNumber();
 }
 
-void AsmStrImmediate::Print(ostream& o) const
+AsmStrImmediate AsmCode::GenLabel(string prefix)
 {
-    o << '$' << value;
+    return AsmStrImmediate(prefix + '_' + NextLabelNumber());
 }
 
-void AsmStrImmediate::PrintBase(ostream& o) const
+string AsmCode::GenStrLabel(string prefix)
 {
-    o << value;
+    return prefix + '_' + NextLabelNumber();
 }
 
-string AsmStrImmediate::GetStrValue() const 
+AsmStrImmediate AsmCode::LabelByStr(string str)
 {
-    return value;
+    return AsmStrImmediate(ChangeName(str));
 }
 
-//---AsmMemory---
-
-AsmMemory::AsmMemory(AsmOperandBase* base_, int disp_, int index_, unsigned scale_):
-    base(base_),
-    disp(disp_),
-    index(index_),
-    scale(scale_)
+void AsmCode::SetNamespace(string name_space_)
 {
+    name_space = name_space_;
 }
 
-AsmMemory::AsmMemory(AsmStrImmediate base_, int disp_, int index_, unsigned scale_):
-    base(new AsmStrImmediate(base_)),
-    disp(disp_),
-    index(index_),
-    scale(scale_)
+void AsmCode::SetTarget(AsmTarget target_)
 {
+    target = target_;
 }
 
-AsmMemory::AsmMemory(AsmIntImmediate base_, int disp_, int index_, unsigned scale_):
-    base(new AsmIntImmediate(base_)),
-    disp(disp_),
-    index(index_),
-    scale(scale_)
+AsmTarget AsmCode::GetTarget() const
 {
+    return target;
 }
 
-AsmMemory::AsmMemory(RegisterName reg, int disp_, int index_, unsigned scale_):
-    base(new AsmRegister(reg)),
-    disp(disp_),
-    index(index_),
-    scale(scale_)
+void AsmCode::SetSse(bool sse_)
 {
+    sse = sse_;
 }
 
-void AsmMemory::Print(ostream& o) const
+bool AsmCode::IsSse() const
 {
-    if (disp) o << disp;
-    o << '(';
-    base->PrintBase(o);
-    if (index) o << ", " << index;
-    if (scale) o << ", " << scale;
-    o << ')';
+    return sse || target == TARGET_X86_64;
 }
 
-//---AsmCode---
+void AsmCode::SetRegResults(bool reg_results_)
+{
+    reg_results = reg_results_;
+}
 
-AsmCode::AsmCode():
-    funct_write(AsmStrImmediate("printf")),
-    label_counter(0),
-    was_real(false),
-    was_int(false),
-    was_str(false),
-    was_new_line(false)
+bool AsmCode::IsRegResults() const
 {
+    return reg_results || target == TARGET_X86_64;
 }
 
-string AsmCode::GenStrLabel()
+void AsmCode::SetOptimize(bool optimize_)
 {
-    stringstream s;
-    s << label_counter++;
-    return s.str();
+    optimize = optimize_;
 }
 
-AsmStrImmediate AsmCode::GenLabel(string prefix)
+bool AsmCode::IsOptimize() const
 {
-    stringstream s;
-    s << prefix << '_' << label_counter++;
-    return AsmStrImmediate(s.str());
+    return optimize;
 }
 
-string AsmCode::GenStrLabel(string prefix)
+void AsmCode::SetReservedRegs(const vector<RegisterName>& reserved)
 {
-    stringstream s;
-    s << prefix << '_' << label_counter++;
-    return s.str();
+    expr_regs_count = 0;
+    for (int i = 0; i < EXPR_REGS_COUNT; ++i)
+        if (find(reserved.begin(), reserved.end(), EXPR_REGS[i]) == reserved.end())
+            expr_regs[expr_regs_count++] = EXPR_REGS[i];
 }
 
-AsmStrImmediate AsmCode::LabelByStr(string str)
+const RegisterName* AsmCode::GetExprRegs() const
 {
-    return AsmStrImmediate(ChangeName(str));
+    return expr_regs;
 }
 
-string AsmCode::ChangeName(string str)
+int AsmCode::GetExprRegsCount() const
 {
-    return str;
+    return expr_regs_count;
 }
 
-void AsmCode::AddCmd(AsmCmd* cmd)
+unsigned AsmCode::GetStackSize(unsigned size) const
 {
-    commands.push_back(cmd);
+    unsigned slot = target == TARGET_X86_64 ? 8 : 4;
+    return (size + slot - 1) / slot * slot;
 }
 
-void AsmCode::AddCmd(AsmLabel label)
+CmdSize AsmCode::GetPtrSize() const
 {
-    commands.push_back(new AsmLabel(label));
+    return target == TARGET_X86_64 ? SIZE_QUARD : SIZE_LONG;
 }
 
-void AsmCode::AddCmd(string raw_cmd)
+string AsmCode::ChangeName(string str)
 {
-    commands.push_back(new AsmRawCmd(raw_cmd));
+    if (name_space.empty()) return str;
+    return name_space + '.' + str;
 }
 
-void AsmCode::AddCmd(AsmCmdName cmd, CmdSize size)
+unsigned AsmCode::LabelId(const string& name)
 {
-    commands.push_back(new AsmCmd0(cmd, size));
+    map<string, unsigned>::iterator it = label_ids.find(name);
+    if (it != label_ids.end()) return it->second;
+    code.names.push_back(name);
+    return label_ids[name] = code.names.size() - 1;
 }
 
-void AsmCode::AddCmd(AsmCmdName cmd, AsmMemory mem, CmdSize size)
+AsmOperand AsmCode::Operand(RegisterName reg)
 {
-    commands.push_back(new AsmCmd1(cmd, new AsmMemory(mem), size));
+    AsmOperand res;
+    res.type = OPER_REGISTER;
+    res.reg = reg;
+    return res;
 }
 
-void AsmCode::AddCmd(AsmCmdName cmd, RegisterName src, RegisterName dest, CmdSize size)
+AsmOperand AsmCode::Operand(AsmIntImmediate int_imm)
 {
-    commands.push_back(new AsmCmd2(cmd, new AsmRegister(src), new AsmRegister(dest), size));
+    AsmOperand res;
+    res.type = OPER_INT;
+    res.value = int_imm.GetIntValue();
+    return res;
 }
 
-void AsmCode::AddCmd(AsmCmdName cmd, AsmOperand* oper, CmdSize size)
+AsmOperand AsmCode::Operand(const AsmStrImmediate& str_imm)
 {
-    commands.push_back(new AsmCmd1(cmd, oper, size));
+    AsmOperand res;
+    res.type = OPER_LABEL;
+    res.label = LabelId(str_imm.GetStrValue());
+    return res;
 }
 
-void AsmCode::AddCmd(AsmCmdName cmd, RegisterName reg, CmdSize size)
+AsmOperand AsmCode::Operand(const AsmMemory& mem)
 {
-    commands.push_back(new AsmCmd1(cmd, new AsmRegister(reg), size));
+    AsmOperand res;
+    res.type = OPER_MEMORY;
+    res.mem.base_type = mem.base_type;
+    res.mem.base = mem.base_type == OPER_LABEL ? LabelId(mem.label) : mem.base;
+    res.mem.disp = mem.disp;
+    res.mem.index = mem.index;
+    res.mem.scale = mem.scale;
+    return res;
 }
 
-void AsmCode::AddCmd(AsmCmdName cmd, AsmMemory* mem, CmdSize size)
+static RegisterName Reg64(RegisterName reg)
 {
-    commands.push_back(new AsmCmd1(cmd, mem, size));
+    switch (reg)
+    {
+        case REG_EAX: return REG_RAX;
+        case REG_EBX: return REG_RBX;
+        case REG_ECX: return REG_RCX;
+        case REG_EDX: return REG_RDX;
+        case REG_EDI: return REG_RDI;
+        case REG_ESI: return REG_RSI;
+        case REG_EBP: return REG_RBP;
+        case REG_ESP: return REG_RSP;
+        case REG_R12D: return REG_R12;
+        case REG_R13D: return REG_R13;
+        case REG_R14D: return REG_R14;
+        case REG_R15D: return REG_R15;
+        default: return reg;
+    }
 }
 
-void AsmCode::AddCmd(AsmCmdName cmd, AsmImmediate* imm, CmdSize size)
+void AsmCode::WidenTo64(AsmCmd& cmd)
 {
-    commands.push_back(new AsmCmd1(cmd, imm, size));
+    bool wide = cmd.size == SIZE_QUARD || cmd.command == ASM_PUSH || cmd.command == ASM_POP || cmd.command == ASM_LEA;
+    for (int i = 0; i < 2; ++i)
+        if (cmd.oper[i].type == OPER_REGISTER && (cmd.oper[i].reg == REG_ESP || cmd.oper[i].reg == REG_EBP))
+            wide = true;
+    if (wide && cmd.size != SIZE_NONE) cmd.size = SIZE_QUARD;
+    for (int i = 0; i < 2; ++i)
+    {
+        AsmOperand& oper = cmd.oper[i];
+        if (oper.type == OPER_REGISTER && wide)
+            oper.reg = Reg64(oper.reg);
+        else if (oper.type == OPER_MEMORY && oper.mem.base_type == OPER_REGISTER)
+        {
+            oper.mem.base = Reg64((RegisterName)oper.mem.base);
+            if (oper.mem.scale) oper.mem.index = Reg64((RegisterName)oper.mem.index);
+        }
+        else if (oper.type == OPER_MEMORY && oper.mem.base_type == OPER_LABEL && cmd.command == ASM_CALL)
+        {
+            unsigned label = oper.mem.base;
+            oper.type = OPER_LABEL;
+            oper.label = label;
+            cmd.size = SIZE_NONE;
+        }
+        else if (oper.type == OPER_MEMORY && oper.mem.base_type == OPER_LABEL)
+            oper.mem.base_type = OPER_RIP_LABEL;
+    }
 }
 
-void AsmCode::AddCmd(AsmCmdName cmd, AsmStrImmediate str_imm, CmdSize size)
+void AsmCode::PushCmd(AsmCmdKind kind, AsmCmdName cmd, CmdSize size, AsmOperand src, AsmOperand dest)
 {
-    AsmStrImmediate* tmp = new AsmStrImmediate(str_imm);
-    commands.push_back(new AsmCmd1(cmd, tmp, size));
+    if (target == TARGET_X86_64 && kind == CMD_INSTRUCTION && cmd == ASM_PUSH
+        && (src.type == OPER_LABEL || (src.type == OPER_MEMORY && size != SIZE_QUARD)))
+    {
+        //pushq can't take a 64-bit address and would read 8 bytes of a 4-byte value
+        if (src.type == OPER_LABEL)
+        {
+            AsmOperand mem;
+            mem.type = OPER_MEMORY;
+            mem.mem.base_type = OPER_LABEL;
+            mem.mem.base = src.label;
+            mem.mem.disp = mem.mem.index = mem.mem.scale = 0;
+            PushCmd(kind, ASM_LEA, SIZE_QUARD, mem, Operand(REG_R11));
+        }
+        else
+            PushCmd(kind, ASM_MOV, SIZE_LONG, src, Operand(REG_R11D));
+        src = Operand(REG_R11);
+    }
+    AsmCmd res;
+    res.kind = kind;
+    res.command = cmd;
+    res.size = size;
+    res.oper[0] = src;
+    res.oper[1] = dest;
+    if (target == TARGET_X86_64 && kind == CMD_INSTRUCTION) WidenTo64(res);
+    code.commands.push_back(res);
 }
 
-void AsmCode::AddCmd(AsmCmdName cmd, AsmIntImmediate int_imm, CmdSize size)
+static const AsmOperand NO_OPERAND = { OPER_NONE };
+
+void AsmCode::AddCmd(string raw_cmd)
 {
-    AsmIntImmediate* tmp = new AsmIntImmediate(int_imm);
-    commands.push_back(new AsmCmd1(cmd, tmp, size));
+    AsmOperand oper;
+    oper.type = OPER_NONE;
+    oper.value = code.names.size();
+    code.names.push_back(raw_cmd);
+    PushCmd(CMD_RAW, ASM_ADD, SIZE_NONE, oper, NO_OPERAND);
 }
 
-void AsmCode::AddCmd(AsmCmdName cmd, int int_imm, CmdSize size)
+void AsmCode::AddCmd(AsmCmdName cmd, CmdSize size)
 {
-    AsmIntImmediate* tmp = new AsmIntImmediate(int_imm);
-    commands.push_back(new AsmCmd1(cmd, tmp, size));
+    PushCmd(CMD_INSTRUCTION, cmd, size, NO_OPERAND, NO_OPERAND);
 }
 
-void AsmCode::AddCmd(AsmCmdName cmd, AsmOperand* oper1, AsmOperand* oper2, CmdSize size)
+void AsmCode::AddCmd(AsmCmdName cmd, RegisterName reg, CmdSize size)
 {
-    commands.push_back(new AsmCmd2(cmd, oper1, oper2, size));
+    PushCmd(CMD_INSTRUCTION, cmd, size, Operand(reg), NO_OPERAND);
 }
 
-void AsmCode::AddCmd(AsmCmdName cmd, RegisterName reg, AsmImmediate* dest, CmdSize size)
+void AsmCode::AddCmd(AsmCmdName cmd, const AsmMemory& mem, CmdSize size)
 {
-    commands.push_back(new AsmCmd2(cmd, new AsmRegister(reg), dest, size));
+    PushCmd(CMD_INSTRUCTION, cmd, size, Operand(mem), NO_OPERAND);
 }
 
-void AsmCode::AddCmd(AsmCmdName cmd, RegisterName reg, AsmStrImmediate dest, CmdSize size)
+void AsmCode::AddCmd(AsmCmdName cmd, const AsmStrImmediate& str_imm, CmdSize size)
 {
-    AsmStrImmediate* imm = new AsmStrImmediate(dest);
-    commands.push_back(new AsmCmd2(cmd, new AsmRegister(reg), imm, size));
+    PushCmd(CMD_INSTRUCTION, cmd, size, Operand(str_imm), NO_OPERAND);
 }
 
-void AsmCode::AddCmd(AsmCmdName cmd, RegisterName reg, AsmIntImmediate dest, CmdSize size)
+void AsmCode::AddCmd(AsmCmdName cmd, AsmIntImmediate int_imm, CmdSize size)
 {
-    AsmIntImmediate* imm = new AsmIntImmediate(dest);
-    commands.push_back(new AsmCmd2(cmd, new AsmRegister(reg), imm, size));
+    PushCmd(CMD_INSTRUCTION, cmd, size, Operand(int_imm), NO_OPERAND);
 }
 
-void AsmCode::AddCmd(AsmCmdName cmd, int int_imm, RegisterName reg, CmdSize size)
+void AsmCode::AddCmd(AsmCmdName cmd, int int_imm, CmdSize size)
 {
-    AsmIntImmediate* imm = new AsmIntImmediate(int_imm);
-    commands.push_back(new AsmCmd2(cmd, imm,  new AsmRegister(reg), size));    
+    PushCmd(CMD_INSTRUCTION, cmd, size, Operand(AsmIntImmediate(int_imm)), NO_OPERAND);
 }
 
-void AsmCode::AddCmd(AsmCmdName cmd, AsmImmediate* src, RegisterName reg, CmdSize size)
+void AsmCode::AddCmd(AsmCmdName cmd, RegisterName src, RegisterName dest, CmdSize size)
 {
-    commands.push_back(new AsmCmd2(cmd, src, new AsmRegister(reg), size));
+    PushCmd(CMD_INSTRUCTION, cmd, size, Operand(src), Operand(dest));
 }
 
-void AsmCode::AddCmd(AsmCmdName cmd, AsmStrImmediate src, RegisterName reg, CmdSize size)
+void AsmCode::AddCmd(AsmCmdName cmd, RegisterName reg, const AsmStrImmediate& dest, CmdSize size)
 {
-    AsmStrImmediate* imm = new AsmStrImmediate(src);
-    commands.push_back(new AsmCmd2(cmd, imm, new AsmRegister(reg), size));
+    PushCmd(CMD_INSTRUCTION, cmd, size, Operand(reg), Operand(dest));
 }
 
-void AsmCode::AddCmd(AsmCmdName cmd, AsmIntImmediate src, RegisterName reg, CmdSize size)
+void AsmCode::AddCmd(AsmCmdName cmd, RegisterName reg, AsmIntImmediate dest, CmdSize size)
 {
-    AsmIntImmediate* imm = new AsmIntImmediate(src);
-    commands.push_back(new AsmCmd2(cmd, imm, new AsmRegister(reg), size));
+    PushCmd(CMD_INSTRUCTION, cmd, size, Operand(reg), Operand(dest));
 }
 
-void AsmCode::AddCmd(AsmCmdName cmd, AsmMemory* mem, RegisterName reg, CmdSize size)
+void AsmCode::AddCmd(AsmCmdName cmd, int int_imm, RegisterName reg, CmdSize size)
 {
-    commands.push_back(new AsmCmd2(cmd, mem, new AsmRegister(reg), size));
+    PushCmd(CMD_INSTRUCTION, cmd, size, Operand(AsmIntImmediate(int_imm)), Operand(reg));
 }
 
-void AsmCode::AddCmd(AsmCmdName cmd, AsmMemory mem, RegisterName reg, CmdSize size)
+void AsmCode::AddCmd(AsmCmdName cmd, const AsmStrImmediate& src, RegisterName reg, CmdSize size)
 {
-    commands.push_back(new AsmCmd2(cmd, new AsmMemory(mem), new AsmRegister(reg), size));
+    PushCmd(CMD_INSTRUCTION, cmd, size, Operand(src), Operand(reg));
 }
 
-void AsmCode::AddCmd(AsmCmdName cmd, RegisterName reg, AsmMemory* mem, CmdSize size)
+void AsmCode::AddCmd(AsmCmdName cmd, AsmIntImmediate src, RegisterName reg, CmdSize size)
 {
-    commands.push_back(new AsmCmd2(cmd, new AsmRegister(reg), mem, size));
+    PushCmd(CMD_INSTRUCTION, cmd, size, Operand(src), Operand(reg));
 }
 
-void AsmCode::AddCmd(AsmCmdName cmd, RegisterName reg, AsmMemory mem, CmdSize size)
+void AsmCode::AddCmd(AsmCmdName cmd, const AsmMemory& mem, RegisterName reg, CmdSize size)
 {
-    commands.push_back(new AsmCmd2(cmd, new AsmRegister(reg), new AsmMemory(mem), size));
+    PushCmd(CMD_INSTRUCTION, cmd, size, Operand(mem), Operand(reg));
 }
 
-void AsmCode::AddCmd(AsmCmdName cmd, AsmImmediate* src, AsmMemory* mem, CmdSize size)
+void AsmCode::AddCmd(AsmCmdName cmd, RegisterName reg, const AsmMemory& mem, CmdSize size)
 {
-    commands.push_back(new AsmCmd2(cmd, src, mem, size));
+    PushCmd(CMD_INSTRUCTION, cmd, size, Operand(reg), Operand(mem));
 }
 
-void AsmCode::AddCmd(AsmCmdName cmd, AsmStrImmediate src, AsmMemory mem, CmdSize size)
+void AsmCode::AddCmd(AsmCmdName cmd, const AsmStrImmediate& str_imm, const AsmMemory& mem, CmdSize size)
 {
-    AddCmd(cmd, new AsmStrImmediate(src), new AsmMemory(mem), size);
+    PushCmd(CMD_INSTRUCTION, cmd, size, Operand(str_imm), Operand(mem));
 }
 
-void AsmCode::AddCmd(AsmCmdName cmd, AsmIntImmediate int_imm, AsmMemory mem, CmdSize size)
+void AsmCode::AddCmd(AsmCmdName cmd, AsmIntImmediate int_imm, const AsmMemory& mem, CmdSize size)
 {
-    AddCmd(cmd, new AsmIntImmediate(int_imm), new AsmMemory(mem), size);
+    PushCmd(CMD_INSTRUCTION, cmd, size, Operand(int_imm), Operand(mem));
 }
 
 void AsmCode::AddData(AsmData* new_data)
@@ -594,44 +865,175 @@ AsmStrImmediate AsmCode::AddData(unsigned size)
     return AddData(GenStrLabel(), size);
 }
 
-void AsmCode::AddLabel(AsmStrImmediate* label)
+void AsmCode::AddLabel(const AsmStrImmediate& label)
 {
-    commands.push_back(new AsmLabel(label));
+    PushCmd(CMD_LABEL, ASM_ADD, SIZE_NONE, Operand(label), NO_OPERAND);
 }
 
-void AsmCode::AddLabel(AsmStrImmediate label)
+void AsmCode::AddLabel(string label)
 {
-    commands.push_back(new AsmLabel(label));
+    AddLabel(AsmStrImmediate(label));
 }
 
-void AsmCode::AddLabel(string label)
+void AsmCode::AlignLoop()
 {
-    commands.push_back(new AsmLabel(label));
+    if (optimize) AddCmd("    .p2align 4,0x90");
 }
 
 void AsmCode::Print(ostream& o) const
 {
-    o << ".data\n";
+    AsmWriter writer(o);
+    Print(writer);
+}
+
+void AsmCode::Optimize(PeepholeOptimizer& optimizer)
+{
+    optimizer.Optimize(code.commands);
+}
+
+void AsmCode::OmitFramePointer(FrameOmitter& omitter)
+{
+    omitter.Process(code);
+}
+
+void AsmCode::Print(AsmWriter& o) const
+{
+    PrintData(o);
+    o.Write(".text\n", 6);
+    PrintCommands(o, code);
+}
+
+void AsmCode::PrintData(ostream& o) const
+{
+    AsmWriter writer(o);
+    PrintData(writer);
+}
+
+void AsmCode::PrintData(AsmWriter& o) const
+{
+    o.Write(".data\n", 6);
     for (list<AsmData*>::const_iterator it = data.begin(); it != data.end(); ++it)
     {
         (*it)->Print(o);
-        o << '\n';
+        o.Write('\n');
+    }
+}
+
+void AsmCode::PrintOperand(AsmWriter& o, const AsmChunk& chunk, const AsmOperand& oper, bool as_base)
+{
+    switch (oper.type)
+    {
+        case OPER_REGISTER:
+            o.Write(REG_TO_STR[oper.reg]);
+        break;
+        case OPER_INT:
+            if (!as_base) o.Write('$');
+            o.WriteInt(oper.value);
+        break;
+        case OPER_LABEL:
+            if (!as_base) o.Write('$');
+            o.Write(chunk.names[oper.label]);
+        break;
+        case OPER_MEMORY:
+            if (oper.mem.base_type == OPER_RIP_LABEL)
+            {
+                o.Write(chunk.names[oper.mem.base]);
+                if (oper.mem.disp > 0) o.Write('+');
+                if (oper.mem.disp) o.WriteInt(oper.mem.disp);
+                o.Write("(%rip)", 6);
+                break;
+            }
+            if (oper.mem.base_type == OPER_LABEL && !oper.mem.scale)
+            {
+                o.Write('(');
+                o.Write(chunk.names[oper.mem.base]);
+                if (oper.mem.disp > 0) o.Write('+');
+                if (oper.mem.disp) o.WriteInt(oper.mem.disp);
+                o.Write(')');
+                break;
+            }
+            if (oper.mem.base_type == OPER_LABEL)
+            {
+                o.Write(chunk.names[oper.mem.base]);
+                if (oper.mem.disp > 0) o.Write('+');
+            }
+            if (oper.mem.disp) o.WriteInt(oper.mem.disp);
+            o.Write('(');
+            if (oper.mem.base_type == OPER_REGISTER) o.Write(REG_TO_STR[oper.mem.base]);
+            else if (oper.mem.base_type == OPER_INT) o.WriteInt(oper.mem.base);
+            if (oper.mem.scale)
+            {
+                o.Write(',');
+                o.Write(REG_TO_STR[oper.mem.index]);
+                o.Write(',');
+                o.WriteInt(oper.mem.scale);
+            }
+            o.Write(')');
+        break;
+        default:
+        break;
     }
-    o << ".text\n";
-    for (list<AsmCmd*>::const_iterator it = commands.begin(); it != commands.end(); ++it)
+}
+
+void AsmCode::PrintCommands(AsmWriter& o, const AsmChunk& chunk)
+{
+    for (vector<AsmCmd>::const_iterator it = chunk.commands.begin(); it != chunk.commands.end(); ++it)
     {
-        (*it)->Print(o);
-        o << '\n';
+        switch (it->kind)
+        {
+            case CMD_LABEL:
+                o.Write("  ", 2);
+                o.Write(chunk.names[it->oper[0].label]);
+                o.Write(':');
+            break;
+            case CMD_RAW:
+                o.Write(chunk.names[it->oper[0].value]);
+            break;
+            case CMD_INSTRUCTION:
+                o.Write(CMD_TEXT[it->command * CMD_SIZE_COUNT + it->size]);
+                if (it->oper[0].type == OPER_NONE) break;
+                o.Write('\t');
+                PrintOperand(o, chunk, it->oper[0], it->size == SIZE_NONE && it->oper[1].type == OPER_NONE);
+                if (it->oper[1].type == OPER_NONE) break;
+                o.Write(", ", 2);
+                PrintOperand(o, chunk, it->oper[1], false);
+            break;
+        }
+        o.Write('\n');
     }
 }
 
+const AsmChunk& AsmCode::GetCommands() const
+{
+    return code;
+}
+
+const list<AsmData*>& AsmCode::GetData() const
+{
+    return data;
+}
+
+void AsmCode::FlushCommands(AsmChunk& res)
+{
+    res.commands.swap(code.commands);
+    res.names.swap(code.names);
+    code.commands.clear();
+    code.names.clear();
+    label_ids.clear();
+}
+
 void AsmCode::GenCallWriteForInt()
 {
     if (!was_int)
     {
-        format_str_int = AddData(ChangeName("format_str_d"), "%d", DATA_STR);
+        format_str_int = AddData("format_str_d", "%d", DATA_STR);
         was_int = true;
     }
+    if (target == TARGET_X86_64)
+    {
+        GenCallWrite64(format_str_int, DATA_INT);
+        return;
+    }
     AddCmd(ASM_PUSH, format_str_int);
     AddCmd(ASM_CALL, funct_write);
     AddCmd(ASM_ADD, 8, REG_ESP);
@@ -641,12 +1043,26 @@ void AsmCode::GenCallWriteForReal()
 {
     if (!was_real)
     {
-        format_str_real = AddData(ChangeName("format_str_f"), "%f", DATA_STR);
+        format_str_real = AddData("format_str_f", "%f", DATA_STR);
         was_real = true;
     }
-    AddCmd(ASM_FLD, AsmMemory(REG_ESP), SIZE_SHORT);
-    AddCmd(ASM_SUB, 8, REG_ESP);
-    AddCmd(ASM_FSTP, AsmMemory(REG_ESP, 4));
+    if (target == TARGET_X86_64)
+    {
+        GenCallWrite64(format_str_real, DATA_REAL);
+        return;
+    }
+    if (sse)
+    {
+        AddCmd(ASM_CVTSS2SD, AsmMemory(REG_ESP), REG_XMM0, SIZE_NONE);
+        AddCmd(ASM_SUB, 8, REG_ESP);
+        AddCmd(ASM_MOVSD, REG_XMM0, AsmMemory(REG_ESP, 4), SIZE_NONE);
+    }
+    else
+    {
+        AddCmd(ASM_FLD, AsmMemory(REG_ESP), SIZE_SHORT);
+        AddCmd(ASM_SUB, 8, REG_ESP);
+        AddCmd(ASM_FSTP, AsmMemory(REG_ESP, 4));
+    }
     AddCmd(ASM_MOV, format_str_real, AsmMemory(REG_ESP));
     AddCmd(ASM_CALL, funct_write);
     AddCmd(ASM_ADD, 12, REG_ESP);
@@ -656,9 +1072,14 @@ void AsmCode::GenCallWriteForStr()
 {
     if (!was_str)
     {
-        format_str_str = AddData(ChangeName("format_str_s"), "%s", DATA_STR);
+        format_str_str = AddData("format_str_s", "%s", DATA_STR);
         was_str = true;
     }
+    if (target == TARGET_X86_64)
+    {
+        GenCallWrite64(format_str_str, DATA_STR);
+        return;
+    }
     AddCmd(ASM_PUSH, format_str_str);
     AddCmd(ASM_CALL, funct_write);
     AddCmd(ASM_ADD, 8, REG_ESP);
@@ -668,31 +1089,111 @@ void AsmCode::GenWriteNewLine()
 {
     if (!was_new_line)
     {
-        format_str_new_line = AddData(ChangeName("format_str_new_line"), "\\n", DATA_STR);
+        format_str_new_line = AddData("format_str_new_line", "\\n", DATA_STR);
         was_new_line = true;
     }
+    if (target == TARGET_X86_64)
+    {
+        GenCallWrite64(format_str_new_line, DATA_UNTYPED);
+        return;
+    }
     AddCmd(ASM_PUSH, format_str_new_line);
     AddCmd(ASM_CALL, funct_write);
     AddCmd(ASM_ADD, 4, REG_ESP);
 }
 
+void AsmCode::GenCallWrite64(const AsmStrImmediate& format_str, AsmDataType type)
+{
+    if (type == DATA_REAL)
+    {
+        AddCmd(ASM_MOVSS, AsmMemory(REG_ESP), REG_XMM0, SIZE_NONE);
+        AddCmd(ASM_ADD, 8, REG_ESP);
+        AddCmd(ASM_CVTSS2SD, REG_XMM0, REG_XMM0, SIZE_NONE);
+    }
+    else if (type != DATA_UNTYPED)
+        AddCmd(ASM_POP, REG_ESI);
+    AddCmd(ASM_MOV, REG_ESP, REG_EAX);
+    AddCmd(ASM_AND, -16, REG_ESP);
+    AddCmd(ASM_SUB, 8, REG_ESP);
+    AddCmd(ASM_PUSH, REG_EAX);
+    AddCmd(ASM_LEA, AsmMemory(format_str), REG_EDI);
+    AddCmd(ASM_MOV, type == DATA_REAL ? 1 : 0, REG_EAX);
+    AddCmd(ASM_CALL, funct_write);
+    AddCmd(ASM_POP, REG_ESP);
+}
+
+void AsmCode::CopyMemory(RegisterName src, RegisterName dest, unsigned size)
+{
+    bool wide = target == TARGET_X86_64 || sse;
+    if (size > (wide ? COPY_SSE_UNROLL_LIMIT : COPY_UNROLL_LIMIT))
+    {
+        RegisterName* regs_end = expr_regs + expr_regs_count;
+        bool save_esi = find(expr_regs, regs_end, REG_ESI) == regs_end;
+        bool save_edi = find(expr_regs, regs_end, REG_EDI) == regs_end;
+        int shift = (save_esi + save_edi) * GetStackSize(4);
+        if (save_esi) AddCmd(ASM_PUSH, REG_ESI);
+        if (save_edi) AddCmd(ASM_PUSH, REG_EDI);
+        AddCmd(ASM_LEA, AsmMemory(src, src == REG_ESP ? shift : 0), REG_ESI);
+        AddCmd(ASM_LEA, AsmMemory(dest, dest == REG_ESP ? shift : 0), REG_EDI);
+        AddCmd(ASM_MOV, size / 4, REG_ECX);
+        AddCmd(ASM_REP_MOVS);
+        if (save_edi) AddCmd(ASM_POP, REG_EDI);
+        if (save_esi) AddCmd(ASM_POP, REG_ESI);
+        return;
+    }
+    unsigned i = 0;
+    if (wide)
+        for (; i + 16 <= size; i += 16)
+        {
+            AddCmd(ASM_MOVDQU, AsmMemory(src, i), REG_XMM0, SIZE_NONE);
+            AddCmd(ASM_MOVDQU, REG_XMM0, AsmMemory(dest, i), SIZE_NONE);
+        }
+    if (target == TARGET_X86_64)
+        for (; i + 8 <= size; i += 8)
+        {
+            AddCmd(ASM_MOV, AsmMemory(src, i), REG_EAX, SIZE_QUARD);
+            AddCmd(ASM_MOV, REG_EAX, AsmMemory(dest, i), SIZE_QUARD);
+        }
+    for (; i < size; i += 4)
+    {
+        AddCmd(ASM_MOV, AsmMemory(src, i), REG_EAX);
+        AddCmd(ASM_MOV, REG_EAX, AsmMemory(dest, i));
+    }
+}
+
 void AsmCode::PushMemory(unsigned size)
 {
     AddCmd(ASM_POP, REG_EBX);
-    for (int i = 0; i < size; i += 4)
+    if (size <= 4)
     {
-        AddCmd(ASM_MOV, AsmMemory(REG_EBX, size - i - 4), REG_EAX);
+        AddCmd(ASM_MOV, AsmMemory(REG_EBX), REG_EAX);
         AddCmd(ASM_PUSH, REG_EAX);
     }
+    else if (target == TARGET_X86 && size <= COPY_UNROLL_LIMIT)
+        for (int i = size - 4; i >= 0; i -= 4)
+            AddCmd(ASM_PUSH, AsmMemory(REG_EBX, i));
+    else
+    {
+        AddCmd(ASM_SUB, GetStackSize(size), REG_ESP);
+        CopyMemory(REG_EBX, REG_ESP, size);
+    }
 }
 
 void AsmCode::MoveToMemoryFromStack(unsigned size)
 {
     AddCmd(ASM_POP, REG_EBX);
-    for (int i = 0; i < size; i += 4)
+    if (size <= 4)
     {
         AddCmd(ASM_POP, REG_EAX);
-        AddCmd(ASM_MOV, REG_EAX, AsmMemory(REG_EBX, i));
+        AddCmd(ASM_MOV, REG_EAX, AsmMemory(REG_EBX));
+    }
+    else if (target == TARGET_X86 && size <= COPY_UNROLL_LIMIT)
+        for (unsigned i = 0; i < size; i += 4)
+            AddCmd(ASM_POP, AsmMemory(REG_EBX, i));
+    else
+    {
+        CopyMemory(REG_ESP, REG_EBX, size);
+        AddCmd(ASM_ADD, GetStackSize(size), REG_ESP);
     }
 }
 
@@ -700,15 +1201,40 @@ void AsmCode::MoveMemory(unsigned size)
 {
     AddCmd(ASM_POP, REG_EBX);
     AddCmd(ASM_POP, REG_EDX);
-    AddCmd(ASM_SUB, size, REG_ESP);
-    for (int i = 0; i < size; i += 4)
-    {
-        AddCmd(ASM_MOV, AsmMemory(REG_EBX, i), REG_EAX);
-        AddCmd(ASM_MOV, REG_EAX, AsmMemory(REG_EDX, size - i - 4));
-    }
+    CopyMemory(REG_EDX, REG_EBX, size);
 }
 
 void AsmCode::AddMainFunctionLabel()
 {
     AddCmd(".globl main\nmain:\n");
 }
+
+void AsmCode::AddGlobalDeclaration(AsmStrImmediate label)
+{
+    AddCmd(".globl " + label.GetStrValue());
+}
+
+//---AsmSink---
+
+AsmSink::~AsmSink()
+{
+}
+
+//---AsmStreamSink---
+
+AsmStreamSink::AsmStreamSink(ostream& output_):
+    output(output_)
+{
+    output.Write(".text\n", 6);
+}
+
+void AsmStreamSink::Emit(AsmChunk* chunk)
+{
+    AsmCode::PrintCommands(output, *chunk);
+    delete chunk;
+}
+
+void AsmStreamSink::Finish()
+{
+    output.Flush();
+}
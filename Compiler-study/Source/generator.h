@@ -2,139 +2,142 @@
 #define GENERATOR
 
 #include "asm_commands.h"
+#include "asm_writer.h"
 #include <list>
 #include <iostream>
 #include <stdio.h>
 #include <sstream>
+#include <set>
+#include <map>
+#include <vector>
 using namespace std;
 
-class AsmOperand;
-class AsmStrImmediate;
+class PeepholeOptimizer;
+class FrameOmitter;
 
 extern const string ASM_DATA_TYPE_TO_STR[];
 
-class AsmCmd{
-public:
-    virtual void Print(ostream& o) const;
+enum AsmTarget{
+    TARGET_X86,
+    TARGET_X86_64
 };
 
-class AsmLabel: public AsmCmd{
-    AsmStrImmediate* label;
-public:
-    AsmLabel(AsmStrImmediate* label);
-    AsmLabel(AsmStrImmediate label);
-    AsmLabel(string label);
-    virtual void Print(ostream& o) const;
-};
+static const unsigned X64_INT_ARG_REGS_COUNT = 6;
+static const unsigned X64_REAL_ARG_REGS_COUNT = 8;
 
-class AsmRawCmd: public AsmCmd{
-private:
-    string str;
-public:
-    AsmRawCmd(string cmd);
-    virtual void Print(ostream& o) const;
-};
+extern const RegisterName X64_INT_ARG_REGS[];
+extern const RegisterName X64_REAL_ARG_REGS[];
 
-class AsmCmd0: public AsmCmd{
-protected:
-    AsmCmdName command;
-    CmdSize size;
-public:
-    AsmCmd0(AsmCmdName cmd, CmdSize cmd_size = SIZE_LONG);
-    virtual void Print(ostream& o) const;
-};
+static const int EXPR_REGS_COUNT = 6;
+static const int REG_NEED_STACK = 1 << 16;
 
-class AsmData{
-private:
-    string name;
-    string value;
-    AsmDataType type;
-public:
-    AsmData(string name_, string value, AsmDataType type = DATA_UNTYPED);
-    virtual void Print(ostream& o) const;
+extern const RegisterName EXPR_REGS[];
+
+static const int X86_VAR_REGS_COUNT = 2;
+static const int X64_VAR_REGS_COUNT = 4;
+
+extern const RegisterName X86_VAR_REGS[];
+extern const RegisterName X64_VAR_REGS[];
+
+static const unsigned COPY_UNROLL_LIMIT = 64;
+static const unsigned COPY_SSE_UNROLL_LIMIT = 128;
+
+string UnescapeAsmString(const string& str);
+AsmCmdName InverseJump(AsmCmdName cmd);
+
+enum AsmOperandType{
+    OPER_NONE,
+    OPER_REGISTER,
+    OPER_INT,
+    OPER_LABEL,
+    OPER_MEMORY,
+    OPER_RIP_LABEL
 };
 
-class AsmCmd1: public AsmCmd0{
-private:
-    AsmOperand* oper;
-public:
-    AsmCmd1(AsmCmdName cmd, AsmOperand* oper_, CmdSize size = SIZE_LONG);
-    virtual void Print(ostream& o) const;
+struct AsmAddress{
+    AsmOperandType base_type;
+    int base;
+    int disp;
+    int index;
+    unsigned scale;
 };
 
-class AsmCmd2: public AsmCmd0{
-private:
-    AsmOperand* src;
-    AsmOperand* dest;
-public:
-    AsmCmd2(AsmCmdName cmd, AsmOperand* src_, AsmOperand* dest_, CmdSize size = SIZE_LONG);
-    virtual void Print(ostream& o) const;
+struct AsmOperand{
+    AsmOperandType type;
+    union{
+        RegisterName reg;
+        int value;
+        unsigned label;
+        AsmAddress mem;
+    };
 };
 
-class AsmOperand{
-public:
-    virtual void Print(ostream& o) const;
-    virtual void PrintBase(ostream& o) const;
+enum AsmCmdKind{
+    CMD_INSTRUCTION,
+    CMD_LABEL,
+    CMD_RAW
 };
 
-class AsmOperandBase: public AsmOperand{
-public:
-    virtual void Print(ostream& o) const;
-    virtual void PrintBase(ostream& o) const;
+struct AsmCmd{
+    AsmCmdKind kind;
+    AsmCmdName command;
+    CmdSize size;
+    AsmOperand oper[2];
 };
 
-class AsmRegister: public AsmOperandBase{
-private:
-    RegisterName reg;
-public:
-    AsmRegister(RegisterName reg_);
-    virtual void Print(ostream& o) const;
-    virtual void PrintBase(ostream& o) const;
+struct AsmChunk{
+    vector<AsmCmd> commands;
+    vector<string> names;
 };
 
-class AsmImmediate: public AsmOperandBase{
+class AsmData{
+private:
+    string name;
+    string value;
+    AsmDataType type;
 public:
-    virtual void Print(ostream& o) const;
-    virtual void PrintBase(ostream& o) const;
-    virtual string GetStrValue() const;
-    virtual int GetIntValue() const;
+    AsmData(string name_, string value, AsmDataType type = DATA_UNTYPED);
+    virtual ~AsmData();
+    string GetName() const;
+    string GetValue() const;
+    AsmDataType GetType() const;
+    virtual void Print(AsmWriter& o) const;
+    void RelocateLabels(unsigned base);
 };
 
-class AsmIntImmediate: public AsmOperandBase{
+class AsmIntImmediate{
 private:
     int value;
 public:
     AsmIntImmediate(int value_);
-    AsmIntImmediate(const AsmIntImmediate& src);
-    virtual int GetIntValue() const;
-    virtual void Print(ostream& o) const;
-    virtual void PrintBase(ostream& o) const;
+    int GetIntValue() const;
 };
 
-class AsmStrImmediate: public AsmImmediate{
+class AsmStrImmediate{
 private:
     string value;
 public:
     AsmStrImmediate();
     AsmStrImmediate(const string& value_);
-    AsmStrImmediate(const AsmStrImmediate& src);
-    virtual string GetStrValue() const;
-    virtual void Print(ostream& o) const;
-    virtual void PrintBase(ostream& o) const;
+    const string& GetStrValue() const;
 };
 
-class AsmMemory: public AsmOperand{
+class AsmMemory{
 private:
-    AsmOperandBase* base;
+    AsmOperandType base_type;
+    int base;
+    string label;
     int disp;
     int index;
     unsigned scale;
 public:
-    AsmMemory(AsmOperandBase* base_, int disp_ = 0, int index_ = 0, unsigned scale_ = 0);
-    AsmMemory(AsmStrImmediate base, int disp_ = 0, int index_ = 0, unsigned scale_ = 0);
-    AsmMemory(AsmIntImmediate base, int disp_ = 0, int index_ = 0, unsigned scale_ = 0);
+    AsmMemory(AsmStrImmediate base_, int disp_ = 0, int index_ = 0, unsigned scale_ = 0);
+    AsmMemory(AsmIntImmediate base_, int disp_ = 0, int index_ = 0, unsigned scale_ = 0);
     AsmMemory(RegisterName reg, int disp_ = 0, int index_ = 0, unsigned scale_ = 0);
-    virtual void Print(ostream& o) const;
+    void AddDisp(int delta);
+    void SetIndex(RegisterName reg, unsigned scale_);
+    bool IsIndexed() const;
+    friend class AsmCode;
 };
 
 class AsmCode{
@@ -148,61 +151,116 @@ private:
     bool was_str;
     bool was_new_line;
     AsmMemory funct_write;
-    list<AsmCmd*> commands;
+    AsmChunk code;
+    map<string, unsigned> label_ids;
     list<AsmData*> data;
     string ChangeName(string str);
     unsigned label_counter;
+    string name_space;
+    bool relocatable;
+    AsmTarget target;
+    bool sse;
+    bool reg_results;
+    bool optimize;
+    RegisterName expr_regs[EXPR_REGS_COUNT];
+    int expr_regs_count;
+    string NextLabelNumber();
+    unsigned LabelId(const string& name);
+    unsigned RelocateLabelId(const AsmCode& fragment, vector<int>& relocated, unsigned id);
+    AsmOperand Operand(RegisterName reg);
+    AsmOperand Operand(AsmIntImmediate int_imm);
+    AsmOperand Operand(const AsmStrImmediate& str_imm);
+    AsmOperand Operand(const AsmMemory& mem);
+    void PushCmd(AsmCmdKind kind, AsmCmdName cmd, CmdSize size, AsmOperand src, AsmOperand dest);
+    static void WidenTo64(AsmCmd& cmd);
+    void GenCallWrite64(const AsmStrImmediate& format_str, AsmDataType type);
+    static void PrintOperand(AsmWriter& o, const AsmChunk& chunk, const AsmOperand& oper, bool as_base);
+    static void MergeFormatStr(bool& was, AsmStrImmediate& format_str, bool fragment_was,
+                               const AsmStrImmediate& fragment_format_str, set<string>& duplicates);
 public:
     AsmCode();
+    virtual ~AsmCode();
+    AsmCode* CreateFragment() const;
+    void AppendFragment(AsmCode& fragment);
+    void SetNamespace(string name_space_);
+    void SetTarget(AsmTarget target_);
+    AsmTarget GetTarget() const;
+    void SetSse(bool sse_);
+    bool IsSse() const;
+    void SetRegResults(bool reg_results_);
+    bool IsRegResults() const;
+    void SetOptimize(bool optimize_);
+    bool IsOptimize() const;
+    void SetReservedRegs(const vector<RegisterName>& reserved);
+    const RegisterName* GetExprRegs() const;
+    int GetExprRegsCount() const;
+    unsigned GetStackSize(unsigned size) const;
+    CmdSize GetPtrSize() const;
     string GenStrLabel();
     AsmStrImmediate GenLabel(string prefix);
     string GenStrLabel(string prefix);
     AsmStrImmediate LabelByStr(string str);
-    void AddCmd(AsmCmd* cmd);
-    void AddCmd(AsmLabel cmd);
     void AddCmd(AsmCmdName cmd, CmdSize size = SIZE_LONG);
     void AddCmd(string raw_cmd);
-    void AddCmd(AsmCmdName cmd, AsmOperand* oper, CmdSize size = SIZE_LONG);
     void AddCmd(AsmCmdName cmd, RegisterName reg, CmdSize size = SIZE_LONG);
-    void AddCmd(AsmCmdName cmd, AsmMemory* mem, CmdSize size = SIZE_LONG);
-    void AddCmd(AsmCmdName cmd, AsmMemory mem, CmdSize size = SIZE_LONG);
-    void AddCmd(AsmCmdName cmd, AsmImmediate* imm, CmdSize size = SIZE_LONG);
-    void AddCmd(AsmCmdName cmd, AsmStrImmediate str_imm, CmdSize size = SIZE_LONG);
+    void AddCmd(AsmCmdName cmd, const AsmMemory& mem, CmdSize size = SIZE_LONG);
+    void AddCmd(AsmCmdName cmd, const AsmStrImmediate& str_imm, CmdSize size = SIZE_LONG);
     void AddCmd(AsmCmdName cmd, AsmIntImmediate int_imm, CmdSize size = SIZE_LONG);
     void AddCmd(AsmCmdName cmd, int int_imm, CmdSize size = SIZE_LONG);
-    void AddCmd(AsmCmdName cmd, AsmOperand* oper1, AsmOperand* oper2, CmdSize size = SIZE_LONG);
     void AddCmd(AsmCmdName cmd, RegisterName src, RegisterName dest, CmdSize size = SIZE_LONG);
-    void AddCmd(AsmCmdName cmd, RegisterName reg, AsmImmediate* dest, CmdSize size = SIZE_LONG);
-    void AddCmd(AsmCmdName cmd, RegisterName reg, AsmStrImmediate dest, CmdSize size = SIZE_LONG);
+    void AddCmd(AsmCmdName cmd, RegisterName reg, const AsmStrImmediate& dest, CmdSize size = SIZE_LONG);
     void AddCmd(AsmCmdName cmd, RegisterName reg, AsmIntImmediate dest, CmdSize size = SIZE_LONG);
     void AddCmd(AsmCmdName cmd, int int_imm, RegisterName reg, CmdSize size = SIZE_LONG);
-    void AddCmd(AsmCmdName cmd, AsmImmediate* src, RegisterName oper1, CmdSize size = SIZE_LONG);
-    void AddCmd(AsmCmdName cmd, AsmStrImmediate src, RegisterName oper1, CmdSize size = SIZE_LONG);
-    void AddCmd(AsmCmdName cmd, AsmIntImmediate src, RegisterName oper1, CmdSize size = SIZE_LONG);
-    void AddCmd(AsmCmdName cmd, AsmMemory* mem, RegisterName reg, CmdSize size = SIZE_LONG);
-    void AddCmd(AsmCmdName cmd, AsmMemory mem, RegisterName reg, CmdSize size = SIZE_LONG);
-    void AddCmd(AsmCmdName cmd, RegisterName reg, AsmMemory* mem, CmdSize size = SIZE_LONG);
-    void AddCmd(AsmCmdName cmd, RegisterName reg, AsmMemory mem, CmdSize size = SIZE_LONG);
-    void AddCmd(AsmCmdName cmd, AsmImmediate* src, AsmMemory* mem, CmdSize size = SIZE_LONG);
-    void AddCmd(AsmCmdName cmd, AsmStrImmediate str_imm, AsmMemory mem, CmdSize size = SIZE_LONG);
-    void AddCmd(AsmCmdName cmd, AsmIntImmediate int_imm, AsmMemory mem, CmdSize size = SIZE_LONG);
+    void AddCmd(AsmCmdName cmd, const AsmStrImmediate& src, RegisterName reg, CmdSize size = SIZE_LONG);
+    void AddCmd(AsmCmdName cmd, AsmIntImmediate src, RegisterName reg, CmdSize size = SIZE_LONG);
+    void AddCmd(AsmCmdName cmd, const AsmMemory& mem, RegisterName reg, CmdSize size = SIZE_LONG);
+    void AddCmd(AsmCmdName cmd, RegisterName reg, const AsmMemory& mem, CmdSize size = SIZE_LONG);
+    void AddCmd(AsmCmdName cmd, const AsmStrImmediate& str_imm, const AsmMemory& mem, CmdSize size = SIZE_LONG);
+    void AddCmd(AsmCmdName cmd, AsmIntImmediate int_imm, const AsmMemory& mem, CmdSize size = SIZE_LONG);
     void AddData(AsmData* new_data);
     AsmStrImmediate AddData(string label, string value, AsmDataType type = DATA_UNTYPED);
     AsmStrImmediate AddData(string label, unsigned size);
     AsmStrImmediate AddData(string value, AsmDataType type = DATA_UNTYPED);
     AsmStrImmediate AddData(unsigned size);
-    void AddLabel(AsmStrImmediate* label);
-    void AddLabel(AsmStrImmediate label);
+    void AddLabel(const AsmStrImmediate& label);
     void AddLabel(string label);
+    void AlignLoop();
     virtual void Print(ostream& o) const;
+    void Print(AsmWriter& o) const;
+    void Optimize(PeepholeOptimizer& optimizer);
+    void OmitFramePointer(FrameOmitter& omitter);
+    void PrintData(ostream& o) const;
+    void PrintData(AsmWriter& o) const;
+    static void PrintCommands(AsmWriter& o, const AsmChunk& chunk);
+    const AsmChunk& GetCommands() const;
+    const list<AsmData*>& GetData() const;
+    void FlushCommands(AsmChunk& res);
     void GenCallWriteForInt();
     void GenCallWriteForReal();
     void GenCallWriteForStr();
     void GenWriteNewLine();
+    void CopyMemory(RegisterName src, RegisterName dest, unsigned size);
     void PushMemory(unsigned size);
     void MoveToMemoryFromStack(unsigned size);
     void MoveMemory(unsigned size);
     void AddMainFunctionLabel();
+    void AddGlobalDeclaration(AsmStrImmediate label);
+};
+
+class AsmSink{
+public:
+    virtual ~AsmSink();
+    virtual void Emit(AsmChunk* chunk) = 0;
+    virtual void Finish() = 0;
+};
+
+class AsmStreamSink: public AsmSink{
+private:
+    AsmWriter output;
+public:
+    AsmStreamSink(ostream& output_);
+    virtual void Emit(AsmChunk* chunk);
+    virtual void Finish();
 };
 
 #endif
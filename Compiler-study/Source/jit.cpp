@@ -0,0 +1,622 @@
+#include "jit.h"
+#include "asm_writer.h"
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <fstream>
+#include <algorithm>
+
+#if defined(__linux__) && defined(__x86_64__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define JIT_SUPPORTED
+#endif
+
+enum X64Register{
+    X64_RAX = 0,
+    X64_RCX = 1,
+    X64_RDX = 2,
+    X64_RBX = 3,
+    X64_RSP = 4,
+    X64_RBP = 5,
+    X64_RSI = 6,
+    X64_RDI = 7,
+    X64_R12 = 12,
+    X64_R13 = 13,
+    X64_R14 = 14,
+    X64_R15 = 15
+};
+
+enum X64Opcode{
+    X64_CALL = 0xE8,
+    X64_JMP = 0xE9,
+    X64_JB = 0x0F82,
+    X64_JAE = 0x0F83,
+    X64_JE = 0x0F84,
+    X64_JNE = 0x0F85,
+    X64_JA = 0x0F87
+};
+
+static const char* const FAULT_MESSAGES[JIT_FAULT_COUNT] =
+{
+    "",
+    "memory access out of range",
+    "division by zero",
+    "stack overflow",
+    "invalid string"
+};
+
+static const unsigned JIT_NATIVE_STACK_SIZE = VM_STACK_SIZE * 2 + (1 << 20);
+
+struct JitState{
+    char* mem;
+    void* regs;
+    void* reg_end;
+    void* stack_top;
+    void* saved_rsp;
+    unsigned fp;
+    unsigned sp;
+    int fault;
+    AsmWriter* out;
+    const vector<string>* strings;
+};
+
+static void JitWrite(JitState* state, int kind, int value)
+{
+    switch (kind)
+    {
+        case VM_WRITE_INT:
+            state->out->WriteInt(value);
+        break;
+        case VM_WRITE_REAL:
+        {
+            float real;
+            char buf[64];
+            memcpy(&real, &value, sizeof(real));
+            state->out->Write(buf, sprintf(buf, "%f", (double)real));
+        }
+        break;
+        case VM_WRITE_STR:
+            state->out->Write((*state->strings)[value]);
+        break;
+        case VM_WRITE_LN:
+            state->out->Write('\n');
+        break;
+    }
+}
+
+//---JitCompiler---
+
+JitCompiler::JitCompiler(const VmCode& code_):
+    code(code_),
+    exit_stub(0),
+    mem_size(code_.globals_size + VM_STACK_SIZE)
+{
+}
+
+void JitCompiler::Byte(unsigned char value)
+{
+    text.push_back(value);
+}
+
+void JitCompiler::Long(int value)
+{
+    for (int i = 0; i < 4; ++i)
+        Byte((unsigned)value >> (i * 8) & 0xFF);
+}
+
+void JitCompiler::Quad(unsigned long long value)
+{
+    for (int i = 0; i < 8; ++i)
+        Byte(value >> (i * 8) & 0xFF);
+}
+
+void JitCompiler::Instr(unsigned prefix, bool wide, unsigned opcode, unsigned reg, unsigned base, int disp, int index)
+{
+    if (prefix) Byte(prefix);
+    unsigned rex = (wide ? 8 : 0) | (reg & 8 ? 4 : 0) | (index >= 0 && index & 8 ? 2 : 0) | (base & 8 ? 1 : 0);
+    if (rex) Byte(0x40 | rex);
+    if (opcode > 0xFF) Byte(opcode >> 8);
+    Byte(opcode & 0xFF);
+    unsigned mod = !disp && (base & 7) != X64_RBP ? 0 : (-128 <= disp && disp <= 127 ? 1 : 2);
+    if (index >= 0 || (base & 7) == X64_RSP)
+    {
+        Byte(mod << 6 | (reg & 7) << 3 | X64_RSP);
+        Byte((index >= 0 ? index & 7 : X64_RSP) << 3 | (base & 7));
+    }
+    else
+        Byte(mod << 6 | (reg & 7) << 3 | (base & 7));
+    if (mod == 1) Byte(disp);
+    else if (mod == 2) Long(disp);
+}
+
+void JitCompiler::RegReg(unsigned prefix, bool wide, unsigned opcode, unsigned reg, unsigned rm)
+{
+    if (prefix) Byte(prefix);
+    unsigned rex = (wide ? 8 : 0) | (reg & 8 ? 4 : 0) | (rm & 8 ? 1 : 0);
+    if (rex) Byte(0x40 | rex);
+    if (opcode > 0xFF) Byte(opcode >> 8);
+    Byte(opcode & 0xFF);
+    Byte(0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+void JitCompiler::RegImm(bool wide, unsigned digit, unsigned reg, int imm)
+{
+    unsigned rex = (wide ? 8 : 0) | (reg & 8 ? 1 : 0);
+    if (rex) Byte(0x40 | rex);
+    bool short_imm = -128 <= imm && imm <= 127;
+    Byte(short_imm ? 0x83 : 0x81);
+    Byte(0xC0 | digit << 3 | (reg & 7));
+    if (short_imm) Byte(imm);
+    else Long(imm);
+}
+
+void JitCompiler::LoadReg(unsigned reg, VmReg vm_reg)
+{
+    Instr(0, false, 0x8B, reg, X64_R13, vm_reg * 4);
+}
+
+void JitCompiler::StoreReg(unsigned reg, VmReg vm_reg)
+{
+    Instr(0, false, 0x89, reg, X64_R13, vm_reg * 4);
+}
+
+void JitCompiler::Jump(unsigned opcode, unsigned target)
+{
+    if (opcode > 0xFF) Byte(opcode >> 8);
+    Byte(opcode & 0xFF);
+    Long(target - (text.size() + 4));
+}
+
+void JitCompiler::JumpToCmd(unsigned opcode, int cmd)
+{
+    if (opcode > 0xFF) Byte(opcode >> 8);
+    Byte(opcode & 0xFF);
+    JitFixup fixup = { static_cast<unsigned>(text.size()), static_cast<unsigned>(cmd), false };
+    fixups.push_back(fixup);
+    Long(0);
+}
+
+void JitCompiler::JumpToFault(unsigned condition, JitFault fault)
+{
+    Jump(condition, fault_stubs[fault]);
+}
+
+void JitCompiler::CheckAddress(unsigned size)
+{
+    if (size > mem_size)
+    {
+        JumpToFault(X64_JMP, JIT_FAULT_MEMORY);
+        return;
+    }
+    RegImm(false, 7, X64_RAX, mem_size - size);
+    JumpToFault(X64_JA, JIT_FAULT_MEMORY);
+}
+
+void JitCompiler::CopyMemory(unsigned dest_index, unsigned src_index, unsigned size)
+{
+    static const unsigned CHUNK_OPCODES[] = { 0, 0x0F10, 0x0F10, 0x0F10 };
+    static const unsigned CHUNK_PREFIXES[] = { 0, 0xF3, 0xF2, 0 };
+    vector<unsigned> chunks;
+    for (unsigned rest = size; rest; )
+    {
+        unsigned chunk = rest >= 16 ? 16 : (rest >= 8 ? 8 : 4);
+        chunks.push_back(chunk);
+        rest -= chunk;
+    }
+    if (chunks.size() > 4)
+    {
+        Instr(0, true, 0x8D, X64_RDI, X64_R12, 0, dest_index);
+        Instr(0, true, 0x8D, X64_RSI, X64_R12, 0, src_index);
+        Byte(0xBA);
+        Long(size);
+        CallThunk((void*)&memmove);
+        return;
+    }
+    unsigned offset = 0;
+    for (unsigned i = 0; i < chunks.size(); offset += chunks[i++])
+    {
+        unsigned kind = chunks[i] == 16 ? 3 : chunks[i] / 4;
+        Instr(CHUNK_PREFIXES[kind], false, CHUNK_OPCODES[kind], i, X64_R12, offset, src_index);
+    }
+    offset = 0;
+    for (unsigned i = 0; i < chunks.size(); offset += chunks[i++])
+    {
+        unsigned kind = chunks[i] == 16 ? 3 : chunks[i] / 4;
+        Instr(CHUNK_PREFIXES[kind], false, CHUNK_OPCODES[kind] + 1, i, X64_R12, offset, dest_index);
+    }
+}
+
+void JitCompiler::CallThunk(void* thunk)
+{
+    Byte(0x48);
+    Byte(0xB8);
+    Quad((unsigned long long)(size_t)thunk);
+    Byte(0xFF);
+    Byte(0xD0);
+}
+
+void JitCompiler::EmitEntry()
+{
+    static const unsigned char SAVED[] = { X64_RBX, X64_RBP, X64_R12, X64_R13, X64_R14, X64_R15 };
+    for (unsigned i = 0; i < sizeof(SAVED); ++i)
+    {
+        if (SAVED[i] & 8) Byte(0x41);
+        Byte(0x50 | (SAVED[i] & 7));
+    }
+    RegImm(true, 5, X64_RSP, 8);
+    RegReg(0, true, 0x89, X64_RDI, X64_RBX);
+    Instr(0, true, 0x89, X64_RSP, X64_RBX, offsetof(JitState, saved_rsp));
+    Instr(0, true, 0x8B, X64_R12, X64_RBX, offsetof(JitState, mem));
+    Instr(0, true, 0x8B, X64_R13, X64_RBX, offsetof(JitState, regs));
+    Instr(0, false, 0x8B, X64_R14, X64_RBX, offsetof(JitState, fp));
+    Instr(0, false, 0x8B, X64_R15, X64_RBX, offsetof(JitState, sp));
+    Instr(0, true, 0x8D, X64_RBP, X64_R12, 0, X64_R14);
+    Instr(0, true, 0x8B, X64_RSP, X64_RBX, offsetof(JitState, stack_top));
+    Byte(X64_CALL);
+    JitFixup fixup = { static_cast<unsigned>(text.size()), static_cast<unsigned>(code.main_proc), true };
+    fixups.push_back(fixup);
+    Long(0);
+    exit_stub = text.size();
+    Instr(0, true, 0x8B, X64_RSP, X64_RBX, offsetof(JitState, saved_rsp));
+    RegImm(true, 0, X64_RSP, 8);
+    for (int i = sizeof(SAVED) - 1; i >= 0; --i)
+    {
+        if (SAVED[i] & 8) Byte(0x41);
+        Byte(0x58 | (SAVED[i] & 7));
+    }
+    Byte(0xC3);
+    fault_stubs[JIT_OK] = exit_stub;
+    for (int fault = JIT_OK + 1; fault < JIT_FAULT_COUNT; ++fault)
+    {
+        fault_stubs[fault] = text.size();
+        Instr(0, false, 0xC7, 0, X64_RBX, offsetof(JitState, fault));
+        Long(fault);
+        Jump(X64_JMP, exit_stub);
+    }
+}
+
+void JitCompiler::EmitProlog(const VmProc& proc, bool main)
+{
+    if (!main)
+    {
+        RegImm(false, 7, X64_R15, code.globals_size + 8 + proc.frame_size);
+        JumpToFault(X64_JB, JIT_FAULT_STACK);
+        Instr(0, true, 0x8D, X64_RAX, X64_R13, proc.regs * 4);
+        Instr(0, true, 0x3B, X64_RAX, X64_RBX, offsetof(JitState, reg_end));
+        JumpToFault(X64_JA, JIT_FAULT_STACK);
+    }
+    Byte(0x41);
+    Byte(0x50 | (X64_R14 & 7));
+    if (main) return;
+    Instr(0, false, 0x8D, X64_R14, X64_R15, -8);
+    Instr(0, false, 0x8D, X64_R15, X64_R14, -(int)proc.frame_size);
+    Instr(0, true, 0x8D, X64_RBP, X64_R12, 0, X64_R14);
+}
+
+void JitCompiler::EmitCmd(const VmCmd& cmd, const VmProc& proc)
+{
+    switch (cmd.op)
+    {
+        case VM_LOADI:
+            Instr(0, false, 0xC7, 0, X64_R13, cmd.a * 4);
+            Long(cmd.b);
+        break;
+        case VM_MOV:
+            LoadReg(X64_RAX, cmd.b);
+            StoreReg(X64_RAX, cmd.a);
+        break;
+        case VM_ADD: case VM_SUB: case VM_MUL: case VM_AND: case VM_OR: case VM_XOR:
+        {
+            static const unsigned OPCODES[] = { 0x03, 0x2B, 0x0FAF, 0, 0, 0x23, 0x0B, 0x33 };
+            LoadReg(X64_RAX, cmd.b);
+            Instr(0, false, OPCODES[cmd.op - VM_ADD], X64_RAX, X64_R13, cmd.c * 4);
+            StoreReg(X64_RAX, cmd.a);
+        }
+        break;
+        case VM_DIV: case VM_MOD:
+        {
+            LoadReg(X64_RAX, cmd.b);
+            LoadReg(X64_RCX, cmd.c);
+            RegReg(0, false, 0x85, X64_RCX, X64_RCX);
+            JumpToFault(X64_JE, JIT_FAULT_DIVISION);
+            RegImm(false, 7, X64_RCX, -1);
+            Byte(0x75);
+            Byte(0);
+            unsigned not_minus_one = text.size();
+            if (cmd.op == VM_DIV) RegReg(0, false, 0xF7, 3, X64_RAX);
+            else RegReg(0, false, 0x31, X64_RAX, X64_RAX);
+            Byte(0xEB);
+            Byte(0);
+            unsigned done = text.size();
+            text[not_minus_one - 1] = text.size() - not_minus_one;
+            Byte(0x99);
+            RegReg(0, false, 0xF7, 7, X64_RCX);
+            if (cmd.op == VM_MOD) RegReg(0, false, 0x89, X64_RDX, X64_RAX);
+            text[done - 1] = text.size() - done;
+            StoreReg(X64_RAX, cmd.a);
+        }
+        break;
+        case VM_SHL: case VM_SHR:
+            LoadReg(X64_RAX, cmd.b);
+            LoadReg(X64_RCX, cmd.c);
+            RegReg(0, false, 0xD3, cmd.op == VM_SHL ? 4 : 7, X64_RAX);
+            StoreReg(X64_RAX, cmd.a);
+        break;
+        case VM_EQ: case VM_NE: case VM_LT: case VM_LE: case VM_GT: case VM_GE:
+        {
+            static const unsigned SETCC[] = { 0x0F94, 0x0F95, 0x0F9C, 0x0F9E, 0x0F9F, 0x0F9D };
+            LoadReg(X64_RAX, cmd.b);
+            Instr(0, false, 0x3B, X64_RAX, X64_R13, cmd.c * 4);
+            RegReg(0, false, SETCC[cmd.op - VM_EQ], 0, X64_RAX);
+            RegReg(0, false, 0x0FB6, X64_RAX, X64_RAX);
+            StoreReg(X64_RAX, cmd.a);
+        }
+        break;
+        case VM_NOT:
+            LoadReg(X64_RAX, cmd.b);
+            RegReg(0, false, 0x85, X64_RAX, X64_RAX);
+            RegReg(0, false, 0x0F94, 0, X64_RAX);
+            RegReg(0, false, 0x0FB6, X64_RAX, X64_RAX);
+            StoreReg(X64_RAX, cmd.a);
+        break;
+        case VM_NEG:
+            LoadReg(X64_RAX, cmd.b);
+            RegReg(0, false, 0xF7, 3, X64_RAX);
+            StoreReg(X64_RAX, cmd.a);
+        break;
+        case VM_ADDI:
+            LoadReg(X64_RAX, cmd.b);
+            if (cmd.c) RegImm(false, 0, X64_RAX, cmd.c);
+            StoreReg(X64_RAX, cmd.a);
+        break;
+        case VM_MULI:
+            Instr(0, false, 0x69, X64_RAX, X64_R13, cmd.b * 4);
+            Long(cmd.c);
+            StoreReg(X64_RAX, cmd.a);
+        break;
+        case VM_FADD: case VM_FSUB: case VM_FMUL: case VM_FDIV:
+        {
+            static const unsigned OPCODES[] = { 0x0F58, 0x0F5C, 0x0F59, 0x0F5E };
+            Instr(0xF3, false, 0x0F10, 0, X64_R13, cmd.b * 4);
+            Instr(0xF3, false, OPCODES[cmd.op - VM_FADD], 0, X64_R13, cmd.c * 4);
+            Instr(0xF3, false, 0x0F11, 0, X64_R13, cmd.a * 4);
+        }
+        break;
+        case VM_FEQ: case VM_FNE: case VM_FLT: case VM_FLE: case VM_FGT: case VM_FGE:
+        {
+            // ucomiss reports unordered operands with the same flags as fcompp + sahf
+            static const unsigned SETCC[] = { 0x0F94, 0x0F95, 0x0F92, 0x0F96, 0x0F97, 0x0F93 };
+            Instr(0xF3, false, 0x0F10, 0, X64_R13, cmd.b * 4);
+            Instr(0, false, 0x0F2E, 0, X64_R13, cmd.c * 4);
+            RegReg(0, false, SETCC[cmd.op - VM_FEQ], 0, X64_RAX);
+            RegReg(0, false, 0x0FB6, X64_RAX, X64_RAX);
+            StoreReg(X64_RAX, cmd.a);
+        }
+        break;
+        case VM_FNEG:
+            LoadReg(X64_RAX, cmd.b);
+            RegImm(false, 6, X64_RAX, 0x80000000);
+            StoreReg(X64_RAX, cmd.a);
+        break;
+        case VM_ITOF:
+            Instr(0xF3, false, 0x0F2A, 0, X64_R13, cmd.b * 4);
+            Instr(0xF3, false, 0x0F11, 0, X64_R13, cmd.a * 4);
+        break;
+        case VM_LEA:
+            Instr(0, false, 0x8D, X64_RAX, X64_R14, cmd.b);
+            StoreReg(X64_RAX, cmd.a);
+        break;
+        case VM_LOAD:
+            LoadReg(X64_RAX, cmd.b);
+            if (cmd.c) RegImm(false, 0, X64_RAX, cmd.c);
+            CheckAddress(4);
+            Instr(0, false, 0x8B, X64_RAX, X64_R12, 0, X64_RAX);
+            StoreReg(X64_RAX, cmd.a);
+        break;
+        case VM_STORE:
+            LoadReg(X64_RAX, cmd.b);
+            if (cmd.c) RegImm(false, 0, X64_RAX, cmd.c);
+            CheckAddress(4);
+            LoadReg(X64_RCX, cmd.a);
+            Instr(0, false, 0x89, X64_RCX, X64_R12, 0, X64_RAX);
+        break;
+        case VM_LOAD_FP:
+            Instr(0, false, 0x8B, X64_RAX, X64_RBP, cmd.b);
+            StoreReg(X64_RAX, cmd.a);
+        break;
+        case VM_STORE_FP:
+            LoadReg(X64_RAX, cmd.a);
+            Instr(0, false, 0x89, X64_RAX, X64_RBP, cmd.b);
+        break;
+        case VM_LOAD_ABS:
+            if ((unsigned)cmd.b > mem_size - 4)
+            {
+                JumpToFault(X64_JMP, JIT_FAULT_MEMORY);
+                break;
+            }
+            Instr(0, false, 0x8B, X64_RAX, X64_R12, cmd.b);
+            StoreReg(X64_RAX, cmd.a);
+        break;
+        case VM_STORE_ABS:
+            if ((unsigned)cmd.b > mem_size - 4)
+            {
+                JumpToFault(X64_JMP, JIT_FAULT_MEMORY);
+                break;
+            }
+            LoadReg(X64_RAX, cmd.a);
+            Instr(0, false, 0x89, X64_RAX, X64_R12, cmd.b);
+        break;
+        case VM_COPY:
+            LoadReg(X64_RAX, cmd.a);
+            CheckAddress(cmd.c);
+            RegReg(0, false, 0x89, X64_RAX, X64_RDX);
+            LoadReg(X64_RAX, cmd.b);
+            CheckAddress(cmd.c);
+            CopyMemory(X64_RDX, X64_RAX, cmd.c);
+        break;
+        case VM_JMP:
+            JumpToCmd(X64_JMP, cmd.b);
+        break;
+        case VM_JZ: case VM_JNZ:
+            Instr(0, false, 0x83, 7, X64_R13, cmd.a * 4);
+            Byte(0);
+            JumpToCmd(cmd.op == VM_JZ ? X64_JE : X64_JNE, cmd.b);
+        break;
+        case VM_PUSH:
+            RegImm(false, 7, X64_R15, code.globals_size + 4);
+            JumpToFault(X64_JB, JIT_FAULT_STACK);
+            RegImm(false, 5, X64_R15, 4);
+            LoadReg(X64_RAX, cmd.a);
+            Instr(0, false, 0x89, X64_RAX, X64_R12, 0, X64_R15);
+        break;
+        case VM_PUSHN:
+            RegImm(false, 7, X64_R15, code.globals_size + cmd.c);
+            JumpToFault(X64_JB, JIT_FAULT_STACK);
+            LoadReg(X64_RAX, cmd.a);
+            CheckAddress(cmd.c);
+            RegImm(false, 5, X64_R15, cmd.c);
+            CopyMemory(X64_R15, X64_RAX, cmd.c);
+        break;
+        case VM_RESERVE:
+            RegImm(false, 7, X64_R15, code.globals_size + cmd.b);
+            JumpToFault(X64_JB, JIT_FAULT_STACK);
+            RegImm(false, 5, X64_R15, cmd.b);
+        break;
+        case VM_POP:
+            Instr(0, false, 0x8B, X64_RAX, X64_R12, 0, X64_R15);
+            StoreReg(X64_RAX, cmd.a);
+            RegImm(false, 0, X64_R15, 4);
+        break;
+        case VM_POPN:
+            LoadReg(X64_RAX, cmd.a);
+            CheckAddress(cmd.c);
+            CopyMemory(X64_RAX, X64_R15, cmd.c);
+            RegImm(false, 0, X64_R15, cmd.c);
+        break;
+        case VM_CALL:
+        {
+            if (proc.regs) RegImm(true, 0, X64_R13, proc.regs * 4);
+            Byte(X64_CALL);
+            JitFixup fixup = { static_cast<unsigned>(text.size()), static_cast<unsigned>(cmd.b), true };
+            fixups.push_back(fixup);
+            Long(0);
+            if (proc.regs) RegImm(true, 5, X64_R13, proc.regs * 4);
+        }
+        break;
+        case VM_RET:
+            Instr(0, false, 0x8D, X64_R15, X64_R14, 8 + proc.ret_pop);
+            Byte(0x41);
+            Byte(0x58 | (X64_R14 & 7));
+            Instr(0, true, 0x8D, X64_RBP, X64_R12, 0, X64_R14);
+            Byte(0xC3);
+        break;
+        case VM_HALT:
+            Jump(X64_JMP, exit_stub);
+        break;
+        case VM_WRITE_STR:
+            LoadReg(X64_RDX, cmd.a);
+            RegImm(false, 7, X64_RDX, code.strings.size());
+            JumpToFault(X64_JAE, JIT_FAULT_STRING);
+            [[fallthrough]];
+        case VM_WRITE_INT: case VM_WRITE_REAL: case VM_WRITE_LN:
+            RegReg(0, true, 0x89, X64_RBX, X64_RDI);
+            Byte(0xB8 | X64_RSI);
+            Long(cmd.op);
+            if (cmd.op != VM_WRITE_LN) LoadReg(X64_RDX, cmd.a);
+            CallThunk((void*)&JitWrite);
+        break;
+        default:
+            throw CompilerException("JIT can't compile instruction");
+    }
+}
+
+void JitCompiler::Compile()
+{
+    vector<int> proc_at(code.commands.size(), -1);
+    for (unsigned i = 0; i < code.procs.size(); ++i)
+        if (code.procs[i].entry >= 0) proc_at[code.procs[i].entry] = i;
+    EmitEntry();
+    cmd_offsets.resize(code.commands.size());
+    proc_offsets.resize(code.procs.size());
+    int current = -1;
+    for (unsigned i = 0; i < code.commands.size(); ++i)
+    {
+        if (proc_at[i] >= 0)
+        {
+            current = proc_at[i];
+            proc_offsets[current] = text.size();
+            EmitProlog(code.procs[current], current == code.main_proc);
+        }
+        cmd_offsets[i] = text.size();
+        EmitCmd(code.commands[i], code.procs[current]);
+    }
+    for (vector<JitFixup>::const_iterator it = fixups.begin(); it != fixups.end(); ++it)
+    {
+        unsigned target = it->to_proc ? proc_offsets[it->target] : cmd_offsets[it->target];
+        unsigned rel = target - (it->offset + 4);
+        for (int i = 0; i < 4; ++i)
+            text[it->offset + i] = rel >> (i * 8) & 0xFF;
+    }
+}
+
+void JitCompiler::WritePerfMap(const unsigned char* base) const
+{
+#ifdef JIT_SUPPORTED
+    char name[64];
+    sprintf(name, "/tmp/perf-%d.map", (int)getpid());
+    ofstream map(name, ios::out | ios::app);
+    if (!map.good()) return;
+    vector<pair<unsigned, string> > symbols;
+    symbols.push_back(make_pair(0u, string("jit_entry")));
+    for (unsigned i = 0; i < code.procs.size(); ++i)
+        if (code.procs[i].entry >= 0) symbols.push_back(make_pair(proc_offsets[i], code.procs[i].name));
+    sort(symbols.begin(), symbols.end());
+    for (unsigned i = 0; i < symbols.size(); ++i)
+    {
+        unsigned end = i + 1 < symbols.size() ? symbols[i + 1].first : text.size();
+        map << hex << (size_t)(base + symbols[i].first) << ' ' << end - symbols[i].first << dec
+            << ' ' << symbols[i].second << '\n';
+    }
+#endif
+}
+
+void JitCompiler::Run(ostream& o)
+{
+#ifdef JIT_SUPPORTED
+    const VmProc& main = code.procs[code.main_proc];
+    if (main.regs > VM_REGISTERS || main.frame_size > VM_STACK_SIZE)
+        throw CompilerException(string("runtime error: ") + FAULT_MESSAGES[JIT_FAULT_STACK]);
+    Compile();
+    size_t size = text.size();
+    void* buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED) throw CompilerException("can't allocate executable memory");
+    memcpy(buf, &text[0], size);
+    if (mprotect(buf, size, PROT_READ | PROT_EXEC))
+    {
+        munmap(buf, size);
+        throw CompilerException("can't allocate executable memory");
+    }
+    WritePerfMap((const unsigned char*)buf);
+    vector<char> memory(mem_size);
+    vector<int> regs(VM_REGISTERS);
+    vector<char> native_stack(JIT_NATIVE_STACK_SIZE);
+    AsmWriter out(o);
+    JitState state;
+    state.mem = &memory[0];
+    state.regs = &regs[0];
+    state.reg_end = &regs[0] + regs.size();
+    state.stack_top = (void*)((size_t)(&native_stack[0] + native_stack.size()) & ~(size_t)15);
+    state.saved_rsp = NULL;
+    state.fp = mem_size;
+    state.sp = mem_size - main.frame_size;
+    state.fault = JIT_OK;
+    state.out = &out;
+    state.strings = &code.strings;
+    ((void (*)(JitState*))buf)(&state);
+    munmap(buf, size);
+    if (state.fault != JIT_OK) throw CompilerException(string("runtime error: ") + FAULT_MESSAGES[state.fault]);
+#else
+    throw CompilerException("JIT is only supported on x86-64 Linux");
+#endif
+}
@@ -0,0 +1,59 @@
+#ifndef JIT
+#define JIT
+
+#include "vm.h"
+#include "exception.h"
+#include <vector>
+#include <string>
+#include <ostream>
+using namespace std;
+
+enum JitFault{
+    JIT_OK,
+    JIT_FAULT_MEMORY,
+    JIT_FAULT_DIVISION,
+    JIT_FAULT_STACK,
+    JIT_FAULT_STRING,
+    JIT_FAULT_COUNT
+};
+
+class JitCompiler{
+private:
+    struct JitFixup{
+        unsigned offset;
+        unsigned target;
+        bool to_proc;
+    };
+    const VmCode& code;
+    vector<unsigned char> text;
+    vector<unsigned> cmd_offsets;
+    vector<unsigned> proc_offsets;
+    vector<JitFixup> fixups;
+    unsigned fault_stubs[JIT_FAULT_COUNT];
+    unsigned exit_stub;
+    unsigned mem_size;
+    void Byte(unsigned char value);
+    void Long(int value);
+    void Quad(unsigned long long value);
+    void Instr(unsigned prefix, bool wide, unsigned opcode, unsigned reg, unsigned base, int disp, int index = -1);
+    void RegReg(unsigned prefix, bool wide, unsigned opcode, unsigned reg, unsigned rm);
+    void RegImm(bool wide, unsigned digit, unsigned reg, int imm);
+    void LoadReg(unsigned reg, VmReg vm_reg);
+    void StoreReg(unsigned reg, VmReg vm_reg);
+    void Jump(unsigned opcode, unsigned target);
+    void JumpToCmd(unsigned opcode, int cmd);
+    void JumpToFault(unsigned condition, JitFault fault);
+    void CheckAddress(unsigned size);
+    void CopyMemory(unsigned dest_index, unsigned src_index, unsigned size);
+    void CallThunk(void* thunk);
+    void EmitEntry();
+    void EmitProlog(const VmProc& proc, bool main);
+    void EmitCmd(const VmCmd& cmd, const VmProc& proc);
+    void Compile();
+    void WritePerfMap(const unsigned char* base) const;
+public:
+    JitCompiler(const VmCode& code_);
+    void Run(ostream& o);
+};
+
+#endif
@@ -6,25 +6,142 @@
 #include <sstream>
 #include <string.h>
 #include "exception.h"
+#include "token_buffer.h"
+#include "watcher.h"
+#include "pipeline.h"
 
 void PrintHelp()
 {
-    cout << "Usage: compiler [option] filename\n\
+    cout << "Usage: compiler option [--watch] [--pipeline] [--stream] [--threads=N] [--sse] [--omit-frame-pointer] [--reg-results] [--stats] filename\n\
 Avaible options are:\n\
 \n\
 optimization off\n\
 \t-b\tprint Both syntax tree and symtable\n\
+\t-c\tCompile straight into ELF32 object file <file>.o\n\
 \t-h\tshow this message\n\
 \t-g\tGenerate code for x86_32 GNU assembler\n\
+\t-g64\tGenerate code for x86_64 GNU assembler (System V calling convention)\n\
+\t-j\tJust-in-time compile program to x86-64 and run it, writes /tmp/perf-<pid>.map\n\
 \t-l\tshow Lexems stream\n\
+\t-r\tRun program on the bytecode virtual machine\n\
 \t-s\tprint Syntax tree\n\
 \t-t\tprint symTable\n\
 \n\
 optimization on\n\
 \t-B\tprint Both syntax tree and symtable\n\
+\t-C\tCompile straight into ELF32 object file <file>.o\n\
 \t-G\tGenerate code for x86_32 GNU assembler\n\
+\t-G64\tGenerate code for x86_64 GNU assembler (System V calling convention)\n\
+\t-J\tJust-in-time compile program to x86-64 and run it, writes /tmp/perf-<pid>.map\n\
+\t-R\tRun program on the bytecode virtual machine\n\
 \t-S\tprint Syntax tree\n\
-\t-T\tprint symTable\n";
+\t-T\tprint symTable\n\
+\n\
+\t--watch\twith -g/-G stay resident and recompile on every save\n\
+\t--pipeline\twith -g/-G scan, parse and emit on concurrent threads\n\
+\t--stream\twith -g/-G emit and free every procedure as soon as it is parsed\n\
+\t--threads=N\twith -g/-G/-c/-C generate procedures on N threads, output doesn't depend on N\n\
+\t--sse\twith -g/-G compute reals in SSE registers instead of the x87 stack, always on for -g64/-G64\n\
+\t--omit-frame-pointer\twith -g/-G address the frame off %esp where the stack depth is static, emit .cfi unwind info\n\
+\t--reg-results\twith -g/-G return Integer results in %eax and Real results in %st0 (%xmm0 with --sse) instead of a caller-reserved slot\n\
+\t--stats\twith -G/-G64/-C print peephole optimizer rule hits to stderr\n\
+\n\
+-g/-G/-c/-C on a unit also writes its interface file <unit>.itf next to the source\n";
+}
+
+string ReadFile(const char* file_name)
+{
+    ifstream in(file_name, ios::in | ios::binary);
+    if (!in.good()) throw CompilerException("can't open file");
+    stringstream s;
+    s << in.rdbuf();
+    return s.str();
+}
+
+string GetUnitDir(const char* file_name)
+{
+    string name(file_name);
+    size_t pos = name.find_last_of("/\\");
+    return pos == string::npos ? "" : name.substr(0, pos + 1);
+}
+
+string GetObjectName(const char* file_name)
+{
+    string name(file_name);
+    size_t pos = name.find_last_of("./\\");
+    if (pos != string::npos && name[pos] == '.') name.erase(pos);
+    return name + ".o";
+}
+
+void GenerateInterface(Parser& parser, const string& unit_dir)
+{
+    if (!parser.IsUnit()) return;
+    stringstream s;
+    parser.GenerateInterface(s);
+    string itf_name = unit_dir + parser.GetUnitName() + ".itf";
+    ofstream itf(itf_name.c_str(), ios::out | ios::binary);
+    if (!itf.good()) throw CompilerException("can't create file " + itf_name);
+    itf << s.str();
+}
+
+void CompileToObject(istream& in, const char* file_name, bool optimize, unsigned threads, bool stats)
+{
+    Scanner scan(in);
+    Parser parser(scan, optimize, GetUnitDir(file_name));
+    stringstream s;
+    parser.GenerateObject(s, threads);
+    string obj_name = GetObjectName(file_name);
+    ofstream obj(obj_name.c_str(), ios::out | ios::binary);
+    if (!obj.good()) throw CompilerException("can't create file " + obj_name);
+    obj << s.str();
+    if (stats) parser.PrintPeepholeStats(cerr);
+    GenerateInterface(parser, GetUnitDir(file_name));
+}
+
+void WatchAndGenerate(const char* file_name, bool optimize, unsigned threads, AsmTarget target, bool sse, bool fpo,
+                      bool reg_results)
+{
+    FileWatcher watcher(file_name);
+    TokenBuffer tokens;
+    while (true)
+    {
+        try
+        {
+            tokens.Update(ReadFile(file_name));
+            cerr << "relexed " << tokens.GetRelexedCount() << " of " << tokens.GetSize() << " tokens\n";
+            Parser parser(tokens, optimize, GetUnitDir(file_name), NULL, target, sse, fpo, reg_results);
+            parser.Generate(std::cout, threads);
+            GenerateInterface(parser, GetUnitDir(file_name));
+        }
+        catch (CompilerException& e)
+        {
+            cout << e.what() << endl;
+        }
+        cout.flush();
+        watcher.WaitForChange();
+    }
+}
+
+void PipelineAndGenerate(istream& in, bool optimize, const string& unit_dir, AsmTarget target, bool sse, bool fpo,
+                         bool reg_results, bool stats)
+{
+    ScannerStage scan(in);
+    EmitterStage emitter(std::cout);
+    Parser parser(scan, optimize, unit_dir, &emitter, target, sse, fpo, reg_results);
+    parser.Generate(std::cout);
+    if (stats) parser.PrintPeepholeStats(cerr);
+    GenerateInterface(parser, unit_dir);
+}
+
+void StreamAndGenerate(istream& in, bool optimize, const string& unit_dir, AsmTarget target, bool sse, bool fpo,
+                       bool reg_results, bool stats)
+{
+    Scanner scan(in);
+    AsmStreamSink sink(std::cout);
+    Parser parser(scan, optimize, unit_dir, &sink, target, sse, fpo, reg_results);
+    parser.Generate(std::cout);
+    if (stats) parser.PrintPeepholeStats(cerr);
+    GenerateInterface(parser, unit_dir);
 }
 
 int main(int argc, char* argv[])
@@ -36,7 +153,6 @@ int main(int argc, char* argv[])
     }
     try
     {
-        if (argc > 3) throw CompilerException("too many parametrs");
         if (argc == 2)
         {
             if (argv[1][1] == 'h')
@@ -49,21 +165,64 @@ int main(int argc, char* argv[])
             else
                 throw CompilerException("uncknown option");
         }
+        bool watch = false;
+        bool pipeline = false;
+        bool stream = false;
+        bool sse = false;
+        bool fpo = false;
+        bool reg_results = false;
+        bool stats = false;
+        int threads = 1;
+        for (int i = 2; i < argc - 1; ++i)
+        {
+            if (!strcmp(argv[i], "--watch")) watch = true;
+            else if (!strcmp(argv[i], "--pipeline")) pipeline = true;
+            else if (!strcmp(argv[i], "--stream")) stream = true;
+            else if (!strcmp(argv[i], "--sse")) sse = true;
+            else if (!strcmp(argv[i], "--omit-frame-pointer")) fpo = true;
+            else if (!strcmp(argv[i], "--reg-results")) reg_results = true;
+            else if (!strcmp(argv[i], "--stats")) stats = true;
+            else if (!strncmp(argv[i], "--threads=", 10))
+            {
+                threads = atoi(argv[i] + 10);
+                if (threads < 1) throw CompilerException("invalid thread count");
+            }
+            else throw CompilerException("uncknown option");
+        }
+        const char* file_name = argv[argc - 1];
+        string unit_dir = GetUnitDir(file_name);
         ifstream in;
-        in.open(argv[2], ios::in);
+        in.open(file_name, ios::in);
         if (!in.good()) throw CompilerException("can't open file");
         if (argv[1][0] != '-')
             throw CompilerException("invalid option");
         else
             {
-                if (!argv[1][1] || argv[1][2]) throw CompilerException("invalid option");
+                AsmTarget target = TARGET_X86;
+                if (tolower(argv[1][1]) == 'g' && !strcmp(argv[1] + 2, "64")) target = TARGET_X86_64;
+                else if (!argv[1][1] || argv[1][2]) throw CompilerException("invalid option");
                 bool optimize = isupper(argv[1][1]);
+                if (watch && tolower(argv[1][1]) != 'g') throw CompilerException("--watch requires -g or -G");
+                if (pipeline && tolower(argv[1][1]) != 'g') throw CompilerException("--pipeline requires -g or -G");
+                if (pipeline && watch) throw CompilerException("--pipeline can't be combined with --watch");
+                if (stream && tolower(argv[1][1]) != 'g') throw CompilerException("--stream requires -g or -G");
+                if (stream && (watch || pipeline)) throw CompilerException("--stream can't be combined with --watch or --pipeline");
+                if (threads > 1 && tolower(argv[1][1]) != 'g' && tolower(argv[1][1]) != 'c')
+                    throw CompilerException("--threads requires -g, -G, -c or -C");
+                if (sse && tolower(argv[1][1]) != 'g') throw CompilerException("--sse requires -g or -G");
+                if (fpo && (tolower(argv[1][1]) != 'g' || target != TARGET_X86))
+                    throw CompilerException("--omit-frame-pointer requires -g or -G");
+                if (reg_results && (tolower(argv[1][1]) != 'g' || target != TARGET_X86))
+                    throw CompilerException("--reg-results requires -g or -G");
+                if (stats && ((argv[1][1] != 'G' && argv[1][1] != 'C') || watch))
+                    throw CompilerException("--stats requires -G, -G64 or -C and can't be combined with --watch");
+                if (threads > 1 && (pipeline || stream)) throw CompilerException("--threads can't be combined with --pipeline or --stream");
                 switch (tolower(argv[1][1]))
                 {
                     case 'b':
                     {
                         Scanner scan(in);
-                        Parser parser(scan, optimize);
+                        Parser parser(scan, optimize, unit_dir);
                         parser.PrintSymTable(std::cout);
                         parser.PrintSyntaxTree(std::cout);
                     }
@@ -71,22 +230,56 @@ int main(int argc, char* argv[])
                     case 's':
                     {
                         Scanner scan(in);
-                        Parser parser(scan, optimize);
+                        Parser parser(scan, optimize, unit_dir);
                         parser.PrintSyntaxTree(std::cout);
                     }
                     break;
                     case 't':
                     {
                         Scanner scan(in);
-                        Parser parser(scan, optimize);
+                        Parser parser(scan, optimize, unit_dir);
                         parser.PrintSymTable(std::cout);
                     }
                     break;
                     case 'g':
+                    {
+                        if (watch)
+                        {
+                            in.close();
+                            WatchAndGenerate(file_name, optimize, threads, target, sse, fpo, reg_results);
+                        }
+                        if (pipeline)
+                        {
+                            PipelineAndGenerate(in, optimize, unit_dir, target, sse, fpo, reg_results, stats);
+                            break;
+                        }
+                        if (stream)
+                        {
+                            StreamAndGenerate(in, optimize, unit_dir, target, sse, fpo, reg_results, stats);
+                            break;
+                        }
+                        Scanner scan(in);
+                        Parser parser(scan, optimize, unit_dir, NULL, target, sse, fpo, reg_results);
+                        parser.Generate(std::cout, threads);
+                        if (stats) parser.PrintPeepholeStats(cerr);
+                        GenerateInterface(parser, unit_dir);
+                    }
+                    break;
+                    case 'c':
+                        CompileToObject(in, file_name, optimize, threads, stats);
+                    break;
+                    case 'r':
+                    {
+                        Scanner scan(in);
+                        Parser parser(scan, optimize, unit_dir);
+                        parser.Run(std::cout);
+                    }
+                    break;
+                    case 'j':
                     {
                         Scanner scan(in);
-                        Parser parser(scan, optimize);
-                        parser.Generate(std::cout);
+                        Parser parser(scan, optimize, unit_dir);
+                        parser.RunJit(std::cout);
                     }
                     break;
                     case 'l':
@@ -0,0 +1,1030 @@
+#include "object_file.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const unsigned char REG_CODE[] =
+{
+    0, 3, 1, 2, 4, 7, 5, 6,
+    0, 3, 1, 2, 7, 6,
+    0, 3, 1, 2, 7, 6, 5, 4,
+    0, 0, 1, 2, 3, 4, 5, 6, 7
+};
+
+static unsigned RegWidth(RegisterName reg)
+{
+    if (reg <= REG_DH) return 8;
+    if (reg <= REG_SI) return 16;
+    if (reg <= REG_ESP) return 32;
+    return 0;
+}
+
+static bool IsByte(int value)
+{
+    return value >= -128 && value <= 127;
+}
+
+static bool IsFpuReg(const AsmOperand& oper)
+{
+    return oper.type == OPER_REGISTER && oper.reg >= REG_ST && oper.reg <= REG_ST7;
+}
+
+static bool IsIntReg(const AsmOperand& oper)
+{
+    return oper.type == OPER_REGISTER && oper.reg < REG_ST;
+}
+
+static bool IsRegOrMem(const AsmOperand& oper)
+{
+    return IsIntReg(oper) || oper.type == OPER_MEMORY;
+}
+
+static bool IsImmediate(const AsmOperand& oper)
+{
+    return oper.type == OPER_INT || oper.type == OPER_LABEL;
+}
+
+static bool IsAbsolute(const AsmOperand& oper)
+{
+    return oper.type == OPER_MEMORY && oper.mem.base_type != OPER_REGISTER && !oper.mem.index && !oper.mem.scale;
+}
+
+static const unsigned char SCALE_CODE[] = { 0, 0, 1, 0, 2, 0, 0, 0, 3 };
+
+static const unsigned char NOP_FILL[][7] =
+{
+    { 0x90 },
+    { 0x66, 0x90 },
+    { 0x8D, 0x76, 0x00 },
+    { 0x8D, 0x74, 0x26, 0x00 },
+    { 0x8D, 0x74, 0x26, 0x00, 0x90 },
+    { 0x8D, 0xB6, 0x00, 0x00, 0x00, 0x00 },
+    { 0x8D, 0xB4, 0x26, 0x00, 0x00, 0x00, 0x00 }
+};
+
+static void PutNops(vector<unsigned char>& buf, unsigned count)
+{
+    for (unsigned n; count; count -= n)
+    {
+        n = count < 7 ? count : 7;
+        buf.insert(buf.end(), NOP_FILL[n - 1], NOP_FILL[n - 1] + n);
+    }
+}
+
+static void PutWord(vector<unsigned char>& buf, unsigned value)
+{
+    buf.push_back(value & 0xFF);
+    buf.push_back((value >> 8) & 0xFF);
+}
+
+static void PutLong(vector<unsigned char>& buf, unsigned value)
+{
+    PutWord(buf, value & 0xFFFF);
+    PutWord(buf, value >> 16);
+}
+
+static unsigned GetLong(const vector<unsigned char>& buf, unsigned pos)
+{
+    return buf[pos] | buf[pos + 1] << 8 | buf[pos + 2] << 16 | (unsigned)buf[pos + 3] << 24;
+}
+
+static void SetLong(vector<unsigned char>& buf, unsigned pos, unsigned value)
+{
+    for (int i = 0; i < 4; ++i, value >>= 8)
+        buf[pos + i] = value & 0xFF;
+}
+
+static void PutString(vector<unsigned char>& buf, const string& str)
+{
+    string value = UnescapeAsmString(str);
+    buf.insert(buf.end(), value.begin(), value.end());
+    buf.push_back(0);
+}
+
+static string Trim(const string& str)
+{
+    size_t begin = str.find_first_not_of(" \t\r");
+    if (begin == string::npos) return "";
+    return str.substr(begin, str.find_last_not_of(" \t\r") - begin + 1);
+}
+
+//---X86Encoder---
+
+X86Encoder::X86Encoder(vector<unsigned char>& out_, vector<X86Fixup>& fixups_):
+    out(out_),
+    fixups(fixups_)
+{
+}
+
+void X86Encoder::Fail(const AsmCmd& cmd) const
+{
+    throw CompilerException("can't encode instruction " + ASM_CMD_TO_STR[cmd.command] + SIZE_TO_STR[cmd.size]);
+}
+
+void X86Encoder::Byte(unsigned char value)
+{
+    out.push_back(value);
+}
+
+void X86Encoder::Word(int value)
+{
+    PutWord(out, value);
+}
+
+void X86Encoder::Long(int value)
+{
+    PutLong(out, value);
+}
+
+void X86Encoder::Label(unsigned label, int addend, bool pc_relative)
+{
+    X86Fixup fixup = { static_cast<unsigned>(out.size()), label, pc_relative };
+    fixups.push_back(fixup);
+    Long(addend);
+}
+
+void X86Encoder::Immediate(const AsmOperand& oper, unsigned width)
+{
+    if (oper.type == OPER_LABEL)
+    {
+        if (width != 32) throw CompilerException("label doesn't fit into immediate");
+        Label(oper.label, 0, false);
+    }
+    else if (width == 8) Byte(oper.value);
+    else if (width == 16) Word(oper.value);
+    else Long(oper.value);
+}
+
+void X86Encoder::Address(const AsmAddress& mem)
+{
+    if (mem.base_type == OPER_LABEL) Label(mem.base, mem.disp, false);
+    else Long(mem.base + mem.disp);
+}
+
+void X86Encoder::ModRM(unsigned reg, const AsmOperand& rm)
+{
+    if (rm.type == OPER_REGISTER)
+    {
+        Byte(0xC0 | reg << 3 | REG_CODE[rm.reg]);
+        return;
+    }
+    const AsmAddress& mem = rm.mem;
+    if (rm.type != OPER_MEMORY || (mem.index && !mem.scale))
+        throw CompilerException("can't encode address");
+    unsigned sib = 0x24;
+    if (mem.scale)
+    {
+        RegisterName index = (RegisterName)mem.index;
+        if (RegWidth(index) != 32 || REG_CODE[index] == 4) throw CompilerException("can't encode address");
+        sib = SCALE_CODE[mem.scale] << 6 | REG_CODE[index] << 3;
+    }
+    if (mem.base_type != OPER_REGISTER)
+    {
+        if (mem.scale)
+        {
+            Byte(0x04 | reg << 3);
+            Byte(sib | 5);
+        }
+        else
+            Byte(0x05 | reg << 3);
+        Address(mem);
+        return;
+    }
+    if (RegWidth((RegisterName)mem.base) != 32) throw CompilerException("can't encode address");
+    unsigned base = REG_CODE[mem.base];
+    unsigned mod = mem.disp == 0 && base != 5 ? 0 : IsByte(mem.disp) ? 1 : 2;
+    Byte(mod << 6 | reg << 3 | (mem.scale ? 4 : base));
+    if (mem.scale) Byte(sib | base);
+    else if (base == 4) Byte(0x24);
+    if (mod == 1) Byte(mem.disp);
+    else if (mod == 2) Long(mem.disp);
+}
+
+unsigned X86Encoder::OperandWidth(const AsmCmd& cmd) const
+{
+    switch (cmd.size)
+    {
+        case SIZE_BYTE: return 8;
+        case SIZE_WORD: return 16;
+        case SIZE_LONG: return 32;
+        case SIZE_NONE:
+            for (int i = 1; i >= 0; --i)
+                if (IsIntReg(cmd.oper[i])) return RegWidth(cmd.oper[i].reg);
+            return 32;
+        default:
+            Fail(cmd);
+    }
+    return 0;
+}
+
+void X86Encoder::OperandPrefix(unsigned width)
+{
+    if (width == 16) Byte(0x66);
+}
+
+void X86Encoder::EncodeAlu(const AsmCmd& cmd, unsigned digit)
+{
+    const AsmOperand& src = cmd.oper[0];
+    const AsmOperand& dest = cmd.oper[1];
+    unsigned width = OperandWidth(cmd);
+    unsigned char w = width == 8 ? 0 : 1;
+    OperandPrefix(width);
+    if (IsIntReg(src) && IsRegOrMem(dest))
+    {
+        Byte(digit * 8 + w);
+        ModRM(REG_CODE[src.reg], dest);
+    }
+    else if (src.type == OPER_MEMORY && IsIntReg(dest))
+    {
+        Byte(digit * 8 + 2 + w);
+        ModRM(REG_CODE[dest.reg], src);
+    }
+    else if (IsImmediate(src) && IsRegOrMem(dest))
+    {
+        bool to_acc = dest.type == OPER_REGISTER && REG_CODE[dest.reg] == 0;
+        if (width == 8)
+        {
+            if (to_acc) Byte(digit * 8 + 4);
+            else
+            {
+                Byte(0x80);
+                ModRM(digit, dest);
+            }
+            Immediate(src, 8);
+        }
+        else if (src.type == OPER_INT && IsByte(src.value))
+        {
+            Byte(0x83);
+            ModRM(digit, dest);
+            Byte(src.value);
+        }
+        else
+        {
+            if (to_acc) Byte(digit * 8 + 5);
+            else
+            {
+                Byte(0x81);
+                ModRM(digit, dest);
+            }
+            Immediate(src, width);
+        }
+    }
+    else Fail(cmd);
+}
+
+void X86Encoder::EncodeMov(const AsmCmd& cmd)
+{
+    const AsmOperand& src = cmd.oper[0];
+    const AsmOperand& dest = cmd.oper[1];
+    unsigned width = OperandWidth(cmd);
+    unsigned char w = width == 8 ? 0 : 1;
+    OperandPrefix(width);
+    if (IsIntReg(src) && IsAbsolute(dest) && REG_CODE[src.reg] == 0)
+    {
+        Byte(0xA2 + w);
+        Address(dest.mem);
+    }
+    else if (IsIntReg(src) && IsRegOrMem(dest))
+    {
+        Byte(0x88 + w);
+        ModRM(REG_CODE[src.reg], dest);
+    }
+    else if (IsAbsolute(src) && IsIntReg(dest) && REG_CODE[dest.reg] == 0)
+    {
+        Byte(0xA0 + w);
+        Address(src.mem);
+    }
+    else if (src.type == OPER_MEMORY && IsIntReg(dest))
+    {
+        Byte(0x8A + w);
+        ModRM(REG_CODE[dest.reg], src);
+    }
+    else if (IsImmediate(src) && IsIntReg(dest))
+    {
+        Byte((width == 8 ? 0xB0 : 0xB8) + REG_CODE[dest.reg]);
+        Immediate(src, width);
+    }
+    else if (IsImmediate(src) && dest.type == OPER_MEMORY)
+    {
+        Byte(0xC6 + w);
+        ModRM(0, dest);
+        Immediate(src, width);
+    }
+    else Fail(cmd);
+}
+
+void X86Encoder::EncodeTest(const AsmCmd& cmd)
+{
+    const AsmOperand& src = cmd.oper[0];
+    const AsmOperand& dest = cmd.oper[1];
+    unsigned width = OperandWidth(cmd);
+    unsigned char w = width == 8 ? 0 : 1;
+    OperandPrefix(width);
+    if (IsIntReg(src) && IsRegOrMem(dest))
+    {
+        Byte(0x84 + w);
+        ModRM(REG_CODE[src.reg], dest);
+    }
+    else if (src.type == OPER_MEMORY && IsIntReg(dest))
+    {
+        Byte(0x84 + w);
+        ModRM(REG_CODE[dest.reg], src);
+    }
+    else if (IsImmediate(src) && IsRegOrMem(dest))
+    {
+        if (dest.type == OPER_REGISTER && REG_CODE[dest.reg] == 0) Byte(0xA8 + w);
+        else
+        {
+            Byte(0xF6 + w);
+            ModRM(0, dest);
+        }
+        Immediate(src, width);
+    }
+    else Fail(cmd);
+}
+
+void X86Encoder::EncodeUnary(const AsmCmd& cmd, unsigned digit)
+{
+    if (!IsRegOrMem(cmd.oper[0]) || cmd.oper[1].type != OPER_NONE) Fail(cmd);
+    unsigned width = OperandWidth(cmd);
+    OperandPrefix(width);
+    Byte(width == 8 ? 0xF6 : 0xF7);
+    ModRM(digit, cmd.oper[0]);
+}
+
+void X86Encoder::EncodeImul(const AsmCmd& cmd)
+{
+    const AsmOperand& src = cmd.oper[0];
+    const AsmOperand& dest = cmd.oper[1];
+    if (dest.type == OPER_NONE)
+    {
+        EncodeUnary(cmd, 5);
+        return;
+    }
+    if (!IsIntReg(dest) || OperandWidth(cmd) != 32) Fail(cmd);
+    if (IsRegOrMem(src))
+    {
+        Byte(0x0F);
+        Byte(0xAF);
+        ModRM(REG_CODE[dest.reg], src);
+    }
+    else if (src.type == OPER_INT)
+    {
+        Byte(IsByte(src.value) ? 0x6B : 0x69);
+        ModRM(REG_CODE[dest.reg], dest);
+        if (IsByte(src.value)) Byte(src.value);
+        else Long(src.value);
+    }
+    else Fail(cmd);
+}
+
+void X86Encoder::EncodeShift(const AsmCmd& cmd, unsigned digit)
+{
+    const AsmOperand& count = cmd.oper[0];
+    const AsmOperand& dest = cmd.oper[1].type == OPER_NONE ? cmd.oper[0] : cmd.oper[1];
+    if (!IsRegOrMem(dest)) Fail(cmd);
+    unsigned width = OperandWidth(cmd);
+    unsigned char w = width == 8 ? 0 : 1;
+    OperandPrefix(width);
+    if (cmd.oper[1].type == OPER_NONE || (count.type == OPER_INT && count.value == 1))
+    {
+        Byte(0xD0 + w);
+        ModRM(digit, dest);
+    }
+    else if (count.type == OPER_INT)
+    {
+        Byte(0xC0 + w);
+        ModRM(digit, dest);
+        Byte(count.value);
+    }
+    else if (count.type == OPER_REGISTER && count.reg == REG_CL)
+    {
+        Byte(0xD2 + w);
+        ModRM(digit, dest);
+    }
+    else Fail(cmd);
+}
+
+void X86Encoder::EncodePush(const AsmCmd& cmd)
+{
+    const AsmOperand& src = cmd.oper[0];
+    if (IsIntReg(src) && RegWidth(src.reg) == 32)
+        Byte(0x50 + REG_CODE[src.reg]);
+    else if (src.type == OPER_INT && IsByte(src.value))
+    {
+        Byte(0x6A);
+        Byte(src.value);
+    }
+    else if (IsImmediate(src))
+    {
+        Byte(0x68);
+        Immediate(src, 32);
+    }
+    else if (src.type == OPER_MEMORY)
+    {
+        Byte(0xFF);
+        ModRM(6, src);
+    }
+    else Fail(cmd);
+}
+
+void X86Encoder::EncodePop(const AsmCmd& cmd)
+{
+    const AsmOperand& dest = cmd.oper[0];
+    if (IsIntReg(dest) && RegWidth(dest.reg) == 32)
+        Byte(0x58 + REG_CODE[dest.reg]);
+    else if (dest.type == OPER_MEMORY)
+    {
+        Byte(0x8F);
+        ModRM(0, dest);
+    }
+    else Fail(cmd);
+}
+
+void X86Encoder::EncodeCall(const AsmCmd& cmd)
+{
+    const AsmOperand& target = cmd.oper[0];
+    if (target.type == OPER_LABEL)
+    {
+        Byte(0xE8);
+        Label(target.label, 0, true);
+    }
+    else if (target.type == OPER_MEMORY && target.mem.base_type == OPER_LABEL && !target.mem.disp
+             && !target.mem.index && !target.mem.scale)
+    {
+        Byte(0xE8);
+        Label(target.mem.base, 0, true);
+    }
+    else if (IsRegOrMem(target))
+    {
+        Byte(0xFF);
+        ModRM(2, target);
+    }
+    else Fail(cmd);
+}
+
+void X86Encoder::EncodeFpuArith(const AsmCmd& cmd, unsigned char base)
+{
+    unsigned index = 1;
+    if (cmd.oper[0].type != OPER_NONE)
+    {
+        if (!IsFpuReg(cmd.oper[0]) || !IsFpuReg(cmd.oper[1]) || REG_CODE[cmd.oper[0].reg]) Fail(cmd);
+        index = REG_CODE[cmd.oper[1].reg];
+    }
+    Byte(0xDE);
+    Byte(base + index);
+}
+
+void X86Encoder::EncodeFpuMemory(const AsmCmd& cmd, unsigned char op_short, unsigned char op_long,
+                                 unsigned digit, unsigned char op_reg)
+{
+    const AsmOperand& oper = cmd.oper[0];
+    if (IsFpuReg(oper))
+    {
+        Byte(op_reg == 0xC0 ? 0xD9 : 0xDD);
+        Byte(op_reg + REG_CODE[oper.reg]);
+    }
+    else if (oper.type == OPER_MEMORY && (cmd.size == SIZE_SHORT || cmd.size == SIZE_LONG))
+    {
+        Byte(cmd.size == SIZE_SHORT ? op_short : op_long);
+        ModRM(digit, oper);
+    }
+    else Fail(cmd);
+}
+
+bool X86Encoder::IsRelaxable(const AsmCmd& cmd)
+{
+    return cmd.command >= ASM_JA && cmd.command <= ASM_JZ && cmd.oper[0].type == OPER_LABEL && cmd.oper[1].type == OPER_NONE;
+}
+
+int X86Encoder::JumpCondition(AsmCmdName cmd)
+{
+    switch (cmd)
+    {
+        case ASM_JMP: return -1;
+        case ASM_JB: return 0x2;
+        case ASM_JAE: return 0x3;
+        case ASM_JZ: return 0x4;
+        case ASM_JNE:
+        case ASM_JNZ: return 0x5;
+        case ASM_JBE: return 0x6;
+        case ASM_JA: return 0x7;
+        case ASM_JL: return 0xC;
+        case ASM_JNL: return 0xD;
+        case ASM_JNG: return 0xE;
+        case ASM_JG: return 0xF;
+        default:
+            throw CompilerException("can't encode jump " + ASM_CMD_TO_STR[cmd]);
+    }
+}
+
+void X86Encoder::Encode(const AsmCmd& cmd)
+{
+    switch (cmd.command)
+    {
+        case ASM_ADD: EncodeAlu(cmd, 0); break;
+        case ASM_OR: EncodeAlu(cmd, 1); break;
+        case ASM_AND: EncodeAlu(cmd, 4); break;
+        case ASM_SUB: EncodeAlu(cmd, 5); break;
+        case ASM_XOR: EncodeAlu(cmd, 6); break;
+        case ASM_CMP: EncodeAlu(cmd, 7); break;
+        case ASM_TEST: EncodeTest(cmd); break;
+        case ASM_MOV: EncodeMov(cmd); break;
+        case ASM_NOT: EncodeUnary(cmd, 2); break;
+        case ASM_NEG: EncodeUnary(cmd, 3); break;
+        case ASM_MUL: EncodeUnary(cmd, 4); break;
+        case ASM_IMUL: EncodeImul(cmd); break;
+        case ASM_DIV: EncodeUnary(cmd, 6); break;
+        case ASM_IDIV: EncodeUnary(cmd, 7); break;
+        case ASM_SAL: EncodeShift(cmd, 4); break;
+        case ASM_SAR: EncodeShift(cmd, 7); break;
+        case ASM_SHR: EncodeShift(cmd, 5); break;
+        case ASM_PUSH: EncodePush(cmd); break;
+        case ASM_POP: EncodePop(cmd); break;
+        case ASM_CALL: EncodeCall(cmd); break;
+        case ASM_LEA:
+            if (cmd.oper[0].type != OPER_MEMORY || !IsIntReg(cmd.oper[1])) Fail(cmd);
+            OperandPrefix(OperandWidth(cmd));
+            Byte(0x8D);
+            ModRM(REG_CODE[cmd.oper[1].reg], cmd.oper[0]);
+        break;
+        case ASM_MOVZB:
+            if (!IsRegOrMem(cmd.oper[0]) || !IsIntReg(cmd.oper[1])) Fail(cmd);
+            if (cmd.oper[0].type == OPER_REGISTER && RegWidth(cmd.oper[0].reg) != 8) Fail(cmd);
+            OperandPrefix(OperandWidth(cmd));
+            Byte(0x0F);
+            Byte(0xB6);
+            ModRM(REG_CODE[cmd.oper[1].reg], cmd.oper[0]);
+        break;
+        case ASM_SETA: case ASM_SETAE: case ASM_SETB: case ASM_SETBE: case ASM_SETG:
+        case ASM_SETGE: case ASM_SETL: case ASM_SETLE: case ASM_SETE: case ASM_SETNE:
+        {
+            static const unsigned char SET_CONDITION[] = { 0x7, 0x3, 0x2, 0x6, 0xF, 0xD, 0xC, 0xE, 0x4, 0x5 };
+            if (!IsRegOrMem(cmd.oper[0]) || (cmd.oper[0].type == OPER_REGISTER && RegWidth(cmd.oper[0].reg) != 8))
+                Fail(cmd);
+            Byte(0x0F);
+            Byte(0x90 + SET_CONDITION[cmd.command - ASM_SETA]);
+            ModRM(0, cmd.oper[0]);
+        }
+        break;
+        case ASM_JMP:
+            if (!IsRegOrMem(cmd.oper[0])) Fail(cmd);
+            Byte(0xFF);
+            ModRM(4, cmd.oper[0]);
+        break;
+        case ASM_RET:
+            if (cmd.oper[0].type == OPER_NONE) Byte(0xC3);
+            else if (cmd.oper[0].type == OPER_INT)
+            {
+                Byte(0xC2);
+                Word(cmd.oper[0].value);
+            }
+            else Fail(cmd);
+        break;
+        case ASM_SAHF:
+            Byte(0x9E);
+        break;
+        case ASM_CLTD:
+            Byte(0x99);
+        break;
+        case ASM_REP_MOVS:
+            if (cmd.size != SIZE_LONG) Fail(cmd);
+            Byte(0xF3);
+            Byte(0xA5);
+        break;
+        case ASM_FADDP: EncodeFpuArith(cmd, 0xC0); break;
+        case ASM_FMULP: EncodeFpuArith(cmd, 0xC8); break;
+        case ASM_FSUBRP: EncodeFpuArith(cmd, 0xE8); break;
+        case ASM_FDIVRP: EncodeFpuArith(cmd, 0xF8); break;
+        case ASM_FLD: EncodeFpuMemory(cmd, 0xD9, 0xDD, 0, 0xC0); break;
+        case ASM_FSTP: EncodeFpuMemory(cmd, 0xD9, 0xDD, 3, 0xD8); break;
+        case ASM_FILD:
+            if (cmd.oper[0].type != OPER_MEMORY) Fail(cmd);
+            if (cmd.size == SIZE_SHORT) Byte(0xDF);
+            else if (cmd.size == SIZE_LONG) Byte(0xDB);
+            else Fail(cmd);
+            ModRM(0, cmd.oper[0]);
+        break;
+        case ASM_FXCH:
+            if (cmd.oper[0].type != OPER_NONE && !IsFpuReg(cmd.oper[0])) Fail(cmd);
+            Byte(0xD9);
+            Byte(0xC8 + (cmd.oper[0].type == OPER_NONE ? 1 : REG_CODE[cmd.oper[0].reg]));
+        break;
+        case ASM_FCOMPP:
+            Byte(0xDE);
+            Byte(0xD9);
+        break;
+        case ASM_FUCOMIP:
+            if (!IsFpuReg(cmd.oper[0]) || !IsFpuReg(cmd.oper[1]) || REG_CODE[cmd.oper[1].reg]) Fail(cmd);
+            Byte(0xDF);
+            Byte(0xE8 + REG_CODE[cmd.oper[0].reg]);
+        break;
+        case ASM_FNSTSW:
+            if (cmd.oper[0].type == OPER_REGISTER && cmd.oper[0].reg == REG_AX)
+            {
+                Byte(0xDF);
+                Byte(0xE0);
+            }
+            else if (cmd.oper[0].type == OPER_MEMORY)
+            {
+                Byte(0xDD);
+                ModRM(7, cmd.oper[0]);
+            }
+            else Fail(cmd);
+        break;
+        case ASM_FCH:
+            if (cmd.size != SIZE_SHORT) Fail(cmd);
+            Byte(0xD9);
+            Byte(0xE0);
+        break;
+        default:
+            Fail(cmd);
+    }
+}
+
+//---ObjectFile---
+
+ObjectFile::ObjectFile(const AsmCode& code)
+{
+    const list<AsmData*>& items = code.GetData();
+    for (list<AsmData*>::const_iterator it = items.begin(); it != items.end(); ++it)
+        AddData(**it);
+    Assemble(code.GetCommands());
+}
+
+unsigned ObjectFile::SymbolId(const string& name)
+{
+    map<string, unsigned>::iterator it = symbol_ids.find(name);
+    if (it != symbol_ids.end()) return it->second;
+    ObjSymbol sym = { name, SECTION_UNDEF, 0, false };
+    symbols.push_back(sym);
+    return symbol_ids[name] = symbols.size() - 1;
+}
+
+unsigned ObjectFile::LabelSymbol(const AsmChunk& chunk, vector<int>& ids, unsigned label)
+{
+    if (ids[label] < 0) ids[label] = SymbolId(chunk.names[label]);
+    return ids[label];
+}
+
+void ObjectFile::DefineSymbol(unsigned id, ObjSection section, unsigned value)
+{
+    if (symbols[id].section != SECTION_UNDEF)
+        throw CompilerException("symbol " + symbols[id].name + " is already defined");
+    symbols[id].section = section;
+    symbols[id].value = value;
+}
+
+void ObjectFile::AddData(const AsmData& item)
+{
+    DefineSymbol(SymbolId(item.GetName()), SECTION_DATA, data.size());
+    string value = item.GetValue();
+    switch (item.GetType())
+    {
+        case DATA_UNTYPED:
+            data.resize(data.size() + atoi(value.c_str()), 0);
+        break;
+        case DATA_INT:
+            PutLong(data, strtol(value.c_str(), NULL, 0));
+        break;
+        case DATA_REAL:
+        {
+            float real = (float)atof(value.c_str());
+            unsigned bits;
+            memcpy(&bits, &real, sizeof(bits));
+            PutLong(data, bits);
+        }
+        break;
+        case DATA_STR:
+            PutString(data, value);
+        break;
+    }
+}
+
+void ObjectFile::AddLabel(unsigned symbol, vector<TextItem>& items)
+{
+    DefineSymbol(symbol, SECTION_TEXT, 0);
+    TextItem item = { 0, 0, 0, (int)symbol, 0, false, 0 };
+    items.push_back(item);
+}
+
+void ObjectFile::AddRawCommand(const string& raw, vector<TextItem>& items)
+{
+    for (size_t begin = 0; begin < raw.size();)
+    {
+        size_t end = raw.find('\n', begin);
+        if (end == string::npos) end = raw.size();
+        string line = Trim(raw.substr(begin, end - begin));
+        begin = end + 1;
+        if (line.empty()) continue;
+        if (!line.compare(0, 7, ".globl "))
+            symbols[SymbolId(Trim(line.substr(7)))].global = true;
+        else if (line[line.size() - 1] == ':')
+            AddLabel(SymbolId(line.substr(0, line.size() - 1)), items);
+        else if (!line.compare(0, 9, ".p2align ") && line.find(",0x90") != string::npos)
+        {
+            TextItem item = { 0, 0, 0, -1, 0, false, 1u << atoi(line.c_str() + 9) };
+            items.push_back(item);
+        }
+        else
+            throw CompilerException("can't assemble directive " + line);
+    }
+}
+
+void ObjectFile::Relax(vector<TextItem>& items)
+{
+    map<int, unsigned> label_items;
+    unsigned addr = 0;
+    for (unsigned i = 0; i < items.size(); ++i)
+    {
+        TextItem& item = items[i];
+        if (item.is_jump && symbols[item.symbol].section != SECTION_TEXT)
+            throw CompilerException("jump to undefined label " + symbols[item.symbol].name);
+        if (item.symbol >= 0 && !item.is_jump) label_items[item.symbol] = i;
+        item.addr = addr;
+        if (item.align) item.size = (item.align - addr % item.align) % item.align;
+        addr += item.size;
+    }
+    //like GAS, walk in order and guess forward targets from how far the code before them has grown
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        addr = 0;
+        for (unsigned i = 0; i < items.size(); ++i)
+        {
+            TextItem& item = items[i];
+            int stretch = addr - item.addr;
+            item.addr = addr;
+            if (item.align) item.size = (item.align - addr % item.align) % item.align;
+            if (item.symbol >= 0 && !item.is_jump) symbols[item.symbol].value = addr;
+            if (item.is_jump && item.size == 2)
+            {
+                int target = symbols[item.symbol].value;
+                map<int, unsigned>::iterator label = label_items.find(item.symbol);
+                if (label != label_items.end() && label->second > i)
+                {
+                    for (unsigned j = i + 1; j < label->second && stretch; ++j)
+                        if (items[j].align) stretch -= stretch % (int)items[j].align;
+                    target = items[label->second].addr + stretch;
+                }
+                if (!IsByte(target - (int)(addr + 2)))
+                {
+                    item.size = item.condition < 0 ? 5 : 6;
+                    changed = true;
+                }
+            }
+            addr += item.size;
+        }
+        for (unsigned i = 0; i < items.size() && !changed; ++i)
+            if (items[i].is_jump && items[i].size == 2
+                && !IsByte(symbols[items[i].symbol].value - (int)(items[i].addr + 2)))
+            {
+                items[i].size = items[i].condition < 0 ? 5 : 6;
+                changed = true;
+            }
+    }
+}
+
+void ObjectFile::Assemble(const AsmChunk& chunk)
+{
+    vector<int> label_symbols(chunk.names.size(), -1);
+    vector<unsigned char> pool;
+    vector<X86Fixup> fixups;
+    vector<TextItem> items;
+    X86Encoder encoder(pool, fixups);
+    for (vector<AsmCmd>::const_iterator it = chunk.commands.begin(); it != chunk.commands.end(); ++it)
+        switch (it->kind)
+        {
+            case CMD_LABEL:
+                AddLabel(LabelSymbol(chunk, label_symbols, it->oper[0].label), items);
+            break;
+            case CMD_RAW:
+                AddRawCommand(chunk.names[it->oper[0].value], items);
+            break;
+            case CMD_INSTRUCTION:
+                if (X86Encoder::IsRelaxable(*it))
+                {
+                    int symbol = LabelSymbol(chunk, label_symbols, it->oper[0].label);
+                    TextItem item = { 0, 2, 0, symbol, X86Encoder::JumpCondition(it->command), true, 0 };
+                    items.push_back(item);
+                }
+                else
+                {
+                    unsigned begin = pool.size();
+                    encoder.Encode(*it);
+                    if (!items.empty() && items.back().symbol < 0 && !items.back().align)
+                        items.back().size += pool.size() - begin;
+                    else
+                    {
+                        TextItem item = { begin, static_cast<unsigned>(pool.size() - begin), 0, -1, 0, false, 0 };
+                        items.push_back(item);
+                    }
+                }
+            break;
+        }
+    Relax(items);
+    vector<X86Fixup> placed;
+    unsigned fixup = 0;
+    for (vector<TextItem>::iterator it = items.begin(); it != items.end(); ++it)
+    {
+        if (it->is_jump)
+        {
+            int target = symbols[it->symbol].value;
+            if (it->size == 2)
+                text.push_back(it->condition < 0 ? 0xEB : 0x70 + it->condition);
+            else if (it->condition < 0)
+                text.push_back(0xE9);
+            else
+            {
+                text.push_back(0x0F);
+                text.push_back(0x80 + it->condition);
+            }
+            int disp = target - (it->addr + it->size);
+            if (it->size == 2) text.push_back(disp & 0xFF);
+            else PutLong(text, disp);
+        }
+        else if (it->align)
+            PutNops(text, it->size);
+        else if (it->symbol < 0)
+        {
+            for (; fixup < fixups.size() && fixups[fixup].offset < it->begin + it->size; ++fixup)
+            {
+                X86Fixup f = fixups[fixup];
+                f.offset += it->addr - it->begin;
+                f.label = LabelSymbol(chunk, label_symbols, f.label);
+                placed.push_back(f);
+            }
+            text.insert(text.end(), pool.begin() + it->begin, pool.begin() + it->begin + it->size);
+        }
+    }
+    for (vector<X86Fixup>::iterator it = placed.begin(); it != placed.end(); ++it)
+    {
+        const ObjSymbol& sym = symbols[it->label];
+        unsigned field = GetLong(text, it->offset);
+        ObjRelocation rel = { it->offset, it->label, SECTION_UNDEF, it->pc_relative };
+        if (sym.global || sym.section == SECTION_UNDEF)
+        {
+            if (it->pc_relative) SetLong(text, it->offset, field - 4);
+            relocations.push_back(rel);
+        }
+        else if (it->pc_relative)
+        {
+            if (sym.section == SECTION_TEXT)
+                SetLong(text, it->offset, field + sym.value - (it->offset + 4));
+            else
+            {
+                rel.section = sym.section;
+                SetLong(text, it->offset, field + sym.value - 4);
+                relocations.push_back(rel);
+            }
+        }
+        else
+        {
+            rel.section = sym.section;
+            SetLong(text, it->offset, field + sym.value);
+            relocations.push_back(rel);
+        }
+    }
+}
+
+static const unsigned char ELF_CLASS32 = 1;
+static const unsigned char ELF_DATA2LSB = 1;
+static const unsigned ET_REL = 1;
+static const unsigned EM_386 = 3;
+static const unsigned SHT_PROGBITS = 1;
+static const unsigned SHT_SYMTAB = 2;
+static const unsigned SHT_STRTAB = 3;
+static const unsigned SHT_REL = 9;
+static const unsigned SHF_WRITE = 1;
+static const unsigned SHF_ALLOC = 2;
+static const unsigned SHF_EXECINSTR = 4;
+static const unsigned SHF_INFO_LINK = 0x40;
+static const unsigned STB_LOCAL = 0;
+static const unsigned STB_GLOBAL = 1;
+static const unsigned STT_NOTYPE = 0;
+static const unsigned STT_SECTION = 3;
+static const unsigned R_386_32 = 1;
+static const unsigned R_386_PC32 = 2;
+
+enum ElfSectionIndex{
+    ELF_NULL,
+    ELF_TEXT,
+    ELF_DATA,
+    ELF_SYMTAB,
+    ELF_STRTAB,
+    ELF_REL_TEXT,
+    ELF_SHSTRTAB,
+    ELF_SECTION_COUNT
+};
+
+static unsigned AddString(vector<unsigned char>& table, const string& str)
+{
+    unsigned res = table.size();
+    table.insert(table.end(), str.begin(), str.end());
+    table.push_back(0);
+    return res;
+}
+
+static void PutSymbol(vector<unsigned char>& symtab, unsigned name, unsigned value, unsigned char info, unsigned section)
+{
+    PutLong(symtab, name);
+    PutLong(symtab, value);
+    PutLong(symtab, 0);
+    symtab.push_back(info);
+    symtab.push_back(0);
+    PutWord(symtab, section);
+}
+
+void ObjectFile::Write(ostream& o) const
+{
+    static const unsigned SECTION_INDEX[] = { 0, ELF_TEXT, ELF_DATA };
+    vector<unsigned char> symtab, strtab(1, 0), rel, shstrtab(1, 0);
+    vector<unsigned> elf_index(symbols.size());
+    PutSymbol(symtab, 0, 0, 0, 0);
+    PutSymbol(symtab, 0, 0, STB_LOCAL << 4 | STT_SECTION, ELF_TEXT);
+    PutSymbol(symtab, 0, 0, STB_LOCAL << 4 | STT_SECTION, ELF_DATA);
+    unsigned count = 3;
+    unsigned first_global = 0;
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        bool global_pass = pass == 1;
+        if (global_pass) first_global = count;
+        for (unsigned i = 0; i < symbols.size(); ++i)
+        {
+            const ObjSymbol& sym = symbols[i];
+            if ((sym.global || sym.section == SECTION_UNDEF) != global_pass) continue;
+            elf_index[i] = count++;
+            unsigned char bind = global_pass ? STB_GLOBAL : STB_LOCAL;
+            PutSymbol(symtab, AddString(strtab, sym.name), sym.value, bind << 4 | STT_NOTYPE, SECTION_INDEX[sym.section]);
+        }
+    }
+    for (vector<ObjRelocation>::const_iterator it = relocations.begin(); it != relocations.end(); ++it)
+    {
+        unsigned index = it->section != SECTION_UNDEF ? SECTION_INDEX[it->section] : elf_index[it->symbol];
+        PutLong(rel, it->offset);
+        PutLong(rel, index << 8 | (it->pc_relative ? R_386_PC32 : R_386_32));
+    }
+    struct ElfSection{
+        const char* name;
+        unsigned type;
+        unsigned flags;
+        const vector<unsigned char>* content;
+        unsigned link;
+        unsigned info;
+        unsigned align;
+        unsigned entsize;
+    };
+    const ElfSection sections[ELF_SECTION_COUNT] =
+    {
+        { "", 0, 0, NULL, 0, 0, 0, 0 },
+        { ".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, &text, 0, 0, 16, 0 },
+        { ".data", SHT_PROGBITS, SHF_WRITE | SHF_ALLOC, &data, 0, 0, 4, 0 },
+        { ".symtab", SHT_SYMTAB, 0, &symtab, ELF_STRTAB, first_global, 4, 16 },
+        { ".strtab", SHT_STRTAB, 0, &strtab, 0, 0, 1, 0 },
+        { ".rel.text", SHT_REL, SHF_INFO_LINK, &rel, ELF_SYMTAB, ELF_TEXT, 4, 8 },
+        { ".shstrtab", SHT_STRTAB, 0, &shstrtab, 0, 0, 1, 0 }
+    };
+    unsigned names[ELF_SECTION_COUNT];
+    for (int i = 0; i < ELF_SECTION_COUNT; ++i)
+        names[i] = i ? AddString(shstrtab, sections[i].name) : 0;
+    vector<unsigned char> file(52, 0);
+    unsigned offsets[ELF_SECTION_COUNT] = { 0 };
+    for (int i = 1; i < ELF_SECTION_COUNT; ++i)
+    {
+        file.resize((file.size() + 3) & ~3, 0);
+        offsets[i] = file.size();
+        file.insert(file.end(), sections[i].content->begin(), sections[i].content->end());
+    }
+    file.resize((file.size() + 3) & ~3, 0);
+    unsigned section_headers = file.size();
+    for (int i = 0; i < ELF_SECTION_COUNT; ++i)
+    {
+        PutLong(file, names[i]);
+        PutLong(file, sections[i].type);
+        PutLong(file, sections[i].flags);
+        PutLong(file, 0);
+        PutLong(file, offsets[i]);
+        PutLong(file, sections[i].content ? sections[i].content->size() : 0);
+        PutLong(file, sections[i].link);
+        PutLong(file, sections[i].info);
+        PutLong(file, sections[i].align);
+        PutLong(file, sections[i].entsize);
+    }
+    vector<unsigned char> header;
+    const unsigned char ident[16] = { 0x7F, 'E', 'L', 'F', ELF_CLASS32, ELF_DATA2LSB, 1 };
+    header.insert(header.end(), ident, ident + 16);
+    PutWord(header, ET_REL);
+    PutWord(header, EM_386);
+    PutLong(header, 1);
+    PutLong(header, 0);
+    PutLong(header, 0);
+    PutLong(header, section_headers);
+    PutLong(header, 0);
+    PutWord(header, 52);
+    PutWord(header, 0);
+    PutWord(header, 0);
+    PutWord(header, 40);
+    PutWord(header, ELF_SECTION_COUNT);
+    PutWord(header, ELF_SHSTRTAB);
+    copy(header.begin(), header.end(), file.begin());
+    o.write((const char*)&file[0], file.size());
+}
@@ -0,0 +1,98 @@
+#ifndef OBJECT_FILE
+#define OBJECT_FILE
+
+#include "generator.h"
+#include "exception.h"
+#include <vector>
+#include <map>
+#include <string>
+#include <ostream>
+using namespace std;
+
+struct X86Fixup{
+    unsigned offset;
+    unsigned label;
+    bool pc_relative;
+};
+
+class X86Encoder{
+private:
+    vector<unsigned char>& out;
+    vector<X86Fixup>& fixups;
+    void Byte(unsigned char value);
+    void Word(int value);
+    void Long(int value);
+    void Label(unsigned label, int addend, bool pc_relative);
+    void Address(const AsmAddress& mem);
+    void Immediate(const AsmOperand& oper, unsigned width);
+    void ModRM(unsigned reg, const AsmOperand& rm);
+    unsigned OperandWidth(const AsmCmd& cmd) const;
+    void OperandPrefix(unsigned width);
+    void EncodeAlu(const AsmCmd& cmd, unsigned digit);
+    void EncodeMov(const AsmCmd& cmd);
+    void EncodeTest(const AsmCmd& cmd);
+    void EncodeUnary(const AsmCmd& cmd, unsigned digit);
+    void EncodeImul(const AsmCmd& cmd);
+    void EncodeShift(const AsmCmd& cmd, unsigned digit);
+    void EncodePush(const AsmCmd& cmd);
+    void EncodePop(const AsmCmd& cmd);
+    void EncodeCall(const AsmCmd& cmd);
+    void EncodeFpuArith(const AsmCmd& cmd, unsigned char base);
+    void EncodeFpuMemory(const AsmCmd& cmd, unsigned char op_short, unsigned char op_long,
+                         unsigned digit, unsigned char op_reg);
+    void Fail(const AsmCmd& cmd) const;
+public:
+    X86Encoder(vector<unsigned char>& out_, vector<X86Fixup>& fixups_);
+    static bool IsRelaxable(const AsmCmd& cmd);
+    static int JumpCondition(AsmCmdName cmd);
+    void Encode(const AsmCmd& cmd);
+};
+
+enum ObjSection{
+    SECTION_UNDEF,
+    SECTION_TEXT,
+    SECTION_DATA
+};
+
+class ObjectFile{
+private:
+    struct ObjSymbol{
+        string name;
+        ObjSection section;
+        unsigned value;
+        bool global;
+    };
+    struct ObjRelocation{
+        unsigned offset;
+        unsigned symbol;
+        ObjSection section;
+        bool pc_relative;
+    };
+    struct TextItem{
+        unsigned begin;
+        unsigned size;
+        unsigned addr;
+        int symbol;
+        int condition;
+        bool is_jump;
+        unsigned align;
+    };
+    vector<unsigned char> text;
+    vector<unsigned char> data;
+    vector<ObjSymbol> symbols;
+    map<string, unsigned> symbol_ids;
+    vector<ObjRelocation> relocations;
+    unsigned SymbolId(const string& name);
+    unsigned LabelSymbol(const AsmChunk& chunk, vector<int>& ids, unsigned label);
+    void DefineSymbol(unsigned id, ObjSection section, unsigned value);
+    void AddData(const AsmData& item);
+    void AddLabel(unsigned symbol, vector<TextItem>& items);
+    void AddRawCommand(const string& raw, vector<TextItem>& items);
+    void Assemble(const AsmChunk& chunk);
+    void Relax(vector<TextItem>& items);
+public:
+    ObjectFile(const AsmCode& code);
+    void Write(ostream& o) const;
+};
+
+#endif
@@ -78,6 +78,12 @@ void Parser::CheckForBaseType(SyntaxNode* expr, Token tok_err)
     }
 }
 
+void Parser::CheckWritableOrDie(SymVar* var, Token tok_err)
+{
+    if (var != NULL && (var->GetClassName() & SYM_VAR_PARAM) && ((SymVarParam*)var)->IsConst())
+        Error("constant parameter can't be modified", tok_err);
+}
+
 void Parser::PrintSyntaxTree(ostream& o)
 {
     body->Print(o, 0);
@@ -88,30 +94,188 @@ void Parser::PrintSymTable(ostream& o)
     if (body != NULL) sym_table_stack.back()->Print(o, 0);
 }
 
-void Parser::Generate(ostream& o)
+void Parser::GenerateMain()
 {
-    sym_table_stack.back()->GenerateDeclarations(asm_code);
+    if (IsUnit())
+    {
+        for (std::vector<Symbol*>::iterator it = exported.begin(); it != exported.end(); ++it)
+            if ((*it)->GetClassName() & SYM_VAR_GLOBAL)
+                asm_code.AddGlobalDeclaration(((SymVarGlobal*)*it)->GetLabel());
+            else if ((*it)->GetClassName() & SYM_PROC && !((SymProc*)*it)->IsDummyProc())
+                asm_code.AddGlobalDeclaration(((SymProc*)*it)->GetLabel());
+        return;
+    }
     asm_code.AddMainFunctionLabel();
+    if (asm_code.GetTarget() == TARGET_X86_64)
+    {
+        GenerateMain64();
+        return;
+    }
     asm_code.AddCmd(ASM_MOV, REG_ESP, REG_EBP);
     body->Generate(asm_code);
     asm_code.AddLabel(exit_label);
     asm_code.AddCmd(ASM_MOV, REG_EBP, REG_ESP);
     asm_code.AddCmd(ASM_MOV, 0, REG_EAX);
     asm_code.AddCmd(ASM_RET);
+}
+
+void Parser::GenerateMain64()
+{
+    asm_code.AddCmd(ASM_PUSH, REG_EBP);
+    asm_code.AddCmd(ASM_MOV, REG_ESP, REG_EBP);
+    asm_code.AddCmd(ASM_PUSH, REG_EBX);
+    body->Generate(asm_code);
+    asm_code.AddLabel(exit_label);
+    asm_code.AddCmd(ASM_MOV, AsmMemory(REG_EBP, -8), REG_EBX, SIZE_QUARD);
+    asm_code.AddCmd(ASM_MOV, REG_EBP, REG_ESP);
+    asm_code.AddCmd(ASM_POP, REG_EBP);
+    asm_code.AddCmd(ASM_MOV, 0, REG_EAX);
+    asm_code.AddCmd(ASM_RET, SIZE_NONE);
+}
+
+void Parser::FlushToSink()
+{
+    AsmChunk* chunk = new AsmChunk;
+    asm_code.FlushCommands(*chunk);
+    if (optimization) peephole.Optimize(chunk->commands);
+    if (omit_frame_pointer) frame_omitter.Process(*chunk);
+    sink->Emit(chunk);
+}
+
+void Parser::StreamProc(SymProc* proc)
+{
+    if (optimization) proc->Optimize();
+    proc->PrepareGeneration();
+    proc->GenerateDeclaration(asm_code);
+    FlushToSink();
+    proc->ReleaseBody();
+}
+
+void Parser::StreamReadyProcs(bool all_parsed)
+{
+    const std::vector<SymProc*>& procs = sym_table_stack.back()->GetProcs();
+    for (; streamed_procs < procs.size(); ++streamed_procs)
+    {
+        SymProc* proc = procs[streamed_procs];
+        if (proc->IsHaveBody()) StreamProc(proc);
+        else if (!all_parsed) return;
+    }
+}
+
+void Parser::GenerateStreamed(ostream& o)
+{
+    GenerateMain();
+    FlushToSink();
+    sink->Finish();
+    sym_table_stack.back()->GenerateGlobalsDeclarations(asm_code);
+    asm_code.PrintData(o);
+}
+
+void Parser::GenerateCode(unsigned threads)
+{
+    sym_table_stack.back()->PrepareGeneration();
+    if (threads > 1)
+    {
+        sym_table_stack.back()->GenerateGlobalsDeclarations(asm_code);
+        ProcGenerator generator(sym_table_stack.back()->GetProcs(), asm_code);
+        generator.Generate(threads);
+        generator.AppendTo(asm_code);
+    }
+    else
+        sym_table_stack.back()->GenerateDeclarations(asm_code);
+    GenerateMain();
+    if (optimization) asm_code.Optimize(peephole);
+    if (omit_frame_pointer) asm_code.OmitFramePointer(frame_omitter);
+}
+
+void Parser::Generate(ostream& o, unsigned threads)
+{
+    if (sink != NULL)
+    {
+        GenerateStreamed(o);
+        return;
+    }
+    GenerateCode(threads);
     asm_code.Print(o);
 }
 
-Parser::Parser(Scanner& scanner, bool optimize):
+void Parser::GenerateObject(ostream& o, unsigned threads)
+{
+    if (asm_code.GetTarget() != TARGET_X86) throw CompilerException("object files can only be written for x86_32");
+    GenerateCode(threads);
+    ObjectFile object(asm_code);
+    object.Write(o);
+}
+
+void Parser::PrintPeepholeStats(ostream& o) const
+{
+    peephole.PrintStats(o);
+}
+
+void Parser::LowerToVm(VmCode& code)
+{
+    if (IsUnit()) throw CompilerException("unit can't be run");
+    sym_table_stack.back()->PrepareGeneration();
+    sym_table_stack.back()->GenerateDeclarations(code);
+    code.BeginMain();
+    body->Generate(code);
+    code.EndProc();
+    code.Link();
+}
+
+void Parser::Run(ostream& o)
+{
+    VmCode code;
+    LowerToVm(code);
+    VirtualMachine vm(code);
+    vm.Run(o);
+}
+
+void Parser::RunJit(ostream& o)
+{
+    VmCode code;
+    LowerToVm(code);
+    JitCompiler jit(code);
+    jit.Run(o);
+}
+
+bool Parser::IsUnit() const
+{
+    return !unit_name.empty();
+}
+
+string Parser::GetUnitName() const
+{
+    return unit_name;
+}
+
+void Parser::GenerateInterface(ostream& o)
+{
+    UnitWriter writer(o);
+    writer.Write(unit_name, exported);
+}
+
+Parser::Parser(TokenStream& scanner, bool optimize, const string& unit_dir_, AsmSink* sink_, AsmTarget target, bool sse,
+               bool omit_frame_pointer_, bool reg_results):
     optimization(optimize),
     body(NULL),
     scan(scanner),
-    current_proc(NULL)
+    current_proc(NULL),
+    peephole(target),
+    omit_frame_pointer(omit_frame_pointer_),
+    unit_dir(unit_dir_),
+    sink(sink_),
+    streamed_procs(0)
 {
     scan.NextToken();
     top_sym_table.Add(top_type_int);
     top_sym_table.Add(top_type_real);
     sym_table_stack.push_back(&top_sym_table);
     sym_table_stack.push_back(new SymTable());
+    asm_code.SetTarget(target);
+    asm_code.SetSse(sse);
+    asm_code.SetRegResults(reg_results);
+    asm_code.SetOptimize(optimize);
     exit_label = asm_code.GenLabel("exit");
     Parse();
 }
@@ -225,7 +389,12 @@ void Parser::ParseVarDeclarationFactory(SymbolClass var_class_name)
                 //TODO
             break;
             case SYM_VAR_GLOBAL:
-                sym_table_stack.back()->Add(new SymVarGlobal(*it, type));
+            {
+                SymVarGlobal* var = new SymVarGlobal(*it, type);
+                AsmStrImmediate label = asm_code.LabelByStr(var->GetName());
+                var->SetLabel(label);
+                sym_table_stack.back()->Add(var);
+            }
             break;
             case SYM_VAR_LOCAL:
                 sym_table_stack.back()->Add(new SymVarLocal(*it, type, sym_table_stack.back()->GetLocalsSize()));
@@ -247,7 +416,7 @@ void Parser::ParseTypeDeclarations()
     }
 }
 
-void Parser::ParseDeclarations(bool is_global)
+void Parser::ParseDeclarations(bool is_global, bool is_interface)
 {
     bool loop = true;
     while (loop)
@@ -255,7 +424,7 @@ void Parser::ParseDeclarations(bool is_global)
         switch (scan.GetToken().GetValue()) {
             case TOK_PROCEDURE:
             case TOK_FUNCTION:
-                ParseFunctionDefinition();
+                ParseFunctionDefinition(is_global, is_interface);
             break;
             case TOK_CONST:
                 scan.NextToken();
@@ -284,8 +453,10 @@ void Parser::ParseFunctionParameters(SymProc* funct)
     bool was_semicolon = true;
     while (was_semicolon)
     {
-        bool by_ref = false;
-        if (by_ref = (scan.GetToken().GetValue() == TOK_VAR)) scan.NextToken();
+        ParamMode mode = PARAM_VALUE;
+        if (scan.GetToken().GetValue() == TOK_VAR) mode = PARAM_VAR;
+        else if (scan.GetToken().GetValue() == TOK_CONST) mode = PARAM_CONST;
+        if (mode != PARAM_VALUE) scan.NextToken();
         vector<Token> v;
         bool was_comma = true;
         while (was_comma)
@@ -298,7 +469,7 @@ void Parser::ParseFunctionParameters(SymProc* funct)
         const SymType* type = (SymType*)FindSymbolOrDie(scan.GetToken(), SYM_TYPE, "type identifier expected");
         for (vector<Token>::iterator it = v.begin(); it != v.end(); ++it)
         {
-            SymVarParam* param = new SymVarParam(*it, type, by_ref, sym_table_stack.back()->GetParamsSize() + 8);
+            SymVarParam* param = new SymVarParam(*it, type, mode, sym_table_stack.back()->GetParamsSize() + 8);
             sym_table_stack.back()->Add(param);
             funct->AddParam(param);
         }
@@ -315,7 +486,7 @@ void Parser::ParseFunctionBody(SymProc* funct)
     current_proc = NULL;
 }
 
-void Parser::ParseFunctionDefinition()
+void Parser::ParseFunctionDefinition(bool is_global, bool is_interface)
 {
     SymProc* res = NULL;
     SymProc* prototype = NULL;
@@ -325,7 +496,7 @@ void Parser::ParseFunctionDefinition()
     const Symbol* sym = FindSymbol(name);
     if (sym != NULL)
     {
-        if (sym->GetClassName() & SYM_PROC && !((SymProc*)sym)->IsHaveBody())
+        if (sym->GetClassName() & SYM_PROC && !((SymProc*)sym)->IsHaveBody() && !((SymProc*)sym)->IsImported())
             prototype = (SymProc*)sym;
         else
             Error("duplicate identifier");
@@ -352,10 +523,14 @@ void Parser::ParseFunctionDefinition()
         sym_table_stack.pop_back();
         sym_table_stack.push_back(res->GetSymTable());
     }
-    if (scan.GetToken().GetValue() == TOK_FORWARD)
+    if (is_interface || scan.GetToken().GetValue() == TOK_FORWARD)
     {
-        scan.NextToken();
-        CheckTokOrDie(TOK_SEMICOLON);
+        res->SetLabel(asm_code.LabelByStr(res->GetName()));
+        if (!is_interface)
+        {
+            scan.NextToken();
+            CheckTokOrDie(TOK_SEMICOLON);
+        }
     }
     else
     {
@@ -365,6 +540,7 @@ void Parser::ParseFunctionDefinition()
         CheckTokOrDie(TOK_SEMICOLON);
     }
     sym_table_stack.pop_back();
+    if (is_global && sink != NULL) StreamReadyProcs();
 }
 
 NodeStatement* Parser::ParseStatement()
@@ -443,6 +619,7 @@ StmtLoop* Parser::ParseForStatement()
     if (!scan.GetToken().IsVar()) Error("identifier expected");
     SymVar* index = (SymVar*)FindSymbolOrDie(scan.GetToken(), SYM_VAR, "identifier not found");
     if (index->GetVarType() != top_type_int) Error("integer variable expected");
+    CheckWritableOrDie(index, scan.GetToken());
     CheckNextTokOrDie(TOK_ASSIGN);
     SyntaxNode* first = GetIntExprOrDie();
     bool is_inc = (scan.GetToken().GetValue() == TOK_TO);
@@ -512,6 +689,7 @@ NodeStatement* Parser::ParseAssignStatement()
     if (right == NULL) Error("expression expected");
     ConvertTypeOrDie(right, left->GetSymType(), op);
     if (!(left->IsLValue())) Error("l-value expected", op);
+    CheckWritableOrDie(left->GetAffectedVar(), op);
     return new StmtAssign(left, right);
 }
 
@@ -568,15 +746,81 @@ const Symbol* Parser::FindSymbol(const Token& tok)
     return FindSymbol(&sym);
 }
 
+void Parser::LoadUnit(Token name)
+{
+    if (used_units.find(name.GetName()) != used_units.end() || unit_name == name.GetName())
+        Error("duplicate identifier", name);
+    string file_name = unit_dir + name.GetName() + ".itf";
+    ifstream in(file_name.c_str(), ios::in | ios::binary);
+    if (!in.good()) Error("can't open interface file " + file_name, name);
+    SymTable* table = NULL;
+    try
+    {
+        UnitReader reader(in, imported_globals);
+        table = reader.Read(name.GetName());
+    }
+    catch (CompilerException& e)
+    {
+        Error(e.what(), name);
+    }
+    sym_table_stack.insert(sym_table_stack.end() - 1, table);
+    used_units.insert(name.GetName());
+}
+
+void Parser::ParseUses()
+{
+    CheckTokOrDie(TOK_USES);
+    bool was_comma = true;
+    while (was_comma)
+    {
+        if (!scan.GetToken().IsVar()) Error("identifier expected");
+        LoadUnit(scan.GetToken());
+        was_comma = scan.NextToken().GetValue() == TOK_COMMA;
+        if (was_comma) scan.NextToken();
+    }
+    CheckTokOrDie(TOK_SEMICOLON);
+}
+
+void Parser::ParseUnit()
+{
+    CheckTokOrDie(TOK_UNIT);
+    if (!scan.GetToken().IsVar()) Error("identifier expected");
+    unit_name = scan.GetToken().GetName();
+    asm_code.SetNamespace(unit_name);
+    scan.NextToken();
+    CheckTokOrDie(TOK_SEMICOLON);
+    CheckTokOrDie(TOK_INTERFACE);
+    if (scan.GetToken().GetValue() == TOK_USES) ParseUses();
+    ParseDeclarations(true, true);
+    sym_table_stack.back()->GetSymbols(exported);
+    CheckTokOrDie(TOK_IMPLEMENTATION);
+    ParseDeclarations(true);
+    for (std::vector<Symbol*>::iterator it = exported.begin(); it != exported.end(); ++it)
+        if ((*it)->GetClassName() & SYM_PROC && !((SymProc*)*it)->IsHaveBody())
+            Error(string("unsatisfied forward declaration of '") + (*it)->GetName() + "'");
+    if (sink != NULL) StreamReadyProcs(true);
+    CheckTokOrDie(TOK_END);
+    if (scan.GetToken().GetValue() != TOK_DOT) Error("'.' expected");
+    body = new StmtBlock();
+    if (optimization && sink == NULL) sym_table_stack.back()->Optimize();
+}
+
 void Parser::Parse()
 {
+    if (scan.GetToken().GetValue() == TOK_UNIT)
+    {
+        ParseUnit();
+        return;
+    }
+    if (scan.GetToken().GetValue() == TOK_USES) ParseUses();
     ParseDeclarations(true);
+    if (sink != NULL) StreamReadyProcs(true);
     if (scan.GetToken().GetValue() != TOK_BEGIN) Error("'begin' expected");
     body = (StmtBlock*)ParseStatement();
     if (scan.GetToken().GetValue() != TOK_DOT) Error("'.' expected");
     if (optimization)
     {
-        sym_table_stack.back()->Optimize();
+        if (sink == NULL) sym_table_stack.back()->Optimize();
         body->Optimize();
     }
 }
@@ -652,7 +896,11 @@ SyntaxNode* Parser::ParseFunctionCall(SymProc* funct_name)
                 Error(", expected");
             if (funct->GetCurrentArgType() == NULL) Error("too many actual parameters", err_pos_tok);
             ConvertTypeOrDie(arg, funct->GetCurrentArgType(), err_pos_tok);
-            if (funct->IsCurrentArfByRef() && !arg->IsLValue()) Error("lvalue expected", err_pos_tok);
+            if (funct->IsCurrentArfByRef())
+            {
+                if (!arg->IsLValue()) Error("lvalue expected", err_pos_tok);
+                CheckWritableOrDie(arg->GetAffectedVar(), err_pos_tok);
+            }
             funct->AddArg(arg);
         }
         scan.NextToken();
@@ -8,17 +8,25 @@
 #include "statement.h"
 #include "generator.h"
 #include "exception.h"
+#include "unit_file.h"
+#include "pipeline.h"
+#include "object_file.h"
+#include "vm.h"
+#include "jit.h"
+#include "peephole.h"
 #include <string.h>
 #include <vector>
 #include <utility>
 #include <stack>
 #include <ostream>
+#include <fstream>
+#include <set>
 
 class Parser{
 private:
     bool optimization;
     StmtBlock* body;
-    Scanner& scan;
+    TokenStream& scan;
     SymTable top_sym_table;
     SymType* top_type_bool;
     std::vector<SymTable*> sym_table_stack;
@@ -26,6 +34,16 @@ private:
     SymProc* current_proc;
     AsmStrImmediate exit_label;
     AsmCode asm_code;
+    PeepholeOptimizer peephole;
+    bool omit_frame_pointer;
+    FrameOmitter frame_omitter;
+    string unit_dir;
+    string unit_name;
+    std::vector<Symbol*> exported;
+    std::set<string> used_units;
+    GlobalsRegistry imported_globals;
+    AsmSink* sink;
+    unsigned streamed_procs;
     SyntaxNode* ConvertType(SyntaxNode* node, const SymType* type);
     void TryToConvertType(SyntaxNode*& first, SyntaxNode*& second);
     void TryToConvertType(SyntaxNode*& expr, const SymType* type);
@@ -33,6 +51,7 @@ private:
     void ConvertTypeOrDie(SyntaxNode*& expr, const SymType* type, Token tok_err);
     void ConvertToBaseTypeOrDie(SyntaxNode*& first, SyntaxNode*& second, Token tok_err);
     void CheckForBaseType(SyntaxNode* expr, Token tok_err);
+    void CheckWritableOrDie(SymVar* var, Token tok_err);
     void CheckTokOrDie(TokenValue tok_val);
     void CheckNextTokOrDie(TokenValue tok_val);
     SyntaxNode* GetIntExprOrDie();
@@ -59,10 +78,13 @@ private:
     void ParseVarDeclarationFactory(SymbolClass var_class_name);
     void ParseVarDeclarations(bool is_global = true);
     void ParseTypeDeclarations();
-    void ParseDeclarations(bool is_global = true);
+    void ParseDeclarations(bool is_global = true, bool is_interface = false);
     void ParseFunctionParameters(SymProc* funct);
     void ParseFunctionBody(SymProc* funct);
-    void ParseFunctionDefinition();
+    void ParseFunctionDefinition(bool is_global = true, bool is_interface = false);
+    void LoadUnit(Token name);
+    void ParseUses();
+    void ParseUnit();
     NodeStatement* ParseBlockStatement();
     NodeStatement* ParseStatement();
     NodeStatement* ParseLoopStatement();
@@ -79,11 +101,27 @@ private:
     const Symbol* FindSymbolOrDie(Token tok, SymbolClass type, string msg);
     const Symbol* FindSymbol(const Token& tok);
     void Parse();
+    void FlushToSink();
+    void StreamProc(SymProc* proc);
+    void StreamReadyProcs(bool all_parsed = false);
+    void GenerateMain();
+    void GenerateMain64();
+    void GenerateStreamed(ostream& o);
+    void GenerateCode(unsigned threads);
+    void LowerToVm(VmCode& code);
 public:
-    Parser(Scanner& scanner, bool optimize = false);
+    Parser(TokenStream& scanner, bool optimize = false, const string& unit_dir_ = "", AsmSink* sink_ = NULL,
+           AsmTarget target = TARGET_X86, bool sse = false, bool omit_frame_pointer_ = false, bool reg_results = false);
     void PrintSyntaxTree(ostream& o);
     void PrintSymTable(ostream& o);
-    void Generate(ostream& o);
+    void Generate(ostream& o, unsigned threads = 1);
+    void GenerateObject(ostream& o, unsigned threads = 1);
+    void PrintPeepholeStats(ostream& o) const;
+    void Run(ostream& o);
+    void RunJit(ostream& o);
+    bool IsUnit() const;
+    string GetUnitName() const;
+    void GenerateInterface(ostream& o);
 };
 
 #endif
@@ -0,0 +1,761 @@
+#include "peephole.h"
+
+static const unsigned DISTANT_PUSH_WINDOW = 8;
+
+//---Operand helpers---
+
+static RegisterName RegFamily(RegisterName reg)
+{
+    switch (reg)
+    {
+        case REG_AL: case REG_AH: case REG_AX: case REG_RAX: return REG_EAX;
+        case REG_BL: case REG_BH: case REG_BX: case REG_RBX: return REG_EBX;
+        case REG_CL: case REG_CH: case REG_CX: case REG_RCX: return REG_ECX;
+        case REG_DL: case REG_DH: case REG_DX: case REG_RDX: return REG_EDX;
+        case REG_DI: case REG_RDI: return REG_EDI;
+        case REG_SI: case REG_RSI: return REG_ESI;
+        case REG_RBP: return REG_EBP;
+        case REG_RSP: return REG_ESP;
+        case REG_R11: return REG_R11D;
+        case REG_R12: return REG_R12D;
+        case REG_R13: return REG_R13D;
+        case REG_R14: return REG_R14D;
+        case REG_R15: return REG_R15D;
+        default: return reg;
+    }
+}
+
+static bool IsFullReg(RegisterName reg)
+{
+    return (reg >= REG_EAX && reg <= REG_ESP) || (reg >= REG_RAX && reg <= REG_R15D);
+}
+
+static bool IsGeneralReg(RegisterName reg)
+{
+    return reg <= REG_ESP || (reg >= REG_RAX && reg <= REG_R15D);
+}
+
+static bool IsReg(const AsmOperand& oper, RegisterName family)
+{
+    return oper.type == OPER_REGISTER && RegFamily(oper.reg) == family;
+}
+
+static bool AddressUsesReg(const AsmOperand& oper, RegisterName family)
+{
+    if (oper.type != OPER_MEMORY) return false;
+    if (oper.mem.scale && RegFamily((RegisterName)oper.mem.index) == family) return true;
+    return oper.mem.base_type == OPER_REGISTER && RegFamily((RegisterName)oper.mem.base) == family;
+}
+
+static bool UsesReg(const AsmOperand& oper, RegisterName family)
+{
+    return IsReg(oper, family) || AddressUsesReg(oper, family);
+}
+
+static bool IsPlainMemory(const AsmOperand& oper)
+{
+    return oper.type == OPER_MEMORY && !oper.mem.index && !oper.mem.scale;
+}
+
+static bool SameOperand(const AsmOperand& a, const AsmOperand& b)
+{
+    if (a.type != b.type) return false;
+    switch (a.type)
+    {
+        case OPER_REGISTER:
+            return a.reg == b.reg;
+        case OPER_INT:
+            return a.value == b.value;
+        case OPER_LABEL:
+        case OPER_RIP_LABEL:
+            return a.label == b.label;
+        case OPER_MEMORY:
+            return a.mem.base_type == b.mem.base_type && a.mem.base == b.mem.base && a.mem.disp == b.mem.disp
+                && a.mem.index == b.mem.index && a.mem.scale == b.mem.scale;
+        default:
+            return true;
+    }
+}
+
+//---Instruction helpers---
+
+static bool IsInstr(const AsmCmd& cmd, AsmCmdName name)
+{
+    return cmd.kind == CMD_INSTRUCTION && cmd.command == name;
+}
+
+static bool IsSetCmd(AsmCmdName cmd)
+{
+    return cmd >= ASM_SETA && cmd <= ASM_SETNE;
+}
+
+static bool IsJump(const AsmCmd& cmd)
+{
+    return cmd.kind == CMD_INSTRUCTION && cmd.command >= ASM_JA && cmd.command <= ASM_JZ
+        && cmd.oper[0].type == OPER_LABEL;
+}
+
+static bool ReadsFlags(const AsmCmd& cmd)
+{
+    return cmd.kind != CMD_INSTRUCTION || IsSetCmd(cmd.command)
+        || (cmd.command >= ASM_JA && cmd.command <= ASM_JZ && cmd.command != ASM_JMP);
+}
+
+static bool IsFlagsDeadAt(const vector<AsmCmd>& cmds, unsigned pos)
+{
+    return pos >= cmds.size() || !ReadsFlags(cmds[pos]);
+}
+
+static bool IsWriteOnly(AsmCmdName cmd)
+{
+    return cmd == ASM_MOV || cmd == ASM_LEA || cmd == ASM_MOVZB || cmd == ASM_POP;
+}
+
+static bool IsAnalyzable(const AsmCmd& cmd)
+{
+    if (cmd.kind != CMD_INSTRUCTION) return false;
+    for (int i = 0; i < 2; ++i)
+        if (cmd.oper[i].type == OPER_REGISTER && !IsGeneralReg(cmd.oper[i].reg)) return false;
+    switch (cmd.command)
+    {
+        case ASM_MOV: case ASM_LEA: case ASM_MOVZB: case ASM_ADD: case ASM_SUB:
+        case ASM_AND: case ASM_OR: case ASM_XOR: case ASM_CMP: case ASM_TEST:
+        case ASM_NEG: case ASM_NOT: case ASM_PUSH: case ASM_POP:
+            return true;
+        case ASM_IMUL:
+            return cmd.oper[1].type != OPER_NONE;
+        default:
+            return IsSetCmd(cmd.command);
+    }
+}
+
+static const AsmOperand& Dest(const AsmCmd& cmd)
+{
+    return cmd.oper[1].type == OPER_NONE ? cmd.oper[0] : cmd.oper[1];
+}
+
+static bool ReadsReg(const AsmCmd& cmd, RegisterName family)
+{
+    if (AddressUsesReg(cmd.oper[0], family) || AddressUsesReg(cmd.oper[1], family)) return true;
+    if (cmd.command == ASM_POP) return false;
+    if (cmd.oper[1].type == OPER_NONE) return IsReg(cmd.oper[0], family);
+    if (IsReg(cmd.oper[0], family)) return true;
+    return IsReg(cmd.oper[1], family) && (!IsWriteOnly(cmd.command) || !IsFullReg(cmd.oper[1].reg));
+}
+
+static bool WritesReg(const AsmCmd& cmd, RegisterName family)
+{
+    if (cmd.command == ASM_PUSH || cmd.command == ASM_CMP || cmd.command == ASM_TEST) return false;
+    return IsReg(Dest(cmd), family);
+}
+
+static bool WritesMemory(const AsmCmd& cmd)
+{
+    if (cmd.command == ASM_CMP || cmd.command == ASM_TEST || cmd.command == ASM_LEA) return false;
+    return cmd.command == ASM_PUSH || Dest(cmd).type == OPER_MEMORY;
+}
+
+static bool TouchesStack(const AsmCmd& cmd)
+{
+    return cmd.command == ASM_PUSH || cmd.command == ASM_POP
+        || UsesReg(cmd.oper[0], REG_ESP) || UsesReg(cmd.oper[1], REG_ESP);
+}
+
+static bool IsValidOperands(AsmCmdName cmd, const AsmOperand& src, const AsmOperand& dest)
+{
+    if (src.type == OPER_MEMORY && dest.type == OPER_MEMORY) return false;
+    if (cmd == ASM_IMUL) return dest.type == OPER_REGISTER;
+    return true;
+}
+
+static AsmCmdName SetToJump(AsmCmdName cmd)
+{
+    switch (cmd)
+    {
+        case ASM_SETA: return ASM_JA;
+        case ASM_SETAE: return ASM_JAE;
+        case ASM_SETB: return ASM_JB;
+        case ASM_SETBE: return ASM_JBE;
+        case ASM_SETG: return ASM_JG;
+        case ASM_SETGE: return ASM_JNL;
+        case ASM_SETL: return ASM_JL;
+        case ASM_SETLE: return ASM_JNG;
+        case ASM_SETE: return ASM_JZ;
+        default: return ASM_JNZ;
+    }
+}
+
+static bool LabelFollows(const vector<AsmCmd>& cmds, unsigned pos, unsigned label)
+{
+    for (; pos < cmds.size() && cmds[pos].kind == CMD_LABEL; ++pos)
+        if (cmds[pos].oper[0].label == label) return true;
+    return false;
+}
+
+//---PeepholeOptimizer---
+
+const PeepholeOptimizer::PeepholeRule PeepholeOptimizer::RULES[] =
+{
+    { "push-pop", 2, &PeepholeOptimizer::PushPop },
+    { "push-pop-distant", 3, &PeepholeOptimizer::PushPopDistant },
+    { "pop-push", 2, &PeepholeOptimizer::PopPush },
+    { "push-drop", 2, &PeepholeOptimizer::PushDrop },
+    { "store-load", 2, &PeepholeOptimizer::StoreLoad },
+    { "mov-self", 1, &PeepholeOptimizer::MoveSelf },
+    { "copy-propagation", 2, &PeepholeOptimizer::CopyPropagation },
+    { "address-fold", 2, &PeepholeOptimizer::AddressFold },
+    { "dead-mov", 1, &PeepholeOptimizer::DeadMove },
+    { "add-zero", 1, &PeepholeOptimizer::AddZero },
+    { "add-add", 2, &PeepholeOptimizer::AddAdd },
+    { "setcc-test-jcc", 4, &PeepholeOptimizer::SetTestJump },
+    { "jcc-over-jmp", 3, &PeepholeOptimizer::JumpOverJump },
+    { "jmp-to-next", 2, &PeepholeOptimizer::JumpToNext }
+};
+
+const unsigned PeepholeOptimizer::RULES_COUNT = sizeof(RULES) / sizeof(RULES[0]);
+
+PeepholeOptimizer::PeepholeOptimizer(AsmTarget target_):
+    target(target_),
+    hits(RULES_COUNT, 0),
+    before(0),
+    after(0)
+{
+}
+
+void PeepholeOptimizer::SetTarget(AsmTarget target_)
+{
+    target = target_;
+}
+
+void PeepholeOptimizer::Optimize(vector<AsmCmd>& commands)
+{
+    before += commands.size();
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (unsigned pos = 0; pos < commands.size(); ++pos)
+            for (unsigned i = 0; i < RULES_COUNT; ++i)
+            {
+                RuleApply apply = RULES[i].apply;
+                if (pos + RULES[i].window <= commands.size() && (this->*apply)(commands, pos))
+                {
+                    ++hits[i];
+                    changed = true;
+                }
+            }
+    }
+    after += commands.size();
+}
+
+void PeepholeOptimizer::PrintStats(ostream& o) const
+{
+    for (unsigned i = 0; i < RULES_COUNT; ++i)
+        o << "peephole " << RULES[i].name << ": " << hits[i] << "\n";
+    o << "peephole commands: " << before << " -> " << after << "\n";
+}
+
+bool PeepholeOptimizer::IsDeadAfter(const vector<AsmCmd>& cmds, unsigned pos, RegisterName family) const
+{
+    for (unsigned i = pos + 1; i < cmds.size(); ++i)
+    {
+        const AsmCmd& cmd = cmds[i];
+        if (IsInstr(cmd, ASM_CALL))
+            return target == TARGET_X86 && !UsesReg(cmd.oper[0], family)
+                && (family == REG_EAX || family == REG_EBX || family == REG_ECX || family == REG_EDX);
+        if (!IsAnalyzable(cmd) || ReadsReg(cmd, family)) return false;
+        if (WritesReg(cmd, family) && IsWriteOnly(cmd.command) && IsFullReg(Dest(cmd).reg)) return true;
+    }
+    return false;
+}
+
+AsmOperand PeepholeOptimizer::StackTop() const
+{
+    AsmOperand top;
+    top.type = OPER_MEMORY;
+    top.mem.base_type = OPER_REGISTER;
+    top.mem.base = target == TARGET_X86_64 ? REG_RSP : REG_ESP;
+    top.mem.disp = 0;
+    top.mem.index = 0;
+    top.mem.scale = 0;
+    return top;
+}
+
+bool PeepholeOptimizer::PushPop(vector<AsmCmd>& cmds, unsigned pos) const
+{
+    AsmCmd& push = cmds[pos];
+    AsmCmd& pop = cmds[pos + 1];
+    if (!IsInstr(push, ASM_PUSH) || !IsInstr(pop, ASM_POP) || push.size != pop.size) return false;
+    if (UsesReg(push.oper[0], REG_ESP) || UsesReg(pop.oper[0], REG_ESP)) return false;
+    if (SameOperand(push.oper[0], pop.oper[0]))
+    {
+        cmds.erase(cmds.begin() + pos, cmds.begin() + pos + 2);
+        return true;
+    }
+    if (!IsValidOperands(ASM_MOV, push.oper[0], pop.oper[0])) return false;
+    pop.command = ASM_MOV;
+    pop.oper[1] = pop.oper[0];
+    pop.oper[0] = push.oper[0];
+    cmds.erase(cmds.begin() + pos);
+    return true;
+}
+
+bool PeepholeOptimizer::PushPopDistant(vector<AsmCmd>& cmds, unsigned pos) const
+{
+    const AsmCmd& push = cmds[pos];
+    if (!IsInstr(push, ASM_PUSH)) return false;
+    const AsmOperand& src = push.oper[0];
+    if (UsesReg(src, REG_ESP)) return false;
+    RegisterName src_reg = REG_NONE;
+    RegisterName src_index = REG_NONE;
+    if (src.type == OPER_REGISTER) src_reg = RegFamily(src.reg);
+    else if (src.type == OPER_MEMORY && src.mem.base_type == OPER_REGISTER) src_reg = RegFamily((RegisterName)src.mem.base);
+    if (src.type == OPER_MEMORY && src.mem.scale) src_index = RegFamily((RegisterName)src.mem.index);
+    unsigned end = min((unsigned)cmds.size(), pos + 1 + DISTANT_PUSH_WINDOW);
+    for (unsigned i = pos + 1; i < end; ++i)
+    {
+        AsmCmd& cmd = cmds[i];
+        if (IsInstr(cmd, ASM_POP))
+        {
+            if (i == pos + 1 || cmd.size != push.size || UsesReg(cmd.oper[0], REG_ESP)) return false;
+            if (!IsValidOperands(ASM_MOV, src, cmd.oper[0])) return false;
+            cmd.command = ASM_MOV;
+            cmd.oper[1] = cmd.oper[0];
+            cmd.oper[0] = src;
+            cmds.erase(cmds.begin() + pos);
+            return true;
+        }
+        if (!IsAnalyzable(cmd) || TouchesStack(cmd)) return false;
+        if (src_reg != REG_NONE && WritesReg(cmd, src_reg)) return false;
+        if (src_index != REG_NONE && WritesReg(cmd, src_index)) return false;
+        if (src.type == OPER_MEMORY && WritesMemory(cmd)) return false;
+    }
+    return false;
+}
+
+bool PeepholeOptimizer::PopPush(vector<AsmCmd>& cmds, unsigned pos) const
+{
+    AsmCmd& pop = cmds[pos];
+    const AsmCmd& push = cmds[pos + 1];
+    if (!IsInstr(pop, ASM_POP) || !IsInstr(push, ASM_PUSH) || pop.size != push.size) return false;
+    if (pop.oper[0].type != OPER_REGISTER || !SameOperand(pop.oper[0], push.oper[0])) return false;
+    if (IsReg(pop.oper[0], REG_ESP)) return false;
+    pop.command = ASM_MOV;
+    pop.oper[1] = pop.oper[0];
+    pop.oper[0] = StackTop();
+    cmds.erase(cmds.begin() + pos + 1);
+    return true;
+}
+
+bool PeepholeOptimizer::PushDrop(vector<AsmCmd>& cmds, unsigned pos) const
+{
+    const AsmCmd& push = cmds[pos];
+    AsmCmd& add = cmds[pos + 1];
+    int slot = target == TARGET_X86_64 ? 8 : 4;
+    if (!IsInstr(push, ASM_PUSH) || !IsInstr(add, ASM_ADD)) return false;
+    if (add.oper[0].type != OPER_INT || add.oper[0].value < slot || !IsReg(add.oper[1], REG_ESP)) return false;
+    if (!IsFlagsDeadAt(cmds, pos + 2)) return false;
+    add.oper[0].value -= slot;
+    cmds.erase(cmds.begin() + pos);
+    return true;
+}
+
+bool PeepholeOptimizer::StoreLoad(vector<AsmCmd>& cmds, unsigned pos) const
+{
+    const AsmCmd& first = cmds[pos];
+    const AsmCmd& second = cmds[pos + 1];
+    if (!IsInstr(first, ASM_MOV) || !IsInstr(second, ASM_MOV) || first.size != second.size) return false;
+    if (!SameOperand(first.oper[0], second.oper[1]) || !SameOperand(first.oper[1], second.oper[0])) return false;
+    const AsmOperand& reg = first.oper[0].type == OPER_REGISTER ? first.oper[0] : first.oper[1];
+    const AsmOperand& mem = first.oper[0].type == OPER_REGISTER ? first.oper[1] : first.oper[0];
+    if (reg.type != OPER_REGISTER || !IsGeneralReg(reg.reg)) return false;
+    if (mem.type != OPER_REGISTER && mem.type != OPER_MEMORY) return false;
+    if (AddressUsesReg(mem, RegFamily(reg.reg))) return false;
+    if (target == TARGET_X86_64 && mem.type == OPER_REGISTER && first.size != SIZE_QUARD) return false;
+    cmds.erase(cmds.begin() + pos + 1);
+    return true;
+}
+
+bool PeepholeOptimizer::MoveSelf(vector<AsmCmd>& cmds, unsigned pos) const
+{
+    const AsmCmd& cmd = cmds[pos];
+    if (!IsInstr(cmd, ASM_MOV) || cmd.oper[0].type != OPER_REGISTER || !SameOperand(cmd.oper[0], cmd.oper[1])) return false;
+    if (target == TARGET_X86_64 && cmd.size != SIZE_QUARD) return false;
+    cmds.erase(cmds.begin() + pos);
+    return true;
+}
+
+bool PeepholeOptimizer::CopyPropagation(vector<AsmCmd>& cmds, unsigned pos) const
+{
+    const AsmCmd& first = cmds[pos];
+    AsmCmd& second = cmds[pos + 1];
+    if (!IsInstr(first, ASM_MOV) && !IsInstr(first, ASM_LEA) && !IsInstr(first, ASM_MOVZB)) return false;
+    if (!IsAnalyzable(second) || second.oper[0].type != OPER_REGISTER || first.oper[1].type != OPER_REGISTER) return false;
+    RegisterName reg = first.oper[1].reg;
+    RegisterName family = RegFamily(reg);
+    if (second.oper[0].reg != reg || !IsFullReg(reg) || UsesReg(second.oper[1], family)) return false;
+    if (UsesReg(first.oper[0], REG_ESP) && TouchesStack(second)) return false;
+    if (!IsDeadAfter(cmds, pos + 1, family)) return false;
+    switch (second.command)
+    {
+        case ASM_PUSH:
+            if (first.command != ASM_MOV || first.size != second.size) return false;
+            break;
+        case ASM_MOV:
+            if (first.command == ASM_MOVZB) break;
+            [[fallthrough]];
+        case ASM_ADD: case ASM_SUB: case ASM_AND: case ASM_OR: case ASM_XOR: case ASM_CMP: case ASM_IMUL:
+            if (first.size != second.size || second.oper[1].type == OPER_NONE) return false;
+            if (first.command != ASM_MOV && second.command != ASM_MOV) return false;
+            if (!IsValidOperands(second.command, first.oper[0], second.oper[1])) return false;
+            break;
+        default:
+            return false;
+    }
+    if (first.command != ASM_MOV)
+    {
+        if (second.oper[1].type != OPER_REGISTER) return false;
+        second.command = first.command;
+        second.size = first.size;
+    }
+    second.oper[0] = first.oper[0];
+    cmds.erase(cmds.begin() + pos);
+    return true;
+}
+
+bool PeepholeOptimizer::AddressFold(vector<AsmCmd>& cmds, unsigned pos) const
+{
+    const AsmCmd& first = cmds[pos];
+    AsmCmd& second = cmds[pos + 1];
+    if (first.oper[1].type != OPER_REGISTER || !IsFullReg(first.oper[1].reg)) return false;
+    bool is_lea = IsInstr(first, ASM_LEA) && IsPlainMemory(first.oper[0]) && first.oper[0].mem.base_type != OPER_RIP_LABEL;
+    bool is_label = IsInstr(first, ASM_MOV) && first.oper[0].type == OPER_LABEL && target == TARGET_X86;
+    if (!is_lea && !is_label) return false;
+    if (!IsAnalyzable(second)) return false;
+    RegisterName family = RegFamily(first.oper[1].reg);
+    if (is_lea && AddressUsesReg(first.oper[0], REG_ESP) && TouchesStack(second)) return false;
+    int mem_index = -1;
+    for (int i = 0; i < 2; ++i)
+    {
+        if (AddressUsesReg(second.oper[i], family))
+        {
+            if (mem_index >= 0 || !IsPlainMemory(second.oper[i])) return false;
+            mem_index = i;
+        }
+    }
+    if (mem_index < 0) return false;
+    const AsmOperand& other = second.oper[1 - mem_index];
+    bool rewrites = mem_index == 0 && IsWriteOnly(second.command) && IsReg(other, family) && IsFullReg(other.reg);
+    if (IsReg(other, family) && !rewrites) return false;
+    if (!rewrites && !IsDeadAfter(cmds, pos + 1, family)) return false;
+    AsmOperand& mem = second.oper[mem_index];
+    int disp = mem.mem.disp;
+    if (is_lea)
+        mem = first.oper[0];
+    else
+    {
+        mem.mem.base_type = OPER_LABEL;
+        mem.mem.base = first.oper[0].label;
+        mem.mem.disp = 0;
+    }
+    mem.mem.disp += disp;
+    cmds.erase(cmds.begin() + pos);
+    return true;
+}
+
+bool PeepholeOptimizer::DeadMove(vector<AsmCmd>& cmds, unsigned pos) const
+{
+    const AsmCmd& cmd = cmds[pos];
+    if (!IsInstr(cmd, ASM_MOV) && !IsInstr(cmd, ASM_LEA) && !IsInstr(cmd, ASM_MOVZB)) return false;
+    if (cmd.oper[1].type != OPER_REGISTER || !IsFullReg(cmd.oper[1].reg) || IsReg(cmd.oper[1], REG_ESP)) return false;
+    if (!IsDeadAfter(cmds, pos, RegFamily(cmd.oper[1].reg))) return false;
+    cmds.erase(cmds.begin() + pos);
+    return true;
+}
+
+bool PeepholeOptimizer::AddZero(vector<AsmCmd>& cmds, unsigned pos) const
+{
+    const AsmCmd& cmd = cmds[pos];
+    if (!IsInstr(cmd, ASM_ADD) && !IsInstr(cmd, ASM_SUB)) return false;
+    if (cmd.oper[0].type != OPER_INT || cmd.oper[0].value || !IsFlagsDeadAt(cmds, pos + 1)) return false;
+    cmds.erase(cmds.begin() + pos);
+    return true;
+}
+
+bool PeepholeOptimizer::AddAdd(vector<AsmCmd>& cmds, unsigned pos) const
+{
+    AsmCmd& first = cmds[pos];
+    const AsmCmd& second = cmds[pos + 1];
+    if (!IsInstr(first, ASM_ADD) || !IsInstr(second, ASM_ADD) || first.size != second.size) return false;
+    if (first.oper[0].type != OPER_INT || second.oper[0].type != OPER_INT) return false;
+    if (first.oper[1].type != OPER_REGISTER || !SameOperand(first.oper[1], second.oper[1])) return false;
+    first.oper[0].value += second.oper[0].value;
+    cmds.erase(cmds.begin() + pos + 1);
+    return true;
+}
+
+bool PeepholeOptimizer::SetTestJump(vector<AsmCmd>& cmds, unsigned pos) const
+{
+    const AsmCmd& set = cmds[pos];
+    const AsmCmd& movzb = cmds[pos + 1];
+    const AsmCmd& test = cmds[pos + 2];
+    AsmCmd& jump = cmds[pos + 3];
+    if (set.kind != CMD_INSTRUCTION || !IsSetCmd(set.command) || set.oper[0].type != OPER_REGISTER) return false;
+    if (!IsInstr(movzb, ASM_MOVZB) || !SameOperand(movzb.oper[0], set.oper[0])) return false;
+    if (movzb.oper[1].type != OPER_REGISTER || RegFamily(movzb.oper[1].reg) != RegFamily(set.oper[0].reg)) return false;
+    if (!IsInstr(test, ASM_TEST) || !SameOperand(test.oper[0], movzb.oper[1]) || !SameOperand(test.oper[1], movzb.oper[1])) return false;
+    if (!IsJump(jump) || (jump.command != ASM_JZ && jump.command != ASM_JNZ)) return false;
+    // the generator only tests a condition value right before branching on it, so it is dead on both edges
+    AsmCmdName cmd = SetToJump(set.command);
+    jump.command = jump.command == ASM_JZ ? InverseJump(cmd) : cmd;
+    cmds.erase(cmds.begin() + pos, cmds.begin() + pos + 3);
+    return true;
+}
+
+bool PeepholeOptimizer::JumpOverJump(vector<AsmCmd>& cmds, unsigned pos) const
+{
+    AsmCmd& cond = cmds[pos];
+    const AsmCmd& jump = cmds[pos + 1];
+    if (!IsJump(cond) || cond.command == ASM_JMP || InverseJump(cond.command) == ASM_JMP) return false;
+    if (!IsJump(jump) || jump.command != ASM_JMP || !LabelFollows(cmds, pos + 2, cond.oper[0].label)) return false;
+    cond.command = InverseJump(cond.command);
+    cond.oper[0] = jump.oper[0];
+    cmds.erase(cmds.begin() + pos + 1);
+    return true;
+}
+
+bool PeepholeOptimizer::JumpToNext(vector<AsmCmd>& cmds, unsigned pos) const
+{
+    const AsmCmd& jump = cmds[pos];
+    if (!IsJump(jump) || !LabelFollows(cmds, pos + 1, jump.oper[0].label)) return false;
+    cmds.erase(cmds.begin() + pos);
+    return true;
+}
+
+//---FrameOmitter---
+
+static bool IsRegMove(const AsmCmd& cmd, RegisterName src, RegisterName dest)
+{
+    return IsInstr(cmd, ASM_MOV) && IsReg(cmd.oper[0], src) && IsReg(cmd.oper[1], dest);
+}
+
+static string IntToStr(int value)
+{
+    stringstream s;
+    s << value;
+    return s.str();
+}
+
+static AsmCmd DropStackCmd(int size)
+{
+    AsmCmd res = { CMD_INSTRUCTION, ASM_ADD, SIZE_LONG, {} };
+    res.oper[0].type = OPER_INT;
+    res.oper[0].value = size;
+    res.oper[1].type = OPER_REGISTER;
+    res.oper[1].reg = REG_ESP;
+    return res;
+}
+
+static void RebaseOperand(AsmOperand& oper, int depth)
+{
+    //without the saved %ebp the locals move up to the return address, the params stay where they were
+    if (!AddressUsesReg(oper, REG_EBP)) return;
+    oper.mem.base = REG_ESP;
+    oper.mem.disp += oper.mem.disp < 0 ? depth : depth - 4;
+}
+
+FrameOmitter::FrameOmitter()
+{
+    //the runtime write function is cdecl, the caller drops its arguments
+    callee_pops["printf"] = 0;
+}
+
+unsigned FrameOmitter::FrameSetupSize(const vector<AsmCmd>& cmds, unsigned pos)
+{
+    if (cmds[pos].kind == CMD_LABEL && pos + 2 < cmds.size() && IsInstr(cmds[pos + 1], ASM_PUSH)
+        && IsReg(cmds[pos + 1].oper[0], REG_EBP) && IsRegMove(cmds[pos + 2], REG_ESP, REG_EBP)) return 3;
+    if (cmds[pos].kind == CMD_RAW && pos + 1 < cmds.size() && IsRegMove(cmds[pos + 1], REG_ESP, REG_EBP)) return 2;
+    return 0;
+}
+
+void FrameOmitter::AddDirective(AsmChunk& chunk, vector<AsmCmd>& res, const string& directive)
+{
+    AsmCmd cmd = { CMD_RAW, ASM_ADD, SIZE_NONE, {} };
+    cmd.oper[0].type = OPER_NONE;
+    cmd.oper[0].value = chunk.names.size();
+    cmd.oper[1].type = OPER_NONE;
+    chunk.names.push_back("    " + directive);
+    res.push_back(cmd);
+}
+
+void FrameOmitter::AddCfaOffset(AsmChunk& chunk, vector<AsmCmd>& res, int depth)
+{
+    AddDirective(chunk, res, ".cfi_def_cfa_offset " + IntToStr(depth + 4));
+}
+
+void FrameOmitter::CollectCalleePops(const AsmChunk& chunk)
+{
+    const vector<AsmCmd>& cmds = chunk.commands;
+    for (unsigned pos = 0; pos < cmds.size(); ++pos)
+    {
+        if (cmds[pos].kind != CMD_LABEL || FrameSetupSize(cmds, pos) != 3) continue;
+        unsigned end = pos + 3;
+        while (end < cmds.size() && !IsInstr(cmds[end], ASM_RET)) ++end;
+        if (end == cmds.size()) return;
+        callee_pops[chunk.names[cmds[pos].oper[0].label]] = cmds[end].oper[0].type == OPER_INT ? cmds[end].oper[0].value : 0;
+        pos = end;
+    }
+}
+
+bool FrameOmitter::ComputeDepths(const AsmChunk& chunk, unsigned begin, unsigned end, vector<int>& depths) const
+{
+    const vector<AsmCmd>& cmds = chunk.commands;
+    unsigned setup = FrameSetupSize(cmds, begin);
+    depths.assign(end - begin + 1, -1);
+    map<unsigned, int> labels;
+    int depth = 0;
+    bool reachable = true;
+    unsigned pos = begin + setup;
+    for (; pos < end && !IsRegMove(cmds[pos], REG_EBP, REG_ESP); ++pos)
+    {
+        const AsmCmd& cmd = cmds[pos];
+        if (cmd.kind == CMD_LABEL)
+        {
+            map<unsigned, int>::iterator it = labels.find(cmd.oper[0].label);
+            if (it == labels.end()) labels[cmd.oper[0].label] = depth;
+            else if (reachable && it->second != depth) return false;
+            else depth = it->second;
+            depths[pos - begin] = depth;
+            reachable = true;
+            continue;
+        }
+        if (cmd.kind != CMD_INSTRUCTION) continue;
+        depths[pos - begin] = depth;
+        for (int i = 0; i < 2; ++i)
+            if (IsReg(cmd.oper[i], REG_EBP) || (AddressUsesReg(cmd.oper[i], REG_EBP)
+                && cmd.oper[i].mem.disp >= 0 && cmd.oper[i].mem.disp < 8)) return false;
+        if (IsInstr(cmd, ASM_PUSH))
+            depth += 4;
+        else if (IsInstr(cmd, ASM_POP))
+            depth -= 4;
+        else if (IsInstr(cmd, ASM_CALL))
+        {
+            if (cmd.oper[0].type != OPER_MEMORY || cmd.oper[0].mem.base_type != OPER_LABEL) return false;
+            map<string, int>::const_iterator it = callee_pops.find(chunk.names[cmd.oper[0].mem.base]);
+            if (it == callee_pops.end()) return false;
+            depth -= it->second;
+        }
+        else if (IsJump(cmd))
+        {
+            map<unsigned, int>::iterator it = labels.find(cmd.oper[0].label);
+            if (it == labels.end()) labels[cmd.oper[0].label] = depth;
+            else if (it->second != depth) return false;
+            reachable = cmd.command != ASM_JMP;
+        }
+        else if (IsInstr(cmd, ASM_RET) || (cmd.command >= ASM_JA && cmd.command <= ASM_JZ))
+            return false;
+        else if (IsReg(Dest(cmd), REG_ESP) && cmd.command != ASM_CMP && cmd.command != ASM_TEST)
+        {
+            if ((cmd.command != ASM_ADD && cmd.command != ASM_SUB) || cmd.oper[0].type != OPER_INT) return false;
+            depth += cmd.command == ASM_SUB ? cmd.oper[0].value : -cmd.oper[0].value;
+        }
+        if (depth < 0) return false;
+    }
+    if (pos == end) return false;
+    depths[pos - begin] = depth;
+    if (setup == 3 && !(IsInstr(cmds[++pos], ASM_POP) && IsReg(cmds[pos].oper[0], REG_EBP))) return false;
+    for (++pos; pos < end; ++pos)
+        if (cmds[pos].kind != CMD_INSTRUCTION || TouchesStack(cmds[pos]) || IsInstr(cmds[pos], ASM_CALL)
+            || UsesReg(cmds[pos].oper[0], REG_EBP) || UsesReg(cmds[pos].oper[1], REG_EBP)) return false;
+    return true;
+}
+
+void FrameOmitter::OmitFrame(AsmChunk& chunk, unsigned begin, unsigned end, const vector<int>& depths,
+                             vector<AsmCmd>& res) const
+{
+    const vector<AsmCmd>& cmds = chunk.commands;
+    unsigned setup = FrameSetupSize(cmds, begin);
+    res.push_back(cmds[begin]);
+    AddDirective(chunk, res, ".cfi_startproc");
+    int cfa = 0;
+    unsigned pos = begin + setup;
+    for (; !IsRegMove(cmds[pos], REG_EBP, REG_ESP); ++pos)
+    {
+        AsmCmd cmd = cmds[pos];
+        int depth = depths[pos - begin];
+        if (depth >= 0 && depth != cfa) AddCfaOffset(chunk, res, cfa = depth);
+        if (cmd.kind == CMD_INSTRUCTION)
+            for (int i = 0; i < 2; ++i)
+                RebaseOperand(cmd.oper[i], IsInstr(cmd, ASM_POP) ? depth - 4 : depth);
+        res.push_back(cmd);
+    }
+    int depth = depths[pos - begin];
+    if (depth != cfa) AddCfaOffset(chunk, res, depth);
+    if (depth)
+    {
+        res.push_back(DropStackCmd(depth));
+        AddCfaOffset(chunk, res, 0);
+    }
+    for (pos += setup == 3 ? 2 : 1; pos <= end; ++pos)
+        res.push_back(cmds[pos]);
+    AddDirective(chunk, res, ".cfi_endproc");
+}
+
+void FrameOmitter::KeepFrame(AsmChunk& chunk, unsigned begin, unsigned end, vector<AsmCmd>& res) const
+{
+    const vector<AsmCmd>& cmds = chunk.commands;
+    bool saves_ebp = FrameSetupSize(cmds, begin) == 3;
+    bool reset = false;
+    for (unsigned pos = begin; pos <= end; ++pos)
+    {
+        const AsmCmd& cmd = cmds[pos];
+        res.push_back(cmd);
+        if (pos == begin)
+            AddDirective(chunk, res, ".cfi_startproc");
+        else if (pos == begin + 1 && saves_ebp)
+        {
+            AddDirective(chunk, res, ".cfi_def_cfa_offset 8");
+            AddDirective(chunk, res, ".cfi_offset %ebp, -8");
+        }
+        else if (IsRegMove(cmd, REG_ESP, REG_EBP) && pos <= begin + 2)
+            AddDirective(chunk, res, ".cfi_def_cfa_register %ebp");
+        else if (IsRegMove(cmd, REG_EBP, REG_ESP) && !saves_ebp && !reset)
+        {
+            AddDirective(chunk, res, ".cfi_def_cfa_register %esp");
+            reset = true;
+        }
+        else if (IsInstr(cmd, ASM_POP) && IsReg(cmd.oper[0], REG_EBP) && saves_ebp && !reset)
+        {
+            AddDirective(chunk, res, ".cfi_def_cfa %esp, 4");
+            reset = true;
+        }
+    }
+    AddDirective(chunk, res, ".cfi_endproc");
+}
+
+void FrameOmitter::Process(AsmChunk& chunk)
+{
+    CollectCalleePops(chunk);
+    const vector<AsmCmd>& cmds = chunk.commands;
+    vector<AsmCmd> res;
+    vector<int> depths;
+    for (unsigned pos = 0; pos < cmds.size(); ++pos)
+    {
+        unsigned end = pos + FrameSetupSize(cmds, pos);
+        if (end == pos)
+        {
+            res.push_back(cmds[pos]);
+            continue;
+        }
+        while (end < cmds.size() && !IsInstr(cmds[end], ASM_RET)) ++end;
+        if (end == cmds.size())
+        {
+            res.push_back(cmds[pos]);
+            continue;
+        }
+        if (ComputeDepths(chunk, pos, end, depths)) OmitFrame(chunk, pos, end, depths, res);
+        else KeepFrame(chunk, pos, end, res);
+        pos = end;
+    }
+    chunk.commands.swap(res);
+}
@@ -0,0 +1,64 @@
+#ifndef PEEPHOLE
+#define PEEPHOLE
+
+#include "generator.h"
+#include <ostream>
+#include <vector>
+#include <map>
+#include <string>
+
+using namespace std;
+
+class PeepholeOptimizer{
+private:
+    typedef bool (PeepholeOptimizer::*RuleApply)(vector<AsmCmd>& cmds, unsigned pos) const;
+    struct PeepholeRule{
+        const char* name;
+        unsigned window;
+        RuleApply apply;
+    };
+    static const PeepholeRule RULES[];
+    static const unsigned RULES_COUNT;
+    AsmTarget target;
+    vector<unsigned> hits;
+    unsigned long long before;
+    unsigned long long after;
+    bool IsDeadAfter(const vector<AsmCmd>& cmds, unsigned pos, RegisterName family) const;
+    AsmOperand StackTop() const;
+    bool PushPop(vector<AsmCmd>& cmds, unsigned pos) const;
+    bool PushPopDistant(vector<AsmCmd>& cmds, unsigned pos) const;
+    bool PopPush(vector<AsmCmd>& cmds, unsigned pos) const;
+    bool PushDrop(vector<AsmCmd>& cmds, unsigned pos) const;
+    bool StoreLoad(vector<AsmCmd>& cmds, unsigned pos) const;
+    bool MoveSelf(vector<AsmCmd>& cmds, unsigned pos) const;
+    bool CopyPropagation(vector<AsmCmd>& cmds, unsigned pos) const;
+    bool AddressFold(vector<AsmCmd>& cmds, unsigned pos) const;
+    bool DeadMove(vector<AsmCmd>& cmds, unsigned pos) const;
+    bool AddZero(vector<AsmCmd>& cmds, unsigned pos) const;
+    bool AddAdd(vector<AsmCmd>& cmds, unsigned pos) const;
+    bool SetTestJump(vector<AsmCmd>& cmds, unsigned pos) const;
+    bool JumpOverJump(vector<AsmCmd>& cmds, unsigned pos) const;
+    bool JumpToNext(vector<AsmCmd>& cmds, unsigned pos) const;
+public:
+    PeepholeOptimizer(AsmTarget target_ = TARGET_X86);
+    void SetTarget(AsmTarget target_);
+    void Optimize(vector<AsmCmd>& commands);
+    void PrintStats(ostream& o) const;
+};
+
+class FrameOmitter{
+private:
+    map<string, int> callee_pops;
+    static unsigned FrameSetupSize(const vector<AsmCmd>& cmds, unsigned pos);
+    static void AddDirective(AsmChunk& chunk, vector<AsmCmd>& res, const string& directive);
+    static void AddCfaOffset(AsmChunk& chunk, vector<AsmCmd>& res, int depth);
+    void CollectCalleePops(const AsmChunk& chunk);
+    bool ComputeDepths(const AsmChunk& chunk, unsigned begin, unsigned end, vector<int>& depths) const;
+    void OmitFrame(AsmChunk& chunk, unsigned begin, unsigned end, const vector<int>& depths, vector<AsmCmd>& res) const;
+    void KeepFrame(AsmChunk& chunk, unsigned begin, unsigned end, vector<AsmCmd>& res) const;
+public:
+    FrameOmitter();
+    void Process(AsmChunk& chunk);
+};
+
+#endif
@@ -0,0 +1,159 @@
+#include "pipeline.h"
+
+static const unsigned TOKEN_BATCH_SIZE = 512;
+
+TokenBatch::TokenBatch():
+    failed(false)
+{
+    tokens.reserve(TOKEN_BATCH_SIZE);
+}
+
+//---ScannerStage---
+
+ScannerStage::ScannerStage(istream& input_):
+    input(input_),
+    batch(NULL),
+    next(0)
+{
+    worker = std::thread(&ScannerStage::Run, this);
+}
+
+ScannerStage::~ScannerStage()
+{
+    ring.Close();
+    worker.join();
+    delete batch;
+    while (ring.TryPop(batch))
+        delete batch;
+}
+
+bool ScannerStage::Push(TokenBatch* new_batch)
+{
+    if (ring.Push(new_batch)) return true;
+    delete new_batch;
+    return false;
+}
+
+void ScannerStage::Run()
+{
+    Scanner scan(input);
+    TokenBatch* new_batch = new TokenBatch();
+    try
+    {
+        while (true)
+        {
+            new_batch->tokens.push_back(scan.NextToken());
+            if (new_batch->tokens.back().GetType() == END_OF_FILE) break;
+            if (new_batch->tokens.size() == TOKEN_BATCH_SIZE)
+            {
+                if (!Push(new_batch)) return;
+                new_batch = new TokenBatch();
+            }
+        }
+    }
+    catch (CompilerException& e)
+    {
+        new_batch->failed = true;
+        new_batch->error = e.what();
+    }
+    Push(new_batch);
+}
+
+Token ScannerStage::GetToken()
+{
+    return token;
+}
+
+Token ScannerStage::NextToken()
+{
+    if (token.GetType() == END_OF_FILE) return token;
+    while (batch == NULL || next == batch->tokens.size())
+    {
+        if (batch != NULL && batch->failed) throw CompilerException(batch->error);
+        delete batch;
+        batch = NULL;
+        ring.Pop(batch);
+        next = 0;
+    }
+    token = batch->tokens[next++];
+    return token;
+}
+
+//---EmitterStage---
+
+EmitterStage::EmitterStage(ostream& output_):
+    output(output_),
+    finished(false)
+{
+    worker = std::thread(&EmitterStage::Run, this);
+}
+
+EmitterStage::~EmitterStage()
+{
+    Finish();
+}
+
+void EmitterStage::Run()
+{
+    output.Write(".text\n", 6);
+    while (true)
+    {
+        AsmChunk* chunk;
+        ring.Pop(chunk);
+        if (chunk == NULL) break;
+        AsmCode::PrintCommands(output, *chunk);
+        delete chunk;
+    }
+    output.Flush();
+}
+
+void EmitterStage::Emit(AsmChunk* chunk)
+{
+    ring.Push(chunk);
+}
+
+void EmitterStage::Finish()
+{
+    if (finished) return;
+    finished = true;
+    Emit(NULL);
+    worker.join();
+}
+
+//---ProcGenerator---
+
+ProcGenerator::ProcGenerator(const std::vector<SymProc*>& procs_, const AsmCode& asm_code):
+    procs(procs_),
+    next(0)
+{
+    for (unsigned i = 0; i < procs.size(); ++i)
+        fragments.push_back(asm_code.CreateFragment());
+}
+
+ProcGenerator::~ProcGenerator()
+{
+    for (std::vector<AsmCode*>::iterator it = fragments.begin(); it != fragments.end(); ++it)
+        delete *it;
+}
+
+void ProcGenerator::Run()
+{
+    for (unsigned i = next++; i < procs.size(); i = next++)
+        procs[i]->GenerateDeclaration(*fragments[i]);
+}
+
+void ProcGenerator::Generate(unsigned threads)
+{
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < threads; ++i)
+        workers.push_back(std::thread(&ProcGenerator::Run, this));
+    Run();
+    for (std::vector<std::thread>::iterator it = workers.begin(); it != workers.end(); ++it)
+        it->join();
+}
+
+void ProcGenerator::AppendTo(AsmCode& asm_code)
+{
+    for (std::vector<AsmCode*>::iterator it = fragments.begin(); it != fragments.end(); ++it)
+        asm_code.AppendFragment(**it);
+}
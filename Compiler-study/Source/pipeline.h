@@ -0,0 +1,158 @@
+#ifndef PIPELINE
+#define PIPELINE
+
+#include "scanner.h"
+#include "generator.h"
+#include "sym_table.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <list>
+
+static const unsigned RING_SPIN_LIMIT = 64;
+
+template <class T, unsigned Size>
+class SpscRing{
+private:
+    T items[Size];
+    std::atomic<unsigned> head;
+    std::atomic<unsigned> tail;
+    std::atomic<unsigned> sleepers;
+    std::atomic<bool> closed;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool CanPush() const
+    {
+        return closed || tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire) != Size;
+    }
+    bool CanPop() const
+    {
+        return closed || head.load(std::memory_order_acquire) != tail.load(std::memory_order_acquire);
+    }
+    void Wait(bool (SpscRing::*ready)() const)
+    {
+        for (unsigned i = 0; i < RING_SPIN_LIMIT; ++i)
+        {
+            if ((this->*ready)()) return;
+            std::this_thread::yield();
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        ++sleepers;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (!(this->*ready)())
+            wakeup.wait(lock);
+        --sleepers;
+    }
+    void Wake()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepers.load(std::memory_order_relaxed) == 0) return;
+        std::lock_guard<std::mutex> lock(mutex);
+        wakeup.notify_all();
+    }
+public:
+    SpscRing():
+        head(0),
+        tail(0),
+        sleepers(0),
+        closed(false)
+    {
+    }
+    bool TryPush(const T& item)
+    {
+        unsigned t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == Size) return false;
+        items[t % Size] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+    bool TryPop(T& item)
+    {
+        unsigned h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        item = items[h % Size];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+    bool Push(const T& item)
+    {
+        while (!TryPush(item))
+        {
+            if (closed) return false;
+            Wait(&SpscRing::CanPush);
+        }
+        Wake();
+        return true;
+    }
+    bool Pop(T& item)
+    {
+        while (!TryPop(item))
+        {
+            if (closed) return TryPop(item);
+            Wait(&SpscRing::CanPop);
+        }
+        Wake();
+        return true;
+    }
+    void Close()
+    {
+        closed = true;
+        std::lock_guard<std::mutex> lock(mutex);
+        wakeup.notify_all();
+    }
+};
+
+struct TokenBatch{
+    std::vector<Token> tokens;
+    bool failed;
+    string error;
+    TokenBatch();
+};
+
+class ScannerStage: public TokenStream{
+private:
+    istream& input;
+    SpscRing<TokenBatch*, 64> ring;
+    TokenBatch* batch;
+    unsigned next;
+    Token token;
+    std::thread worker;
+    bool Push(TokenBatch* new_batch);
+    void Run();
+public:
+    ScannerStage(istream& input_);
+    ~ScannerStage();
+    virtual Token GetToken();
+    virtual Token NextToken();
+};
+
+class EmitterStage: public AsmSink{
+private:
+    AsmWriter output;
+    SpscRing<AsmChunk*, 64> ring;
+    bool finished;
+    std::thread worker;
+    void Run();
+public:
+    EmitterStage(ostream& output_);
+    ~EmitterStage();
+    virtual void Emit(AsmChunk* chunk);
+    virtual void Finish();
+};
+
+class ProcGenerator{
+private:
+    const std::vector<SymProc*>& procs;
+    std::vector<AsmCode*> fragments;
+    std::atomic<unsigned> next;
+    void Run();
+public:
+    ProcGenerator(const std::vector<SymProc*>& procs_, const AsmCode& asm_code);
+    ~ProcGenerator();
+    void Generate(unsigned threads);
+    void AppendTo(AsmCode& asm_code);
+};
+
+#endif
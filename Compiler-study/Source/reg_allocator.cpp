@@ -0,0 +1,137 @@
+#include "reg_allocator.h"
+#include "sym_table.h"
+#include <algorithm>
+#include <limits.h>
+
+//a register costs a save and a restore, so a range has to be used in a loop or often enough
+static const int MIN_ALLOCATED_WEIGHT = 4;
+
+//---RegAllocator---
+
+RegAllocator::RegAllocator():
+    pos(1)
+{
+}
+
+void RegAllocator::AddCandidate(SymVar* var, bool live_on_entry)
+{
+    LiveRange range = { var, live_on_entry ? 0 : INT_MAX, -1, 0, REG_NONE };
+    range_index[var] = ranges.size();
+    ranges.push_back(range);
+}
+
+void RegAllocator::AddUse(SymVar* var)
+{
+    map<SymVar*, unsigned>::iterator it = range_index.find(var);
+    if (it == range_index.end()) return;
+    LiveRange& range = ranges[it->second];
+    range.start = min(range.start, pos);
+    range.end = max(range.end, pos);
+    range.weight += 1 << 2 * min<int>(open_loops.size(), 10);
+}
+
+void RegAllocator::AddUses(SyntaxNode* expr)
+{
+    VarsContainer used;
+    expr->GetAllUsedVars(used, addressed);
+    for (VarsContainer::iterator it = used.begin(); it != used.end(); ++it)
+        AddUse(*it);
+}
+
+void RegAllocator::AddResult(SymVar* var)
+{
+    //the epilogue reads the result, and a register also saves the store and load of its frame slot
+    map<SymVar*, unsigned>::iterator it = range_index.find(var);
+    if (it == range_index.end()) return;
+    NextPosition();
+    AddUse(var);
+    ranges[it->second].weight += MIN_ALLOCATED_WEIGHT;
+}
+
+void RegAllocator::NextPosition()
+{
+    ++pos;
+}
+
+void RegAllocator::BeginLoop()
+{
+    open_loops.push_back(pos);
+}
+
+void RegAllocator::EndLoop()
+{
+    loops.push_back(make_pair(open_loops.back(), pos));
+    open_loops.pop_back();
+    ++pos;
+}
+
+void RegAllocator::ExtendOverLoops(LiveRange& range) const
+{
+    //a value used anywhere inside a loop may be live across its back edge
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (vector<pair<int, int> >::const_iterator it = loops.begin(); it != loops.end(); ++it)
+            if (it->first <= range.end && range.start <= it->second
+                && (it->first < range.start || range.end < it->second))
+            {
+                range.start = min(range.start, it->first);
+                range.end = max(range.end, it->second);
+                changed = true;
+            }
+    }
+}
+
+bool RegAllocator::StartLess(const LiveRange* a, const LiveRange* b)
+{
+    return a->start < b->start;
+}
+
+void RegAllocator::Allocate(const RegisterName* regs, int count, vector<RegisterName>& used_regs)
+{
+    vector<LiveRange*> order;
+    for (vector<LiveRange>::iterator it = ranges.begin(); it != ranges.end(); ++it)
+    {
+        it->var->SetAllocatedReg(REG_NONE);
+        if (it->weight < MIN_ALLOCATED_WEIGHT || addressed.find(it->var) != addressed.end()) continue;
+        ExtendOverLoops(*it);
+        order.push_back(&*it);
+    }
+    stable_sort(order.begin(), order.end(), StartLess);
+    vector<RegisterName> free_regs(regs, regs + count);
+    vector<LiveRange*> active;
+    for (vector<LiveRange*>::iterator it = order.begin(); it != order.end(); ++it)
+    {
+        LiveRange* range = *it;
+        for (int i = active.size() - 1; 0 <= i; --i)
+            if (active[i]->end < range->start)
+            {
+                free_regs.push_back(active[i]->reg);
+                active.erase(active.begin() + i);
+            }
+        if (!free_regs.empty())
+        {
+            range->reg = free_regs.front();
+            free_regs.erase(free_regs.begin());
+            active.push_back(range);
+            continue;
+        }
+        size_t lightest = 0;
+        for (size_t i = 1; i < active.size(); ++i)
+            if (active[i]->weight < active[lightest]->weight) lightest = i;
+        if (active.empty() || active[lightest]->weight >= range->weight) continue;
+        range->reg = active[lightest]->reg;
+        active[lightest]->reg = REG_NONE;
+        active[lightest] = range;
+    }
+    for (vector<LiveRange*>::iterator it = order.begin(); it != order.end(); ++it)
+        (*it)->var->SetAllocatedReg((*it)->reg);
+    for (int i = 0; i < count; ++i)
+        for (vector<LiveRange*>::iterator it = order.begin(); it != order.end(); ++it)
+            if ((*it)->reg == regs[i])
+            {
+                used_regs.push_back(regs[i]);
+                break;
+            }
+}
@@ -0,0 +1,39 @@
+#ifndef REG_ALLOCATOR
+#define REG_ALLOCATOR
+
+#include "syntax_node_base.h"
+#include <map>
+#include <vector>
+
+using namespace std;
+
+class RegAllocator{
+private:
+    struct LiveRange{
+        SymVar* var;
+        int start;
+        int end;
+        int weight;
+        RegisterName reg;
+    };
+    vector<LiveRange> ranges;
+    map<SymVar*, unsigned> range_index;
+    VarsContainer addressed;
+    vector<pair<int, int> > loops;
+    vector<int> open_loops;
+    int pos;
+    void ExtendOverLoops(LiveRange& range) const;
+    static bool StartLess(const LiveRange* a, const LiveRange* b);
+public:
+    RegAllocator();
+    void AddCandidate(SymVar* var, bool live_on_entry);
+    void AddUse(SymVar* var);
+    void AddUses(SyntaxNode* expr);
+    void AddResult(SymVar* var);
+    void NextPosition();
+    void BeginLoop();
+    void EndLoop();
+    void Allocate(const RegisterName* regs, int count, vector<RegisterName>& used_regs);
+};
+
+#endif
@@ -99,7 +99,11 @@ const string TOKEN_VALUE_DESCRIPTION[] =
     "TOK_INTEGER",
     "TOK_REAL",
     "TOK_WRITE",
-    "TOK_WRITELN"
+    "TOK_WRITELN",
+    "TOK_UNIT",
+    "TOK_USES",
+    "TOK_INTERFACE",
+    "TOK_IMPLEMENTATION"
 };
 
 const string TOKEN_TO_STR[] = 
@@ -164,12 +168,16 @@ const string TOKEN_TO_STR[] =
     "=",
     "<=",
     ">=",
-    "<>"
+    "<>",
     "UNRESERVED",
     "integer",
     "real",
     "write",
-    "writeln"
+    "writeln",
+    "unit",
+    "uses",
+    "interface",
+    "implementation"
 };
 
 //---Reserved words--
@@ -246,6 +254,10 @@ ReservedWords::ReservedWords()
     Add("<>", OPERATION, TOK_NOT_EQUAL);
     Add("write", IDENTIFIER, TOK_WRITE);
     Add("writeln", IDENTIFIER, TOK_WRITELN);    
+    Add("unit", RESERVED_WORD, TOK_UNIT);
+    Add("uses", RESERVED_WORD, TOK_USES);
+    Add("interface", RESERVED_WORD, TOK_INTERFACE);
+    Add("implementation", RESERVED_WORD, TOK_IMPLEMENTATION);
 }
 
 bool ReservedWords::Identify(string& str, TokenType& returned_type, TokenValue& returned_value)
@@ -400,6 +412,12 @@ void Token::NameToLowerCase()
     while (name[++i]) name[i] = tolower(name[i]);
 }
 
+void Token::SetPosition(int line_, int pos_)
+{
+    line = line_;
+    pos = pos_;
+}
+
 int Token::GetIntValue() const
 {    
     if (name[0] != '$') return atoi(name);
@@ -462,6 +480,7 @@ void Scanner::ReduceBuffer()
 void Scanner::MakeToken(TokenType type, TokenValue value)
 {
     token = Token(buffer.c_str(), type, value, first_line, first_pos);
+    token_offset = first_offset;
     buffer.clear();
     buffer_low.clear();
     state = NONE_ST;
@@ -502,16 +521,36 @@ Scanner::Scanner(istream& input):
     in(input),
     line(1),
     pos(0),
+    offset(-1),
+    first_offset(0),
+    token_offset(0),
     state(NONE_ST),
     c(0)
 {
 }
 
+Scanner::Scanner(istream& input, int line_, int pos_, int offset_):
+    in(input),
+    line(line_),
+    pos(pos_ - 1),
+    offset(offset_ - 1),
+    first_offset(offset_),
+    token_offset(offset_),
+    c(0),
+    state(NONE_ST)
+{
+}
+
 Token Scanner::GetToken()
 {
     return token;
 }
 
+int Scanner::GetTokenOffset() const
+{
+    return token_offset;
+}
+
 void Scanner::EatLineComment()
 {
     if (c =='/' && in.peek() == '/')
@@ -710,6 +749,7 @@ void Scanner::ExtractChar()
 {
     c = in.get();
     ++pos;
+    ++offset;
 }
 
 Token Scanner::NextToken()
@@ -758,6 +798,7 @@ Token Scanner::NextToken()
             {
                 first_pos = pos;
                 first_line = line;
+                first_offset = offset;
                 if (in.eof())
                 {
                     state = EOF_ST;
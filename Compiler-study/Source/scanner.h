@@ -90,7 +90,11 @@ enum TokenValue{
     TOK_INTEGER, 
     TOK_REAL,
     TOK_WRITE,
-    TOK_WRITELN
+    TOK_WRITELN,
+    TOK_UNIT,
+    TOK_USES,
+    TOK_INTERFACE,
+    TOK_IMPLEMENTATION
 };
 
 extern const string TOKEN_TO_STR[];
@@ -133,19 +137,26 @@ public:
     Token(int value_);
     Token(float value_);
     Token& operator=(const Token& token);
-    ~Token();
+    virtual ~Token();
     TokenType GetType() const;
     TokenValue GetValue() const;
     int GetPos() const;
     int GetLine() const;
     void NameToLowerCase();
+    void SetPosition(int line_, int pos_);
     virtual const char* GetName() const;
     virtual int GetIntValue() const;
     virtual float GetRealValue() const;
     void ChangeSign();
 };
 
-class Scanner{
+class TokenStream{
+public:
+    virtual Token GetToken() = 0;
+    virtual Token NextToken() = 0;
+};
+
+class Scanner: public TokenStream{
 public:
     enum State {
         IDENTIFIER_ST,
@@ -166,6 +177,9 @@ private:
     Token token;
     int line;
     int pos;
+    int offset;
+    int first_offset;
+    int token_offset;
     char c;
     State state;
     void AddToBuffer(char c);
@@ -186,8 +200,10 @@ private:
     void EatOperation();
 public:
     Scanner(istream& input);
+    Scanner(istream& input, int line_, int pos_, int offset_);
     Token GetToken();
     Token NextToken();
+    int GetTokenOffset() const;
 };
 
 #endif
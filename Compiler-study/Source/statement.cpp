@@ -1,4 +1,21 @@
 #include "statement.h"
+#include "reg_allocator.h"
+
+static void GenerateToAllocatedReg(AsmCode& asm_code, const SyntaxNode* value, RegisterName reg)
+{
+    if (value->GetRegNeed(asm_code) == 0)
+        value->GenerateToReg(asm_code, &reg, 1);
+    else if (value->GetRegNeed(asm_code) == REG_NEED_STACK)
+    {
+        value->GenerateValue(asm_code);
+        asm_code.AddCmd(ASM_POP, reg);
+    }
+    else
+    {
+        value->GenerateToReg(asm_code, asm_code.GetExprRegs(), asm_code.GetExprRegsCount());
+        asm_code.AddCmd(ASM_MOV, asm_code.GetExprRegs()[0], reg);
+    }
+}
 
 void StmtAssign::Optimize()
 {
@@ -13,6 +30,12 @@ StmtAssign::StmtAssign(SyntaxNode* left_, SyntaxNode* right_):
 {
 }
 
+StmtAssign::~StmtAssign()
+{
+    delete left;
+    delete right;
+}
+
 const SyntaxNode* StmtAssign::GetLeft() const
 {
     return left;
@@ -32,9 +55,69 @@ void StmtAssign::Print(ostream& o, int offset) const
 
 void StmtAssign::Generate(AsmCode& asm_code)
 {
+    RegisterName reg = left->GetAffectedVar()->GetAllocatedReg();
+    if (reg != REG_NONE)
+    {
+        GenerateToAllocatedReg(asm_code, right, reg);
+        return;
+    }
+    if (right->CanConstructIn(left))
+    {
+        right->ConstructIn(asm_code, left);
+        return;
+    }
+    unsigned size = left->GetSymType()->GetSize();
+    if (size == 4 && left->GetAddressRegNeed(asm_code) != REG_NEED_STACK)
+    {
+        const RegisterName* regs = asm_code.GetExprRegs();
+        int count = asm_code.GetExprRegsCount();
+        //the address is computed with the value held in regs[0], so it must not contain a call
+        if (right->GetRegNeed(asm_code) == REG_NEED_STACK || left->GetAddressRegNeed(asm_code) >= count)
+        {
+            right->GenerateValue(asm_code);
+            asm_code.AddCmd(ASM_POP, left->GenerateAddress(asm_code, regs, count));
+        }
+        else
+        {
+            right->GenerateToReg(asm_code, regs, count);
+            asm_code.AddCmd(ASM_MOV, regs[0], left->GenerateAddress(asm_code, regs + 1, count - 1));
+        }
+        return;
+    }
+    if (size > 4 && right->IsLValue() && !left->IsHaveSideEffect())
+    {
+        right->GenerateLValue(asm_code);
+        left->GenerateLValue(asm_code);
+        asm_code.MoveMemory(size);
+        return;
+    }
     right->GenerateValue(asm_code);
     left->GenerateLValue(asm_code);
-    asm_code.MoveToMemoryFromStack(left->GetSymType()->GetSize());
+    asm_code.MoveToMemoryFromStack(size);
+}
+
+void StmtAssign::Generate(VmCode& code)
+{
+    if (right->CanConstructIn(left))
+    {
+        right->ConstructIn(code, left);
+        return;
+    }
+    unsigned size = left->GetSymType()->GetSize();
+    VmReg value = right->GenerateValue(code);
+    if (size == 4)
+    {
+        code.AddStore(value, left->GenerateLValue(code));
+        return;
+    }
+    if (left->IsHaveSideEffect())
+    {
+        VmReg copy = code.NewReg();
+        code.AddCmd(VM_LEA, copy, code.AllocTemp(size));
+        code.AddCmd(VM_COPY, copy, value, size);
+        value = copy;
+    }
+    code.AddCmd(VM_COPY, left->GenerateLValue(code), value, size);
 }
 
 bool StmtAssign::IsHaveSideEffect()
@@ -56,6 +139,13 @@ void StmtAssign::GetAllDependences(VarsContainer& res_cont, bool with_self)
     left->GetAllDependences(res_cont, false);
 }
 
+void StmtAssign::CollectLiveRanges(RegAllocator& allocator)
+{
+    allocator.AddUses(right);
+    allocator.AddUses(left);
+    allocator.NextPosition();
+}
+
 StmtClassName StmtAssign::GetClassName() const
 {
     return STMT_ASSIGN;
@@ -68,6 +158,12 @@ bool StmtAssign::CanBeReplaced()
 
 //---StmtBlock---
 
+StmtBlock::~StmtBlock()
+{
+    for (std::vector<NodeStatement*>::iterator it = statements.begin(); it != statements.end(); ++it)
+        delete *it;
+}
+
 void StmtBlock::Optimize()
 {
     OptimizeLoops();
@@ -122,7 +218,11 @@ void StmtBlock::AddStatement(NodeStatement* new_stmt)
 {
     if (new_stmt == NULL) return;
     if (new_stmt->GetClassName() == STMT_BLOCK)
+    {
         CopyContent((StmtBlock*)new_stmt);
+        ((StmtBlock*)new_stmt)->Release();
+        delete new_stmt;
+    }
     else
         statements.push_back(new_stmt);
 }
@@ -133,6 +233,11 @@ void StmtBlock::CopyContent(StmtBlock* src)
       AddStatement(*it);
 }
 
+void StmtBlock::Release()
+{
+    statements.clear();
+}
+
 
 /*void StmtBlock::Print(ostream& o, int offset)
 {
@@ -179,6 +284,22 @@ void StmtBlock::Generate(AsmCode& asm_code)
         (*it)->Generate(asm_code);
 }
 
+void StmtBlock::Generate(VmCode& code)
+{
+    for (vector<NodeStatement*>::const_iterator it = statements.begin(); it != statements.end(); ++it)
+    {
+        unsigned mark = code.GetRegMark();
+        (*it)->Generate(code);
+        code.ReleaseRegs(mark);
+    }
+}
+
+void StmtBlock::CollectLiveRanges(RegAllocator& allocator)
+{
+    for (vector<NodeStatement*>::const_iterator it = statements.begin(); it != statements.end(); ++it)
+        (*it)->CollectLiveRanges(allocator);
+}
+
 bool StmtBlock::IsHaveSideEffect()
 {
     for (std::vector<NodeStatement*>::iterator it = statements.begin(); it != statements.end(); ++it)
@@ -223,6 +344,11 @@ StmtExpression::StmtExpression(SyntaxNode* expression):
 {
 }
 
+StmtExpression::~StmtExpression()
+{
+    delete expr;
+}
+
 void StmtExpression::Print(ostream& o, int offset) const
 {
     expr->Print(o, offset);
@@ -231,7 +357,19 @@ void StmtExpression::Print(ostream& o, int offset) const
 void StmtExpression::Generate(AsmCode& asm_code)
 {
     expr->GenerateValue(asm_code);
-    asm_code.AddCmd(ASM_ADD, expr->GetSymType()->GetSize(), REG_ESP);
+    unsigned size = asm_code.GetStackSize(expr->GetSymType()->GetSize());
+    if (size) asm_code.AddCmd(ASM_ADD, size, REG_ESP);
+}
+
+void StmtExpression::Generate(VmCode& code)
+{
+    expr->GenerateValue(code);
+}
+
+void StmtExpression::CollectLiveRanges(RegAllocator& allocator)
+{
+    allocator.AddUses(expr);
+    allocator.NextPosition();
 }
 
 bool StmtExpression::IsHaveSideEffect()
@@ -277,6 +415,12 @@ void StmtLoop::ObtainLabels(AsmCode& asm_code)
     continue_label = asm_code.GenLabel("continue");;
 }
 
+void StmtLoop::ObtainLabels(VmCode& code)
+{
+    vm_break_label = code.GenLabel();
+    vm_continue_label = code.GenLabel();
+}
+
 void StmtLoop::CalculateDependences(set<SymVar*>& affected_cont, set<SymVar*>& deps)
 {
 }
@@ -300,15 +444,22 @@ void StmtLoop::TakeOutVars(std::vector<NodeStatement*>& before_loop)
         if (fixed) new_body->AddStatement(stmt);
         else before_loop.push_back(stmt);
     }
+    body->Release();
     delete body;
-    body = new_body;    
+    body = new_body;
 }
 
-StmtLoop::StmtLoop(NodeStatement* body_)
+StmtLoop::StmtLoop(NodeStatement* body_):
+    body(NULL)
 {
     AddBody(body_);
 }
 
+StmtLoop::~StmtLoop()
+{
+    delete body;
+}
+
 AsmStrImmediate StmtLoop::GetBreakLabel() const
 {
     return break_label;
@@ -319,6 +470,16 @@ AsmStrImmediate StmtLoop::GetContinueLabel() const
     return continue_label;
 }
 
+VmLabel StmtLoop::GetVmBreakLabel() const
+{
+    return vm_break_label;
+}
+
+VmLabel StmtLoop::GetVmContinueLabel() const
+{
+    return vm_continue_label;
+}
+
 bool StmtLoop::IsDummyLoop()
 {
     if (IsConditionAffectToVars()) return false;
@@ -373,6 +534,12 @@ StmtFor::StmtFor(SymVar* index_, SyntaxNode* init_value, SyntaxNode* last_value,
 {
 }
 
+StmtFor::~StmtFor()
+{
+    delete init_val;
+    delete last_val;
+}
+
 void StmtFor::Print(ostream& o, int offset) const
 {
     PrintSpaces(o, offset) << "for " << (inc ? "to \n" : "downto \n");
@@ -382,31 +549,126 @@ void StmtFor::Print(ostream& o, int offset) const
     body->Print(o, offset);
 }
 
+void StmtFor::GenerateCheck(AsmCode& asm_code, RegisterName value, const AsmStrImmediate& label, bool leave) const
+{
+    bool is_const = last_val->IsConst();
+    if (is_const) asm_code.AddCmd(ASM_CMP, last_val->ComputeIntConstExpr(), value);
+    else asm_code.AddCmd(ASM_CMP, value, AsmMemory(REG_ESP));
+    AsmCmdName in_range = is_const == inc ? ASM_JNG : ASM_JNL;
+    asm_code.AddCmd(leave ? InverseJump(in_range) : in_range, label, SIZE_NONE);
+}
+
 void StmtFor::Generate(AsmCode& asm_code)
 {
+    if (index->GetAllocatedReg() != REG_NONE)
+    {
+        GenerateInReg(asm_code);
+        return;
+    }
     init_val->GenerateValue(asm_code);
     index->GenerateLValue(asm_code);
     asm_code.AddCmd(ASM_POP, REG_EAX);
     asm_code.AddCmd(ASM_POP, REG_EBX);
     asm_code.AddCmd(ASM_MOV, REG_EBX, AsmMemory(REG_EAX));
-    AsmStrImmediate start_label(asm_code.GenLabel("for_check"));
+    AsmStrImmediate start_label(asm_code.GenLabel("for_start"));
     ObtainLabels(asm_code);
-    last_val->GenerateValue(asm_code);
-    asm_code.AddCmd(ASM_JMP, continue_label, SIZE_NONE);
+    if (!asm_code.IsOptimize())
+    {
+        GenerateUnrotated(asm_code, start_label);
+        return;
+    }
+    if (!last_val->IsConst()) last_val->GenerateValue(asm_code);
+    index->GenerateValue(asm_code);
+    asm_code.AddCmd(ASM_POP, REG_EAX);
+    GenerateCheck(asm_code, REG_EAX, break_label, true);
+    asm_code.AlignLoop();
     asm_code.AddLabel(start_label);
     body->Generate(asm_code);
+    asm_code.AddLabel(continue_label);
     index->GenerateLValue(asm_code);
+    index->GenerateValue(asm_code);
     asm_code.AddCmd(ASM_POP, REG_EAX);
-    if (inc) asm_code.AddCmd(ASM_ADD, 1, AsmMemory(REG_EAX));
-    else asm_code.AddCmd(ASM_SUB, 1, AsmMemory(REG_EAX));
+    asm_code.AddCmd(inc ? ASM_ADD : ASM_SUB, 1, REG_EAX);
+    asm_code.AddCmd(ASM_POP, REG_EBX);
+    asm_code.AddCmd(ASM_MOV, REG_EAX, AsmMemory(REG_EBX));
+    GenerateCheck(asm_code, REG_EAX, start_label, false);
+    asm_code.AddLabel(break_label);
+    if (!last_val->IsConst()) asm_code.AddCmd(ASM_ADD, asm_code.GetStackSize(4), REG_ESP);
+}
+
+void StmtFor::GenerateUnrotated(AsmCode& asm_code, const AsmStrImmediate& start_label)
+{
+    AsmStrImmediate check_label(asm_code.GenLabel("for_check"));
+    last_val->GenerateValue(asm_code);
+    asm_code.AddCmd(ASM_JMP, check_label, SIZE_NONE);
+    asm_code.AddLabel(start_label);
+    body->Generate(asm_code);
     asm_code.AddLabel(continue_label);
+    index->GenerateLValue(asm_code);
+    asm_code.AddCmd(ASM_POP, REG_EAX);
+    asm_code.AddCmd(inc ? ASM_ADD : ASM_SUB, 1, AsmMemory(REG_EAX));
+    asm_code.AddLabel(check_label);
     index->GenerateValue(asm_code);
     asm_code.AddCmd(ASM_POP, REG_EAX);
     asm_code.AddCmd(ASM_CMP, REG_EAX, AsmMemory(REG_ESP));
-    if (inc) asm_code.AddCmd(ASM_JNL, start_label, SIZE_NONE);
-    else asm_code.AddCmd(ASM_JNG, start_label, SIZE_NONE);
+    asm_code.AddCmd(inc ? ASM_JNL : ASM_JNG, start_label, SIZE_NONE);
     asm_code.AddLabel(break_label);
-    asm_code.AddCmd(ASM_ADD, 4, REG_ESP);
+    asm_code.AddCmd(ASM_ADD, asm_code.GetStackSize(4), REG_ESP);
+}
+
+void StmtFor::GenerateInReg(AsmCode& asm_code)
+{
+    RegisterName reg = index->GetAllocatedReg();
+    GenerateToAllocatedReg(asm_code, init_val, reg);
+    AsmStrImmediate start_label(asm_code.GenLabel("for_start"));
+    ObtainLabels(asm_code);
+    if (!last_val->IsConst()) last_val->GenerateValue(asm_code);
+    GenerateCheck(asm_code, reg, break_label, true);
+    asm_code.AlignLoop();
+    asm_code.AddLabel(start_label);
+    body->Generate(asm_code);
+    asm_code.AddLabel(continue_label);
+    asm_code.AddCmd(inc ? ASM_ADD : ASM_SUB, 1, reg);
+    GenerateCheck(asm_code, reg, start_label, false);
+    asm_code.AddLabel(break_label);
+    if (!last_val->IsConst()) asm_code.AddCmd(ASM_ADD, asm_code.GetStackSize(4), REG_ESP);
+}
+
+void StmtFor::Generate(VmCode& code)
+{
+    VmReg value = init_val->GenerateValue(code);
+    code.AddStore(value, index->GenerateLValue(code));
+    VmLabel start_label = code.GenLabel();
+    ObtainLabels(code);
+    VmReg last = last_val->GenerateValue(code);
+    unsigned mark = code.GetRegMark();
+    value = index->GenerateValue(code);
+    code.AddCmd(inc ? VM_GE : VM_LE, value, last, value);
+    code.AddJump(VM_JZ, vm_break_label, value);
+    code.ReleaseRegs(mark);
+    code.AddLabel(start_label);
+    body->Generate(code);
+    code.AddLabel(vm_continue_label);
+    value = index->GenerateValue(code);
+    code.AddCmd(VM_ADDI, value, value, inc ? 1 : -1);
+    code.AddStore(value, index->GenerateLValue(code));
+    code.AddCmd(inc ? VM_GE : VM_LE, value, last, value);
+    code.AddJump(VM_JNZ, start_label, value);
+    code.ReleaseRegs(mark);
+    code.AddLabel(vm_break_label);
+}
+
+void StmtFor::CollectLiveRanges(RegAllocator& allocator)
+{
+    allocator.AddUses(init_val);
+    allocator.AddUses(last_val);
+    allocator.AddUse(index);
+    allocator.NextPosition();
+    allocator.BeginLoop();
+    body->CollectLiveRanges(allocator);
+    allocator.AddUse(index);
+    allocator.NextPosition();
+    allocator.EndLoop();
 }
 
 bool StmtFor::IsHaveSideEffect()
@@ -464,6 +726,11 @@ StmtWhile::StmtWhile(SyntaxNode* condition_, NodeStatement* body_):
 {
 }
 
+StmtWhile::~StmtWhile()
+{
+    delete condition;
+}
+
 void StmtWhile::Print(ostream& o, int offset) const
 {
     PrintSpaces(o, offset) << "while\n";
@@ -474,16 +741,46 @@ void StmtWhile::Print(ostream& o, int offset) const
 void StmtWhile::Generate(AsmCode& asm_code)
 {
     ObtainLabels(asm_code);
-    asm_code.AddLabel(continue_label);
-    condition->GenerateValue(asm_code);
-    asm_code.AddCmd(ASM_POP, REG_EAX);
-    asm_code.AddCmd(ASM_TEST, REG_EAX, REG_EAX);
-    asm_code.AddCmd(ASM_JZ, break_label, SIZE_NONE);
+    if (!asm_code.IsOptimize())
+    {
+        asm_code.AddLabel(continue_label);
+        condition->GenerateJumpIfFalse(asm_code, break_label);
+        body->Generate(asm_code);
+        asm_code.AddCmd(ASM_JMP, continue_label, SIZE_NONE);
+        asm_code.AddLabel(break_label);
+        return;
+    }
+    AsmStrImmediate start_label(asm_code.GenLabel("while_start"));
+    condition->GenerateJumpIfFalse(asm_code, break_label);
+    asm_code.AlignLoop();
+    asm_code.AddLabel(start_label);
     body->Generate(asm_code);
-    asm_code.AddCmd(ASM_JMP, continue_label, SIZE_NONE);
+    asm_code.AddLabel(continue_label);
+    condition->GenerateJumpIfTrue(asm_code, start_label);
     asm_code.AddLabel(break_label);
 }
 
+void StmtWhile::Generate(VmCode& code)
+{
+    ObtainLabels(code);
+    VmLabel start_label = code.GenLabel();
+    condition->GenerateJumpIfFalse(code, vm_break_label);
+    code.AddLabel(start_label);
+    body->Generate(code);
+    code.AddLabel(vm_continue_label);
+    condition->GenerateJumpIfTrue(code, start_label);
+    code.AddLabel(vm_break_label);
+}
+
+void StmtWhile::CollectLiveRanges(RegAllocator& allocator)
+{
+    allocator.BeginLoop();
+    allocator.AddUses(condition);
+    allocator.NextPosition();
+    body->CollectLiveRanges(allocator);
+    allocator.EndLoop();
+}
+
 bool StmtWhile::IsHaveSideEffect()
 {
     return condition->IsHaveSideEffect() || body->IsHaveSideEffect();
@@ -515,7 +812,7 @@ void StmtWhile::Optimize()
 //---StmtUntil---
 
 StmtUntil::StmtUntil(SyntaxNode* condition_, NodeStatement* body_):
-    StmtWhile(condition, body_)
+    StmtWhile(condition_, body_)
 {
 }
 
@@ -535,16 +832,34 @@ void StmtUntil::Generate(AsmCode& asm_code)
 {
     ObtainLabels(asm_code);
     AsmStrImmediate start_label(asm_code.GenLabel("until_start"));
+    asm_code.AlignLoop();
     asm_code.AddLabel(start_label);
     body->Generate(asm_code);
     asm_code.AddLabel(continue_label);
-    condition->GenerateValue(asm_code);
-    asm_code.AddCmd(ASM_POP, REG_EAX);
-    asm_code.AddCmd(ASM_TEST, REG_EAX, REG_EAX);
-    asm_code.AddCmd(ASM_JZ, start_label, SIZE_NONE);
+    condition->GenerateJumpIfFalse(asm_code, start_label);
     asm_code.AddLabel(break_label);
 }
 
+void StmtUntil::Generate(VmCode& code)
+{
+    ObtainLabels(code);
+    VmLabel start_label = code.GenLabel();
+    code.AddLabel(start_label);
+    body->Generate(code);
+    code.AddLabel(vm_continue_label);
+    condition->GenerateJumpIfFalse(code, start_label);
+    code.AddLabel(vm_break_label);
+}
+
+void StmtUntil::CollectLiveRanges(RegAllocator& allocator)
+{
+    allocator.BeginLoop();
+    body->CollectLiveRanges(allocator);
+    allocator.AddUses(condition);
+    allocator.NextPosition();
+    allocator.EndLoop();
+}
+
 //---StmtIf---
 
 bool StmtIf::OptimizeIf(NodeStatement*& res)
@@ -570,6 +885,13 @@ StmtIf::StmtIf(SyntaxNode* condition_, NodeStatement* then_branch_, NodeStatemen
 {
 }
 
+StmtIf::~StmtIf()
+{
+    delete condition;
+    delete then_branch;
+    delete else_branch;
+}
+
 void StmtIf::Print(ostream& o, int offset) const
 {
     if (then_branch == NULL)
@@ -591,19 +913,73 @@ void StmtIf::Print(ostream& o, int offset) const
 void StmtIf::Generate(AsmCode& asm_code)
 {
     if (then_branch == NULL) return;
+    AsmStrImmediate target;
+    bool optimize = asm_code.IsOptimize();
+    if (optimize && else_branch == NULL && then_branch->GetJumpTarget(target))
+    {
+        condition->GenerateJumpIfTrue(asm_code, target);
+        return;
+    }
+    if (optimize && else_branch != NULL && else_branch->GetJumpTarget(target))
+    {
+        condition->GenerateJumpIfFalse(asm_code, target);
+        then_branch->Generate(asm_code);
+        return;
+    }
     AsmStrImmediate label_else(asm_code.GenLabel("else"));
-    AsmStrImmediate label_fin(asm_code.GenLabel("fin"));
-    condition->GenerateValue(asm_code);
-    asm_code.AddCmd(ASM_POP, REG_EAX);
-    asm_code.AddCmd(ASM_TEST, REG_EAX, REG_EAX);
-    asm_code.AddCmd(ASM_JZ, label_else, SIZE_NONE);
+    condition->GenerateJumpIfFalse(asm_code, label_else);
     then_branch->Generate(asm_code);
+    if (else_branch == NULL)
+    {
+        asm_code.AddLabel(label_else);
+        return;
+    }
+    AsmStrImmediate label_fin(asm_code.GenLabel("fin"));
     asm_code.AddCmd(ASM_JMP, label_fin, SIZE_NONE);
     asm_code.AddLabel(label_else);
-    if (else_branch != NULL) else_branch->Generate(asm_code);
+    else_branch->Generate(asm_code);
     asm_code.AddLabel(label_fin);
 }
 
+void StmtIf::Generate(VmCode& code)
+{
+    if (then_branch == NULL) return;
+    VmLabel target;
+    if (else_branch == NULL && then_branch->GetJumpTarget(code, target))
+    {
+        condition->GenerateJumpIfTrue(code, target);
+        return;
+    }
+    if (else_branch != NULL && else_branch->GetJumpTarget(code, target))
+    {
+        condition->GenerateJumpIfFalse(code, target);
+        then_branch->Generate(code);
+        return;
+    }
+    VmLabel label_else = code.GenLabel();
+    condition->GenerateJumpIfFalse(code, label_else);
+    then_branch->Generate(code);
+    if (else_branch == NULL)
+    {
+        code.AddLabel(label_else);
+        return;
+    }
+    VmLabel label_fin = code.GenLabel();
+    code.AddJump(VM_JMP, label_fin);
+    code.AddLabel(label_else);
+    else_branch->Generate(code);
+    code.AddLabel(label_fin);
+}
+
+void StmtIf::CollectLiveRanges(RegAllocator& allocator)
+{
+    if (then_branch == NULL) return;
+    allocator.AddUses(condition);
+    allocator.NextPosition();
+    then_branch->CollectLiveRanges(allocator);
+    if (else_branch != NULL) else_branch->CollectLiveRanges(allocator);
+}
+
 bool StmtIf::IsHaveSideEffect()
 {
     return condition->IsHaveSideEffect() ||
@@ -663,10 +1039,30 @@ void StmtJump::Print(ostream& o, int offset) const
 
 void StmtJump::Generate(AsmCode& asm_code)
 {
-    AsmStrImmediate label = op.GetValue() == TOK_BREAK ? loop->GetBreakLabel() : loop->GetContinueLabel();
+    AsmStrImmediate label;
+    GetJumpTarget(label);
     asm_code.AddCmd(ASM_JMP, label, SIZE_NONE);
 }
 
+void StmtJump::Generate(VmCode& code)
+{
+    VmLabel label;
+    GetJumpTarget(code, label);
+    code.AddJump(VM_JMP, label);
+}
+
+bool StmtJump::GetJumpTarget(AsmStrImmediate& label) const
+{
+    label = op.GetValue() == TOK_BREAK ? loop->GetBreakLabel() : loop->GetContinueLabel();
+    return true;
+}
+
+bool StmtJump::GetJumpTarget(VmCode& code, VmLabel& label) const
+{
+    label = op.GetValue() == TOK_BREAK ? loop->GetVmBreakLabel() : loop->GetVmContinueLabel();
+    return true;
+}
+
 void StmtJump::GetAllAffectedVars(VarsContainer& res_cont)
 {
 }
@@ -698,6 +1094,23 @@ void StmtExit::Generate(AsmCode& asm_code)
     asm_code.AddCmd(ASM_JMP, label, SIZE_NONE);
 }
 
+void StmtExit::Generate(VmCode& code)
+{
+    code.AddJump(VM_JMP, code.GetExitLabel());
+}
+
+bool StmtExit::GetJumpTarget(AsmStrImmediate& label_) const
+{
+    label_ = label;
+    return true;
+}
+
+bool StmtExit::GetJumpTarget(VmCode& code, VmLabel& label_) const
+{
+    label_ = code.GetExitLabel();
+    return true;
+}
+
 void StmtExit::GetAllAffectedVars(VarsContainer& res_cont)
 {
 }
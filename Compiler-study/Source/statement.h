@@ -16,10 +16,13 @@ private:
 public:
     virtual void Optimize();
     StmtAssign(SyntaxNode* left_, SyntaxNode* right_);
+    ~StmtAssign();
     const SyntaxNode* GetLeft() const;
     const SyntaxNode* GetRight() const;
     virtual void Print(ostream& o, int offset = 0) const;
     virtual void Generate(AsmCode& asm_code);
+    virtual void Generate(VmCode& code);
+    virtual void CollectLiveRanges(RegAllocator& allocator);
     virtual bool IsHaveSideEffect();
     virtual void GetAllAffectedVars(VarsContainer& res_cont);
     virtual void GetAllDependences(VarsContainer& res_cont, bool with_self = true);
@@ -31,6 +34,7 @@ class StmtBlock: public NodeStatement{
 protected:
     std::vector<NodeStatement*> statements;
 public:
+    ~StmtBlock();
     virtual void Optimize();
     void OptimizeLoops();
     NodeStatement* GetStmt(unsigned i);
@@ -38,8 +42,11 @@ public:
     unsigned GetSize() const;
     void AddStatement(NodeStatement* new_stmt);
     void CopyContent(StmtBlock* src);
+    void Release();
     virtual void Print(ostream& o, int offset = 0) const;
     virtual void Generate(AsmCode& asm_code);
+    virtual void Generate(VmCode& code);
+    virtual void CollectLiveRanges(RegAllocator& allocator);
     virtual bool IsHaveSideEffect();    
     virtual void GetAllAffectedVars(VarsContainer& res_cont);
     virtual void GetAllDependences(VarsContainer& res_cont, bool with_self = true);
@@ -54,8 +61,11 @@ private:
 public:
     virtual void Optimize();
     StmtExpression(SyntaxNode* expression);
+    ~StmtExpression();
     virtual void Print(ostream& o, int offset = 0) const;
     virtual void Generate(AsmCode& asm_code);
+    virtual void Generate(VmCode& code);
+    virtual void CollectLiveRanges(RegAllocator& allocator);
     virtual bool IsHaveSideEffect();    
     virtual void GetAllAffectedVars(VarsContainer& res_cont);
     virtual void GetAllDependences(VarsContainer& res_cont, bool with_self = true);
@@ -67,15 +77,21 @@ class StmtLoop: public NodeStatement{
 protected:
     AsmStrImmediate break_label;
     AsmStrImmediate continue_label;
+    VmLabel vm_break_label;
+    VmLabel vm_continue_label;
     StmtBlock* body;
     void ObtainLabels(AsmCode& asm_code);
+    void ObtainLabels(VmCode& code);
     virtual void CalculateDependences(set<SymVar*>& affectte_cont, set<SymVar*>& deps);
 public:
     StmtBlock* GetBody() const;
     void TakeOutVars(std::vector<NodeStatement*>& before_loop);
     StmtLoop(NodeStatement* body_);
+    ~StmtLoop();
     AsmStrImmediate GetBreakLabel() const;
     AsmStrImmediate GetContinueLabel() const;
+    VmLabel GetVmBreakLabel() const;
+    VmLabel GetVmContinueLabel() const;
     void AddBody(NodeStatement* body);
     bool IsDummyLoop();
     virtual StmtClassName GetClassName() const;
@@ -89,11 +105,17 @@ private:
     SyntaxNode* last_val;
     bool inc;
     virtual void CalculateDependences(set<SymVar*>& affected_cont, set<SymVar*>& deps);
+    void GenerateInReg(AsmCode& asm_code);
+    void GenerateUnrotated(AsmCode& asm_code, const AsmStrImmediate& start_label);
+    void GenerateCheck(AsmCode& asm_code, RegisterName value, const AsmStrImmediate& label, bool leave) const;
 public:
     StmtFor(SymVar* index_, SyntaxNode* init_value, SyntaxNode* last_value,
             bool is_inc, NodeStatement* body_ = NULL);
+    ~StmtFor();
     virtual void Print(ostream& o, int offset = 0) const;
     virtual void Generate(AsmCode& asm_code);
+    virtual void Generate(VmCode& code);
+    virtual void CollectLiveRanges(RegAllocator& allocator);
     virtual bool IsHaveSideEffect();
     virtual void GetAllAffectedVars(VarsContainer& res_cont);
     virtual void GetAllDependences(VarsContainer& res_cont, bool with_self = true);
@@ -108,8 +130,11 @@ protected:
     virtual void CalculateDependences(set<SymVar*>& affected_cont, set<SymVar*>& deps);
 public:
     StmtWhile(SyntaxNode* condition_ = NULL , NodeStatement* body_ = NULL);
+    ~StmtWhile();
     virtual void Print(ostream& o, int offset = 0) const;
     virtual void Generate(AsmCode& asm_code);
+    virtual void Generate(VmCode& code);
+    virtual void CollectLiveRanges(RegAllocator& allocator);
     virtual bool IsHaveSideEffect();
     virtual void GetAllAffectedVars(VarsContainer& res_cont);
     virtual void GetAllDependences(VarsContainer& res_cont, bool with_self = true);
@@ -124,6 +149,8 @@ public:
     void AddCondition(SyntaxNode* condition);
     virtual void Print(ostream& o, int offset = 0) const;
     virtual void Generate(AsmCode& asm_code);
+    virtual void Generate(VmCode& code);
+    virtual void CollectLiveRanges(RegAllocator& allocator);
 };
 
 class StmtIf: public NodeStatement{
@@ -134,8 +161,11 @@ private:
 public:
     bool OptimizeIf(NodeStatement*& res);
     StmtIf(SyntaxNode* condition_, NodeStatement* then_branch_, NodeStatement* else_branch_ = NULL);
+    ~StmtIf();
     virtual void Print(ostream& o, int offset = 0) const;
     virtual void Generate(AsmCode& asm_code);
+    virtual void Generate(VmCode& code);
+    virtual void CollectLiveRanges(RegAllocator& allocator);
     virtual bool IsHaveSideEffect();
     virtual void GetAllAffectedVars(VarsContainer& res_cont);
     virtual void GetAllDependences(VarsContainer& res_cont, bool with_self = true);
@@ -153,9 +183,12 @@ public:
     StmtJump(Token tok, StmtLoop* loop_);
     virtual void Print(ostream& o, int offset = 0) const;
     virtual void Generate(AsmCode& asm_code);
+    virtual void Generate(VmCode& code);
     virtual void GetAllAffectedVars(VarsContainer& res_cont);
     virtual StmtClassName GetClassName() const;
     virtual bool ContainJump();
+    virtual bool GetJumpTarget(AsmStrImmediate& label) const;
+    virtual bool GetJumpTarget(VmCode& code, VmLabel& label) const;
 };
 
 class StmtExit: public NodeStatement{
@@ -165,9 +198,12 @@ public:
     StmtExit(AsmStrImmediate exit_label);
     virtual void Print(ostream& o, int offset = 0) const;
     virtual void Generate(AsmCode& asm_code);
+    virtual void Generate(VmCode& code);
     virtual void GetAllAffectedVars(VarsContainer& res_cont);
     virtual StmtClassName GetClassName() const;
     virtual bool CanBeReplaced();
+    virtual bool GetJumpTarget(AsmStrImmediate& label) const;
+    virtual bool GetJumpTarget(VmCode& code, VmLabel& label) const;
 };
 
 #endif
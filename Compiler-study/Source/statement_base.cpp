@@ -1,4 +1,5 @@
 #include "statement_base.h"
+#include "reg_allocator.h"
 
 //---NodeStatement---
 
@@ -11,6 +12,25 @@ void NodeStatement::Generate(AsmCode& asm_code)
 {
 }
 
+void NodeStatement::Generate(VmCode& code)
+{
+}
+
+void NodeStatement::CollectLiveRanges(RegAllocator& allocator)
+{
+    allocator.NextPosition();
+}
+
+bool NodeStatement::GetJumpTarget(AsmStrImmediate& label) const
+{
+    return false;
+}
+
+bool NodeStatement::GetJumpTarget(VmCode& code, VmLabel& label) const
+{
+    return false;
+}
+
 /*void NodeStatement::Print(ostream& o, int offset) 
 {
     ((const NodeStatement*)this)->Print(o, offset);
@@ -3,10 +3,12 @@
 
 #include "scanner.h"
 #include "generator.h"
+#include "vm.h"
 #include "syntax_node_base.h"
 #include <vector>
 
 class SymVar;
+class RegAllocator;
 
 enum StmtClassName{
     STMT,
@@ -23,6 +25,10 @@ class NodeStatement: public SyntaxNodeBase{
 public:
     virtual StmtClassName GetClassName() const;
     virtual void Generate(AsmCode& asm_code);
+    virtual void Generate(VmCode& code);
+    virtual void CollectLiveRanges(RegAllocator& allocator);
+    virtual bool GetJumpTarget(AsmStrImmediate& label) const;
+    virtual bool GetJumpTarget(VmCode& code, VmLabel& label) const;
 };
 
 #endif
@@ -1,4 +1,5 @@
 #include "sym_table.h"
+#include "reg_allocator.h"
 
 const string SymbolClassDescription[] = {
     "SYM",
@@ -38,6 +39,10 @@ Symbol::Symbol(const Symbol& sym):
 {
 }
 
+Symbol::~Symbol()
+{
+}
+
 const char* Symbol::GetName() const
 {
     return token.GetName();
@@ -108,6 +113,7 @@ void SymProc::PrintPrototype(ostream& o, int offset) const
         {
             o << "; ";
             if ((*it)->IsByRef()) o << "var ";
+            if ((*it)->IsConst()) o << "const ";
             (*it)->Print(o, 0);
         }
         o << ")";
@@ -116,11 +122,13 @@ void SymProc::PrintPrototype(ostream& o, int offset) const
 
 bool SymProc::IsAffectToParam(int index)
 {
+    if (summary != NULL) return summary->affect_params[index];
     return params[index]->IsByRef() && IsAffectToVar(params[index]);
 }
 
 bool SymProc::IsDependOnParam(int index)
 {
+    if (summary != NULL) return summary->depend_params[index];
     return IsDependOnVar(params[index]);
 }
 
@@ -129,8 +137,11 @@ SymProc::SymProc(Token name):
     have_side_effect(false),
     known_side_effect(false),
     searching(false),
+    dummy_proc(false),
+    body_released(false),
     sym_table(NULL),
-    dummy_proc(false)
+    body(NULL),
+    summary(NULL)
 {
 }
 
@@ -154,6 +165,27 @@ const SymVarParam* SymProc::GetArg(int arg_num) const
     return params[arg_num];
 }
 
+void SymProc::GetArgRegisters64(vector<RegisterName>& regs) const
+{
+    unsigned ints = GetResultType()->GetSize() > 4 ? 1 : 0;
+    unsigned reals = 0;
+    for (size_t i = 0; i < params.size(); ++i)
+    {
+        const SymType* type = params[i]->GetVarType();
+        if (!params[i]->IsPassedByRef() && type == top_type_real)
+            regs.push_back(reals < X64_REAL_ARG_REGS_COUNT ? X64_REAL_ARG_REGS[reals++] : REG_NONE);
+        else if (params[i]->IsPassedByRef() || type->GetSize() == 4)
+            regs.push_back(ints < X64_INT_ARG_REGS_COUNT ? X64_INT_ARG_REGS[ints++] : REG_NONE);
+        else
+            regs.push_back(REG_NONE);
+    }
+}
+
+SymVarParam* SymProc::GetResultParam() const
+{
+    return NULL;
+}
+
 SymTable* SymProc::GetSymTable() const
 {
     return sym_table;
@@ -169,18 +201,86 @@ void SymProc::AddBody(NodeStatement* body_)
     body = body_;
 }
 
+void SymProc::ReleaseBody()
+{
+    delete body;
+    body = NULL;
+    body_released = true;
+}
+
+void SymProc::FindCopiedParams()
+{
+    copied_params.assign(params.size(), false);
+    if (body == NULL) return;
+    VarsContainer affected;
+    bool found = false;
+    for (size_t i = 0; i < params.size(); ++i)
+    {
+        if (!params[i]->IsPassedByRef() || params[i]->GetMode() != PARAM_VALUE) continue;
+        if (!found) GetAllAffectedVars(affected);
+        found = true;
+        for (VarsContainer::iterator it = affected.begin(); it != affected.end() && !copied_params[i]; ++it)
+            copied_params[i] = *it == params[i] || ((*it)->GetClassName() & SYM_VAR_GLOBAL)
+                || (((*it)->GetClassName() & SYM_VAR_PARAM) && ((SymVarParam*)*it)->IsByRef());
+    }
+}
+
+void SymProc::PrepareGeneration()
+{
+    if (body == NULL) return;
+    FindCopiedParams();
+    if (summary == NULL) SetSummary(MakeSummary());
+}
+
+unsigned SymProc::GetArgsSize() const
+{
+    SymVarParam* result = GetResultParam();
+    if (result == NULL || result->IsPassedByRef()) return sym_table->GetParamsSize();
+    return sym_table->GetParamsSize() - result->GetVarType()->GetSize();
+}
+
+unsigned SymProc::GetCopiedParamsSize(const AsmCode& asm_code) const
+{
+    unsigned res = 0;
+    for (size_t i = 0; i < copied_params.size(); ++i)
+        if (copied_params[i]) res += asm_code.GetStackSize(params[i]->GetVarType()->GetSize());
+    return res;
+}
+
+void SymProc::GenerateParamCopies(AsmCode& asm_code, int offset) const
+{
+    for (size_t i = 0; i < copied_params.size(); ++i)
+        if (copied_params[i])
+        {
+            offset -= asm_code.GetStackSize(params[i]->GetVarType()->GetSize());
+            params[i]->GenerateCopy(asm_code, offset);
+        }
+}
+
+void SymProc::GenerateParamCopies(VmCode& code) const
+{
+    for (size_t i = 0; i < copied_params.size(); ++i)
+        if (copied_params[i]) params[i]->GenerateCopy(code);
+}
+
 SymProc::SymProc(Token token, SymTable* syn_table_):
     Symbol(token),
     have_side_effect(false),
     known_side_effect(false),
     searching(false),
-    sym_table(syn_table_)
+    dummy_proc(false),
+    body_released(false),
+    sym_table(syn_table_),
+    body(NULL),
+    summary(NULL)
 {
 }
 
 SymProc::~SymProc()
 {
+   delete body;
    delete sym_table;
+   delete summary;
 }
 
 SymbolClass SymProc::GetClassName() const
@@ -219,15 +319,153 @@ void SymProc::Print(ostream& o, int offset) const
 void SymProc::GenerateDeclaration(AsmCode& asm_code)
 {
     if (IsDummyProc()) return;
+    if (asm_code.GetTarget() == TARGET_X86_64)
+    {
+        GenerateDeclaration64(asm_code);
+        return;
+    }
+    vector<RegisterName> saved_regs;
+    AllocateRegisters(asm_code, saved_regs);
+    SymVarParam* result = GetResultParam();
+    RegisterName result_reg = result != NULL ? result->GetAllocatedReg() : REG_NONE;
+    bool result_in_slot = asm_code.IsRegResults() && result != NULL && !result->IsPassedByRef() && result_reg == REG_NONE;
+    int locals_size = sym_table->GetLocalsSize();
+    if (result_in_slot)
+    {
+        locals_size += 4;
+        result->SetLocation(-locals_size);
+    }
+    unsigned copies_offset = locals_size + 4 * saved_regs.size();
+    unsigned frame = copies_offset + GetCopiedParamsSize(asm_code);
+    asm_code.AddLabel(label);
+    asm_code.AddCmd(ASM_PUSH, REG_EBP);
+    asm_code.AddCmd(ASM_MOV, REG_ESP, REG_EBP);
+    if (frame) asm_code.AddCmd(ASM_SUB, frame, REG_ESP);
+    for (size_t i = 0; i < saved_regs.size(); ++i)
+        asm_code.AddCmd(ASM_MOV, saved_regs[i], AsmMemory(REG_EBP, -locals_size - 4 * (int)(i + 1)));
+    GenerateParamCopies(asm_code, -(int)copies_offset);
+    for (size_t i = 0; i < params.size(); ++i)
+        params[i]->GenerateLoadToAllocatedReg(asm_code);
+    //callers keep their own allocated variables in these registers and only saved_regs are restored
+    asm_code.SetReservedRegs(vector<RegisterName>(X86_VAR_REGS, X86_VAR_REGS + X86_VAR_REGS_COUNT));
+    body->Generate(asm_code);
+    asm_code.AddLabel(exit_label);
+    if (result_reg != REG_NONE) asm_code.AddCmd(ASM_MOV, result_reg, REG_EAX);
+    for (size_t i = 0; i < saved_regs.size(); ++i)
+        asm_code.AddCmd(ASM_MOV, AsmMemory(REG_EBP, -locals_size - 4 * (int)(i + 1)), saved_regs[i]);
+    asm_code.SetReservedRegs(vector<RegisterName>());
+    if (result_in_slot)
+    {
+        AsmMemory slot(REG_EBP, -locals_size);
+        if (GetResultType() != top_type_real) asm_code.AddCmd(ASM_MOV, slot, REG_EAX);
+        else if (asm_code.IsSse()) asm_code.AddCmd(ASM_MOVSS, slot, REG_XMM0, SIZE_NONE);
+        else asm_code.AddCmd(ASM_FLD, slot, SIZE_SHORT);
+    }
+    asm_code.AddCmd(ASM_MOV, REG_EBP, REG_ESP);
+    asm_code.AddCmd(ASM_POP, REG_EBP);
+    asm_code.AddCmd(ASM_RET, GetArgsSize());
+}
+
+void SymProc::AllocateRegisters(AsmCode& asm_code, vector<RegisterName>& saved_regs)
+{
+    //without optimization every variable stays in its frame slot
+    if (!asm_code.IsOptimize()) return;
+    RegAllocator allocator;
+    vector<Symbol*> symbols;
+    sym_table->GetSymbols(symbols);
+    for (vector<Symbol*>::iterator it = symbols.begin(); it != symbols.end(); ++it)
+    {
+        if (!((*it)->GetClassName() & (SYM_VAR_LOCAL | SYM_VAR_PARAM))) continue;
+        SymVar* var = (SymVar*)*it;
+        bool is_param = var->GetClassName() & SYM_VAR_PARAM;
+        if (var->GetVarType()->GetActualType() != top_type_int
+            || (is_param && ((SymVarParam*)var)->IsPassedByRef())
+            || (var == GetResultParam() && !asm_code.IsRegResults())) continue;
+        allocator.AddCandidate(var, is_param && var != GetResultParam());
+    }
+    body->CollectLiveRanges(allocator);
+    if (GetResultParam() != NULL) allocator.AddResult(GetResultParam());
+    if (asm_code.GetTarget() == TARGET_X86_64)
+        allocator.Allocate(X64_VAR_REGS, X64_VAR_REGS_COUNT, saved_regs);
+    else
+        allocator.Allocate(X86_VAR_REGS, X86_VAR_REGS_COUNT, saved_regs);
+}
+
+void SymProc::GenerateDeclaration64(AsmCode& asm_code)
+{
+    vector<RegisterName> regs;
+    GetArgRegisters64(regs);
+    vector<RegisterName> saved_regs;
+    AllocateRegisters(asm_code, saved_regs);
+    SymVarParam* result = GetResultParam();
+    unsigned result_size = GetResultType()->GetSize();
+    unsigned frame = asm_code.GetStackSize(sym_table->GetLocalsSize());
+    int result_offset = 0;
+    RegisterName result_reg = result != NULL ? result->GetAllocatedReg() : REG_NONE;
+    if (result != NULL && result_reg == REG_NONE)
+    {
+        frame += 8;
+        result_offset = -frame;
+        result->SetLocation64(result_offset, result_size > 4);
+    }
+    vector<int> offsets;
+    int stack_offset = 16;
+    for (size_t i = 0; i < params.size(); ++i)
+    {
+        if (regs[i] == REG_NONE)
+        {
+            offsets.push_back(stack_offset);
+            stack_offset += asm_code.GetStackSize(params[i]->IsPassedByRef() ? 8 : params[i]->GetVarType()->GetSize());
+        }
+        else
+        {
+            frame += 8;
+            offsets.push_back(-frame);
+        }
+        params[i]->SetLocation64(offsets.back(), params[i]->IsPassedByRef());
+    }
+    int saved_offset = -frame;
+    frame += 8 * saved_regs.size();
+    unsigned copies_offset = frame;
+    frame += GetCopiedParamsSize(asm_code);
     asm_code.AddLabel(label);
     asm_code.AddCmd(ASM_PUSH, REG_EBP);
     asm_code.AddCmd(ASM_MOV, REG_ESP, REG_EBP);
-    if (sym_table->GetLocalsSize()) asm_code.AddCmd(ASM_SUB, sym_table->GetLocalsSize(), REG_ESP);
+    if (frame) asm_code.AddCmd(ASM_SUB, frame, REG_ESP);
+    if (result_size > 4) asm_code.AddCmd(ASM_MOV, REG_RDI, AsmMemory(REG_EBP, result_offset), SIZE_QUARD);
+    for (size_t i = 0; i < params.size(); ++i)
+        if (regs[i] >= REG_XMM0 && regs[i] <= REG_XMM7)
+            asm_code.AddCmd(ASM_MOVSS, regs[i], AsmMemory(REG_EBP, offsets[i]), SIZE_NONE);
+        else if (regs[i] != REG_NONE)
+            asm_code.AddCmd(ASM_MOV, regs[i], AsmMemory(REG_EBP, offsets[i]), SIZE_QUARD);
+    for (size_t i = 0; i < saved_regs.size(); ++i)
+        asm_code.AddCmd(ASM_MOV, saved_regs[i], AsmMemory(REG_EBP, saved_offset - 8 * (int)(i + 1)), SIZE_QUARD);
+    GenerateParamCopies(asm_code, -(int)copies_offset);
+    for (size_t i = 0; i < params.size(); ++i)
+        params[i]->GenerateLoadToAllocatedReg(asm_code);
     body->Generate(asm_code);
     asm_code.AddLabel(exit_label);
+    if (result_reg != REG_NONE) asm_code.AddCmd(ASM_MOV, result_reg, REG_EAX);
+    for (size_t i = 0; i < saved_regs.size(); ++i)
+        asm_code.AddCmd(ASM_MOV, AsmMemory(REG_EBP, saved_offset - 8 * (int)(i + 1)), saved_regs[i], SIZE_QUARD);
+    if (result_size > 4)
+        asm_code.AddCmd(ASM_MOV, AsmMemory(REG_EBP, result_offset), REG_RAX, SIZE_QUARD);
+    else if (GetResultType() == top_type_real)
+        asm_code.AddCmd(ASM_MOVSS, AsmMemory(REG_EBP, result_offset), REG_XMM0, SIZE_NONE);
+    else if (result_size && result_reg == REG_NONE)
+        asm_code.AddCmd(ASM_MOV, AsmMemory(REG_EBP, result_offset), REG_EAX);
     asm_code.AddCmd(ASM_MOV, REG_EBP, REG_ESP);
     asm_code.AddCmd(ASM_POP, REG_EBP);
-    asm_code.AddCmd(ASM_RET, sym_table->GetParamsSize() - GetResultType()->GetSize());
+    asm_code.AddCmd(ASM_RET, SIZE_NONE);
+}
+
+void SymProc::GenerateDeclaration(VmCode& code)
+{
+    if (IsDummyProc() || body == NULL) return;
+    code.BeginProc(this, GetName(), sym_table->GetLocalsSize(), GetArgsSize());
+    GenerateParamCopies(code);
+    body->Generate(code);
+    code.EndProc();
 }
 
 AsmStrImmediate SymProc::GetLabel() const
@@ -235,6 +473,11 @@ AsmStrImmediate SymProc::GetLabel() const
     return label;
 }
 
+void SymProc::SetLabel(const AsmStrImmediate& new_label)
+{
+    label = new_label;
+}
+
 AsmStrImmediate SymProc::GetExitLabel() const
 {
     return exit_label;
@@ -248,7 +491,34 @@ void SymProc::ObtainLabels(AsmCode& asm_code)
 
 bool SymProc::IsHaveBody() const
 {
-    return body != NULL;
+    return body != NULL || body_released;
+}
+
+bool SymProc::IsImported() const
+{
+    return summary != NULL && !IsHaveBody();
+}
+
+SideEffectSummary* SymProc::MakeSummary()
+{
+    SideEffectSummary* res = new SideEffectSummary;
+    res->have_side_effect = IsHaveSideEffect();
+    res->can_be_replaced = CanBeReplaced();
+    res->dummy = IsDummyProc();
+    for (size_t i = 0; i < params.size(); ++i)
+    {
+        res->affect_params.push_back(IsAffectToParam(i));
+        res->depend_params.push_back(IsDependOnParam(i));
+    }
+    GetAllAffectedVars(res->affected_vars);
+    GetAllDependences(res->dependences);
+    return res;
+}
+
+void SymProc::SetSummary(SideEffectSummary* summary_)
+{
+    summary = summary_;
+    dummy_proc = summary->dummy;
 }
 
 bool SymProc::ValidateParams(SymProc* src)
@@ -257,6 +527,7 @@ bool SymProc::ValidateParams(SymProc* src)
     if (params.size() != src->params.size()) return false;
     for (int i = 0; i < params.size(); ++i)
         if (params[i]->GetVarType() != src->params[i]->GetVarType()
+            || params[i]->GetMode() != src->params[i]->GetMode()
             || strcmp(params[i]->GetName(), src->params[i]->GetName())) return false;
     return true;
 }
@@ -268,6 +539,7 @@ bool SymProc::IsDummyProc()
 
 bool SymProc::IsHaveSideEffect()
 {
+    if (summary != NULL) return summary->have_side_effect;
     if (known_side_effect) return have_side_effect;
     known_side_effect = true;
     have_side_effect = body->IsHaveSideEffect();
@@ -276,6 +548,7 @@ bool SymProc::IsHaveSideEffect()
 
 bool SymProc::IsAffectToVar(SymVar* var)
 {
+    if (summary != NULL) return summary->affected_vars.find(var) != summary->affected_vars.end();
     if (searching) return false;
     searching = true;
     bool res = body->IsAffectToVar(var);
@@ -285,6 +558,7 @@ bool SymProc::IsAffectToVar(SymVar* var)
 
 bool SymProc::IsDependOnVar(SymVar* var)
 {
+    if (summary != NULL) return summary->dependences.find(var) != summary->dependences.end();
     if (searching) return false;
     searching = true;
     bool res = body->IsDependOnVar(var);
@@ -294,6 +568,11 @@ bool SymProc::IsDependOnVar(SymVar* var)
 
 void SymProc::GetAllAffectedVars(VarsContainer& res_cont)
 {
+    if (summary != NULL)
+    {
+        res_cont.insert(summary->affected_vars.begin(), summary->affected_vars.end());
+        return;
+    }
     if (searching) return;
     searching = true;
     body->GetAllAffectedVars(res_cont);
@@ -302,6 +581,11 @@ void SymProc::GetAllAffectedVars(VarsContainer& res_cont)
 
 void SymProc::GetAllDependences(VarsContainer& res_cont)
 {
+    if (summary != NULL)
+    {
+        res_cont.insert(summary->dependences.begin(), summary->dependences.end());
+        return;
+    }
     if (searching) return;
     searching = true;
     body->GetAllDependences(res_cont);
@@ -310,6 +594,7 @@ void SymProc::GetAllDependences(VarsContainer& res_cont)
 
 void SymProc::Optimize()
 {
+    if (body == NULL) return;
     body->Optimize();
     dummy_proc = !IsHaveSideEffect();
     for (int i = 0; i < params.size() && dummy_proc; ++i)
@@ -318,6 +603,7 @@ void SymProc::Optimize()
 
 bool SymProc::CanBeReplaced()
 {
+    if (summary != NULL) return summary->can_be_replaced;
     if (searching) return true; 
     searching = true;
     bool res = body->CanBeReplaced();
@@ -329,13 +615,15 @@ bool SymProc::CanBeReplaced()
 
 SymFunct::SymFunct(Token token_, SymTable* syn_table, const SymType* result_type_):
     SymProc(token, syn_table),
-    result_type(result_type_)
+    result_type(result_type_),
+    result_param(NULL)
 {
 }
 
 SymFunct::SymFunct(Token name):
     SymProc(name),
-    result_type(NULL)
+    result_type(NULL),
+    result_param(NULL)
 {
 }
 
@@ -343,8 +631,8 @@ void SymFunct::AddResultType(const SymType* result_type_)
 {
     result_type = result_type_;
     Token tok("Result", IDENTIFIER, TOK_UNRESERVED, -1, -1);
-    SymVarParam* param = new SymVarParam(tok, result_type, false, sym_table->GetParamsSize() + 8);
-    sym_table->Add(param);
+    result_param = new SymVarParam(tok, result_type, PARAM_RESULT, sym_table->GetParamsSize() + 8);
+    sym_table->Add(result_param);
 }
 
 SymbolClass SymFunct::GetClassName() const
@@ -357,6 +645,11 @@ const SymType* SymFunct::GetResultType() const
     return result_type->GetActualType();
 }
 
+SymVarParam* SymFunct::GetResultParam() const
+{
+    return result_param;
+}
+
 void SymFunct::Print(ostream& o, int offset) const
 {
     o << "function ";
@@ -374,8 +667,19 @@ bool SymFunct::IsDummyProc()
 
 SymVar::SymVar(Token token, const SymType* type_):
     Symbol(token),
-    type(type_)
+    type(type_),
+    allocated_reg(REG_NONE)
+{
+}
+
+void SymVar::SetAllocatedReg(RegisterName reg)
+{
+    allocated_reg = reg;
+}
+
+RegisterName SymVar::GetAllocatedReg() const
 {
+    return allocated_reg;
 }
 
 SymbolClass SymVar::GetClassName() const
@@ -419,6 +723,42 @@ void SymVar::GenerateValue(AsmCode& asm_code) const
 {
 }
 
+int SymVar::GetRegNeed(const AsmCode& asm_code) const
+{
+    return REG_NEED_STACK;
+}
+
+void SymVar::GenerateOperandCmd(AsmCode& asm_code, AsmCmdName cmd, RegisterName reg) const
+{
+}
+
+void SymVar::GenerateToReg(AsmCode& asm_code, RegisterName reg) const
+{
+    GenerateOperandCmd(asm_code, ASM_MOV, reg);
+}
+
+int SymVar::GetAddressRegNeed(const AsmCode& asm_code) const
+{
+    return REG_NEED_STACK;
+}
+
+AsmMemory SymVar::GenerateAddress(AsmCode& asm_code, RegisterName reg) const
+{
+    GenerateLValue(asm_code);
+    asm_code.AddCmd(ASM_POP, reg);
+    return AsmMemory(reg);
+}
+
+VmReg SymVar::GenerateLValue(VmCode& code) const
+{
+    return code.NewReg();
+}
+
+VmReg SymVar::GenerateValue(VmCode& code) const
+{
+    return code.NewReg();
+}
+
 //---SymTypeScalar---
 
 SymTypeScalar::SymTypeScalar(Token name):
@@ -536,6 +876,11 @@ const SymVarLocal* SymTypeRecord::FindField(Token& field_name)
     return (const SymVarLocal*)res;
 }
 
+SymTable* SymTypeRecord::GetSymTable() const
+{
+    return sym_table;
+}
+
 SymbolClass SymTypeRecord::GetClassName() const
 {
     return SymbolClass(SYM | SYM_TYPE | SYM_TYPE_RECORD);
@@ -578,6 +923,11 @@ void SymTypeAlias::PrintVerbose(ostream& o, int offset) const
     o << "\n";
 }
 
+SymType* SymTypeAlias::GetTarget() const
+{
+    return target;
+}
+
 SymbolClass SymTypeAlias::GetClassName() const
 {
     return SymbolClass(SYM | SYM_TYPE | SYM_TYPE_ALIAS);
@@ -667,18 +1017,64 @@ void SymVarConst::GenerateValue(AsmCode& asm_code) const
     }
 }
 
+int SymVarConst::GetRegNeed(const AsmCode& asm_code) const
+{
+    return value.GetType() == INT_CONST && type->GetActualType() == top_type_int ? 0 : REG_NEED_STACK;
+}
+
+void SymVarConst::GenerateOperandCmd(AsmCode& asm_code, AsmCmdName cmd, RegisterName reg) const
+{
+    asm_code.AddCmd(cmd, AsmIntImmediate(value.GetIntValue()), reg);
+}
+
+VmReg SymVarConst::GenerateLValue(VmCode& code) const
+{
+    throw CompilerException("cant get const l-value");
+}
+
+VmReg SymVarConst::GenerateValue(VmCode& code) const
+{
+    VmReg res = code.NewReg();
+    if (value.GetType() == INT_CONST)
+        code.AddCmd(VM_LOADI, res, value.GetIntValue());
+    else if (value.GetType() == REAL_CONST)
+    {
+        stringstream s;
+        s << value.GetName();
+        float f;
+        int* p = (int*)&f;
+        s >> f;
+        code.AddCmd(VM_LOADI, res, *p);
+    }
+    else
+        code.AddCmd(VM_LOADI, res, code.StringIndex(token.GetName()));
+    return res;
+}
+
 //---SymVarParam---
 
+bool SymVarParam::IsRefInFrame(const AsmCode& asm_code) const
+{
+    return asm_code.GetTarget() == TARGET_X86_64 ? by_ref64 : by_ref;
+}
+
+int SymVarParam::GetFrameOffset(const AsmCode& asm_code) const
+{
+    return asm_code.GetTarget() == TARGET_X86_64 ? offset64 : offset;
+}
+
 void SymVarParam::GenAdrInStack(AsmCode& asm_code) const
 {
-    asm_code.AddCmd(ASM_LEA, AsmMemory(REG_EBP, offset), REG_EAX);
+    asm_code.AddCmd(ASM_LEA, AsmMemory(REG_EBP, GetFrameOffset(asm_code)), REG_EAX);
     asm_code.AddCmd(ASM_PUSH, REG_EAX);
 }
 
 void SymVarParam::GenValueInStack(AsmCode& asm_code) const
 {
-    if (by_ref || type->GetSize() == 4)
-        asm_code.AddCmd(ASM_PUSH, AsmMemory(REG_EBP, offset));
+    if (IsRefInFrame(asm_code))
+        asm_code.AddCmd(ASM_PUSH, AsmMemory(REG_EBP, GetFrameOffset(asm_code)), asm_code.GetPtrSize());
+    else if (type->GetSize() == 4)
+        asm_code.AddCmd(ASM_PUSH, AsmMemory(REG_EBP, GetFrameOffset(asm_code)));
     else
     {
         GenAdrInStack(asm_code);
@@ -688,39 +1084,151 @@ void SymVarParam::GenValueInStack(AsmCode& asm_code) const
 
 void SymVarParam::GenValueByRef(AsmCode& asm_code) const
 {
-    asm_code.AddCmd(ASM_PUSH, AsmMemory(REG_EBP, offset));
+    asm_code.AddCmd(ASM_PUSH, AsmMemory(REG_EBP, GetFrameOffset(asm_code)), asm_code.GetPtrSize());
     asm_code.PushMemory(type->GetSize());
 }
 
-SymVarParam::SymVarParam(Token name, const SymType* type, bool by_ref_, int offset_):
+SymVarParam::SymVarParam(Token name, const SymType* type, ParamMode mode_, int offset_):
     SymVar(name, type),
-    by_ref(by_ref_),
-    offset(offset_)
+    mode(mode_),
+    by_ref(mode_ == PARAM_VAR || type->GetSize() > (mode_ == PARAM_RESULT ? 4 : PARAM_BY_VALUE_LIMIT)),
+    offset(offset_),
+    by_ref64(by_ref),
+    offset64(offset_)
 {
 }
 
+ParamMode SymVarParam::GetMode() const
+{
+    return mode;
+}
+
 bool SymVarParam::IsByRef() const
+{
+    return mode == PARAM_VAR;
+}
+
+bool SymVarParam::IsConst() const
+{
+    return mode == PARAM_CONST;
+}
+
+bool SymVarParam::IsPassedByRef() const
 {
     return by_ref;
 }
 
+void SymVarParam::GenerateCopy(AsmCode& asm_code, int copy_offset) const
+{
+    int slot = GetFrameOffset(asm_code);
+    asm_code.AddCmd(ASM_MOV, AsmMemory(REG_EBP, slot), REG_EBX, asm_code.GetPtrSize());
+    asm_code.AddCmd(ASM_LEA, AsmMemory(REG_EBP, copy_offset), REG_EDX);
+    asm_code.AddCmd(ASM_MOV, REG_EDX, AsmMemory(REG_EBP, slot), asm_code.GetPtrSize());
+    asm_code.CopyMemory(REG_EBX, REG_EDX, type->GetSize());
+}
+
+void SymVarParam::GenerateCopy(VmCode& code) const
+{
+    unsigned mark = code.GetRegMark();
+    VmReg src = code.NewReg();
+    code.AddCmd(VM_LEA, src, offset);
+    code.AddLoad(src, src);
+    VmReg dest = code.NewReg();
+    code.AddCmd(VM_LEA, dest, code.AllocTemp(type->GetSize()));
+    code.AddCmd(VM_COPY, dest, src, type->GetSize());
+    VmReg slot = code.NewReg();
+    code.AddCmd(VM_LEA, slot, offset);
+    code.AddStore(dest, slot);
+    code.ReleaseRegs(mark);
+}
+
+void SymVarParam::SetLocation(int offset_)
+{
+    offset = offset_;
+}
+
+void SymVarParam::SetLocation64(int offset_, bool by_ref_)
+{
+    offset64 = offset_;
+    by_ref64 = by_ref_;
+}
+
 SymbolClass SymVarParam::GetClassName() const
 {
     return SymbolClass(SYM | SYM_VAR | SYM_VAR_PARAM);
 }
 
+void SymVarParam::GenerateLoadToAllocatedReg(AsmCode& asm_code) const
+{
+    if (allocated_reg != REG_NONE)
+        asm_code.AddCmd(ASM_MOV, AsmMemory(REG_EBP, GetFrameOffset(asm_code)), allocated_reg);
+}
+
 void SymVarParam::GenerateLValue(AsmCode& asm_code) const
 {
-    if (by_ref) GenValueInStack(asm_code);
+    if (IsRefInFrame(asm_code)) GenValueInStack(asm_code);
     else GenAdrInStack(asm_code);
 }
 
 void SymVarParam::GenerateValue(AsmCode& asm_code) const
 {
-    if (by_ref) GenValueByRef(asm_code);
+    if (allocated_reg != REG_NONE) asm_code.AddCmd(ASM_PUSH, allocated_reg);
+    else if (IsRefInFrame(asm_code)) GenValueByRef(asm_code);
     else GenValueInStack(asm_code);
 }
 
+int SymVarParam::GetRegNeed(const AsmCode& asm_code) const
+{
+    if (type->GetActualType() != top_type_int) return REG_NEED_STACK;
+    return IsRefInFrame(asm_code) ? 1 : 0;
+}
+
+void SymVarParam::GenerateOperandCmd(AsmCode& asm_code, AsmCmdName cmd, RegisterName reg) const
+{
+    if (allocated_reg != REG_NONE) asm_code.AddCmd(cmd, allocated_reg, reg);
+    else asm_code.AddCmd(cmd, AsmMemory(REG_EBP, GetFrameOffset(asm_code)), reg);
+}
+
+void SymVarParam::GenerateToReg(AsmCode& asm_code, RegisterName reg) const
+{
+    if (!IsRefInFrame(asm_code))
+    {
+        GenerateOperandCmd(asm_code, ASM_MOV, reg);
+        return;
+    }
+    asm_code.AddCmd(ASM_MOV, AsmMemory(REG_EBP, GetFrameOffset(asm_code)), reg, asm_code.GetPtrSize());
+    asm_code.AddCmd(ASM_MOV, AsmMemory(reg), reg);
+}
+
+int SymVarParam::GetAddressRegNeed(const AsmCode& asm_code) const
+{
+    if (asm_code.GetTarget() == TARGET_X86_64 || allocated_reg != REG_NONE) return REG_NEED_STACK;
+    return IsRefInFrame(asm_code) ? 1 : 0;
+}
+
+AsmMemory SymVarParam::GenerateAddress(AsmCode& asm_code, RegisterName reg) const
+{
+    if (GetAddressRegNeed(asm_code) == REG_NEED_STACK) return SymVar::GenerateAddress(asm_code, reg);
+    if (!IsRefInFrame(asm_code)) return AsmMemory(REG_EBP, GetFrameOffset(asm_code));
+    asm_code.AddCmd(ASM_MOV, AsmMemory(REG_EBP, GetFrameOffset(asm_code)), reg);
+    return AsmMemory(reg);
+}
+
+VmReg SymVarParam::GenerateLValue(VmCode& code) const
+{
+    VmReg res = code.NewReg();
+    code.AddCmd(VM_LEA, res, offset);
+    if (by_ref) code.AddLoad(res, res);
+    return res;
+}
+
+VmReg SymVarParam::GenerateValue(VmCode& code) const
+{
+    VmReg res = GenerateLValue(code);
+    if (type->GetSize() == 4) code.AddLoad(res, res);
+    return res;
+}
+
 //---SymVarGlobal---
 
 SymVarGlobal::SymVarGlobal(Token name, const SymType* type):
@@ -748,6 +1256,11 @@ void SymVarGlobal::GenerateDeclaration(AsmCode& asm_code)
     label = asm_code.AddData(token.GetName(), type->GetSize());
 }
 
+void SymVarGlobal::GenerateDeclaration(VmCode& code) const
+{
+    code.GlobalAddress(this, type->GetSize());
+}
+
 void SymVarGlobal::GenerateLValue(AsmCode& asm_code) const
 {
     asm_code.AddCmd(ASM_PUSH, label);
@@ -764,6 +1277,41 @@ void SymVarGlobal::GenerateValue(AsmCode& asm_code) const
         asm_code.AddCmd(ASM_PUSH, AsmMemory(label));
 }
 
+int SymVarGlobal::GetRegNeed(const AsmCode& asm_code) const
+{
+    return type->GetActualType() == top_type_int ? 0 : REG_NEED_STACK;
+}
+
+void SymVarGlobal::GenerateOperandCmd(AsmCode& asm_code, AsmCmdName cmd, RegisterName reg) const
+{
+    asm_code.AddCmd(cmd, AsmMemory(label), reg);
+}
+
+int SymVarGlobal::GetAddressRegNeed(const AsmCode& asm_code) const
+{
+    return asm_code.GetTarget() == TARGET_X86_64 || allocated_reg != REG_NONE ? REG_NEED_STACK : 0;
+}
+
+AsmMemory SymVarGlobal::GenerateAddress(AsmCode& asm_code, RegisterName reg) const
+{
+    if (GetAddressRegNeed(asm_code) == REG_NEED_STACK) return SymVar::GenerateAddress(asm_code, reg);
+    return AsmMemory(label);
+}
+
+VmReg SymVarGlobal::GenerateLValue(VmCode& code) const
+{
+    VmReg res = code.NewReg();
+    code.AddCmd(VM_LOADI, res, code.GlobalAddress(this, type->GetSize()));
+    return res;
+}
+
+VmReg SymVarGlobal::GenerateValue(VmCode& code) const
+{
+    VmReg res = GenerateLValue(code);
+    if (type->GetSize() == 4) code.AddLoad(res, res);
+    return res;
+}
+
 //---SymVarLocal---
 
 SymVarLocal::SymVarLocal(Token name, const SymType* type, unsigned offset_):
@@ -777,15 +1325,67 @@ SymbolClass SymVarLocal::GetClassName() const
     return SymbolClass(SYM | SYM_VAR | SYM_VAR_LOCAL);
 }
 
+int SymVarLocal::GetFrameOffset(const AsmCode& asm_code) const
+{
+    return -offset - type->GetSize();
+}
+
 void SymVarLocal::GenerateLValue(AsmCode& asm_code) const
 {
-    asm_code.AddCmd(ASM_LEA, AsmMemory(REG_EBP, -offset - 4), REG_EAX);
+    asm_code.AddCmd(ASM_LEA, AsmMemory(REG_EBP, GetFrameOffset(asm_code)), REG_EAX);
     asm_code.AddCmd(ASM_PUSH, REG_EAX);
 }
 
 void SymVarLocal::GenerateValue(AsmCode& asm_code) const
 {
-    asm_code.AddCmd(ASM_PUSH, AsmMemory(REG_EBP, -offset - 4));
+    if (allocated_reg != REG_NONE)
+    {
+        asm_code.AddCmd(ASM_PUSH, allocated_reg);
+        return;
+    }
+    if (type->GetSize() > 4)
+    {
+        GenerateLValue(asm_code);
+        asm_code.PushMemory(type->GetSize());
+        return;
+    }
+    asm_code.AddCmd(ASM_PUSH, AsmMemory(REG_EBP, GetFrameOffset(asm_code)));
+}
+
+int SymVarLocal::GetRegNeed(const AsmCode& asm_code) const
+{
+    return type->GetActualType() == top_type_int ? 0 : REG_NEED_STACK;
+}
+
+void SymVarLocal::GenerateOperandCmd(AsmCode& asm_code, AsmCmdName cmd, RegisterName reg) const
+{
+    if (allocated_reg != REG_NONE) asm_code.AddCmd(cmd, allocated_reg, reg);
+    else asm_code.AddCmd(cmd, AsmMemory(REG_EBP, GetFrameOffset(asm_code)), reg);
+}
+
+int SymVarLocal::GetAddressRegNeed(const AsmCode& asm_code) const
+{
+    return asm_code.GetTarget() == TARGET_X86_64 || allocated_reg != REG_NONE ? REG_NEED_STACK : 0;
+}
+
+AsmMemory SymVarLocal::GenerateAddress(AsmCode& asm_code, RegisterName reg) const
+{
+    if (GetAddressRegNeed(asm_code) == REG_NEED_STACK) return SymVar::GenerateAddress(asm_code, reg);
+    return AsmMemory(REG_EBP, GetFrameOffset(asm_code));
+}
+
+VmReg SymVarLocal::GenerateLValue(VmCode& code) const
+{
+    VmReg res = code.NewReg();
+    code.AddCmd(VM_LEA, res, -(int)(offset + type->GetSize()));
+    return res;
+}
+
+VmReg SymVarLocal::GenerateValue(VmCode& code) const
+{
+    VmReg res = GenerateLValue(code);
+    if (type->GetSize() == 4) code.AddLoad(res, res);
+    return res;
 }
 
 unsigned SymVarLocal::GetOffset() const
@@ -813,7 +1413,7 @@ void SymTable::Add(Symbol* sym)
     {
         unsigned sym_size = ((SymVar*)sym)->GetVarType()->GetSize();
         if (sym->GetClassName() & SYM_VAR_PARAM)
-            params_size += ((SymVarParam*)sym)->IsByRef() ? 4 : sym_size;
+            params_size += ((SymVarParam*)sym)->IsPassedByRef() ? 4 : sym_size;
         else if (sym->GetClassName() & SYM_VAR_LOCAL)
             locals_size += sym_size;
     }
@@ -836,6 +1436,12 @@ const Symbol* SymTable::Find(const Token& tok) const
     return *it;
 }
 
+void SymTable::GetSymbols(std::vector<Symbol*>& res) const
+{
+    for (std::set<Symbol*, SymbLessComp>::const_iterator it = table.begin(); it != table.end(); ++it)
+        res.push_back(*it);
+}
+
 void SymTable::Print(ostream& o, int offset) const
 {
     std::vector<Symbol*> v;
@@ -867,7 +1473,12 @@ unsigned SymTable::GetParamsSize() const
     return params_size;
 }
 
-void SymTable::GenerateDeclarations(AsmCode& asm_code) const
+const std::vector<SymProc*>& SymTable::GetProcs() const
+{
+    return proc_decl_order;
+}
+
+void SymTable::GenerateGlobalsDeclarations(AsmCode& asm_code) const
 {
     for (std::set<Symbol*, SymbLessComp>::const_iterator it = table.begin(); it != table.end(); ++it)
         if ((*it)->GetClassName() & SYM_VAR_GLOBAL)
@@ -875,13 +1486,38 @@ void SymTable::GenerateDeclarations(AsmCode& asm_code) const
             SymVarGlobal* tmp = (SymVarGlobal*)*it;
             tmp->GenerateDeclaration(asm_code);
         }
+}
+
+void SymTable::GenerateGlobalsDeclarations(VmCode& code) const
+{
+    for (std::set<Symbol*, SymbLessComp>::const_iterator it = table.begin(); it != table.end(); ++it)
+        if ((*it)->GetClassName() & SYM_VAR_GLOBAL)
+            ((SymVarGlobal*)*it)->GenerateDeclaration(code);
+}
+
+void SymTable::GenerateDeclarations(AsmCode& asm_code) const
+{
+    GenerateGlobalsDeclarations(asm_code);
     for (std::vector<SymProc*>::const_iterator it = proc_decl_order.begin(); it != proc_decl_order.end(); ++it)
         (*it)->GenerateDeclaration(asm_code);
 }
 
+void SymTable::GenerateDeclarations(VmCode& code) const
+{
+    GenerateGlobalsDeclarations(code);
+    for (std::vector<SymProc*>::const_iterator it = proc_decl_order.begin(); it != proc_decl_order.end(); ++it)
+        (*it)->GenerateDeclaration(code);
+}
+
 void SymTable::Optimize()
 {
     for (std::vector<SymProc*>::const_iterator it = proc_decl_order.begin(); it != proc_decl_order.end(); ++it)
         (*it)->Optimize();
 }
 
+void SymTable::PrepareGeneration()
+{
+    for (std::vector<SymProc*>::const_iterator it = proc_decl_order.begin(); it != proc_decl_order.end(); ++it)
+        (*it)->PrepareGeneration();
+}
+
@@ -29,6 +29,15 @@ enum SymbolClass{
     SYM_VAR_LOCAL = 8192
 };
 
+enum ParamMode{
+    PARAM_VALUE,
+    PARAM_VAR,
+    PARAM_CONST,
+    PARAM_RESULT
+};
+
+static const unsigned PARAM_BY_VALUE_LIMIT = 16;
+
 class SymTable;
 class SymType;
 class SymVarParam;
@@ -45,6 +54,7 @@ protected:
 public:
     Symbol(Token token_);
     Symbol(const Symbol& sym);
+    virtual ~Symbol();
     const char* GetName() const;
     Token GetToken() const;
     virtual SymbolClass GetClassName() const;
@@ -63,18 +73,37 @@ public:
     virtual unsigned GetSize() const;
 };
 
+struct SideEffectSummary{
+    bool have_side_effect;
+    bool can_be_replaced;
+    bool dummy;
+    std::vector<bool> affect_params;
+    std::vector<bool> depend_params;
+    VarsContainer affected_vars;
+    VarsContainer dependences;
+};
+
 class SymProc: public Symbol{
 protected:
     bool have_side_effect;
     bool known_side_effect;
     bool searching;
     bool dummy_proc;
+    bool body_released;
     vector<SymVarParam*> params;
+    vector<bool> copied_params;
     SymTable* sym_table;
     NodeStatement* body;
+    SideEffectSummary* summary;
     AsmStrImmediate label;
     AsmStrImmediate exit_label;
     virtual void PrintPrototype(ostream& o, int offset) const;
+    void AllocateRegisters(AsmCode& asm_code, vector<RegisterName>& saved_regs);
+    void GenerateDeclaration64(AsmCode& asm_code);
+    void FindCopiedParams();
+    unsigned GetCopiedParamsSize(const AsmCode& asm_code) const;
+    void GenerateParamCopies(AsmCode& asm_code, int offset) const;
+    void GenerateParamCopies(VmCode& code) const;
 public:
     bool IsAffectToParam(int index);
     bool IsDependOnParam(int index);
@@ -85,14 +114,24 @@ public:
     void AddParam(SymVarParam* param);
     int GetArgsCount() const;
     const SymVarParam* GetArg(int arg_num) const;
+    void GetArgRegisters64(vector<RegisterName>& regs) const;
+    virtual SymVarParam* GetResultParam() const;
     SymTable* GetSymTable() const;
     NodeStatement* GetBody() const;
     void AddBody(NodeStatement* body_);
+    void ReleaseBody();
+    void PrepareGeneration();
+    unsigned GetArgsSize() const;
     void GenerateDeclaration(AsmCode& asm_code);
+    void GenerateDeclaration(VmCode& code);
     AsmStrImmediate GetLabel() const;
+    void SetLabel(const AsmStrImmediate& new_label);
     AsmStrImmediate GetExitLabel() const;
     void ObtainLabels(AsmCode& asm_code);
     bool IsHaveBody() const;
+    bool IsImported() const;
+    SideEffectSummary* MakeSummary();
+    void SetSummary(SideEffectSummary* summary_);
     bool ValidateParams(SymProc* src);
     bool IsHaveSideEffect();
     bool IsAffectToVar(SymVar* var);
@@ -111,12 +150,14 @@ public:
 class SymFunct: public SymProc{
 protected:
     const SymType* result_type;
+    SymVarParam* result_param;
 public:
     SymFunct(Token token_, SymTable* syn_table, const SymType* result_type_);
     SymFunct(Token name);
     void AddResultType(const SymType* result_type_);
     virtual SymbolClass GetClassName() const;
     virtual const SymType* GetResultType() const;
+    virtual SymVarParam* GetResultParam() const;
     virtual void Print(ostream& o, int offset = 0) const;
     virtual bool IsDummyProc();
 };
@@ -124,8 +165,11 @@ public:
 class SymVar: public Symbol{
 protected:
     const SymType* type;
+    RegisterName allocated_reg;
 public:
     SymVar(Token token, const SymType* type_);
+    void SetAllocatedReg(RegisterName reg);
+    RegisterName GetAllocatedReg() const;
     virtual SymbolClass GetClassName() const;
     virtual void Print(ostream& o, int ofefset = 0) const;
     virtual void PrintVerbose(ostream& o, int offset) const;
@@ -133,6 +177,13 @@ public:
     void PrintAsNode(ostream& o, int offset = 0) const;
     virtual void GenerateLValue(AsmCode& asm_code) const;
     virtual void GenerateValue(AsmCode& asm_code) const;
+    virtual int GetRegNeed(const AsmCode& asm_code) const;
+    virtual void GenerateOperandCmd(AsmCode& asm_code, AsmCmdName cmd, RegisterName reg) const;
+    virtual void GenerateToReg(AsmCode& asm_code, RegisterName reg) const;
+    virtual int GetAddressRegNeed(const AsmCode& asm_code) const;
+    virtual AsmMemory GenerateAddress(AsmCode& asm_code, RegisterName reg) const;
+    virtual VmReg GenerateLValue(VmCode& code) const;
+    virtual VmReg GenerateValue(VmCode& code) const;
 };
 
 //---SymType descendants---
@@ -185,6 +236,7 @@ private:
 public:
     SymTypeRecord(SymTable* sym_table_);
     const SymVarLocal* FindField(Token& field_name);
+    SymTable* GetSymTable() const;
     virtual SymbolClass GetClassName() const;
     virtual void Print(ostream& o, int offset = 0) const;
     virtual void PrintVerbose(ostream& o, int offset) const;
@@ -196,6 +248,7 @@ private:
     SymType* target;
 public:
     SymTypeAlias(Token name, SymType* ratget_);
+    SymType* GetTarget() const;
     virtual void Print(ostream& o, int offset = 0) const;
     virtual void PrintVerbose(ostream& o, int offset) const;
     virtual SymbolClass GetClassName() const;
@@ -225,21 +278,45 @@ public:
     virtual void PrintVerbose(ostream& o, int offset = 0) const;
     virtual void GenerateLValue(AsmCode& asm_code) const;
     virtual void GenerateValue(AsmCode& asm_code) const;
+    virtual int GetRegNeed(const AsmCode& asm_code) const;
+    virtual void GenerateOperandCmd(AsmCode& asm_code, AsmCmdName cmd, RegisterName reg) const;
+    virtual VmReg GenerateLValue(VmCode& code) const;
+    virtual VmReg GenerateValue(VmCode& code) const;
 };
 
 class SymVarParam: public SymVar{
 protected:
+    ParamMode mode;
     bool by_ref;
     int offset;
+    bool by_ref64;
+    int offset64;
+    bool IsRefInFrame(const AsmCode& asm_code) const;
+    int GetFrameOffset(const AsmCode& asm_code) const;
     void GenAdrInStack(AsmCode& asm_code) const;
     void GenValueInStack(AsmCode& asm_code) const;
     void GenValueByRef(AsmCode& asm_code) const;
 public:
-    SymVarParam(Token name, const SymType* type, bool by_ref_, int offset_);
+    SymVarParam(Token name, const SymType* type, ParamMode mode_, int offset_);
+    ParamMode GetMode() const;
     bool IsByRef() const;
+    bool IsConst() const;
+    bool IsPassedByRef() const;
+    void GenerateCopy(AsmCode& asm_code, int copy_offset) const;
+    void GenerateCopy(VmCode& code) const;
+    void SetLocation(int offset_);
+    void SetLocation64(int offset_, bool by_ref_);
+    void GenerateLoadToAllocatedReg(AsmCode& asm_code) const;
     virtual SymbolClass GetClassName() const;
     virtual void GenerateLValue(AsmCode& asm_code) const;
     virtual void GenerateValue(AsmCode& asm_code) const;
+    virtual int GetRegNeed(const AsmCode& asm_code) const;
+    virtual void GenerateOperandCmd(AsmCode& asm_code, AsmCmdName cmd, RegisterName reg) const;
+    virtual void GenerateToReg(AsmCode& asm_code, RegisterName reg) const;
+    virtual int GetAddressRegNeed(const AsmCode& asm_code) const;
+    virtual AsmMemory GenerateAddress(AsmCode& asm_code, RegisterName reg) const;
+    virtual VmReg GenerateLValue(VmCode& code) const;
+    virtual VmReg GenerateValue(VmCode& code) const;
 };
 
 class SymVarGlobal: public SymVar{
@@ -251,18 +328,32 @@ public:
     AsmStrImmediate GetLabel() const;
     virtual SymbolClass GetClassName() const;
     void GenerateDeclaration(AsmCode& asm_code);
+    void GenerateDeclaration(VmCode& code) const;
     virtual void GenerateLValue(AsmCode& asm_code) const;
     virtual void GenerateValue(AsmCode& asm_code) const;
+    virtual int GetRegNeed(const AsmCode& asm_code) const;
+    virtual void GenerateOperandCmd(AsmCode& asm_code, AsmCmdName cmd, RegisterName reg) const;
+    virtual int GetAddressRegNeed(const AsmCode& asm_code) const;
+    virtual AsmMemory GenerateAddress(AsmCode& asm_code, RegisterName reg) const;
+    virtual VmReg GenerateLValue(VmCode& code) const;
+    virtual VmReg GenerateValue(VmCode& code) const;
 };
 
 class SymVarLocal: public SymVar{
 private:
     unsigned offset;
+    int GetFrameOffset(const AsmCode& asm_code) const;
 public:
     SymVarLocal(Token name, const SymType* type, unsigned offset_);
     virtual SymbolClass GetClassName() const;
     virtual void GenerateLValue(AsmCode& asm_code) const;
     virtual void GenerateValue(AsmCode& asm_code) const;
+    virtual int GetRegNeed(const AsmCode& asm_code) const;
+    virtual void GenerateOperandCmd(AsmCode& asm_code, AsmCmdName cmd, RegisterName reg) const;
+    virtual int GetAddressRegNeed(const AsmCode& asm_code) const;
+    virtual AsmMemory GenerateAddress(AsmCode& asm_code, RegisterName reg) const;
+    virtual VmReg GenerateLValue(VmCode& code) const;
+    virtual VmReg GenerateValue(VmCode& code) const;
     unsigned GetOffset() const;
     void SetOffset(unsigned offset_);
 };
@@ -286,13 +377,19 @@ public:
     void Add(Symbol* sym);
     const Symbol* Find(Symbol* sym) const;
     const Symbol* Find(const Token& tok) const;
+    void GetSymbols(std::vector<Symbol*>& res) const;
     void Print(ostream& o, int offset = 0) const;
     bool IsEmpty() const;
     unsigned GetSize() const;
     unsigned GetLocalsSize() const;
     unsigned GetParamsSize() const;
+    const std::vector<SymProc*>& GetProcs() const;
     void GenerateDeclarations(AsmCode& asm_code) const;
+    void GenerateDeclarations(VmCode& code) const;
+    void GenerateGlobalsDeclarations(AsmCode& asm_code) const;
+    void GenerateGlobalsDeclarations(VmCode& code) const;
     void Optimize();
+    void PrepareGeneration();
 };
 
 #endif
@@ -7,6 +7,30 @@ static void Error(string msg, Token token)
     throw( CompilerException(s.str()) );
 }
 
+static void SetFlagToReg(AsmCode& asm_code, AsmCmdName set_cmd, RegisterName reg)
+{
+    RegisterName low = REG_NONE;
+    switch (reg)
+    {
+        case REG_EAX: low = REG_AL; break;
+        case REG_EBX: low = REG_BL; break;
+        case REG_ECX: low = REG_CL; break;
+        case REG_EDX: low = REG_DL; break;
+        default: break;
+    }
+    if (low != REG_NONE)
+    {
+        asm_code.AddCmd(set_cmd, low, SIZE_NONE);
+        asm_code.AddCmd(ASM_MOVZB, low, reg);
+        return;
+    }
+    //%esi and %edi have no byte form, so borrow %al
+    asm_code.AddCmd(ASM_PUSH, REG_EAX);
+    asm_code.AddCmd(set_cmd, REG_AL, SIZE_NONE);
+    asm_code.AddCmd(ASM_MOVZB, REG_AL, reg);
+    asm_code.AddCmd(ASM_POP, REG_EAX);
+}
+
 //---NodeCallBase---
 
 void NodeCallBase::PrintArgs(ostream& o, int offset) const
@@ -17,6 +41,12 @@ void NodeCallBase::PrintArgs(ostream& o, int offset) const
     }
 }
 
+NodeCallBase::~NodeCallBase()
+{
+    for (std::vector<SyntaxNode*>::iterator it = args.begin(); it != args.end(); ++it)
+        delete *it;
+}
+
 void NodeCallBase::AddArg(SyntaxNode* arg)
 {
     args.push_back(arg);
@@ -62,17 +92,228 @@ const SymType* NodeCall::GetSymType() const
     return funct->GetResultType();
 }
 
-void NodeCall::GenerateValue(AsmCode& asm_code) const
+bool NodeCall::IsArgInTemp(int arg_num) const
+{
+    return funct->GetArg(arg_num)->IsPassedByRef() && !args[arg_num]->IsLValue();
+}
+
+unsigned NodeCall::GetArgStackSize(const AsmCode& asm_code, int arg_num) const
+{
+    return asm_code.GetStackSize(funct->GetArg(arg_num)->IsPassedByRef() ? 4 : args[arg_num]->GetSymType()->GetSize());
+}
+
+unsigned NodeCall::GenerateTemps(AsmCode& asm_code, vector<unsigned>& temp_offsets) const
+{
+    unsigned size = 0;
+    temp_offsets.assign(args.size(), 0);
+    for (int i = args.size() - 1 ; 0 <= i ; --i)
+        if (IsArgInTemp(i))
+        {
+            args[i]->GenerateValue(asm_code);
+            size += asm_code.GetStackSize(args[i]->GetSymType()->GetSize());
+            temp_offsets[i] = size;
+        }
+    for (size_t i = 0; i < args.size(); ++i)
+        if (IsArgInTemp(i)) temp_offsets[i] = size - temp_offsets[i];
+    return size;
+}
+
+void NodeCall::DropTemps(AsmCode& asm_code, unsigned temps_size, unsigned result_size) const
+{
+    if (!temps_size) return;
+    for (int i = result_size - 4; i >= 0; i -= 4)
+    {
+        asm_code.AddCmd(ASM_MOV, AsmMemory(REG_ESP, i), REG_EAX);
+        asm_code.AddCmd(ASM_MOV, REG_EAX, AsmMemory(REG_ESP, i + temps_size));
+    }
+    asm_code.AddCmd(ASM_ADD, temps_size, REG_ESP);
+}
+
+void NodeCall::GenerateArg(AsmCode& asm_code, int arg_num, unsigned temp_disp) const
+{
+    const SymVarParam* param = funct->GetArg(arg_num);
+    if (IsArgInTemp(arg_num))
+    {
+        asm_code.AddCmd(ASM_LEA, AsmMemory(REG_ESP, temp_disp), REG_EAX);
+        asm_code.AddCmd(ASM_PUSH, REG_EAX);
+    }
+    else if (param->IsPassedByRef())
+        args[arg_num]->GenerateLValue(asm_code);
+    else
+        args[arg_num]->GenerateValue(asm_code);
+}
+
+void NodeCall::GenerateCall(AsmCode& asm_code, const SyntaxNode* dest) const
 {
     if (funct->IsDummyProc()) return;
-    if (funct->GetResultType()->GetSize())
-        asm_code.AddCmd(ASM_SUB, funct->GetResultType()->GetSize(), REG_ESP);
+    if (asm_code.GetTarget() == TARGET_X86_64)
+    {
+        GenerateCall64(asm_code, dest);
+        return;
+    }
+    const SymVarParam* result = funct->GetResultParam();
+    bool hidden_result = result != NULL && result->IsPassedByRef();
+    unsigned result_size = funct->GetResultType()->GetSize();
+    unsigned slot_size = hidden_result || asm_code.IsRegResults() ? 0 : result_size;
+    if (hidden_result && dest == NULL) asm_code.AddCmd(ASM_SUB, result_size, REG_ESP);
+    vector<unsigned> temp_offsets;
+    unsigned temps_size = GenerateTemps(asm_code, temp_offsets);
+    unsigned pushed = hidden_result ? 4 : slot_size;
+    if (dest != NULL)
+        dest->GenerateLValue(asm_code);
+    else if (hidden_result)
+    {
+        asm_code.AddCmd(ASM_LEA, AsmMemory(REG_ESP, temps_size), REG_EAX);
+        asm_code.AddCmd(ASM_PUSH, REG_EAX);
+    }
+    else if (slot_size)
+        asm_code.AddCmd(ASM_SUB, slot_size, REG_ESP);
+    for (int i = args.size() - 1 ; 0 <= i ; --i)
+    {
+        GenerateArg(asm_code, i, pushed + temp_offsets[i]);
+        pushed += GetArgStackSize(asm_code, i);
+    }
+    asm_code.AddCmd(ASM_CALL, AsmMemory(funct->GetLabel()));
+    DropTemps(asm_code, temps_size, slot_size);
+}
+
+void NodeCall::GenerateCall64(AsmCode& asm_code, const SyntaxNode* dest) const
+{
+    vector<RegisterName> regs;
+    funct->GetArgRegisters64(regs);
+    const SymType* result_type = funct->GetResultType();
+    unsigned result_size = result_type->GetSize();
+    if (result_size > 4 && dest == NULL) asm_code.AddCmd(ASM_SUB, asm_code.GetStackSize(result_size), REG_ESP);
+    vector<unsigned> temp_offsets;
+    unsigned temps_size = GenerateTemps(asm_code, temp_offsets);
+    unsigned stack_size = 0;
+    unsigned pushed = 0;
     for (int i = args.size() - 1 ; 0 <= i ; --i)
+        if (regs[i] == REG_NONE)
+        {
+            GenerateArg(asm_code, i, pushed + temp_offsets[i]);
+            stack_size += GetArgStackSize(asm_code, i);
+            pushed += GetArgStackSize(asm_code, i);
+        }
+    for (int i = args.size() - 1 ; 0 <= i ; --i)
+        if (regs[i] != REG_NONE)
+        {
+            GenerateArg(asm_code, i, pushed + temp_offsets[i]);
+            pushed += GetArgStackSize(asm_code, i);
+        }
+    if (dest != NULL)
+    {
+        dest->GenerateLValue(asm_code);
+        asm_code.AddCmd(ASM_POP, REG_EDI);
+    }
+    for (size_t i = 0; i < args.size(); ++i)
+        if (regs[i] >= REG_XMM0 && regs[i] <= REG_XMM7)
+        {
+            asm_code.AddCmd(ASM_MOVSS, AsmMemory(REG_ESP), regs[i], SIZE_NONE);
+            asm_code.AddCmd(ASM_ADD, 8, REG_ESP);
+        }
+        else if (regs[i] != REG_NONE)
+            asm_code.AddCmd(ASM_POP, regs[i]);
+    if (result_size > 4 && dest == NULL) asm_code.AddCmd(ASM_LEA, AsmMemory(REG_ESP, stack_size + temps_size), REG_EDI);
+    asm_code.AddCmd(ASM_CALL, AsmMemory(funct->GetLabel()));
+    if (stack_size + temps_size) asm_code.AddCmd(ASM_ADD, stack_size + temps_size, REG_ESP);
+}
+
+void NodeCall::GenerateValue(AsmCode& asm_code) const
+{
+    GenerateCall(asm_code, NULL);
+    const SymVarParam* result = funct->GetResultParam();
+    if (result == NULL || result->IsPassedByRef() || !asm_code.IsRegResults()) return;
+    if (GetSymType() != top_type_real)
+    {
+        asm_code.AddCmd(ASM_PUSH, REG_EAX);
+        return;
+    }
+    asm_code.AddCmd(ASM_SUB, asm_code.GetStackSize(4), REG_ESP);
+    if (asm_code.IsSse()) asm_code.AddCmd(ASM_MOVSS, REG_XMM0, AsmMemory(REG_ESP), SIZE_NONE);
+    else asm_code.AddCmd(ASM_FSTP, AsmMemory(REG_ESP), SIZE_SHORT);
+}
+
+int NodeCall::GetRegNeed(const AsmCode& asm_code) const
+{
+    //the callee may clobber every expression register, so nothing can stay live across the call
+    if (!asm_code.IsRegResults() || GetSymType()->GetActualType() != top_type_int) return REG_NEED_STACK;
+    return asm_code.GetExprRegsCount();
+}
+
+void NodeCall::GenerateToReg(AsmCode& asm_code, const RegisterName* regs, int count) const
+{
+    GenerateCall(asm_code, NULL);
+    if (regs[0] != REG_EAX) asm_code.AddCmd(ASM_MOV, REG_EAX, regs[0]);
+}
+
+VmReg NodeCall::GenerateCall(VmCode& code, const SyntaxNode* dest) const
+{
+    if (funct->IsDummyProc()) return 0;
+    const SymVarParam* result = funct->GetResultParam();
+    bool hidden_result = result != NULL && result->IsPassedByRef();
+    unsigned result_size = funct->GetResultType()->GetSize();
+    VmReg res = 0;
+    if (dest != NULL)
+        res = dest->GenerateLValue(code);
+    else if (hidden_result)
+    {
+        res = code.NewReg();
+        code.AddCmd(VM_LEA, res, code.AllocTemp(result_size));
+    }
+    else if (result_size)
+        code.AddCmd(VM_RESERVE, 0, result_size);
+    if (hidden_result) code.AddCmd(VM_PUSH, res);
+    for (int i = args.size() - 1 ; 0 <= i ; --i)
+    {
+        unsigned mark = code.GetRegMark();
+        unsigned size = args[i]->GetSymType()->GetSize();
         if (funct->GetArg(i)->IsByRef())
-            args[i]->GenerateLValue(asm_code);
+            code.AddCmd(VM_PUSH, args[i]->GenerateLValue(code));
+        else if (funct->GetArg(i)->IsPassedByRef())
+            code.AddCmd(VM_PUSH, args[i]->GenerateValue(code));
+        else if (size == 4)
+            code.AddCmd(VM_PUSH, args[i]->GenerateValue(code));
         else
-            args[i]->GenerateValue(asm_code);
-    asm_code.AddCmd(ASM_CALL, AsmMemory(funct->GetLabel()));
+            code.AddCmd(VM_PUSHN, args[i]->GenerateValue(code), 0, size);
+        code.ReleaseRegs(mark);
+    }
+    code.AddCmd(VM_CALL, 0, code.ProcIndex(funct, funct->GetName()));
+    if (hidden_result) return res;
+    res = code.NewReg();
+    if (result_size) code.AddCmd(VM_POP, res);
+    return res;
+}
+
+VmReg NodeCall::GenerateValue(VmCode& code) const
+{
+    return GenerateCall(code, NULL);
+}
+
+bool NodeCall::CanConstructIn(SyntaxNode* dest)
+{
+    const SymVarParam* result = funct->GetResultParam();
+    if (result == NULL || !result->IsPassedByRef() || dest->IsHaveSideEffect()) return false;
+    SymVar* var = dest->GetAffectedVar();
+    bool is_result = (var->GetClassName() & SYM_VAR_PARAM) && ((SymVarParam*)var)->GetMode() == PARAM_RESULT;
+    if (!(var->GetClassName() & (SYM_VAR_LOCAL | SYM_VAR_GLOBAL)) && !is_result) return false;
+    VarsContainer dest_vars, used, addressed;
+    dest->GetAllUsedVars(dest_vars, addressed);
+    dest->GetAllDependences(dest_vars);
+    if (dest_vars.size() != 1) return false;
+    GetAllUsedVars(used, addressed);
+    if (used.find(var) != used.end() || addressed.find(var) != addressed.end()) return false;
+    return !(var->GetClassName() & SYM_VAR_GLOBAL) || (!funct->IsAffectToVar(var) && !funct->IsDependOnVar(var));
+}
+
+void NodeCall::ConstructIn(AsmCode& asm_code, const SyntaxNode* dest) const
+{
+    GenerateCall(asm_code, dest);
+}
+
+void NodeCall::ConstructIn(VmCode& code, const SyntaxNode* dest) const
+{
+    GenerateCall(code, dest);
 }
 
 bool NodeCall::IsHaveSideEffect()
@@ -103,6 +344,15 @@ void NodeCall::GetAllDependences(VarsContainer& res_cont, bool with_self)
     funct->GetAllDependences(res_cont);
 }
 
+void NodeCall::GetAllUsedVars(VarsContainer& used, VarsContainer& addressed)
+{
+    for (size_t i = 0; i < args.size(); ++i)
+    {
+        args[i]->GetAllUsedVars(used, addressed);
+        if (funct->GetArg(i)->IsPassedByRef()) addressed.insert(args[i]->GetAffectedVar());
+    }
+}
+
 bool NodeCall::CanBeReplaced()
 {
     for (int i = 0; i < args.size(); ++i)
@@ -141,6 +391,25 @@ void NodeWriteCall::GenerateValue(AsmCode& asm_code) const
     if (new_line) asm_code.GenWriteNewLine();
 }
 
+VmReg NodeWriteCall::GenerateValue(VmCode& code) const
+{
+    for (std::vector<SyntaxNode*>::const_iterator it = args.begin(); it != args.end(); ++it)
+    {
+        unsigned mark = code.GetRegMark();
+        VmReg value = (*it)->GenerateValue(code);
+        const SymType* type = (*it)->GetSymType();
+        if (type == top_type_int)
+            code.AddCmd(VM_WRITE_INT, value);
+        else if (type == top_type_real)
+            code.AddCmd(VM_WRITE_REAL, value);
+        else
+            code.AddCmd(VM_WRITE_STR, value);
+        code.ReleaseRegs(mark);
+    }
+    if (new_line) code.AddCmd(VM_WRITE_LN);
+    return 0;
+}
+
 const SymType* NodeWriteCall::GetSymType() const
 {
     return top_type_untyped;
@@ -163,37 +432,137 @@ void NodeWriteCall::GetAllDependences(VarsContainer& res_cont, bool with_self)
         (*it)->GetAllDependences(res_cont);
 }
 
+void NodeWriteCall::GetAllUsedVars(VarsContainer& used, VarsContainer& addressed)
+{
+    for (std::vector<SyntaxNode*>::iterator it = args.begin(); it != args.end(); ++ it)
+        (*it)->GetAllUsedVars(used, addressed);
+}
+
 bool NodeWriteCall::CanBeReplaced()
 {
     return false;
 }
 
+static void ComputeDivMagic(unsigned divisor, int& magic, int& shift)
+{
+    const unsigned two31 = 0x80000000u;
+    unsigned anc = two31 - 1 - two31 % divisor;
+    unsigned q1 = two31 / anc, r1 = two31 - q1 * anc;
+    unsigned q2 = two31 / divisor, r2 = two31 - q2 * divisor;
+    unsigned delta;
+    shift = 31;
+    do
+    {
+        ++shift;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc)
+        {
+            ++q1;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= divisor)
+        {
+            ++q2;
+            r2 -= divisor;
+        }
+        delta = divisor - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+    magic = q2 + 1;
+    shift -= 32;
+}
+
 //---NodeBinaryOp---
 
+bool NodeBinaryOp::GetIntRegCmd(AsmCmdName& cmd) const
+{
+    switch (token.GetValue())
+    {
+        case TOK_PLUS: cmd = ASM_ADD; return true;
+        case TOK_MINUS: cmd = ASM_SUB; return true;
+        case TOK_MULT: cmd = ASM_IMUL; return true;
+        case TOK_AND: cmd = ASM_AND; return true;
+        case TOK_OR: cmd = ASM_OR; return true;
+        case TOK_XOR: cmd = ASM_XOR; return true;
+        default: break;
+    }
+    cmd = ASM_CMP;
+    return token.IsRelationalOp();
+}
+
+bool NodeBinaryOp::IsDivByConst() const
+{
+    if (left->GetSymType() != top_type_int || (token.GetValue() != TOK_DIV && token.GetValue() != TOK_MOD)) return false;
+    return right->IsConst() && right->ComputeIntConstExpr();
+}
+
+AsmCmdName NodeBinaryOp::GetIntSetCmd() const
+{
+    switch (token.GetValue())
+    {
+        case TOK_GREATER: return ASM_SETG;
+        case TOK_GREATER_OR_EQUAL: return ASM_SETGE;
+        case TOK_LESS: return ASM_SETL;
+        case TOK_LESS_OR_EQUAL: return ASM_SETLE;
+        case TOK_EQUAL: return ASM_SETE;
+        case TOK_NOT_EQUAL: return ASM_SETNE;
+        default: break;
+    }
+    throw CompilerException("operation " + string(token.GetName()) + " isn't relational");
+}
+
+AsmCmdName NodeBinaryOp::GetIntFalseJumpCmd() const
+{
+    switch (token.GetValue())
+    {
+        case TOK_GREATER: return ASM_JNG;
+        case TOK_GREATER_OR_EQUAL: return ASM_JL;
+        case TOK_LESS: return ASM_JNL;
+        case TOK_LESS_OR_EQUAL: return ASM_JG;
+        case TOK_EQUAL: return ASM_JNZ;
+        case TOK_NOT_EQUAL: return ASM_JZ;
+        default: break;
+    }
+    throw CompilerException("operation " + string(token.GetName()) + " isn't relational");
+}
+
 void NodeBinaryOp::FinGenForIntRelationalOp(AsmCode& asm_code) const
 {
     asm_code.AddCmd(ASM_CMP, REG_EBX, REG_EAX);
+    asm_code.AddCmd(GetIntSetCmd(), REG_AL, SIZE_NONE);
+    asm_code.AddCmd(ASM_MOVZB, REG_AL, REG_EAX);
+}
+
+AsmCmdName NodeBinaryOp::GetRealSetCmd() const
+{
     switch (token.GetValue())
     {
-        case TOK_GREATER:
-            asm_code.AddCmd(ASM_SETG, REG_AL, SIZE_NONE);
-        break;
-        case TOK_GREATER_OR_EQUAL:
-            asm_code.AddCmd(ASM_SETGE, REG_AL, SIZE_NONE);
-        break;
-        case TOK_LESS:
-            asm_code.AddCmd(ASM_SETL, REG_AL, SIZE_NONE);
-        break;
-        case TOK_LESS_OR_EQUAL:
-            asm_code.AddCmd(ASM_SETLE, REG_AL, SIZE_NONE);
-        break;
-        case TOK_EQUAL:
-            asm_code.AddCmd(ASM_SETE, REG_AL, SIZE_NONE);
-        break;
-        case TOK_NOT_EQUAL:
-            asm_code.AddCmd(ASM_SETNE, REG_AL, SIZE_NONE);
+        case TOK_GREATER: return ASM_SETA;
+        case TOK_GREATER_OR_EQUAL: return ASM_SETAE;
+        case TOK_LESS: return ASM_SETB;
+        case TOK_LESS_OR_EQUAL: return ASM_SETBE;
+        case TOK_EQUAL: return ASM_SETE;
+        case TOK_NOT_EQUAL: return ASM_SETNE;
+        default: break;
     }
-    asm_code.AddCmd(ASM_MOVZB, REG_AL, REG_EAX);
+    throw CompilerException("operation " + string(token.GetName()) + " can't be run on reals");
+}
+
+AsmCmdName NodeBinaryOp::GetRealFalseJumpCmd() const
+{
+    switch (token.GetValue())
+    {
+        case TOK_GREATER: return ASM_JBE;
+        case TOK_GREATER_OR_EQUAL: return ASM_JB;
+        case TOK_LESS: return ASM_JAE;
+        case TOK_LESS_OR_EQUAL: return ASM_JA;
+        case TOK_EQUAL: return ASM_JNZ;
+        case TOK_NOT_EQUAL: return ASM_JZ;
+        default: break;
+    }
+    throw CompilerException("operation " + string(token.GetName()) + " can't be run on reals");
 }
 
 void NodeBinaryOp::FinGenForRealRelationalOp(AsmCode& asm_code) const
@@ -201,32 +570,8 @@ void NodeBinaryOp::FinGenForRealRelationalOp(AsmCode& asm_code) const
     asm_code.AddCmd(ASM_FXCH, REG_ST1, SIZE_NONE);
     asm_code.AddCmd(ASM_FCOMPP, SIZE_NONE);
     asm_code.AddCmd(ASM_FNSTSW, REG_AX, SIZE_NONE);
-    switch (token.GetValue())
-    {
-        case TOK_GREATER:
-            asm_code.AddCmd(ASM_SAHF, SIZE_NONE);
-            asm_code.AddCmd(ASM_SETA, REG_AL, SIZE_NONE);
-        break;
-        case TOK_GREATER_OR_EQUAL:
-            asm_code.AddCmd(ASM_SAHF, SIZE_NONE);
-            asm_code.AddCmd(ASM_SETAE, REG_AL, SIZE_NONE);
-        break;
-        case TOK_LESS:
-            asm_code.AddCmd(ASM_SAHF, SIZE_NONE);
-            asm_code.AddCmd(ASM_SETB, REG_AL, SIZE_NONE);
-        break;
-        case TOK_LESS_OR_EQUAL:
-            asm_code.AddCmd(ASM_SAHF, SIZE_NONE);
-            asm_code.AddCmd(ASM_SETBE, REG_AL, SIZE_NONE);
-        break;
-        case TOK_EQUAL:
-            asm_code.AddCmd(ASM_SAHF, SIZE_NONE);
-            asm_code.AddCmd(ASM_SETE, REG_AL, SIZE_NONE);
-        break;
-        case TOK_NOT_EQUAL:
-            asm_code.AddCmd(ASM_SAHF, SIZE_NONE);
-            asm_code.AddCmd(ASM_SETNE, REG_AL, SIZE_NONE);
-    }
+    asm_code.AddCmd(ASM_SAHF, SIZE_NONE);
+    asm_code.AddCmd(GetRealSetCmd(), REG_AL, SIZE_NONE);
     asm_code.AddCmd(ASM_MOVZB, REG_AL, REG_EAX);
     asm_code.AddCmd(ASM_MOV, REG_EAX, AsmMemory(REG_ESP));
 }
@@ -247,11 +592,11 @@ void NodeBinaryOp::GenerateForInt(AsmCode& asm_code) const
             asm_code.AddCmd(ASM_IMUL, REG_EBX);
         break;
         case TOK_DIV:
-            asm_code.AddCmd(ASM_XOR, REG_EDX, REG_EDX);
+            asm_code.AddCmd(ASM_CLTD, SIZE_NONE);
             asm_code.AddCmd(ASM_IDIV, REG_EBX);
         break;
         case TOK_MOD:
-            asm_code.AddCmd(ASM_XOR, REG_EDX, REG_EDX);
+            asm_code.AddCmd(ASM_CLTD, SIZE_NONE);
             asm_code.AddCmd(ASM_IDIV, REG_EBX);
             asm_code.AddCmd(ASM_PUSH, REG_EDX);
             return;
@@ -283,11 +628,93 @@ void NodeBinaryOp::GenerateForInt(AsmCode& asm_code) const
     asm_code.AddCmd(ASM_PUSH, REG_EAX);
 }
 
+void NodeBinaryOp::GenerateDivByConst(AsmCode& asm_code, int divisor) const
+{
+    bool is_mod = token.GetValue() == TOK_MOD;
+    unsigned abs_divisor = divisor < 0 ? 0u - (unsigned)divisor : divisor;
+    asm_code.AddCmd(ASM_POP, REG_EAX);
+    if (abs_divisor == 1)
+    {
+        if (is_mod) asm_code.AddCmd(ASM_XOR, REG_EAX, REG_EAX);
+        else if (divisor < 0) asm_code.AddCmd(ASM_NEG, REG_EAX);
+        asm_code.AddCmd(ASM_PUSH, REG_EAX);
+        return;
+    }
+    if (is_mod) asm_code.AddCmd(ASM_MOV, REG_EAX, REG_EBX);
+    if (!(abs_divisor & (abs_divisor - 1)))
+    {
+        int shift = 0;
+        while (1u << shift != abs_divisor) ++shift;
+        asm_code.AddCmd(ASM_CLTD, SIZE_NONE);
+        asm_code.AddCmd(ASM_SHR, 32 - shift, REG_EDX);
+        asm_code.AddCmd(ASM_ADD, REG_EDX, REG_EAX);
+        if (is_mod) asm_code.AddCmd(ASM_AND, (int)(0u - abs_divisor), REG_EAX);
+        else asm_code.AddCmd(ASM_SAR, shift, REG_EAX);
+    }
+    else
+    {
+        int magic, shift;
+        ComputeDivMagic(abs_divisor, magic, shift);
+        if (!is_mod) asm_code.AddCmd(ASM_MOV, REG_EAX, REG_EBX);
+        asm_code.AddCmd(ASM_MOV, magic, REG_EAX);
+        asm_code.AddCmd(ASM_IMUL, REG_EBX);
+        if (magic < 0) asm_code.AddCmd(ASM_ADD, REG_EBX, REG_EDX);
+        if (shift) asm_code.AddCmd(ASM_SAR, shift, REG_EDX);
+        asm_code.AddCmd(ASM_MOV, REG_EBX, REG_EAX);
+        asm_code.AddCmd(ASM_SHR, 31, REG_EAX);
+        asm_code.AddCmd(ASM_ADD, REG_EDX, REG_EAX);
+        if (is_mod) asm_code.AddCmd(ASM_IMUL, (int)abs_divisor, REG_EAX);
+    }
+    if (is_mod)
+    {
+        asm_code.AddCmd(ASM_SUB, REG_EAX, REG_EBX);
+        asm_code.AddCmd(ASM_PUSH, REG_EBX);
+        return;
+    }
+    if (divisor < 0) asm_code.AddCmd(ASM_NEG, REG_EAX);
+    asm_code.AddCmd(ASM_PUSH, REG_EAX);
+}
+
+void NodeBinaryOp::GenerateForRealSse(AsmCode& asm_code) const
+{
+    unsigned slot = asm_code.GetStackSize(4);
+    asm_code.AddCmd(ASM_MOVSS, AsmMemory(REG_ESP, slot), REG_XMM0, SIZE_NONE);
+    switch (token.GetValue())
+    {
+        case TOK_PLUS:
+            asm_code.AddCmd(ASM_ADDSS, AsmMemory(REG_ESP), REG_XMM0, SIZE_NONE);
+        break;
+        case TOK_MINUS:
+            asm_code.AddCmd(ASM_SUBSS, AsmMemory(REG_ESP), REG_XMM0, SIZE_NONE);
+        break;
+        case TOK_MULT:
+            asm_code.AddCmd(ASM_MULSS, AsmMemory(REG_ESP), REG_XMM0, SIZE_NONE);
+        break;
+        case TOK_DIVISION:
+            asm_code.AddCmd(ASM_DIVSS, AsmMemory(REG_ESP), REG_XMM0, SIZE_NONE);
+        break;
+        default:
+            asm_code.AddCmd(ASM_UCOMISS, AsmMemory(REG_ESP), REG_XMM0, SIZE_NONE);
+            asm_code.AddCmd(GetRealSetCmd(), REG_AL, SIZE_NONE);
+            asm_code.AddCmd(ASM_MOVZB, REG_AL, REG_EAX);
+            asm_code.AddCmd(ASM_ADD, slot, REG_ESP);
+            asm_code.AddCmd(ASM_MOV, REG_EAX, AsmMemory(REG_ESP));
+            return;
+    }
+    asm_code.AddCmd(ASM_ADD, slot, REG_ESP);
+    asm_code.AddCmd(ASM_MOVSS, REG_XMM0, AsmMemory(REG_ESP), SIZE_NONE);
+}
+
 void NodeBinaryOp::GenerateForReal(AsmCode& asm_code) const
 {
-    asm_code.AddCmd(ASM_FLD, AsmMemory(REG_ESP, 4), SIZE_SHORT);
+    if (asm_code.IsSse())
+    {
+        GenerateForRealSse(asm_code);
+        return;
+    }
+    asm_code.AddCmd(ASM_FLD, AsmMemory(REG_ESP, asm_code.GetStackSize(4)), SIZE_SHORT);
     asm_code.AddCmd(ASM_FLD, AsmMemory(REG_ESP), SIZE_SHORT);
-    asm_code.AddCmd(ASM_ADD, 4, REG_ESP);
+    asm_code.AddCmd(ASM_ADD, asm_code.GetStackSize(4), REG_ESP);
     switch (token.GetValue())
     {
         case TOK_PLUS:
@@ -309,6 +736,50 @@ void NodeBinaryOp::GenerateForReal(AsmCode& asm_code) const
     asm_code.AddCmd(ASM_FSTP, AsmMemory(REG_ESP), SIZE_SHORT);
 }
 
+VmOpcode NodeBinaryOp::GetIntOpcode() const
+{
+    switch (token.GetValue())
+    {
+        case TOK_PLUS: return VM_ADD;
+        case TOK_MINUS: return VM_SUB;
+        case TOK_MULT: return VM_MUL;
+        case TOK_DIV: return VM_DIV;
+        case TOK_MOD: return VM_MOD;
+        case TOK_AND: return VM_AND;
+        case TOK_OR: return VM_OR;
+        case TOK_XOR: return VM_XOR;
+        case TOK_SHL: return VM_SHL;
+        case TOK_SHR: return VM_SHR;
+        case TOK_GREATER: return VM_GT;
+        case TOK_GREATER_OR_EQUAL: return VM_GE;
+        case TOK_LESS: return VM_LT;
+        case TOK_LESS_OR_EQUAL: return VM_LE;
+        case TOK_EQUAL: return VM_EQ;
+        case TOK_NOT_EQUAL: return VM_NE;
+        default: break;
+    }
+    throw CompilerException("operation " + string(token.GetName()) + " can't be run on integers");
+}
+
+VmOpcode NodeBinaryOp::GetRealOpcode() const
+{
+    switch (token.GetValue())
+    {
+        case TOK_PLUS: return VM_FADD;
+        case TOK_MINUS: return VM_FSUB;
+        case TOK_MULT: return VM_FMUL;
+        case TOK_DIVISION: return VM_FDIV;
+        case TOK_GREATER: return VM_FGT;
+        case TOK_GREATER_OR_EQUAL: return VM_FGE;
+        case TOK_LESS: return VM_FLT;
+        case TOK_LESS_OR_EQUAL: return VM_FLE;
+        case TOK_EQUAL: return VM_FEQ;
+        case TOK_NOT_EQUAL: return VM_FNE;
+        default: break;
+    }
+    throw CompilerException("operation " + string(token.GetName()) + " can't be run on reals");
+}
+
 NodeBinaryOp::NodeBinaryOp(const Token& name, SyntaxNode* left_, SyntaxNode* right_):
     token(name),
     left(left_),
@@ -316,6 +787,12 @@ NodeBinaryOp::NodeBinaryOp(const Token& name, SyntaxNode* left_, SyntaxNode* rig
 {
 }
 
+NodeBinaryOp::~NodeBinaryOp()
+{
+    delete left;
+    delete right;
+}
+
 void NodeBinaryOp::Print(ostream& o, int offset) const
 {
     PrintSpaces(o, offset) << token.GetName() << " [";
@@ -333,12 +810,221 @@ const SymType* NodeBinaryOp::GetSymType() const
 
 void NodeBinaryOp::GenerateValue(AsmCode& asm_code) const
 {
+    if (GenerateValueInRegs(asm_code)) return;
     left->GenerateValue(asm_code);
+    if (IsDivByConst())
+    {
+        GenerateDivByConst(asm_code, right->ComputeIntConstExpr());
+        return;
+    }
     right->GenerateValue(asm_code);
     if (left->GetSymType() == top_type_int) GenerateForInt(asm_code);
     else GenerateForReal(asm_code);
 }
 
+int NodeBinaryOp::GetRegNeed(const AsmCode& asm_code) const
+{
+    AsmCmdName cmd;
+    //expression trees are kept in registers only when optimizing
+    if (!asm_code.IsOptimize() || left->GetSymType() != top_type_int || !GetIntRegCmd(cmd)) return REG_NEED_STACK;
+    int l = max(left->GetRegNeed(asm_code), 1);
+    int r = right->GetRegNeed(asm_code);
+    if (l == REG_NEED_STACK || r == REG_NEED_STACK) return REG_NEED_STACK;
+    return l == r ? l + 1 : max(l, r);
+}
+
+void NodeBinaryOp::GenerateToReg(AsmCode& asm_code, const RegisterName* regs, int count) const
+{
+    AsmCmdName cmd;
+    GetIntRegCmd(cmd);
+    GenerateOperationToReg(asm_code, regs, count, cmd);
+    if (cmd == ASM_CMP) SetFlagToReg(asm_code, GetIntSetCmd(), regs[0]);
+}
+
+void NodeBinaryOp::GenerateOperationToReg(AsmCode& asm_code, const RegisterName* regs, int count, AsmCmdName cmd) const
+{
+    RegisterName dest = regs[0];
+    int l = max(left->GetRegNeed(asm_code), 1);
+    int r = right->GetRegNeed(asm_code);
+    //calls must keep running left to right, so a side with a call is never evaluated ahead of the left one
+    bool ordered = left->IsHaveSideEffect() || right->IsHaveSideEffect();
+    RegisterName swapped[EXPR_REGS_COUNT];
+    if (count > 1)
+    {
+        swapped[0] = regs[1];
+        swapped[1] = regs[0];
+        copy(regs + 2, regs + count, swapped + 2);
+    }
+    if (r == 0)
+    {
+        left->GenerateToReg(asm_code, regs, count);
+        right->GenerateOperandCmd(asm_code, cmd, dest);
+    }
+    else if (count > 1 && min(l, r) < count && (l >= r || !ordered))
+    {
+        if (l >= r)
+        {
+            left->GenerateToReg(asm_code, regs, count);
+            right->GenerateToReg(asm_code, regs + 1, count - 1);
+        }
+        else
+        {
+            right->GenerateToReg(asm_code, swapped, count);
+            left->GenerateToReg(asm_code, swapped + 1, count - 1);
+        }
+        asm_code.AddCmd(cmd, regs[1], dest);
+    }
+    else if (count > 1 && ordered)
+    {
+        left->GenerateToReg(asm_code, regs, count);
+        asm_code.AddCmd(ASM_PUSH, dest);
+        right->GenerateToReg(asm_code, swapped, count);
+        asm_code.AddCmd(ASM_POP, dest);
+        asm_code.AddCmd(cmd, regs[1], dest);
+    }
+    else
+    {
+        right->GenerateToReg(asm_code, regs, count);
+        asm_code.AddCmd(ASM_PUSH, dest);
+        left->GenerateToReg(asm_code, regs, count);
+        asm_code.AddCmd(cmd, AsmMemory(REG_ESP), dest);
+        asm_code.AddCmd(ASM_LEA, AsmMemory(REG_ESP, asm_code.GetStackSize(4)), REG_ESP);
+    }
+}
+
+bool NodeBinaryOp::IsShortCircuit() const
+{
+    if (left->GetSymType() != top_type_int) return false;
+    if (token.GetValue() == TOK_OR) return true;
+    return token.GetValue() == TOK_AND && left->IsBoolean() && right->IsBoolean();
+}
+
+bool NodeBinaryOp::IsBoolean() const
+{
+    if (token.IsRelationalOp()) return true;
+    return (token.GetValue() == TOK_AND || token.GetValue() == TOK_OR) && left->IsBoolean() && right->IsBoolean();
+}
+
+void NodeBinaryOp::GenerateJumpIfFalse(AsmCode& asm_code, const AsmStrImmediate& label) const
+{
+    GenerateBranch(asm_code, label, false);
+}
+
+void NodeBinaryOp::GenerateJumpIfTrue(AsmCode& asm_code, const AsmStrImmediate& label) const
+{
+    GenerateBranch(asm_code, label, true);
+}
+
+void NodeBinaryOp::GenerateBranch(AsmCode& asm_code, const AsmStrImmediate& label, bool if_true) const
+{
+    if (IsShortCircuit())
+    {
+        bool is_and = token.GetValue() == TOK_AND;
+        if (is_and != if_true)
+        {
+            left->GenerateJump(asm_code, label, if_true);
+            right->GenerateJump(asm_code, label, if_true);
+            return;
+        }
+        AsmStrImmediate label_skip(asm_code.GenLabel(is_and ? "and_false" : "or_true"));
+        left->GenerateJump(asm_code, label_skip, !if_true);
+        right->GenerateJump(asm_code, label, if_true);
+        asm_code.AddLabel(label_skip);
+        return;
+    }
+    //without optimization only sse reals branch on the compare, everything else is materialized and tested
+    bool compare_and_branch = asm_code.IsOptimize() || (asm_code.IsSse() && left->GetSymType() != top_type_int);
+    if (!token.IsRelationalOp() || !compare_and_branch)
+    {
+        if (if_true) SyntaxNode::GenerateJumpIfTrue(asm_code, label);
+        else SyntaxNode::GenerateJumpIfFalse(asm_code, label);
+        return;
+    }
+    if (left->GetSymType() == top_type_int)
+    {
+        if (GetRegNeed(asm_code) == REG_NEED_STACK)
+        {
+            left->GenerateValue(asm_code);
+            right->GenerateValue(asm_code);
+            asm_code.AddCmd(ASM_POP, REG_EBX);
+            asm_code.AddCmd(ASM_POP, REG_EAX);
+            asm_code.AddCmd(ASM_CMP, REG_EBX, REG_EAX);
+        }
+        else
+            GenerateOperationToReg(asm_code, asm_code.GetExprRegs(), asm_code.GetExprRegsCount(), ASM_CMP);
+        asm_code.AddCmd(if_true ? InverseJump(GetIntFalseJumpCmd()) : GetIntFalseJumpCmd(), label, SIZE_NONE);
+        return;
+    }
+    unsigned slot = asm_code.GetStackSize(4);
+    left->GenerateValue(asm_code);
+    right->GenerateValue(asm_code);
+    if (asm_code.IsSse())
+    {
+        asm_code.AddCmd(ASM_MOVSS, AsmMemory(REG_ESP), REG_XMM1, SIZE_NONE);
+        asm_code.AddCmd(ASM_MOVSS, AsmMemory(REG_ESP, slot), REG_XMM0, SIZE_NONE);
+        asm_code.AddCmd(ASM_ADD, 2 * slot, REG_ESP);
+        asm_code.AddCmd(ASM_UCOMISS, REG_XMM1, REG_XMM0, SIZE_NONE);
+    }
+    else
+    {
+        asm_code.AddCmd(ASM_FLD, AsmMemory(REG_ESP), SIZE_SHORT);
+        asm_code.AddCmd(ASM_FLD, AsmMemory(REG_ESP, slot), SIZE_SHORT);
+        asm_code.AddCmd(ASM_ADD, 2 * slot, REG_ESP);
+        asm_code.AddCmd(ASM_FUCOMIP, REG_ST1, REG_ST, SIZE_NONE);
+        asm_code.AddCmd(ASM_FSTP, REG_ST, SIZE_NONE);
+    }
+    asm_code.AddCmd(if_true ? InverseJump(GetRealFalseJumpCmd()) : GetRealFalseJumpCmd(), label, SIZE_NONE);
+}
+
+VmReg NodeBinaryOp::GenerateValue(VmCode& code) const
+{
+    VmReg res = left->GenerateValue(code);
+    if (left->GetSymType() != top_type_int)
+    {
+        code.AddCmd(GetRealOpcode(), res, res, right->GenerateValue(code));
+        return res;
+    }
+    VmOpcode op = GetIntOpcode();
+    if ((op == VM_ADD || op == VM_SUB || op == VM_MUL) && right->IsConst())
+    {
+        int value = right->ComputeIntConstExpr();
+        code.AddCmd(op == VM_MUL ? VM_MULI : VM_ADDI, res, res, op == VM_SUB ? -value : value);
+    }
+    else
+        code.AddCmd(op, res, res, right->GenerateValue(code));
+    return res;
+}
+
+void NodeBinaryOp::GenerateJumpIfFalse(VmCode& code, VmLabel label) const
+{
+    GenerateBranch(code, label, false);
+}
+
+void NodeBinaryOp::GenerateJumpIfTrue(VmCode& code, VmLabel label) const
+{
+    GenerateBranch(code, label, true);
+}
+
+void NodeBinaryOp::GenerateBranch(VmCode& code, VmLabel label, bool if_true) const
+{
+    if (!IsShortCircuit())
+    {
+        if (if_true) SyntaxNode::GenerateJumpIfTrue(code, label);
+        else SyntaxNode::GenerateJumpIfFalse(code, label);
+        return;
+    }
+    if ((token.GetValue() == TOK_AND) != if_true)
+    {
+        left->GenerateJump(code, label, if_true);
+        right->GenerateJump(code, label, if_true);
+        return;
+    }
+    VmLabel label_skip = code.GenLabel();
+    left->GenerateJump(code, label_skip, !if_true);
+    right->GenerateJump(code, label, if_true);
+    code.AddLabel(label_skip);
+}
+
 bool NodeBinaryOp::IsConst() const
 {
     return left->IsConst() && right->IsConst();
@@ -480,6 +1166,12 @@ void NodeBinaryOp::GetAllDependences(VarsContainer& res_cont, bool with_self)
     right->GetAllDependences(res_cont);
 }
 
+void NodeBinaryOp::GetAllUsedVars(VarsContainer& used, VarsContainer& addressed)
+{
+    left->GetAllUsedVars(used, addressed);
+    right->GetAllUsedVars(used, addressed);
+}
+
 void NodeBinaryOp::Optimize()
 {
     left->Optimize();
@@ -510,6 +1202,11 @@ void NodeUnaryOp::GenerateForInt(AsmCode& asm_code) const
 void NodeUnaryOp::GenerateForReal(AsmCode& asm_code) const
 {
     if (token.GetValue() != TOK_MINUS) return;
+    if (asm_code.IsSse())
+    {
+        asm_code.AddCmd(ASM_XOR, AsmIntImmediate(0x80000000), AsmMemory(REG_ESP));
+        return;
+    }
     asm_code.AddCmd(ASM_FLD, AsmMemory(REG_ESP), SIZE_SHORT);
     asm_code.AddCmd(ASM_FCH, SIZE_SHORT);
     asm_code.AddCmd(ASM_FSTP, AsmMemory(REG_ESP), SIZE_SHORT);
@@ -521,6 +1218,11 @@ NodeUnaryOp::NodeUnaryOp(const Token& name, SyntaxNode* child_):
 {
 }
 
+NodeUnaryOp::~NodeUnaryOp()
+{
+    delete child;
+}
+
 void NodeUnaryOp::Print(ostream& o, int offset) const
 {
     PrintSpaces(o, offset) << token.GetName() << " [";
@@ -536,11 +1238,82 @@ const SymType* NodeUnaryOp::GetSymType() const
 
 void NodeUnaryOp::GenerateValue(AsmCode& asm_code) const
 {
+    if (GenerateValueInRegs(asm_code)) return;
     child->GenerateValue(asm_code);
     if (GetSymType() == top_type_int) GenerateForInt(asm_code);
     else GenerateForReal(asm_code);
 }
 
+int NodeUnaryOp::GetRegNeed(const AsmCode& asm_code) const
+{
+    if (!asm_code.IsOptimize() || GetSymType() != top_type_int) return REG_NEED_STACK;
+    return max(child->GetRegNeed(asm_code), 1);
+}
+
+void NodeUnaryOp::GenerateToReg(AsmCode& asm_code, const RegisterName* regs, int count) const
+{
+    child->GenerateToReg(asm_code, regs, count);
+    switch (token.GetValue())
+    {
+        case TOK_NOT:
+            asm_code.AddCmd(ASM_TEST, regs[0], regs[0]);
+            SetFlagToReg(asm_code, ASM_SETE, regs[0]);
+        break;
+        case TOK_MINUS:
+            asm_code.AddCmd(ASM_NEG, regs[0]);
+        break;
+        default:
+        break;
+    }
+}
+
+bool NodeUnaryOp::IsLogicalNot() const
+{
+    return token.GetValue() == TOK_NOT && GetSymType() == top_type_int;
+}
+
+void NodeUnaryOp::GenerateJumpIfFalse(AsmCode& asm_code, const AsmStrImmediate& label) const
+{
+    if (IsLogicalNot()) child->GenerateJumpIfTrue(asm_code, label);
+    else SyntaxNode::GenerateJumpIfFalse(asm_code, label);
+}
+
+void NodeUnaryOp::GenerateJumpIfTrue(AsmCode& asm_code, const AsmStrImmediate& label) const
+{
+    if (IsLogicalNot()) child->GenerateJumpIfFalse(asm_code, label);
+    else SyntaxNode::GenerateJumpIfTrue(asm_code, label);
+}
+
+bool NodeUnaryOp::IsBoolean() const
+{
+    return IsLogicalNot();
+}
+
+void NodeUnaryOp::GenerateJumpIfFalse(VmCode& code, VmLabel label) const
+{
+    if (IsLogicalNot()) child->GenerateJumpIfTrue(code, label);
+    else SyntaxNode::GenerateJumpIfFalse(code, label);
+}
+
+void NodeUnaryOp::GenerateJumpIfTrue(VmCode& code, VmLabel label) const
+{
+    if (IsLogicalNot()) child->GenerateJumpIfFalse(code, label);
+    else SyntaxNode::GenerateJumpIfTrue(code, label);
+}
+
+VmReg NodeUnaryOp::GenerateValue(VmCode& code) const
+{
+    VmReg res = child->GenerateValue(code);
+    if (GetSymType() == top_type_int)
+    {
+        if (token.GetValue() == TOK_NOT) code.AddCmd(VM_NOT, res, res);
+        else if (token.GetValue() == TOK_MINUS) code.AddCmd(VM_NEG, res, res);
+    }
+    else if (token.GetValue() == TOK_MINUS)
+        code.AddCmd(VM_FNEG, res, res);
+    return res;
+}
+
 bool NodeUnaryOp::IsConst() const
 {
     return child->IsConst();
@@ -573,7 +1346,7 @@ float NodeUnaryOp::ComputeRealConstExpr() const
 bool NodeUnaryOp::TryToBecomeConst(SyntaxNode*& link)
 {
     if (!child->IsConst()) return false;
-    Token tok_val(child->ComputeConstExpr());
+    Token tok_val(ComputeConstExpr());
     SymVarConst* sym = new SymVarConst(tok_val, tok_val, GetSymType());
     link = new NodeVar(sym);
     delete this;
@@ -595,6 +1368,11 @@ void NodeUnaryOp::GetAllDependences(VarsContainer& res_cont, bool with_self)
     return child->GetAllDependences(res_cont);
 }
 
+void NodeUnaryOp::GetAllUsedVars(VarsContainer& used, VarsContainer& addressed)
+{
+    child->GetAllUsedVars(used, addressed);
+}
+
 void NodeUnaryOp::Optimize()
 {
     child->Optimize();
@@ -624,10 +1402,23 @@ const SymType* NodeIntToRealConv::GetSymType() const
 void NodeIntToRealConv::GenerateValue(AsmCode& asm_code) const
 {
     child->GenerateValue(asm_code);
+    if (asm_code.IsSse())
+    {
+        asm_code.AddCmd(ASM_CVTSI2SS, AsmMemory(REG_ESP), REG_XMM0);
+        asm_code.AddCmd(ASM_MOVSS, REG_XMM0, AsmMemory(REG_ESP), SIZE_NONE);
+        return;
+    }
     asm_code.AddCmd(ASM_FILD, AsmMemory(REG_ESP), SIZE_SHORT);
     asm_code.AddCmd(ASM_FSTP, AsmMemory(REG_ESP), SIZE_SHORT);
 }
 
+VmReg NodeIntToRealConv::GenerateValue(VmCode& code) const
+{
+    VmReg res = child->GenerateValue(code);
+    code.AddCmd(VM_ITOF, res, res);
+    return res;
+}
+
 float NodeIntToRealConv::ComputeRealConstExpr() const
 {
     return child->ComputeRealConstExpr();
@@ -675,6 +1466,41 @@ void NodeVar::GenerateValue(AsmCode& asm_code) const
     var->GenerateValue(asm_code);
 }
 
+int NodeVar::GetRegNeed(const AsmCode& asm_code) const
+{
+    return var->GetRegNeed(asm_code);
+}
+
+void NodeVar::GenerateToReg(AsmCode& asm_code, const RegisterName* regs, int count) const
+{
+    var->GenerateToReg(asm_code, regs[0]);
+}
+
+void NodeVar::GenerateOperandCmd(AsmCode& asm_code, AsmCmdName cmd, RegisterName reg) const
+{
+    var->GenerateOperandCmd(asm_code, cmd, reg);
+}
+
+int NodeVar::GetAddressRegNeed(const AsmCode& asm_code) const
+{
+    return var->GetAddressRegNeed(asm_code);
+}
+
+AsmMemory NodeVar::GenerateAddress(AsmCode& asm_code, const RegisterName* regs, int count) const
+{
+    return var->GenerateAddress(asm_code, regs[0]);
+}
+
+VmReg NodeVar::GenerateLValue(VmCode& code) const
+{
+    return var->GenerateLValue(code);
+}
+
+VmReg NodeVar::GenerateValue(VmCode& code) const
+{
+    return var->GenerateValue(code);
+}
+
 int NodeVar::ComputeIntConstExpr() const
 {
     return ((SymVarConst*)var)->GetValueTok().GetIntValue();
@@ -704,6 +1530,11 @@ void NodeVar::GetAllDependences(VarsContainer& res_cont, bool with_self)
     if (with_self) res_cont.insert(var);
 }
 
+void NodeVar::GetAllUsedVars(VarsContainer& used, VarsContainer& addressed)
+{
+    used.insert(var);
+}
+
 //---NodeArrayAccess----
 
 NodeArrayAccess::NodeArrayAccess(SyntaxNode* arr_, SyntaxNode* index_):
@@ -712,6 +1543,12 @@ NodeArrayAccess::NodeArrayAccess(SyntaxNode* arr_, SyntaxNode* index_):
 {
 }
 
+NodeArrayAccess::~NodeArrayAccess()
+{
+    delete arr;
+    delete index;
+}
+
 void NodeArrayAccess::Print(ostream& o, int offset) const
 {
     PrintSpaces(o, offset) << "[] [";
@@ -746,17 +1583,44 @@ void NodeArrayAccess::ComputeIndexToEax(AsmCode& asm_code) const
     asm_code.AddCmd(ASM_XOR, REG_EDX, REG_EDX);
     asm_code.AddCmd(ASM_MUL, REG_EBX);
     asm_code.AddCmd(ASM_POP, REG_EBX);
-    asm_code.AddCmd(ASM_ADD, REG_EBX, REG_EAX);
+    if (asm_code.GetTarget() == TARGET_X86_64) asm_code.AddCmd(ASM_CLTQ, SIZE_NONE);
+    asm_code.AddCmd(ASM_ADD, REG_EBX, REG_EAX, asm_code.GetPtrSize());
+}
+
+RegisterName NodeArrayAccess::GetIndexReg() const
+{
+    unsigned size = GetSymType()->GetSize();
+    SymVar* var = index->GetAffectedVar();
+    if (var == NULL || (size != 1 && size != 2 && size != 4 && size != 8)) return REG_NONE;
+    return var->GetAllocatedReg();
+}
+
+unsigned NodeArrayAccess::ScaleIndex(AsmCode& asm_code, RegisterName reg) const
+{
+    unsigned size = GetSymType()->GetSize();
+    if (size == 1 || size == 2 || size == 4 || size == 8) return size;
+    asm_code.AddCmd(ASM_IMUL, size, reg);
+    return 1;
 }
 
 void NodeArrayAccess::GenerateLValue(AsmCode& asm_code) const
 {
+    if (asm_code.GetTarget() == TARGET_X86)
+    {
+        PushAddress(asm_code);
+        return;
+    }
     ComputeIndexToEax(asm_code);
     asm_code.AddCmd(ASM_PUSH, REG_EAX);
 }
 
 void NodeArrayAccess::GenerateValue(AsmCode& asm_code) const
 {
+    if (asm_code.GetTarget() == TARGET_X86)
+    {
+        PushByAddress(asm_code);
+        return;
+    }
     ComputeIndexToEax(asm_code);
     if (GetSymType()->GetSize() == 4)
         asm_code.AddCmd(ASM_PUSH, AsmMemory(REG_EAX));
@@ -767,6 +1631,137 @@ void NodeArrayAccess::GenerateValue(AsmCode& asm_code) const
     }
 }
 
+int NodeArrayAccess::GetRegNeed(const AsmCode& asm_code) const
+{
+    if (GetSymType()->GetActualType() != top_type_int) return REG_NEED_STACK;
+    return GetAddressRegNeed(asm_code);
+}
+
+void NodeArrayAccess::GenerateToReg(AsmCode& asm_code, const RegisterName* regs, int count) const
+{
+    asm_code.AddCmd(ASM_MOV, GenerateAddress(asm_code, regs, count), regs[0]);
+}
+
+void NodeArrayAccess::GenerateOperandCmd(AsmCode& asm_code, AsmCmdName cmd, RegisterName reg) const
+{
+    asm_code.AddCmd(cmd, GenerateAddress(asm_code, &reg, 1), reg);
+}
+
+int NodeArrayAccess::GetAddressRegNeed(const AsmCode& asm_code) const
+{
+    if (asm_code.GetTarget() == TARGET_X86_64) return REG_NEED_STACK;
+    int base = arr->GetAddressRegNeed(asm_code);
+    if (index->IsConst() || base == REG_NEED_STACK) return base;
+    if (arr->IsAddressIndexed()) base = max(base, 1);
+    if (GetIndexReg() != REG_NONE) return base;
+    int need = max(index->GetRegNeed(asm_code), 1);
+    if (need == REG_NEED_STACK) return REG_NEED_STACK;
+    if (base == 0) return need;
+    return base == need ? base + 1 : max(base, need);
+}
+
+bool NodeArrayAccess::IsAddressIndexed() const
+{
+    return !index->IsConst() || arr->IsAddressIndexed();
+}
+
+AsmMemory NodeArrayAccess::GenerateAddress(AsmCode& asm_code, const RegisterName* regs, int count) const
+{
+    if (asm_code.GetTarget() == TARGET_X86_64) return SyntaxNode::GenerateAddress(asm_code, regs, count);
+    int size = GetSymType()->GetSize();
+    int low = ((SymTypeArray*)arr->GetSymType())->GetLow();
+    if (index->IsConst())
+    {
+        AsmMemory res(arr->GenerateAddress(asm_code, regs, count));
+        res.AddDisp((index->ComputeIntConstExpr() - low) * size);
+        return res;
+    }
+    bool indexed = arr->IsAddressIndexed();
+    int base = arr->GetAddressRegNeed(asm_code);
+    RegisterName index_reg = GetIndexReg();
+    int need = index_reg == REG_NONE ? max(index->GetRegNeed(asm_code), 1) : 0;
+    AsmMemory res(REG_EAX);
+    unsigned scale = size;
+    if (index_reg != REG_NONE)
+    {
+        res = arr->GenerateAddress(asm_code, regs, count);
+        if (res.IsIndexed())
+        {
+            asm_code.AddCmd(ASM_LEA, res, regs[0]);
+            res = AsmMemory(regs[0]);
+        }
+    }
+    else if (base == 0 && !indexed)
+    {
+        if (need == REG_NEED_STACK)
+        {
+            index->GenerateValue(asm_code);
+            asm_code.AddCmd(ASM_POP, regs[0]);
+        }
+        else
+            index->GenerateToReg(asm_code, regs, count);
+        index_reg = regs[0];
+        scale = ScaleIndex(asm_code, index_reg);
+        res = arr->GenerateAddress(asm_code, regs, count);
+    }
+    else if (base == REG_NEED_STACK || need == REG_NEED_STACK || arr->IsHaveSideEffect() || index->IsHaveSideEffect())
+    {
+        arr->GenerateLValue(asm_code);
+        index->GenerateValue(asm_code);
+        asm_code.AddCmd(ASM_POP, regs[1]);
+        asm_code.AddCmd(ASM_POP, regs[0]);
+        index_reg = regs[1];
+        scale = ScaleIndex(asm_code, index_reg);
+        res = AsmMemory(regs[0]);
+    }
+    else if (count > 1 && min(max(base, 1), need) < count)
+    {
+        int index_first = base < need ? 1 : 0;
+        RegisterName base_reg = regs[index_first];
+        index_reg = regs[1 - index_first];
+        if (index_first) index->GenerateToReg(asm_code, regs, count);
+        res = arr->GenerateAddress(asm_code, regs + index_first, count - index_first);
+        if (res.IsIndexed())
+        {
+            asm_code.AddCmd(ASM_LEA, res, base_reg);
+            res = AsmMemory(base_reg);
+        }
+        if (!index_first) index->GenerateToReg(asm_code, regs + 1, count - 1);
+        scale = ScaleIndex(asm_code, index_reg);
+    }
+    else
+    {
+        index->GenerateToReg(asm_code, regs, count);
+        if (size != 1) asm_code.AddCmd(ASM_IMUL, size, regs[0]);
+        asm_code.AddCmd(ASM_PUSH, regs[0]);
+        asm_code.AddCmd(ASM_LEA, arr->GenerateAddress(asm_code, regs, count), regs[0]);
+        asm_code.AddCmd(ASM_ADD, AsmMemory(REG_ESP), regs[0]);
+        asm_code.AddCmd(ASM_LEA, AsmMemory(REG_ESP, 4), REG_ESP);
+        return AsmMemory(regs[0], -low * size);
+    }
+    res.SetIndex(index_reg, scale);
+    res.AddDisp(-low * size);
+    return res;
+}
+
+VmReg NodeArrayAccess::GenerateLValue(VmCode& code) const
+{
+    VmReg res = arr->GenerateLValue(code);
+    VmReg offset = index->GenerateValue(code);
+    int low = ((SymTypeArray*)arr->GetSymType())->GetLow();
+    if (low) code.AddCmd(VM_ADDI, offset, offset, -low);
+    code.AddCmd(VM_MULI, offset, offset, GetSymType()->GetSize());
+    code.AddCmd(VM_ADD, res, res, offset);
+    return res;
+}
+
+VmReg NodeArrayAccess::GenerateValue(VmCode& code) const
+{
+    VmReg res = GenerateLValue(code);
+    if (GetSymType()->GetSize() == 4) code.AddLoad(res, res);
+    return res;
+}
+
 bool NodeArrayAccess::IsHaveSideEffect()
 {
     return index->IsHaveSideEffect();
@@ -784,6 +1779,12 @@ void NodeArrayAccess::GetAllDependences(VarsContainer& res_cont, bool with_self)
     arr->GetAllDependences(res_cont, with_self);
 }
 
+void NodeArrayAccess::GetAllUsedVars(VarsContainer& used, VarsContainer& addressed)
+{
+    index->GetAllUsedVars(used, addressed);
+    arr->GetAllUsedVars(used, addressed);
+}
+
 void NodeArrayAccess::Optimize()
 {
     index->Optimize();
@@ -800,6 +1801,11 @@ NodeRecordAccess::NodeRecordAccess(SyntaxNode* record_, Token field_):
     field = var;
 }
 
+NodeRecordAccess::~NodeRecordAccess()
+{
+    delete record;
+}
+
 void NodeRecordAccess::Print(ostream& o, int offset) const
 {
     PrintSpaces(o, offset) << ". [";
@@ -826,6 +1832,11 @@ SymVar* NodeRecordAccess::GetAffectedVar() const
 
 void NodeRecordAccess::GenerateLValue(AsmCode& asm_code) const
 {
+    if (asm_code.GetTarget() == TARGET_X86)
+    {
+        PushAddress(asm_code);
+        return;
+    }
     record->GenerateLValue(asm_code);
     asm_code.AddCmd(ASM_POP, REG_EAX);
     asm_code.AddCmd(ASM_LEA, AsmMemory(REG_EAX, field->GetOffset()), REG_EAX);
@@ -834,10 +1845,65 @@ void NodeRecordAccess::GenerateLValue(AsmCode& asm_code) const
 
 void NodeRecordAccess::GenerateValue(AsmCode& asm_code) const
 {
+    if (asm_code.GetTarget() == TARGET_X86)
+    {
+        PushByAddress(asm_code);
+        return;
+    }
     GenerateLValue(asm_code);
     asm_code.PushMemory(field->GetVarType()->GetSize());
 }
 
+int NodeRecordAccess::GetRegNeed(const AsmCode& asm_code) const
+{
+    if (GetSymType()->GetActualType() != top_type_int) return REG_NEED_STACK;
+    return GetAddressRegNeed(asm_code);
+}
+
+void NodeRecordAccess::GenerateToReg(AsmCode& asm_code, const RegisterName* regs, int count) const
+{
+    asm_code.AddCmd(ASM_MOV, GenerateAddress(asm_code, regs, count), regs[0]);
+}
+
+void NodeRecordAccess::GenerateOperandCmd(AsmCode& asm_code, AsmCmdName cmd, RegisterName reg) const
+{
+    asm_code.AddCmd(cmd, GenerateAddress(asm_code, &reg, 1), reg);
+}
+
+int NodeRecordAccess::GetAddressRegNeed(const AsmCode& asm_code) const
+{
+    if (asm_code.GetTarget() == TARGET_X86_64) return REG_NEED_STACK;
+    return record->GetAddressRegNeed(asm_code);
+}
+
+bool NodeRecordAccess::IsAddressIndexed() const
+{
+    return record->IsAddressIndexed();
+}
+
+AsmMemory NodeRecordAccess::GenerateAddress(AsmCode& asm_code, const RegisterName* regs, int count) const
+{
+    if (asm_code.GetTarget() == TARGET_X86_64) return SyntaxNode::GenerateAddress(asm_code, regs, count);
+    AsmMemory res(record->GenerateAddress(asm_code, regs, count));
+    res.AddDisp(field->GetOffset());
+    return res;
+}
+
+VmReg NodeRecordAccess::GenerateLValue(VmCode& code) const
+{
+    VmReg res = record->GenerateLValue(code);
+    if (field->GetOffset()) code.AddCmd(VM_ADDI, res, res, field->GetOffset());
+    return res;
+}
+
+VmReg NodeRecordAccess::GenerateValue(VmCode& code) const
+{
+    if (field->GetVarType()->GetSize() != 4) return GenerateLValue(code);
+    VmReg res = record->GenerateLValue(code);
+    code.AddLoad(res, res, field->GetOffset());
+    return res;
+}
+
 bool NodeRecordAccess::IsHaveSideEffect()
 {
     return false;
@@ -851,3 +1917,8 @@ void NodeRecordAccess::GetAllDependences(VarsContainer& res_cont, bool with_self
 {
     if (with_self) res_cont.insert(GetAffectedVar());
 }
+
+void NodeRecordAccess::GetAllUsedVars(VarsContainer& used, VarsContainer& addressed)
+{
+    record->GetAllUsedVars(used, addressed);
+}
@@ -12,6 +12,7 @@ protected:
     std::vector<SyntaxNode*> args;
     void PrintArgs(ostream& o, int offset = 0) const;
 public:
+    ~NodeCallBase();
     void AddArg(SyntaxNode* arg);
     virtual void Optimize();
 };
@@ -19,6 +20,14 @@ public:
 class NodeCall: public NodeCallBase{
 private:
     SymProc* funct;
+    bool IsArgInTemp(int arg_num) const;
+    unsigned GetArgStackSize(const AsmCode& asm_code, int arg_num) const;
+    unsigned GenerateTemps(AsmCode& asm_code, vector<unsigned>& temp_offsets) const;
+    void DropTemps(AsmCode& asm_code, unsigned temps_size, unsigned result_size) const;
+    void GenerateArg(AsmCode& asm_code, int arg_num, unsigned temp_disp) const;
+    void GenerateCall(AsmCode& asm_code, const SyntaxNode* dest) const;
+    void GenerateCall64(AsmCode& asm_code, const SyntaxNode* dest) const;
+    VmReg GenerateCall(VmCode& code, const SyntaxNode* dest) const;
 public: 
     NodeCall(SymProc* funct_);
     const SymType* GetCurrentArgType() const;
@@ -26,9 +35,16 @@ public:
     virtual void Print(ostream& o, int offset = 0) const;
     virtual const SymType* GetSymType() const;
     virtual void GenerateValue(AsmCode& asm_code) const;
+    virtual VmReg GenerateValue(VmCode& code) const;
+    virtual int GetRegNeed(const AsmCode& asm_code) const;
+    virtual void GenerateToReg(AsmCode& asm_code, const RegisterName* regs, int count) const;
+    virtual bool CanConstructIn(SyntaxNode* dest);
+    virtual void ConstructIn(AsmCode& asm_code, const SyntaxNode* dest) const;
+    virtual void ConstructIn(VmCode& code, const SyntaxNode* dest) const;
     virtual bool IsHaveSideEffect();    
     virtual void GetAllAffectedVars(VarsContainer& res_cont);
     virtual void GetAllDependences(VarsContainer& res_cont, bool with_self);
+    virtual void GetAllUsedVars(VarsContainer& used, VarsContainer& addressed);
     virtual bool CanBeReplaced();
 };
 
@@ -39,11 +55,13 @@ public:
     NodeWriteCall(bool new_line_ = false);
     virtual void Print(ostream& o, int offset = 0) const;
     virtual void GenerateValue(AsmCode& asm_code) const;
+    virtual VmReg GenerateValue(VmCode& code) const;
     virtual const SymType* GetSymType() const;
     virtual bool IsHaveSideEffect();    
     virtual void GetAllAffectedVars(VarsContainer& res_cont);
     virtual bool CanBeReplaced();
     virtual void GetAllDependences(VarsContainer& res_cont, bool with_self = true);
+    virtual void GetAllUsedVars(VarsContainer& used, VarsContainer& addressed);
 };
 
 class NodeBinaryOp: public SyntaxNode{
@@ -52,14 +70,37 @@ private:
     SyntaxNode* left;
     SyntaxNode* right;
     void FinGenForIntRelationalOp(AsmCode& asm_code) const;
+    bool GetIntRegCmd(AsmCmdName& cmd) const;
+    AsmCmdName GetIntSetCmd() const;
+    AsmCmdName GetIntFalseJumpCmd() const;
+    AsmCmdName GetRealSetCmd() const;
+    AsmCmdName GetRealFalseJumpCmd() const;
     void FinGenForRealRelationalOp(AsmCode& asm_code) const;
+    bool IsDivByConst() const;
     void GenerateForInt(AsmCode& asm_code) const;
+    void GenerateDivByConst(AsmCode& asm_code, int divisor) const;
+    void GenerateForRealSse(AsmCode& asm_code) const;
     void GenerateForReal(AsmCode& asm_code) const;
+    void GenerateOperationToReg(AsmCode& asm_code, const RegisterName* regs, int count, AsmCmdName cmd) const;
+    bool IsShortCircuit() const;
+    void GenerateBranch(AsmCode& asm_code, const AsmStrImmediate& label, bool if_true) const;
+    void GenerateBranch(VmCode& code, VmLabel label, bool if_true) const;
+    VmOpcode GetIntOpcode() const;
+    VmOpcode GetRealOpcode() const;
 public:
     NodeBinaryOp(const Token& name, SyntaxNode* left_, SyntaxNode* right_);
+    ~NodeBinaryOp();
     virtual void Print(ostream& o, int offset = 0) const;
     virtual const SymType* GetSymType() const;
     virtual void GenerateValue(AsmCode& asm_code) const;
+    virtual void GenerateJumpIfFalse(AsmCode& asm_code, const AsmStrImmediate& label) const;
+    virtual void GenerateJumpIfTrue(AsmCode& asm_code, const AsmStrImmediate& label) const;
+    virtual bool IsBoolean() const;
+    virtual int GetRegNeed(const AsmCode& asm_code) const;
+    virtual void GenerateToReg(AsmCode& asm_code, const RegisterName* regs, int count) const;
+    virtual VmReg GenerateValue(VmCode& code) const;
+    virtual void GenerateJumpIfFalse(VmCode& code, VmLabel label) const;
+    virtual void GenerateJumpIfTrue(VmCode& code, VmLabel label) const;
     virtual bool IsConst() const;
     virtual int ComputeIntConstExpr() const;
     virtual float ComputeRealConstExpr() const;
@@ -67,6 +108,7 @@ public:
     virtual bool IsHaveSideEffect();    
     virtual void GetAllAffectedVars(VarsContainer& res_cont);
     virtual void GetAllDependences(VarsContainer& res_cont, bool with_self = true);
+    virtual void GetAllUsedVars(VarsContainer& used, VarsContainer& addressed);
     virtual void Optimize();
 };
 
@@ -76,11 +118,21 @@ protected:
     SyntaxNode* child;
     void GenerateForInt(AsmCode& asm_code) const;
     void GenerateForReal(AsmCode& asm_code) const;
+    bool IsLogicalNot() const;
 public:
     NodeUnaryOp(const Token& name, SyntaxNode* child_);
+    ~NodeUnaryOp();
     virtual void Print(ostream& o, int offset = 0) const;
     virtual const SymType* GetSymType() const;
     void GenerateValue(AsmCode& asm_code) const;
+    virtual int GetRegNeed(const AsmCode& asm_code) const;
+    virtual void GenerateToReg(AsmCode& asm_code, const RegisterName* regs, int count) const;
+    virtual void GenerateJumpIfFalse(AsmCode& asm_code, const AsmStrImmediate& label) const;
+    virtual void GenerateJumpIfTrue(AsmCode& asm_code, const AsmStrImmediate& label) const;
+    virtual bool IsBoolean() const;
+    virtual VmReg GenerateValue(VmCode& code) const;
+    virtual void GenerateJumpIfFalse(VmCode& code, VmLabel label) const;
+    virtual void GenerateJumpIfTrue(VmCode& code, VmLabel label) const;
     virtual bool IsConst() const;
     virtual int ComputeIntConstExpr() const;
     virtual float ComputeRealConstExpr() const;
@@ -88,6 +140,7 @@ public:
     virtual bool IsHaveSideEffect();    
     virtual void GetAllAffectedVars(VarsContainer& res_cont);
     virtual void GetAllDependences(VarsContainer& res_cont, bool with_self = true);
+    virtual void GetAllUsedVars(VarsContainer& used, VarsContainer& addressed);
     virtual void Optimize();
 };
 
@@ -99,6 +152,7 @@ public:
     virtual void Print(ostream& o, int offset = 0) const;
     virtual const SymType* GetSymType() const;
     virtual void GenerateValue(AsmCode& asm_code) const;
+    virtual VmReg GenerateValue(VmCode& code) const;
     virtual float ComputeRealConstExpr() const;
 };
 
@@ -114,12 +168,20 @@ public:
     virtual SymVar* GetAffectedVar() const;
     virtual void GenerateLValue(AsmCode& asm_code) const;
     virtual void GenerateValue(AsmCode& asm_code) const;
+    virtual int GetRegNeed(const AsmCode& asm_code) const;
+    virtual void GenerateToReg(AsmCode& asm_code, const RegisterName* regs, int count) const;
+    virtual void GenerateOperandCmd(AsmCode& asm_code, AsmCmdName cmd, RegisterName reg) const;
+    virtual int GetAddressRegNeed(const AsmCode& asm_code) const;
+    virtual AsmMemory GenerateAddress(AsmCode& asm_code, const RegisterName* regs, int count) const;
+    virtual VmReg GenerateLValue(VmCode& code) const;
+    virtual VmReg GenerateValue(VmCode& code) const;
     virtual int ComputeIntConstExpr() const;
     virtual float ComputeRealConstExpr() const;
     virtual bool IsConst() const;
     virtual bool IsHaveSideEffect();    
     virtual void GetAllAffectedVars(VarsContainer& res_cont);
     virtual void GetAllDependences(VarsContainer& res_cont, bool with_self = true);
+    virtual void GetAllUsedVars(VarsContainer& used, VarsContainer& addressed);
 };
 
 class NodeArrayAccess: public SyntaxNode{
@@ -127,17 +189,29 @@ private:
     SyntaxNode* arr;
     SyntaxNode* index;
     void ComputeIndexToEax(AsmCode& asm_code) const;
+    RegisterName GetIndexReg() const;
+    unsigned ScaleIndex(AsmCode& asm_code, RegisterName reg) const;
 public:
     NodeArrayAccess(SyntaxNode* arr_, SyntaxNode* index_);
+    ~NodeArrayAccess();
     virtual void Print(ostream& o, int offset = 0) const;
     virtual const SymType* GetSymType() const;    
     virtual bool IsLValue() const;
     virtual SymVar* GetAffectedVar() const;
     virtual void GenerateLValue(AsmCode& asm_code) const;
     virtual void GenerateValue(AsmCode& asm_code) const; 
+    virtual int GetRegNeed(const AsmCode& asm_code) const;
+    virtual void GenerateToReg(AsmCode& asm_code, const RegisterName* regs, int count) const;
+    virtual void GenerateOperandCmd(AsmCode& asm_code, AsmCmdName cmd, RegisterName reg) const;
+    virtual int GetAddressRegNeed(const AsmCode& asm_code) const;
+    virtual bool IsAddressIndexed() const;
+    virtual AsmMemory GenerateAddress(AsmCode& asm_code, const RegisterName* regs, int count) const;
+    virtual VmReg GenerateLValue(VmCode& code) const;
+    virtual VmReg GenerateValue(VmCode& code) const;
     virtual bool IsHaveSideEffect();    
     virtual void GetAllAffectedVars(VarsContainer& res_cont);
     virtual void GetAllDependences(VarsContainer& res_cont, bool with_self = true);
+    virtual void GetAllUsedVars(VarsContainer& used, VarsContainer& addressed);
     virtual void Optimize();
 };
 
@@ -147,15 +221,25 @@ private:
     const SymVarLocal* field;
 public:
     NodeRecordAccess(SyntaxNode* record_, Token field_);
+    ~NodeRecordAccess();
     virtual void Print(ostream& o, int offset = 0) const;
     virtual const SymType* GetSymType() const;    
     virtual bool IsLValue() const;
     virtual SymVar* GetAffectedVar() const;
     virtual void GenerateLValue(AsmCode& asm_code) const;
     virtual void GenerateValue(AsmCode& asm_code) const; 
+    virtual int GetRegNeed(const AsmCode& asm_code) const;
+    virtual void GenerateToReg(AsmCode& asm_code, const RegisterName* regs, int count) const;
+    virtual void GenerateOperandCmd(AsmCode& asm_code, AsmCmdName cmd, RegisterName reg) const;
+    virtual int GetAddressRegNeed(const AsmCode& asm_code) const;
+    virtual bool IsAddressIndexed() const;
+    virtual AsmMemory GenerateAddress(AsmCode& asm_code, const RegisterName* regs, int count) const;
+    virtual VmReg GenerateLValue(VmCode& code) const;
+    virtual VmReg GenerateValue(VmCode& code) const;
     virtual bool IsHaveSideEffect();    
     virtual void GetAllAffectedVars(VarsContainer& res_cont);
     virtual void GetAllDependences(VarsContainer& res_cont, bool with_self = true);
+    virtual void GetAllUsedVars(VarsContainer& used, VarsContainer& addressed);
 };
 
 #endif
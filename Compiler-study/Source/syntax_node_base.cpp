@@ -1,7 +1,12 @@
 #include "syntax_node_base.h"
+#include "sym_table.h"
 
 //---SyntaxNodeBase---
 
+SyntaxNodeBase::~SyntaxNodeBase()
+{
+}
+
 void SyntaxNodeBase::Optimize()
 {
 }
@@ -98,6 +103,153 @@ void SyntaxNode::GenerateValue(AsmCode& asm_code) const
 {
 }
 
+void SyntaxNode::GenerateTestValue(AsmCode& asm_code) const
+{
+    if (!asm_code.IsOptimize() || GetRegNeed(asm_code) == REG_NEED_STACK)
+    {
+        GenerateValue(asm_code);
+        asm_code.AddCmd(ASM_POP, REG_EAX);
+    }
+    else
+        GenerateToReg(asm_code, asm_code.GetExprRegs(), asm_code.GetExprRegsCount());
+    asm_code.AddCmd(ASM_TEST, REG_EAX, REG_EAX);
+}
+
+void SyntaxNode::GenerateJumpIfFalse(AsmCode& asm_code, const AsmStrImmediate& label) const
+{
+    GenerateTestValue(asm_code);
+    asm_code.AddCmd(ASM_JZ, label, SIZE_NONE);
+}
+
+void SyntaxNode::GenerateJumpIfTrue(AsmCode& asm_code, const AsmStrImmediate& label) const
+{
+    GenerateTestValue(asm_code);
+    asm_code.AddCmd(ASM_JNZ, label, SIZE_NONE);
+}
+
+void SyntaxNode::GenerateJump(AsmCode& asm_code, const AsmStrImmediate& label, bool if_true) const
+{
+    if (if_true) GenerateJumpIfTrue(asm_code, label);
+    else GenerateJumpIfFalse(asm_code, label);
+}
+
+bool SyntaxNode::IsBoolean() const
+{
+    return false;
+}
+
+int SyntaxNode::GetRegNeed(const AsmCode& asm_code) const
+{
+    return REG_NEED_STACK;
+}
+
+void SyntaxNode::GenerateToReg(AsmCode& asm_code, const RegisterName* regs, int count) const
+{
+    GenerateValue(asm_code);
+    asm_code.AddCmd(ASM_POP, regs[0]);
+}
+
+void SyntaxNode::GenerateOperandCmd(AsmCode& asm_code, AsmCmdName cmd, RegisterName reg) const
+{
+}
+
+int SyntaxNode::GetAddressRegNeed(const AsmCode& asm_code) const
+{
+    return REG_NEED_STACK;
+}
+
+bool SyntaxNode::IsAddressIndexed() const
+{
+    return false;
+}
+
+AsmMemory SyntaxNode::GenerateAddress(AsmCode& asm_code, const RegisterName* regs, int count) const
+{
+    GenerateLValue(asm_code);
+    asm_code.AddCmd(ASM_POP, regs[0]);
+    return AsmMemory(regs[0]);
+}
+
+void SyntaxNode::PushAddress(AsmCode& asm_code) const
+{
+    AsmMemory address(GenerateAddress(asm_code, asm_code.GetExprRegs(), asm_code.GetExprRegsCount()));
+    asm_code.AddCmd(ASM_LEA, address, REG_EAX);
+    asm_code.AddCmd(ASM_PUSH, REG_EAX);
+}
+
+void SyntaxNode::PushByAddress(AsmCode& asm_code) const
+{
+    unsigned size = GetSymType()->GetSize();
+    if (size != 4)
+    {
+        PushAddress(asm_code);
+        asm_code.PushMemory(size);
+        return;
+    }
+    asm_code.AddCmd(ASM_PUSH, GenerateAddress(asm_code, asm_code.GetExprRegs(), asm_code.GetExprRegsCount()));
+}
+
+void SyntaxNode::GetAllUsedVars(VarsContainer& used, VarsContainer& addressed)
+{
+}
+
+bool SyntaxNode::CanConstructIn(SyntaxNode* dest)
+{
+    return false;
+}
+
+void SyntaxNode::ConstructIn(AsmCode& asm_code, const SyntaxNode* dest) const
+{
+}
+
+void SyntaxNode::ConstructIn(VmCode& code, const SyntaxNode* dest) const
+{
+}
+
+bool SyntaxNode::GenerateValueInRegs(AsmCode& asm_code) const
+{
+    if (GetRegNeed(asm_code) == REG_NEED_STACK) return false;
+    GenerateToReg(asm_code, asm_code.GetExprRegs(), asm_code.GetExprRegsCount());
+    asm_code.AddCmd(ASM_PUSH, asm_code.GetExprRegs()[0]);
+    return true;
+}
+
+VmReg SyntaxNode::GenerateLValue(VmCode& code) const
+{
+    unsigned size = GetSymType()->GetSize();
+    VmReg value = GenerateValue(code);
+    if (size != 4) return value;
+    int offset = code.AllocTemp(size);
+    code.AddCmd(VM_STORE_FP, value, offset);
+    code.AddCmd(VM_LEA, value, offset);
+    return value;
+}
+
+VmReg SyntaxNode::GenerateValue(VmCode& code) const
+{
+    return code.NewReg();
+}
+
+void SyntaxNode::GenerateJumpIfFalse(VmCode& code, VmLabel label) const
+{
+    unsigned mark = code.GetRegMark();
+    code.AddJump(VM_JZ, label, GenerateValue(code));
+    code.ReleaseRegs(mark);
+}
+
+void SyntaxNode::GenerateJumpIfTrue(VmCode& code, VmLabel label) const
+{
+    unsigned mark = code.GetRegMark();
+    code.AddJump(VM_JNZ, label, GenerateValue(code));
+    code.ReleaseRegs(mark);
+}
+
+void SyntaxNode::GenerateJump(VmCode& code, VmLabel label, bool if_true) const
+{
+    if (if_true) GenerateJumpIfTrue(code, label);
+    else GenerateJumpIfFalse(code, label);
+}
+
 bool SyntaxNode::IsConst() const
 {
     return false;
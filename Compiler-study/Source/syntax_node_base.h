@@ -3,6 +3,7 @@
 
 #include "scanner.h"
 #include "generator.h"
+#include "vm.h"
 #include <ostream>
 #include <set>
 
@@ -20,6 +21,7 @@ typedef std::set<SymVar*> DependedVerts;
 
 class SyntaxNodeBase{
 public:
+    virtual ~SyntaxNodeBase();
     bool IsDependOnVars(std::set<SymVar*>& vars);
     bool IsAffectToVars(std::set<SymVar*>& vars);
     bool IsAffectToVars();
@@ -35,12 +37,36 @@ public:
 };
 
 class SyntaxNode: public SyntaxNodeBase{
+protected:
+    bool GenerateValueInRegs(AsmCode& asm_code) const;
+    void GenerateTestValue(AsmCode& asm_code) const;
+    void PushAddress(AsmCode& asm_code) const;
+    void PushByAddress(AsmCode& asm_code) const;
 public:
     virtual const SymType* GetSymType() const;
     virtual bool IsLValue() const;
     virtual SymVar* GetAffectedVar() const;
     virtual void GenerateLValue(AsmCode& asm_code) const;    
     virtual void GenerateValue(AsmCode& asm_code) const;
+    virtual void GenerateJumpIfFalse(AsmCode& asm_code, const AsmStrImmediate& label) const;
+    virtual void GenerateJumpIfTrue(AsmCode& asm_code, const AsmStrImmediate& label) const;
+    void GenerateJump(AsmCode& asm_code, const AsmStrImmediate& label, bool if_true) const;
+    virtual bool IsBoolean() const;
+    virtual int GetRegNeed(const AsmCode& asm_code) const;
+    virtual void GenerateToReg(AsmCode& asm_code, const RegisterName* regs, int count) const;
+    virtual void GenerateOperandCmd(AsmCode& asm_code, AsmCmdName cmd, RegisterName reg) const;
+    virtual int GetAddressRegNeed(const AsmCode& asm_code) const;
+    virtual bool IsAddressIndexed() const;
+    virtual AsmMemory GenerateAddress(AsmCode& asm_code, const RegisterName* regs, int count) const;
+    virtual void GetAllUsedVars(VarsContainer& used, VarsContainer& addressed);
+    virtual bool CanConstructIn(SyntaxNode* dest);
+    virtual void ConstructIn(AsmCode& asm_code, const SyntaxNode* dest) const;
+    virtual void ConstructIn(VmCode& code, const SyntaxNode* dest) const;
+    virtual VmReg GenerateLValue(VmCode& code) const;
+    virtual VmReg GenerateValue(VmCode& code) const;
+    virtual void GenerateJumpIfFalse(VmCode& code, VmLabel label) const;
+    virtual void GenerateJumpIfTrue(VmCode& code, VmLabel label) const;
+    void GenerateJump(VmCode& code, VmLabel label, bool if_true) const;
     virtual bool IsConst() const;
     virtual Token ComputeConstExpr() const;
     virtual int ComputeIntConstExpr() const;
@@ -0,0 +1,136 @@
+#include "token_buffer.h"
+
+class TextStreamBuf: public std::streambuf{
+public:
+    TextStreamBuf(const char* begin, const char* end)
+    {
+        setg((char*)begin, (char*)begin, (char*)end);
+    }
+};
+
+//---TokenBuffer---
+
+TokenBuffer::TokenBuffer():
+    current(-1),
+    relexed(0)
+{
+}
+
+TokenBuffer::~TokenBuffer()
+{
+    for (std::vector<Token*>::iterator it = tokens.begin(); it != tokens.end(); ++it)
+        delete *it;
+}
+
+void TokenBuffer::Update(const string& new_text)
+{
+    Rewind();
+    relexed = 0;
+    unsigned prefix = 0;
+    unsigned max_prefix = min(text.size(), new_text.size());
+    while (prefix < max_prefix && text[prefix] == new_text[prefix]) ++prefix;
+    if (!tokens.empty() && prefix == text.size() && prefix == new_text.size()) return;
+    unsigned suffix = 0;
+    while (suffix < text.size() - prefix && suffix < new_text.size() - prefix
+           && text[text.size() - suffix - 1] == new_text[new_text.size() - suffix - 1])
+        ++suffix;
+    int old_end = text.size() - suffix;
+    int new_end = new_text.size() - suffix;
+    int delta = new_end - old_end;
+    unsigned first = 0;
+    while (first < tokens.size() && offsets[first] < (int)prefix) ++first;
+    bool from_start = (first == 0);
+    first = first < 2 ? 0 : first - 2;
+    int start_offset = 0;
+    int start_line = 1;
+    int start_pos = 1;
+    if (!from_start)
+    {
+        start_offset = offsets[first];
+        start_line = tokens[first]->GetLine();
+        start_pos = tokens[first]->GetPos();
+    }
+    TextStreamBuf buf(new_text.data() + start_offset, new_text.data() + new_text.size());
+    istream in(&buf);
+    Scanner scan(in, start_line, start_pos, start_offset);
+    std::vector<Token*> new_tokens;
+    std::vector<int> new_offsets;
+    unsigned resync = first;
+    bool synced = false;
+    Token sync_tok;
+    try
+    {
+        while (true)
+        {
+            Token tok = scan.NextToken();
+            int offset = scan.GetTokenOffset();
+            if (offset >= new_end)
+            {
+                while (resync < tokens.size() && offsets[resync] < offset - delta) ++resync;
+                synced = resync < tokens.size() && offsets[resync] == offset - delta;
+                if (synced)
+                {
+                    sync_tok = tok;
+                    break;
+                }
+            }
+            new_tokens.push_back(new Token(tok));
+            new_offsets.push_back(offset);
+            if (tok.GetType() == END_OF_FILE) break;
+        }
+    }
+    catch (CompilerException&)
+    {
+        for (std::vector<Token*>::iterator it = new_tokens.begin(); it != new_tokens.end(); ++it)
+            delete *it;
+        throw;
+    }
+    if (!synced) resync = tokens.size();
+    relexed = new_tokens.size();
+    if (synced)
+    {
+        int old_line = tokens[resync]->GetLine();
+        int line_delta = sync_tok.GetLine() - old_line;
+        int pos_delta = sync_tok.GetPos() - tokens[resync]->GetPos();
+        for (unsigned i = resync; i < tokens.size(); ++i)
+        {
+            Token* tok = tokens[i];
+            tok->SetPosition(tok->GetLine() + line_delta, tok->GetLine() == old_line ? tok->GetPos() + pos_delta : tok->GetPos());
+            offsets[i] += delta;
+        }
+    }
+    for (unsigned i = first; i < resync; ++i)
+        delete tokens[i];
+    tokens.erase(tokens.begin() + first, tokens.begin() + resync);
+    offsets.erase(offsets.begin() + first, offsets.begin() + resync);
+    tokens.insert(tokens.begin() + first, new_tokens.begin(), new_tokens.end());
+    offsets.insert(offsets.begin() + first, new_offsets.begin(), new_offsets.end());
+    text = new_text;
+}
+
+void TokenBuffer::Rewind()
+{
+    current = -1;
+}
+
+unsigned TokenBuffer::GetSize() const
+{
+    return tokens.size();
+}
+
+unsigned TokenBuffer::GetRelexedCount() const
+{
+    return relexed;
+}
+
+Token TokenBuffer::GetToken()
+{
+    if (current < 0) return Token();
+    return *tokens[current];
+}
+
+Token TokenBuffer::NextToken()
+{
+    if (current + 1 < (int)tokens.size()) ++current;
+    return GetToken();
+}
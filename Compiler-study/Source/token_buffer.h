@@ -0,0 +1,26 @@
+#ifndef TOKEN_BUFFER
+#define TOKEN_BUFFER
+
+#include "scanner.h"
+#include <vector>
+#include <string>
+
+class TokenBuffer: public TokenStream{
+private:
+    string text;
+    std::vector<Token*> tokens;
+    std::vector<int> offsets;
+    int current;
+    unsigned relexed;
+public:
+    TokenBuffer();
+    ~TokenBuffer();
+    void Update(const string& new_text);
+    void Rewind();
+    unsigned GetSize() const;
+    unsigned GetRelexedCount() const;
+    virtual Token GetToken();
+    virtual Token NextToken();
+};
+
+#endif
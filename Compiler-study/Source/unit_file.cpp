@@ -0,0 +1,372 @@
+#include "unit_file.h"
+
+static const char UNIT_FILE_MAGIC[] = "CSIF";
+static const unsigned UNIT_FILE_VERSION = 1;
+
+enum UnitTypeKind{
+    UNIT_TYPE_ARRAY,
+    UNIT_TYPE_RECORD,
+    UNIT_TYPE_ALIAS
+};
+
+static const unsigned PREDEFINED_TYPES_COUNT = 4;
+
+static SymType* PredefinedType(unsigned id)
+{
+    switch (id)
+    {
+        case 0: return top_type_int;
+        case 1: return top_type_real;
+        case 2: return top_type_str;
+        case 3: return top_type_untyped;
+    }
+    return NULL;
+}
+
+//---UnitWriter---
+
+UnitWriter::UnitWriter(ostream& out_):
+    out(out_)
+{
+}
+
+void UnitWriter::WriteNumber(ostream& o, unsigned value)
+{
+    while (value >= 0x80)
+    {
+        o.put(char((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    o.put(char(value));
+}
+
+void UnitWriter::WriteInt(ostream& o, int value)
+{
+    WriteNumber(o, (unsigned(value) << 1) ^ unsigned(value >> 31));
+}
+
+void UnitWriter::WriteString(ostream& o, const string& str)
+{
+    WriteNumber(o, str.size());
+    o.write(str.data(), str.size());
+}
+
+unsigned UnitWriter::TypeId(const SymType* type)
+{
+    for (unsigned i = 0; i < PREDEFINED_TYPES_COUNT; ++i)
+        if (PredefinedType(i) == type) return i;
+    std::map<const SymType*, unsigned>::iterator it = type_ids.find(type);
+    if (it != type_ids.end()) return it->second;
+    stringstream entry;
+    if (type->GetClassName() & SYM_TYPE_ALIAS)
+    {
+        unsigned target = TypeId(((SymTypeAlias*)type)->GetTarget());
+        WriteNumber(entry, UNIT_TYPE_ALIAS);
+        WriteString(entry, type->GetName());
+        WriteNumber(entry, target);
+    }
+    else if (type->GetClassName() & SYM_TYPE_ARRAY)
+    {
+        SymTypeArray* array = (SymTypeArray*)type;
+        unsigned elem = TypeId(array->GetElemType());
+        WriteNumber(entry, UNIT_TYPE_ARRAY);
+        WriteInt(entry, array->GetLow());
+        WriteInt(entry, array->GetHigh());
+        WriteNumber(entry, elem);
+    }
+    else if (type->GetClassName() & SYM_TYPE_RECORD)
+    {
+        std::vector<Symbol*> fields;
+        ((SymTypeRecord*)type)->GetSymTable()->GetSymbols(fields);
+        std::vector<unsigned> field_types;
+        for (std::vector<Symbol*>::iterator it = fields.begin(); it != fields.end(); ++it)
+            field_types.push_back(TypeId(((SymVarLocal*)*it)->GetVarType()));
+        WriteNumber(entry, UNIT_TYPE_RECORD);
+        WriteNumber(entry, fields.size());
+        for (unsigned i = 0; i < fields.size(); ++i)
+        {
+            WriteString(entry, fields[i]->GetName());
+            WriteNumber(entry, field_types[i]);
+            WriteNumber(entry, ((SymVarLocal*)fields[i])->GetOffset());
+        }
+    }
+    else
+        throw CompilerException(string("can't export type ") + type->GetName());
+    unsigned id = PREDEFINED_TYPES_COUNT + type_ids.size();
+    type_ids[type] = id;
+    types_part << entry.str();
+    return id;
+}
+
+unsigned UnitWriter::AddGlobal(SymVarGlobal* var, bool exported)
+{
+    std::map<SymVarGlobal*, unsigned>::iterator it = global_ids.find(var);
+    if (it != global_ids.end())
+    {
+        if (exported) global_exported[it->second] = true;
+        return it->second;
+    }
+    global_ids[var] = globals.size();
+    globals.push_back(var);
+    global_exported.push_back(exported);
+    return globals.size() - 1;
+}
+
+void UnitWriter::WriteVars(const VarsContainer& vars)
+{
+    std::vector<unsigned> ids;
+    for (VarsContainer::const_iterator it = vars.begin(); it != vars.end(); ++it)
+        if ((*it)->GetClassName() & SYM_VAR_GLOBAL)
+            ids.push_back(AddGlobal((SymVarGlobal*)*it, false));
+    WriteNumber(procs_part, ids.size());
+    for (std::vector<unsigned>::iterator it = ids.begin(); it != ids.end(); ++it)
+        WriteNumber(procs_part, *it);
+}
+
+void UnitWriter::WriteProc(SymProc* proc)
+{
+    SideEffectSummary* summary = proc->MakeSummary();
+    bool is_funct = proc->GetClassName() & SYM_FUNCT;
+    WriteNumber(procs_part, is_funct);
+    WriteString(procs_part, proc->GetName());
+    WriteString(procs_part, proc->GetLabel().GetStrValue());
+    WriteNumber(procs_part, proc->GetArgsCount());
+    for (int i = 0; i < proc->GetArgsCount(); ++i)
+    {
+        const SymVarParam* param = proc->GetArg(i);
+        WriteString(procs_part, param->GetName());
+        WriteNumber(procs_part, TypeId(param->GetVarType()));
+        WriteNumber(procs_part, param->GetMode());
+    }
+    if (is_funct) WriteNumber(procs_part, TypeId(proc->GetResultType()));
+    WriteNumber(procs_part, summary->have_side_effect | summary->can_be_replaced << 1 | summary->dummy << 2);
+    for (int i = 0; i < proc->GetArgsCount(); ++i)
+        WriteNumber(procs_part, summary->affect_params[i] | summary->depend_params[i] << 1);
+    WriteVars(summary->affected_vars);
+    WriteVars(summary->dependences);
+    delete summary;
+}
+
+void UnitWriter::Write(const string& unit_name, const std::vector<Symbol*>& exported)
+{
+    stringstream consts_part;
+    stringstream type_syms_part;
+    unsigned procs_count = 0;
+    unsigned consts_count = 0;
+    unsigned type_syms_count = 0;
+    for (std::vector<Symbol*>::const_iterator it = exported.begin(); it != exported.end(); ++it)
+    {
+        SymbolClass sym_class = (*it)->GetClassName();
+        if (sym_class & SYM_VAR_GLOBAL)
+            AddGlobal((SymVarGlobal*)*it, true);
+        else if (sym_class & SYM_VAR_CONST)
+        {
+            SymVarConst* sym = (SymVarConst*)*it;
+            Token value = sym->GetValueTok();
+            WriteString(consts_part, sym->GetName());
+            WriteNumber(consts_part, TypeId(sym->GetVarType()));
+            WriteNumber(consts_part, value.GetType());
+            WriteString(consts_part, value.GetName());
+            ++consts_count;
+        }
+        else if (sym_class & SYM_PROC)
+        {
+            WriteProc((SymProc*)*it);
+            ++procs_count;
+        }
+        else if (sym_class & SYM_TYPE)
+        {
+            WriteNumber(type_syms_part, TypeId((SymType*)*it));
+            ++type_syms_count;
+        }
+    }
+    stringstream globals_part;
+    for (unsigned i = 0; i < globals.size(); ++i)
+    {
+        WriteString(globals_part, globals[i]->GetName());
+        WriteNumber(globals_part, TypeId(globals[i]->GetVarType()));
+        WriteString(globals_part, globals[i]->GetLabel().GetStrValue());
+        WriteNumber(globals_part, global_exported[i]);
+    }
+    out.write(UNIT_FILE_MAGIC, 4);
+    WriteNumber(out, UNIT_FILE_VERSION);
+    WriteString(out, unit_name);
+    WriteNumber(out, type_ids.size());
+    out << types_part.str();
+    WriteNumber(out, globals.size());
+    out << globals_part.str();
+    WriteNumber(out, consts_count);
+    out << consts_part.str();
+    WriteNumber(out, type_syms_count);
+    out << type_syms_part.str();
+    WriteNumber(out, procs_count);
+    out << procs_part.str();
+}
+
+//---UnitReader---
+
+UnitReader::UnitReader(istream& in_, GlobalsRegistry& registry_):
+    in(in_),
+    registry(registry_)
+{
+}
+
+unsigned UnitReader::ReadNumber()
+{
+    unsigned res = 0;
+    for (int shift = 0; shift < 35; shift += 7)
+    {
+        int c = in.get();
+        if (c == EOF) throw CompilerException("unexpected end of interface file");
+        res |= unsigned(c & 0x7f) << shift;
+        if (!(c & 0x80)) return res;
+    }
+    throw CompilerException("corrupted interface file");
+}
+
+int UnitReader::ReadInt()
+{
+    unsigned value = ReadNumber();
+    return int(value >> 1) ^ -int(value & 1);
+}
+
+string UnitReader::ReadString()
+{
+    unsigned size = ReadNumber();
+    string res(size, '\0');
+    if (size && !in.read(&res[0], size)) throw CompilerException("unexpected end of interface file");
+    return res;
+}
+
+Token UnitReader::ReadName()
+{
+    return Token(ReadString().c_str(), IDENTIFIER, TOK_UNRESERVED);
+}
+
+SymType* UnitReader::ReadTypeId()
+{
+    unsigned id = ReadNumber();
+    if (id < PREDEFINED_TYPES_COUNT) return PredefinedType(id);
+    if (id - PREDEFINED_TYPES_COUNT >= types.size()) throw CompilerException("corrupted interface file");
+    return types[id - PREDEFINED_TYPES_COUNT];
+}
+
+void UnitReader::ReadType()
+{
+    switch (ReadNumber())
+    {
+        case UNIT_TYPE_ALIAS:
+        {
+            Token name = ReadName();
+            types.push_back(new SymTypeAlias(name, ReadTypeId()));
+        }
+        break;
+        case UNIT_TYPE_ARRAY:
+        {
+            int low = ReadInt();
+            int high = ReadInt();
+            types.push_back(new SymTypeArray(ReadTypeId(), low, high));
+        }
+        break;
+        case UNIT_TYPE_RECORD:
+        {
+            SymTable* fields = new SymTable();
+            for (unsigned i = ReadNumber(); i > 0; --i)
+            {
+                Token name = ReadName();
+                SymType* type = ReadTypeId();
+                fields->Add(new SymVarLocal(name, type, ReadNumber()));
+            }
+            types.push_back(new SymTypeRecord(fields));
+        }
+        break;
+        default:
+            throw CompilerException("corrupted interface file");
+    }
+}
+
+void UnitReader::ReadVars(VarsContainer& vars)
+{
+    for (unsigned i = ReadNumber(); i > 0; --i)
+    {
+        unsigned id = ReadNumber();
+        if (id >= globals.size()) throw CompilerException("corrupted interface file");
+        vars.insert(globals[id]);
+    }
+}
+
+SymProc* UnitReader::ReadProc()
+{
+    bool is_funct = ReadNumber();
+    Token name = ReadName();
+    SymProc* res = is_funct ? new SymFunct(name) : new SymProc(name);
+    res->SetLabel(AsmStrImmediate(ReadString()));
+    res->AddSymTable(new SymTable());
+    for (unsigned i = ReadNumber(); i > 0; --i)
+    {
+        Token param_name = ReadName();
+        SymType* type = ReadTypeId();
+        ParamMode mode = (ParamMode)ReadNumber();
+        SymVarParam* param = new SymVarParam(param_name, type, mode, res->GetSymTable()->GetParamsSize() + 8);
+        res->GetSymTable()->Add(param);
+        res->AddParam(param);
+    }
+    if (is_funct) ((SymFunct*)res)->AddResultType(ReadTypeId());
+    SideEffectSummary* summary = new SideEffectSummary;
+    unsigned flags = ReadNumber();
+    summary->have_side_effect = flags & 1;
+    summary->can_be_replaced = flags & 2;
+    summary->dummy = flags & 4;
+    for (int i = 0; i < res->GetArgsCount(); ++i)
+    {
+        unsigned param_flags = ReadNumber();
+        summary->affect_params.push_back(param_flags & 1);
+        summary->depend_params.push_back(param_flags & 2);
+    }
+    ReadVars(summary->affected_vars);
+    ReadVars(summary->dependences);
+    res->SetSummary(summary);
+    return res;
+}
+
+SymTable* UnitReader::Read(const string& unit_name)
+{
+    char magic[4];
+    if (!in.read(magic, 4) || memcmp(magic, UNIT_FILE_MAGIC, 4))
+        throw CompilerException("'" + unit_name + "' is not an interface file");
+    if (ReadNumber() != UNIT_FILE_VERSION)
+        throw CompilerException("interface file of unit '" + unit_name + "' has unsupported version");
+    if (ReadString() != unit_name)
+        throw CompilerException("interface file doesn't match unit '" + unit_name + "'");
+    SymTable* res = new SymTable();
+    for (unsigned i = ReadNumber(); i > 0; --i)
+        ReadType();
+    for (unsigned i = ReadNumber(); i > 0; --i)
+    {
+        Token name = ReadName();
+        SymType* type = ReadTypeId();
+        AsmStrImmediate label(ReadString());
+        bool exported = ReadNumber();
+        SymVarGlobal* var = registry[label.GetStrValue()];
+        if (var == NULL)
+        {
+            var = new SymVarGlobal(name, type);
+            var->SetLabel(label);
+            registry[label.GetStrValue()] = var;
+        }
+        globals.push_back(var);
+        if (exported) res->Add(var);
+    }
+    for (unsigned i = ReadNumber(); i > 0; --i)
+    {
+        Token name = ReadName();
+        SymType* type = ReadTypeId();
+        TokenType tok_type = TokenType(ReadNumber());
+        res->Add(new SymVarConst(name, Token(ReadString().c_str(), tok_type, TOK_UNRESERVED), type));
+    }
+    for (unsigned i = ReadNumber(); i > 0; --i)
+        res->Add(ReadTypeId());
+    for (unsigned i = ReadNumber(); i > 0; --i)
+        res->Add(ReadProc());
+    return res;
+}
@@ -0,0 +1,55 @@
+#ifndef UNIT_FILE
+#define UNIT_FILE
+
+#include "sym_table.h"
+#include "exception.h"
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+
+typedef std::map<string, SymVarGlobal*> GlobalsRegistry;
+
+class UnitWriter{
+private:
+    ostream& out;
+    stringstream types_part;
+    stringstream procs_part;
+    std::map<const SymType*, unsigned> type_ids;
+    std::map<SymVarGlobal*, unsigned> global_ids;
+    std::vector<SymVarGlobal*> globals;
+    std::vector<bool> global_exported;
+    static void WriteNumber(ostream& o, unsigned value);
+    static void WriteInt(ostream& o, int value);
+    static void WriteString(ostream& o, const string& str);
+    unsigned TypeId(const SymType* type);
+    unsigned AddGlobal(SymVarGlobal* var, bool exported);
+    void WriteVars(const VarsContainer& vars);
+    void WriteProc(SymProc* proc);
+public:
+    UnitWriter(ostream& out_);
+    void Write(const string& unit_name, const std::vector<Symbol*>& exported);
+};
+
+class UnitReader{
+private:
+    istream& in;
+    GlobalsRegistry& registry;
+    std::vector<SymType*> types;
+    std::vector<SymVarGlobal*> globals;
+    unsigned ReadNumber();
+    int ReadInt();
+    string ReadString();
+    Token ReadName();
+    SymType* ReadTypeId();
+    void ReadType();
+    void ReadVars(VarsContainer& vars);
+    SymProc* ReadProc();
+public:
+    UnitReader(istream& in_, GlobalsRegistry& registry_);
+    SymTable* Read(const string& unit_name);
+};
+
+#endif
@@ -0,0 +1,446 @@
+#include "vm.h"
+#include "generator.h"
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__GNUC__)
+#define VM_THREADED
+#endif
+
+//---VmCode---
+
+VmCode::VmCode():
+    globals_size(0),
+    current(0),
+    next_reg(0),
+    locals_size(0),
+    temps_size(0),
+    label_barrier(0),
+    main_proc(-1),
+    exit_label(0)
+{
+}
+
+VmReg VmCode::NewReg()
+{
+    VmReg res = next_reg++;
+    if (next_reg > procs[current].regs) procs[current].regs = next_reg;
+    return res;
+}
+
+unsigned VmCode::GetRegMark() const
+{
+    return next_reg;
+}
+
+void VmCode::ReleaseRegs(unsigned mark)
+{
+    next_reg = mark;
+}
+
+VmLabel VmCode::GenLabel()
+{
+    labels.push_back(-1);
+    return labels.size() - 1;
+}
+
+void VmCode::AddLabel(VmLabel label)
+{
+    labels[label] = commands.size();
+    label_barrier = commands.size();
+}
+
+void VmCode::AddCmd(VmOpcode op, int a, int b, int c)
+{
+    VmCmd cmd = { op, a, b, c };
+    commands.push_back(cmd);
+}
+
+void VmCode::AddJump(VmOpcode op, VmLabel label, VmReg cond)
+{
+    AddCmd(op, cond, label);
+}
+
+bool VmCode::LastDefines(VmOpcode op, VmReg reg) const
+{
+    return commands.size() > label_barrier && commands.back().op == op && (VmReg)commands.back().a == reg;
+}
+
+void VmCode::AddLoad(VmReg dest, VmReg addr, int disp)
+{
+    if (dest == addr && LastDefines(VM_LEA, addr))
+    {
+        commands.back().op = VM_LOAD_FP;
+        commands.back().b += disp;
+    }
+    else if (dest == addr && LastDefines(VM_LOADI, addr))
+    {
+        commands.back().op = VM_LOAD_ABS;
+        commands.back().b += disp;
+    }
+    else AddCmd(VM_LOAD, dest, addr, disp);
+}
+
+void VmCode::AddStore(VmReg value, VmReg addr, int disp)
+{
+    if (value != addr && LastDefines(VM_LEA, addr))
+    {
+        VmCmd& cmd = commands.back();
+        cmd.op = VM_STORE_FP;
+        cmd.a = value;
+        cmd.b += disp;
+    }
+    else if (value != addr && LastDefines(VM_LOADI, addr))
+    {
+        VmCmd& cmd = commands.back();
+        cmd.op = VM_STORE_ABS;
+        cmd.a = value;
+        cmd.b += disp;
+    }
+    else AddCmd(VM_STORE, value, addr, disp);
+}
+
+int VmCode::AllocTemp(unsigned size)
+{
+    temps_size += size;
+    return -(int)(locals_size + temps_size);
+}
+
+unsigned VmCode::GlobalAddress(const SymVarGlobal* var, unsigned size)
+{
+    map<const SymVarGlobal*, unsigned>::iterator it = global_addrs.find(var);
+    if (it != global_addrs.end()) return it->second;
+    unsigned res = globals_size;
+    globals_size += size;
+    return global_addrs[var] = res;
+}
+
+unsigned VmCode::ProcIndex(const SymProc* proc, const string& name)
+{
+    map<const SymProc*, unsigned>::iterator it = proc_ids.find(proc);
+    if (it != proc_ids.end()) return it->second;
+    VmProc res = { name, -1, 0, 0, 0 };
+    procs.push_back(res);
+    return proc_ids[proc] = procs.size() - 1;
+}
+
+unsigned VmCode::StringIndex(const string& str)
+{
+    string value(UnescapeAsmString(str).c_str());
+    map<string, unsigned>::iterator it = string_ids.find(value);
+    if (it != string_ids.end()) return it->second;
+    strings.push_back(value);
+    return string_ids[value] = strings.size() - 1;
+}
+
+VmLabel VmCode::GetExitLabel() const
+{
+    return exit_label;
+}
+
+void VmCode::Begin(unsigned proc, unsigned locals_size_)
+{
+    current = proc;
+    procs[proc].entry = commands.size();
+    procs[proc].regs = 0;
+    next_reg = 0;
+    locals_size = locals_size_;
+    temps_size = 0;
+    label_barrier = commands.size();
+    exit_label = GenLabel();
+}
+
+void VmCode::BeginProc(const SymProc* proc, const string& name, unsigned locals_size_, unsigned ret_pop)
+{
+    unsigned index = ProcIndex(proc, name);
+    procs[index].ret_pop = ret_pop;
+    Begin(index, locals_size_);
+}
+
+void VmCode::BeginMain()
+{
+    VmProc res = { "main", -1, 0, 0, 0 };
+    procs.push_back(res);
+    main_proc = procs.size() - 1;
+    Begin(main_proc, 0);
+}
+
+void VmCode::EndProc()
+{
+    AddLabel(exit_label);
+    AddCmd((int)current == main_proc ? VM_HALT : VM_RET);
+    procs[current].frame_size = locals_size + temps_size;
+}
+
+void VmCode::Link()
+{
+    if (main_proc < 0) throw CompilerException("nothing to run");
+    for (vector<VmCmd>::iterator it = commands.begin(); it != commands.end(); ++it)
+        if (it->op == VM_JMP || it->op == VM_JZ || it->op == VM_JNZ)
+            it->b = labels[it->b];
+        else if (it->op == VM_CALL && procs[it->b].entry < 0)
+            throw CompilerException("procedure " + procs[it->b].name + " has no body to run");
+}
+
+//---VirtualMachine---
+
+VirtualMachine::VirtualMachine(const VmCode& code_):
+    code(code_)
+{
+}
+
+void VirtualMachine::Fault(const char* msg) const
+{
+    throw CompilerException(string("runtime error: ") + msg);
+}
+
+union VmValue{
+    int i;
+    unsigned u;
+    float f;
+};
+
+struct VmInstr{
+    const void* handler;
+    VmOpcode op;
+    int a;
+    int b;
+    int c;
+};
+
+struct VmFrame{
+    const VmInstr* ret;
+    unsigned fp;
+    VmValue* regs;
+    const VmProc* proc;
+};
+
+#ifdef VM_THREADED
+#define VM_HANDLER_ITEM(name) &&L_##name,
+#define VM_CASE(name) L_##name:
+#define VM_DISPATCH() goto *pc->handler
+#else
+#define VM_CASE(name) case name:
+#define VM_DISPATCH() goto dispatch
+#endif
+#define VM_NEXT() { ++pc; VM_DISPATCH(); }
+#define VM_CHECK(addr, size) if ((addr) > mem_size - (size) || (size) > mem_size) Fault("memory access out of range")
+
+void VirtualMachine::Run(ostream& o)
+{
+#ifdef VM_THREADED
+    static const void* const HANDLERS[VM_OPCODE_COUNT] = { VM_OPCODES(VM_HANDLER_ITEM) };
+#endif
+    vector<VmInstr> program(code.commands.size());
+    for (unsigned i = 0; i < program.size(); ++i)
+    {
+        const VmCmd& cmd = code.commands[i];
+#ifdef VM_THREADED
+        program[i].handler = HANDLERS[cmd.op];
+#else
+        program[i].handler = NULL;
+#endif
+        program[i].op = cmd.op;
+        program[i].a = cmd.a;
+        program[i].b = cmd.b;
+        program[i].c = cmd.c;
+    }
+    vector<char> memory(code.globals_size + VM_STACK_SIZE);
+    vector<VmValue> reg_stack(VM_REGISTERS);
+    vector<VmFrame> frames;
+    AsmWriter out(o);
+    char* mem = &memory[0];
+    const unsigned mem_size = memory.size();
+    const unsigned stack_limit = code.globals_size;
+    const VmValue* reg_end = &reg_stack[0] + reg_stack.size();
+    const VmProc* proc = &code.procs[code.main_proc];
+    if (proc->regs > reg_stack.size() || proc->frame_size > VM_STACK_SIZE) Fault("stack overflow");
+    VmValue* regs = &reg_stack[0];
+    unsigned fp = mem_size;
+    unsigned sp = fp - proc->frame_size;
+    const VmInstr* pc = &program[proc->entry];
+    const VmInstr* start = &program[0];
+#ifdef VM_THREADED
+    VM_DISPATCH();
+#else
+dispatch:
+    switch (pc->op)
+    {
+#endif
+    VM_CASE(VM_LOADI) regs[pc->a].i = pc->b; VM_NEXT();
+    VM_CASE(VM_MOV) regs[pc->a] = regs[pc->b]; VM_NEXT();
+    VM_CASE(VM_ADD) regs[pc->a].u = regs[pc->b].u + regs[pc->c].u; VM_NEXT();
+    VM_CASE(VM_SUB) regs[pc->a].u = regs[pc->b].u - regs[pc->c].u; VM_NEXT();
+    VM_CASE(VM_MUL) regs[pc->a].u = regs[pc->b].u * regs[pc->c].u; VM_NEXT();
+    VM_CASE(VM_DIV)
+        if (!regs[pc->c].i) Fault("division by zero");
+        regs[pc->a].i = regs[pc->c].i == -1 ? (int)(0u - regs[pc->b].u) : regs[pc->b].i / regs[pc->c].i;
+        VM_NEXT();
+    VM_CASE(VM_MOD)
+        if (!regs[pc->c].i) Fault("division by zero");
+        regs[pc->a].i = regs[pc->c].i == -1 ? 0 : regs[pc->b].i % regs[pc->c].i;
+        VM_NEXT();
+    VM_CASE(VM_AND) regs[pc->a].i = regs[pc->b].i & regs[pc->c].i; VM_NEXT();
+    VM_CASE(VM_OR) regs[pc->a].i = regs[pc->b].i | regs[pc->c].i; VM_NEXT();
+    VM_CASE(VM_XOR) regs[pc->a].i = regs[pc->b].i ^ regs[pc->c].i; VM_NEXT();
+    VM_CASE(VM_SHL) regs[pc->a].u = regs[pc->b].u << (regs[pc->c].u & 31); VM_NEXT();
+    VM_CASE(VM_SHR) regs[pc->a].i = regs[pc->b].i >> (regs[pc->c].u & 31); VM_NEXT();
+    VM_CASE(VM_EQ) regs[pc->a].i = regs[pc->b].i == regs[pc->c].i; VM_NEXT();
+    VM_CASE(VM_NE) regs[pc->a].i = regs[pc->b].i != regs[pc->c].i; VM_NEXT();
+    VM_CASE(VM_LT) regs[pc->a].i = regs[pc->b].i < regs[pc->c].i; VM_NEXT();
+    VM_CASE(VM_LE) regs[pc->a].i = regs[pc->b].i <= regs[pc->c].i; VM_NEXT();
+    VM_CASE(VM_GT) regs[pc->a].i = regs[pc->b].i > regs[pc->c].i; VM_NEXT();
+    VM_CASE(VM_GE) regs[pc->a].i = regs[pc->b].i >= regs[pc->c].i; VM_NEXT();
+    VM_CASE(VM_NOT) regs[pc->a].i = !regs[pc->b].i; VM_NEXT();
+    VM_CASE(VM_NEG) regs[pc->a].u = 0u - regs[pc->b].u; VM_NEXT();
+    VM_CASE(VM_ADDI) regs[pc->a].u = regs[pc->b].u + pc->c; VM_NEXT();
+    VM_CASE(VM_MULI) regs[pc->a].u = regs[pc->b].u * pc->c; VM_NEXT();
+    VM_CASE(VM_FADD) regs[pc->a].f = regs[pc->b].f + regs[pc->c].f; VM_NEXT();
+    VM_CASE(VM_FSUB) regs[pc->a].f = regs[pc->b].f - regs[pc->c].f; VM_NEXT();
+    VM_CASE(VM_FMUL) regs[pc->a].f = regs[pc->b].f * regs[pc->c].f; VM_NEXT();
+    VM_CASE(VM_FDIV) regs[pc->a].f = regs[pc->b].f / regs[pc->c].f; VM_NEXT();
+    // unordered operands compare like fcompp + sahf in native code
+    VM_CASE(VM_FEQ) regs[pc->a].i = !(regs[pc->b].f < regs[pc->c].f || regs[pc->b].f > regs[pc->c].f); VM_NEXT();
+    VM_CASE(VM_FNE) regs[pc->a].i = regs[pc->b].f < regs[pc->c].f || regs[pc->b].f > regs[pc->c].f; VM_NEXT();
+    VM_CASE(VM_FLT) regs[pc->a].i = !(regs[pc->b].f >= regs[pc->c].f); VM_NEXT();
+    VM_CASE(VM_FLE) regs[pc->a].i = !(regs[pc->b].f > regs[pc->c].f); VM_NEXT();
+    VM_CASE(VM_FGT) regs[pc->a].i = regs[pc->b].f > regs[pc->c].f; VM_NEXT();
+    VM_CASE(VM_FGE) regs[pc->a].i = regs[pc->b].f >= regs[pc->c].f; VM_NEXT();
+    VM_CASE(VM_FNEG) regs[pc->a].f = -regs[pc->b].f; VM_NEXT();
+    VM_CASE(VM_ITOF) regs[pc->a].f = (float)regs[pc->b].i; VM_NEXT();
+    VM_CASE(VM_LEA) regs[pc->a].u = fp + pc->b; VM_NEXT();
+    VM_CASE(VM_LOAD)
+    {
+        unsigned addr = regs[pc->b].u + pc->c;
+        VM_CHECK(addr, 4);
+        memcpy(&regs[pc->a], mem + addr, 4);
+    }
+    VM_NEXT();
+    VM_CASE(VM_STORE)
+    {
+        unsigned addr = regs[pc->b].u + pc->c;
+        VM_CHECK(addr, 4);
+        memcpy(mem + addr, &regs[pc->a], 4);
+    }
+    VM_NEXT();
+    VM_CASE(VM_LOAD_FP)
+    {
+        unsigned addr = fp + pc->b;
+        VM_CHECK(addr, 4);
+        memcpy(&regs[pc->a], mem + addr, 4);
+    }
+    VM_NEXT();
+    VM_CASE(VM_STORE_FP)
+    {
+        unsigned addr = fp + pc->b;
+        VM_CHECK(addr, 4);
+        memcpy(mem + addr, &regs[pc->a], 4);
+    }
+    VM_NEXT();
+    VM_CASE(VM_LOAD_ABS)
+    {
+        unsigned addr = pc->b;
+        VM_CHECK(addr, 4);
+        memcpy(&regs[pc->a], mem + addr, 4);
+    }
+    VM_NEXT();
+    VM_CASE(VM_STORE_ABS)
+    {
+        unsigned addr = pc->b;
+        VM_CHECK(addr, 4);
+        memcpy(mem + addr, &regs[pc->a], 4);
+    }
+    VM_NEXT();
+    VM_CASE(VM_COPY)
+    {
+        unsigned size = pc->c;
+        VM_CHECK(regs[pc->a].u, size);
+        VM_CHECK(regs[pc->b].u, size);
+        memmove(mem + regs[pc->a].u, mem + regs[pc->b].u, size);
+    }
+    VM_NEXT();
+    VM_CASE(VM_JMP) pc = start + pc->b; VM_DISPATCH();
+    VM_CASE(VM_JZ)
+        if (regs[pc->a].i) VM_NEXT();
+        pc = start + pc->b;
+        VM_DISPATCH();
+    VM_CASE(VM_JNZ)
+        if (!regs[pc->a].i) VM_NEXT();
+        pc = start + pc->b;
+        VM_DISPATCH();
+    VM_CASE(VM_PUSH)
+        if (sp < stack_limit + 4) Fault("stack overflow");
+        sp -= 4;
+        memcpy(mem + sp, &regs[pc->a], 4);
+        VM_NEXT();
+    VM_CASE(VM_PUSHN)
+    {
+        unsigned size = pc->c;
+        if (sp < stack_limit + size) Fault("stack overflow");
+        VM_CHECK(regs[pc->a].u, size);
+        sp -= size;
+        memmove(mem + sp, mem + regs[pc->a].u, size);
+    }
+    VM_NEXT();
+    VM_CASE(VM_RESERVE)
+        if (sp < stack_limit + pc->b) Fault("stack overflow");
+        sp -= pc->b;
+        VM_NEXT();
+    VM_CASE(VM_POP)
+        memcpy(&regs[pc->a], mem + sp, 4);
+        sp += 4;
+        VM_NEXT();
+    VM_CASE(VM_POPN)
+    {
+        unsigned size = pc->c;
+        VM_CHECK(regs[pc->a].u, size);
+        memmove(mem + regs[pc->a].u, mem + sp, size);
+        sp += size;
+    }
+    VM_NEXT();
+    VM_CASE(VM_CALL)
+    {
+        const VmProc* callee = &code.procs[pc->b];
+        VmFrame frame = { pc + 1, fp, regs, proc };
+        frames.push_back(frame);
+        regs += proc->regs;
+        if (callee->regs > (unsigned)(reg_end - regs) || sp < stack_limit + 8 + callee->frame_size)
+            Fault("stack overflow");
+        fp = sp - 8;
+        sp = fp - callee->frame_size;
+        proc = callee;
+        pc = start + callee->entry;
+    }
+    VM_DISPATCH();
+    VM_CASE(VM_RET)
+    {
+        sp = fp + 8 + proc->ret_pop;
+        const VmFrame& frame = frames.back();
+        pc = frame.ret;
+        fp = frame.fp;
+        regs = frame.regs;
+        proc = frame.proc;
+        frames.pop_back();
+    }
+    VM_DISPATCH();
+    VM_CASE(VM_HALT)
+        out.Flush();
+        return;
+    VM_CASE(VM_WRITE_INT) out.WriteInt(regs[pc->a].i); VM_NEXT();
+    VM_CASE(VM_WRITE_REAL)
+    {
+        char buf[64];
+        out.Write(buf, sprintf(buf, "%f", (double)regs[pc->a].f));
+    }
+    VM_NEXT();
+    VM_CASE(VM_WRITE_STR)
+        if (regs[pc->a].u >= code.strings.size()) Fault("invalid string");
+        out.Write(code.strings[regs[pc->a].u]);
+        VM_NEXT();
+    VM_CASE(VM_WRITE_LN) out.Write('\n'); VM_NEXT();
+#ifndef VM_THREADED
+    default:
+        Fault("invalid instruction");
+    }
+#endif
+}
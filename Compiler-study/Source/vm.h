@@ -0,0 +1,111 @@
+#ifndef VM
+#define VM
+
+#include "exception.h"
+#include "asm_writer.h"
+#include <vector>
+#include <map>
+#include <string>
+#include <ostream>
+using namespace std;
+
+class SymProc;
+class SymVarGlobal;
+
+#define VM_OPCODES(X) \
+    X(VM_LOADI) X(VM_MOV) \
+    X(VM_ADD) X(VM_SUB) X(VM_MUL) X(VM_DIV) X(VM_MOD) \
+    X(VM_AND) X(VM_OR) X(VM_XOR) X(VM_SHL) X(VM_SHR) \
+    X(VM_EQ) X(VM_NE) X(VM_LT) X(VM_LE) X(VM_GT) X(VM_GE) \
+    X(VM_NOT) X(VM_NEG) X(VM_ADDI) X(VM_MULI) \
+    X(VM_FADD) X(VM_FSUB) X(VM_FMUL) X(VM_FDIV) \
+    X(VM_FEQ) X(VM_FNE) X(VM_FLT) X(VM_FLE) X(VM_FGT) X(VM_FGE) \
+    X(VM_FNEG) X(VM_ITOF) \
+    X(VM_LEA) X(VM_LOAD) X(VM_STORE) X(VM_LOAD_FP) X(VM_STORE_FP) \
+    X(VM_LOAD_ABS) X(VM_STORE_ABS) X(VM_COPY) \
+    X(VM_JMP) X(VM_JZ) X(VM_JNZ) \
+    X(VM_PUSH) X(VM_PUSHN) X(VM_RESERVE) X(VM_POP) X(VM_POPN) \
+    X(VM_CALL) X(VM_RET) X(VM_HALT) \
+    X(VM_WRITE_INT) X(VM_WRITE_REAL) X(VM_WRITE_STR) X(VM_WRITE_LN)
+
+#define VM_ENUM_ITEM(name) name,
+
+static const unsigned VM_STACK_SIZE = 8 << 20;
+static const unsigned VM_REGISTERS = 1 << 20;
+
+enum VmOpcode{
+    VM_OPCODES(VM_ENUM_ITEM)
+    VM_OPCODE_COUNT
+};
+
+typedef unsigned VmReg;
+typedef unsigned VmLabel;
+
+struct VmCmd{
+    VmOpcode op;
+    int a;
+    int b;
+    int c;
+};
+
+struct VmProc{
+    string name;
+    int entry;
+    unsigned regs;
+    unsigned frame_size;
+    unsigned ret_pop;
+};
+
+class VmCode{
+private:
+    vector<VmCmd> commands;
+    vector<VmProc> procs;
+    vector<string> strings;
+    vector<int> labels;
+    map<const SymProc*, unsigned> proc_ids;
+    map<const SymVarGlobal*, unsigned> global_addrs;
+    map<string, unsigned> string_ids;
+    unsigned globals_size;
+    unsigned current;
+    unsigned next_reg;
+    unsigned locals_size;
+    unsigned temps_size;
+    unsigned label_barrier;
+    int main_proc;
+    VmLabel exit_label;
+    bool LastDefines(VmOpcode op, VmReg reg) const;
+    void Begin(unsigned proc, unsigned locals_size_);
+public:
+    VmCode();
+    VmReg NewReg();
+    unsigned GetRegMark() const;
+    void ReleaseRegs(unsigned mark);
+    VmLabel GenLabel();
+    void AddLabel(VmLabel label);
+    void AddCmd(VmOpcode op, int a = 0, int b = 0, int c = 0);
+    void AddJump(VmOpcode op, VmLabel label, VmReg cond = 0);
+    void AddLoad(VmReg dest, VmReg addr, int disp = 0);
+    void AddStore(VmReg value, VmReg addr, int disp = 0);
+    int AllocTemp(unsigned size);
+    unsigned GlobalAddress(const SymVarGlobal* var, unsigned size);
+    unsigned ProcIndex(const SymProc* proc, const string& name);
+    unsigned StringIndex(const string& str);
+    VmLabel GetExitLabel() const;
+    void BeginProc(const SymProc* proc, const string& name, unsigned locals_size_, unsigned ret_pop);
+    void BeginMain();
+    void EndProc();
+    void Link();
+    friend class VirtualMachine;
+    friend class JitCompiler;
+};
+
+class VirtualMachine{
+private:
+    const VmCode& code;
+    void Fault(const char* msg) const;
+public:
+    VirtualMachine(const VmCode& code_);
+    void Run(ostream& o);
+};
+
+#endif
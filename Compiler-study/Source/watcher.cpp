@@ -0,0 +1,57 @@
+#include "watcher.h"
+
+#ifdef __linux__
+
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <limits.h>
+
+FileWatcher::FileWatcher(const string& file_name)
+{
+    size_t slash = file_name.rfind('/');
+    dir_name = (slash == string::npos) ? "." : file_name.substr(0, slash + 1);
+    base_name = (slash == string::npos) ? file_name : file_name.substr(slash + 1);
+    fd = inotify_init();
+    if (fd < 0) throw CompilerException("can't initialize inotify");
+    wd = inotify_add_watch(fd, dir_name.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    if (wd < 0) throw CompilerException("can't watch file");
+}
+
+FileWatcher::~FileWatcher()
+{
+    close(fd);
+}
+
+void FileWatcher::WaitForChange()
+{
+    char buf[sizeof(inotify_event) + NAME_MAX + 1] __attribute__((aligned(__alignof__(inotify_event))));
+    while (true)
+    {
+        ssize_t len = read(fd, buf, sizeof(buf));
+        if (len <= 0) throw CompilerException("can't watch file");
+        for (char* p = buf; p < buf + len; p += sizeof(inotify_event) + ((inotify_event*)p)->len)
+        {
+            inotify_event* event = (inotify_event*)p;
+            if (event->len && base_name == event->name) return;
+        }
+    }
+}
+
+#else
+
+FileWatcher::FileWatcher(const string& file_name):
+    fd(-1),
+    wd(-1)
+{
+    throw CompilerException("watch mode is not supported on this platform");
+}
+
+FileWatcher::~FileWatcher()
+{
+}
+
+void FileWatcher::WaitForChange()
+{
+}
+
+#endif
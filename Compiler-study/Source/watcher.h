@@ -0,0 +1,21 @@
+#ifndef WATCHER
+#define WATCHER
+
+#include <string>
+#include "exception.h"
+
+using namespace std;
+
+class FileWatcher{
+private:
+    string dir_name;
+    string base_name;
+    int fd;
+    int wd;
+public:
+    FileWatcher(const string& file_name);
+    ~FileWatcher();
+    void WaitForChange();
+};
+
+#endif